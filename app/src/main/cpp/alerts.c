@@ -0,0 +1,412 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "alerts.h"
+#include "classifier.h"
+#include "summed-area.h"
+
+#define LOG_TAG "alerts"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { QUEUE_SIZE = 64 };
+enum { MAX_TABLES = 8 };
+enum { MAX_RULE_LEN = 256 };
+
+static const struct detector *const detectors[NUM_DETECTORS] = {
+    [DETECTOR_BLUETOOTH] = &bluetooth_detector,
+    [DETECTOR_ZIGBEE] = &zigbee_detector,
+    [DETECTOR_WIFI] = &wifi_detector,
+    [DETECTOR_MICROWAVE] = &microwave_detector,
+};
+
+static float pwr_to_mw[256];
+static pthread_once_t pwr_once = PTHREAD_ONCE_INIT;
+
+enum rule_kind {
+  RULE_BAND,
+  RULE_DETECTOR,
+};
+
+// since is the report time from which the rule has held, or -1, and epoch
+// the hop epoch of the last report that covered the band of a band rule.
+struct rule {
+  enum rule_kind kind;
+  uint32_t start_khz;
+  uint32_t end_khz;
+  bool below;
+  float threshold_mw;
+  enum detector_id detector;
+  int64_t hold_us;
+  int64_t since;
+  uint32_t epoch;
+  bool raised;
+};
+
+// The bins of one span that a band rule covers.
+struct band_pred {
+  uint16_t rule;
+  uint16_t bin_start;
+  uint16_t bin_count;
+};
+
+// Band rules compiled for one span and bin count, so that a report only
+// visits the rules whose band it covers.
+struct pred_table {
+  uint16_t center_freq;
+  uint16_t span_width;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  uint16_t num_preds;
+  struct band_pred preds[MAX_ALERT_RULES];
+};
+
+struct alerts {
+  struct rule rules[MAX_ALERT_RULES];
+  size_t num_rules;
+  uint16_t detector_rules[MAX_ALERT_RULES];
+  size_t num_detector_rules;
+  unsigned last_present;
+  bool detectors_pending;
+  struct pred_table tables[MAX_TABLES];
+  size_t num_tables;
+  uint64_t clock;
+  struct alerts_config config;
+  struct alert_event queue[QUEUE_SIZE];
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_int_least64_t dropped;
+  uint64_t num_events;
+  pthread_t thread;
+  sem_t items;
+  atomic_bool stopping;
+};
+
+static void init_pwr(void) {
+  for (int pwr = -128; pwr < 128; pwr++) {
+    pwr_to_mw[pwr + 128] = powf(10.0f, (float)pwr / 10.0f);
+  }
+}
+
+static bool parse_num(const char *tok, double min, double max, double *out) {
+  char *end;
+  if (tok == NULL) {
+    return false;
+  }
+  errno = 0;
+  const double n = strtod(tok, &end);
+  if (errno != 0 || end == tok || *end != '\0' || !(n >= min && n <= max)) {
+    return false;
+  }
+  *out = n;
+  return true;
+}
+
+static bool parse_rule(char *line, struct rule *rule) {
+  char *save;
+  const char *kind = strtok_r(line, " \t", &save);
+  double start, end, threshold;
+  if (strcmp(kind, "band") == 0) {
+    const char *cmp;
+    if (!parse_num(strtok_r(NULL, " \t", &save), 2000, 7200, &start) ||
+        !parse_num(strtok_r(NULL, " \t", &save), start, 7200, &end) ||
+        (cmp = strtok_r(NULL, " \t", &save)) == NULL ||
+        (strcmp(cmp, "above") != 0 && strcmp(cmp, "below") != 0) ||
+        !parse_num(strtok_r(NULL, " \t", &save), -128, 127, &threshold)) {
+      return false;
+    }
+    rule->kind = RULE_BAND;
+    rule->start_khz = (uint32_t)(start * 1000);
+    rule->end_khz = (uint32_t)(end * 1000);
+    rule->below = strcmp(cmp, "below") == 0;
+    rule->threshold_mw = powf(10.0f, (float)threshold / 10.0f);
+  } else if (strcmp(kind, "detector") == 0) {
+    const char *name = strtok_r(NULL, " \t", &save);
+    size_t id = 0;
+    while (name != NULL && id < NUM_DETECTORS &&
+           strcasecmp(name, detectors[id]->name) != 0) {
+      id++;
+    }
+    if (name == NULL || id == NUM_DETECTORS) {
+      return false;
+    }
+    rule->kind = RULE_DETECTOR;
+    rule->detector = (enum detector_id)id;
+  } else {
+    return false;
+  }
+
+  const char *opt = strtok_r(NULL, " \t", &save);
+  double hold_ms = 0;
+  if (opt != NULL &&
+      (strcmp(opt, "for") != 0 ||
+       !parse_num(strtok_r(NULL, " \t", &save), 0, 86400000, &hold_ms) ||
+       strtok_r(NULL, " \t", &save) != NULL)) {
+    return false;
+  }
+  rule->hold_us = (int64_t)(hold_ms * 1000);
+  rule->since = -1;
+  return true;
+}
+
+// Empty lines and lines starting with '#' are skipped.
+static bool parse_rules(struct alerts *a, const char *rules) {
+  int line_num = 0;
+  while (*rules != '\0') {
+    const size_t len = strcspn(rules, "\n");
+    char line[MAX_RULE_LEN];
+    line_num++;
+    if (len >= sizeof(line)) {
+      LOGE("Alert rule %d too long", line_num);
+      return false;
+    }
+    memcpy(line, rules, len);
+    line[len] = '\0';
+    rules += rules[len] == '\n' ? len + 1 : len;
+
+    char *start = line + strspn(line, " \t\r");
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+    line[strcspn(line, "\r")] = '\0';
+    if (a->num_rules == MAX_ALERT_RULES) {
+      LOGE("More than %d alert rules", MAX_ALERT_RULES);
+      return false;
+    }
+    struct rule *rule = &a->rules[a->num_rules];
+    if (!parse_rule(start, rule)) {
+      LOGE("Can't parse alert rule %d", line_num);
+      return false;
+    }
+    if (rule->kind == RULE_DETECTOR) {
+      a->detector_rules[a->num_detector_rules++] = (uint16_t)a->num_rules;
+    }
+    a->num_rules++;
+  }
+  return true;
+}
+
+static void build_table(const struct alerts *a, struct pred_table *table,
+                        uint16_t center_freq, uint16_t span_width,
+                        uint16_t bin_pwr_count) {
+  table->center_freq = center_freq;
+  table->span_width = span_width;
+  table->bin_pwr_count = bin_pwr_count;
+  table->num_preds = 0;
+
+  for (size_t idx = 0; idx < a->num_rules; idx++) {
+    const struct rule *rule = &a->rules[idx];
+    if (rule->kind != RULE_BAND) {
+      continue;
+    }
+    uint16_t bin_start = 0;
+    uint16_t bin_end = 0;
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      const uint32_t khz =
+          summed_area_bin_khz(center_freq, span_width, bin_pwr_count, bin);
+      if (khz < rule->start_khz) {
+        bin_start = (uint16_t)(bin + 1);
+      } else if (khz < rule->end_khz) {
+        bin_end = (uint16_t)(bin + 1);
+      }
+    }
+    if (bin_end > bin_start) {
+      table->preds[table->num_preds++] = (struct band_pred){
+          .rule = (uint16_t)idx,
+          .bin_start = bin_start,
+          .bin_count = (uint16_t)(bin_end - bin_start),
+      };
+    }
+  }
+}
+
+static const struct pred_table *get_table(struct alerts *a,
+                                          uint16_t center_freq,
+                                          uint16_t span_width,
+                                          uint16_t bin_pwr_count) {
+  size_t victim = 0;
+  for (size_t idx = 0; idx < a->num_tables; idx++) {
+    struct pred_table *table = &a->tables[idx];
+    if (table->center_freq == center_freq && table->span_width == span_width &&
+        table->bin_pwr_count == bin_pwr_count) {
+      table->last_used = ++a->clock;
+      return table;
+    }
+    if (table->last_used < a->tables[victim].last_used) {
+      victim = idx;
+    }
+  }
+
+  if (a->num_tables < MAX_TABLES) {
+    victim = a->num_tables++;
+  }
+  struct pred_table *table = &a->tables[victim];
+  build_table(a, table, center_freq, span_width, bin_pwr_count);
+  table->last_used = ++a->clock;
+  return table;
+}
+
+// Only the receive thread pushes, only the alert thread pops. Events are
+// dropped rather than stalling the receive thread.
+static void push_event(struct alerts *a, const struct alert_event *event) {
+  const size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  const size_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+  if (head - tail >= QUEUE_SIZE) {
+    a->dropped++;
+    return;
+  }
+  a->queue[head % QUEUE_SIZE] = *event;
+  atomic_store_explicit(&a->head, head + 1, memory_order_release);
+  sem_post(&a->items);
+}
+
+// sum_mw is the band power of a band rule, converted to dBm only for the
+// events it raises or clears.
+static void update_rule(struct alerts *a, size_t idx, int64_t time_us,
+                        bool holds, float sum_mw) {
+  struct rule *rule = &a->rules[idx];
+  const double pwr = rule->kind == RULE_BAND ? 10 * log10(sum_mw) : NAN;
+  if (!holds) {
+    rule->since = -1;
+    if (rule->raised) {
+      rule->raised = false;
+      const struct alert_event event = {(uint32_t)idx, false, time_us, pwr};
+      push_event(a, &event);
+    }
+    return;
+  }
+
+  if (rule->since < 0) {
+    rule->since = time_us;
+  }
+  if (!rule->raised && time_us - rule->since >= rule->hold_us) {
+    rule->raised = true;
+    const struct alert_event event = {(uint32_t)idx, true, time_us, pwr};
+    push_event(a, &event);
+  }
+}
+
+void alerts_update(struct alerts *a, int64_t time_us, uint32_t epoch,
+                   uint16_t center_freq, uint16_t span_width,
+                   uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                   unsigned present) {
+  const struct pred_table *table =
+      get_table(a, center_freq, span_width, bin_pwr_count);
+  for (uint16_t i = 0; i < table->num_preds; i++) {
+    const struct band_pred *pred = &table->preds[i];
+    struct rule *rule = &a->rules[pred->rule];
+    // A band out of view for a whole hop is not known to have held
+    // meanwhile, so its hold time starts over.
+    if (rule->since >= 0 && epoch - rule->epoch > 1) {
+      rule->since = -1;
+    }
+    rule->epoch = epoch;
+    const int8_t *pwr = bin_pwr + pred->bin_start;
+    float sum = 0;
+    for (uint16_t bin = 0; bin < pred->bin_count; bin++) {
+      sum += pwr_to_mw[pwr[bin] + 128];
+    }
+    const bool holds =
+        rule->below ? sum < rule->threshold_mw : sum > rule->threshold_mw;
+    update_rule(a, pred->rule, time_us, holds, sum);
+  }
+
+  // Detector rules only need a look when a detector changes, or while one
+  // is waiting out its hold time.
+  if (present == a->last_present && !a->detectors_pending) {
+    return;
+  }
+  a->last_present = present;
+  a->detectors_pending = false;
+  for (size_t i = 0; i < a->num_detector_rules; i++) {
+    const size_t idx = a->detector_rules[i];
+    const struct rule *rule = &a->rules[idx];
+    update_rule(a, idx, time_us, present & (1u << rule->detector), 0);
+    if (rule->since >= 0 && !rule->raised) {
+      a->detectors_pending = true;
+    }
+  }
+}
+
+static void *alert_thread(void *arg) {
+  struct alerts *a = arg;
+
+  while (true) {
+    sem_wait(&a->items);
+
+    const size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+    if (tail == head) {
+      if (a->stopping) {
+        break;
+      }
+      continue;
+    }
+
+    const struct alert_event event = a->queue[tail % QUEUE_SIZE];
+    atomic_store_explicit(&a->tail, tail + 1, memory_order_release);
+    a->config.notify(a->config.ctx, &event);
+    a->num_events++;
+  }
+
+  if (a->config.done != NULL) {
+    a->config.done(a->config.ctx);
+  }
+  return NULL;
+}
+
+struct alerts *alerts_create(const char *rules,
+                             const struct alerts_config *config) {
+  pthread_once(&pwr_once, init_pwr);
+
+  struct alerts *a = calloc(1, sizeof(struct alerts));
+  if (a == NULL) {
+    LOGE("Can't allocate alerts");
+    return NULL;
+  }
+  if (!parse_rules(a, rules)) {
+    free(a);
+    return NULL;
+  }
+  a->config = *config;
+
+  sem_init(&a->items, 0, 0);
+  if (pthread_create(&a->thread, 0, alert_thread, a) != 0) {
+    LOGE("Can't create alert thread");
+    sem_destroy(&a->items);
+    free(a);
+    return NULL;
+  }
+
+  LOGI("%zu alert rules, %zu on detectors", a->num_rules,
+       a->num_detector_rules);
+  return a;
+}
+
+void alerts_destroy(struct alerts *a) {
+  if (a == NULL) {
+    return;
+  }
+
+  a->stopping = true;
+  sem_post(&a->items);
+  pthread_join(a->thread, NULL);
+  sem_destroy(&a->items);
+
+  LOGI("Sent %" PRIu64 " alert events, dropped %" PRId64, a->num_events,
+       (int64_t)a->dropped);
+  free(a);
+}
+
+size_t alerts_num_rules(const struct alerts *a) { return a->num_rules; }
+
+size_t alerts_memory(const struct alerts *a) { return sizeof(struct alerts); }
@@ -0,0 +1,53 @@
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Alert rules are given one per line:
+//
+//   band START END above|below DBM [for MS]
+//   detector NAME [for MS]
+//
+// A band rule holds while the total power of the bins between START and
+// END MHz is above or below DBM, measured over the part of the band that
+// each report covers. A detector rule holds while the named detector finds
+// its signal. A rule is raised once it has held for MS milliseconds of
+// report time, and cleared by the first report for which it does not. The
+// hold time of a band rule starts over when a hop went by without a report
+// covering its band.
+enum { MAX_ALERT_RULES = 32 };
+
+// pwr is the band power in dBm, or NAN for detector rules. time_us is on
+// the report clock passed to alerts_update.
+struct alert_event {
+  uint32_t rule;
+  bool raised;
+  int64_t time_us;
+  double pwr;
+};
+
+// notify is called for every event, in order, on a thread of the alerts.
+// done is called on that thread before it exits.
+struct alerts_config {
+  void (*notify)(void *ctx, const struct alert_event *event);
+  void (*done)(void *ctx);
+  void *ctx;
+};
+
+struct alerts;
+
+struct alerts *alerts_create(const char *rules,
+                             const struct alerts_config *config);
+void alerts_destroy(struct alerts *a);
+size_t alerts_num_rules(const struct alerts *a);
+// epoch is the hop epoch of the report, see struct hop_tag. present is the
+// mask of the detectors that currently find their signal, by detector_id.
+void alerts_update(struct alerts *a, int64_t time_us, uint32_t epoch,
+                   uint16_t center_freq, uint16_t span_width,
+                   uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                   unsigned present);
+size_t alerts_memory(const struct alerts *a);
+
+#endif
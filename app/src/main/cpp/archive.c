@@ -0,0 +1,549 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "archive.h"
+#include "row-codec.h"
+#include "spectral-report.h"
+
+#define LOG_TAG "archive"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { QUEUE_SIZE = 512 };
+enum { MAX_OPEN_CHUNKS = 4 };
+enum { MAX_CHUNK_ROWS = 256 };
+enum { CHUNK_BUF_SIZE = 64 * 1024 };
+enum { INDEX_INTERVAL = 64 };
+
+// A chunk never spans more than this, which bounds how far out of order
+// chunks of different channels can be written.
+static const int32_t chunk_time = 1000000;
+
+struct archive_row {
+  int32_t tstamp;
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  int8_t bin_pwr[MAX_NUM_BINS];
+};
+
+struct open_chunk {
+  bool used;
+  struct archive_chunk header;
+  int8_t prev[MAX_NUM_BINS];
+  struct bit_writer bw;
+};
+
+struct archive_writer {
+  FILE *fp;
+  uint64_t offset;
+  bool failed;
+  pthread_t thread;
+  sem_t items;
+  atomic_bool stopping;
+  struct archive_row queue[QUEUE_SIZE];
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_int_least64_t dropped;
+  struct tstamp_clock clock;
+  int64_t time_us;
+  struct open_chunk chunks[MAX_OPEN_CHUNKS];
+  struct archive_index_entry *index;
+  size_t num_entries;
+  size_t index_capacity;
+  uint64_t num_chunks;
+  int64_t max_time_last;
+  uint64_t num_rows;
+  uint64_t raw_bytes;
+};
+
+static void write_data(struct archive_writer *w, const void *data,
+                       size_t len) {
+  if (w->failed) {
+    return;
+  }
+  if (fwrite(data, len, 1, w->fp) != 1) {
+    LOGE("Can't write archive: %s", strerror(errno));
+    w->failed = true;
+    return;
+  }
+  w->offset += len;
+}
+
+static void add_index(struct archive_writer *w, uint64_t offset,
+                      int64_t time_last) {
+  if (time_last > w->max_time_last) {
+    w->max_time_last = time_last;
+  }
+
+  if (w->num_chunks++ % INDEX_INTERVAL == 0) {
+    if (w->num_entries == w->index_capacity) {
+      const size_t capacity = w->index_capacity ? w->index_capacity * 2 : 256;
+      struct archive_index_entry *index =
+          realloc(w->index, capacity * sizeof(struct archive_index_entry));
+      if (index == NULL) {
+        LOGE("Can't grow archive index");
+        w->failed = true;
+        return;
+      }
+      w->index = index;
+      w->index_capacity = capacity;
+    }
+    w->index[w->num_entries++].offset = offset;
+  }
+  w->index[w->num_entries - 1].max_time_last = w->max_time_last;
+}
+
+static void flush_chunk(struct archive_writer *w, struct open_chunk *chunk) {
+  if (!chunk->used) {
+    return;
+  }
+  chunk->used = false;
+
+  flush_bits(&chunk->bw);
+  chunk->header.payload_len = (uint32_t)chunk->bw.pos;
+
+  const uint64_t offset = w->offset;
+  write_data(w, &chunk->header, sizeof(chunk->header));
+  write_data(w, chunk->bw.buf, chunk->bw.pos);
+  if (!w->failed) {
+    add_index(w, offset, chunk->header.time_last);
+  }
+}
+
+static struct open_chunk *get_chunk(struct archive_writer *w,
+                                    uint16_t center_freq,
+                                    uint16_t bin_pwr_count) {
+  struct open_chunk *chunk = NULL;
+  for (size_t idx = 0; idx < MAX_OPEN_CHUNKS; idx++) {
+    struct open_chunk *open = &w->chunks[idx];
+    if (open->used && open->header.center_freq == center_freq &&
+        open->header.bin_pwr_count == bin_pwr_count) {
+      if (open->header.num_rows < MAX_CHUNK_ROWS &&
+          CHUNK_BUF_SIZE - open->bw.pos >= row_codec_max_size(bin_pwr_count)) {
+        return open;
+      }
+      chunk = open;
+      break;
+    }
+  }
+
+  // Otherwise take a free slot, or write out the oldest chunk.
+  for (size_t idx = 0; chunk == NULL && idx < MAX_OPEN_CHUNKS; idx++) {
+    if (!w->chunks[idx].used) {
+      chunk = &w->chunks[idx];
+    }
+  }
+  if (chunk == NULL) {
+    chunk = &w->chunks[0];
+    for (size_t idx = 1; idx < MAX_OPEN_CHUNKS; idx++) {
+      if (w->chunks[idx].header.time_first < chunk->header.time_first) {
+        chunk = &w->chunks[idx];
+      }
+    }
+  }
+
+  flush_chunk(w, chunk);
+  chunk->used = true;
+  chunk->header = (struct archive_chunk){
+      .magic = ARCHIVE_CHUNK_MAGIC,
+      .center_freq = center_freq,
+      .bin_pwr_count = bin_pwr_count,
+      .time_first = w->time_us,
+      .time_last = w->time_us,
+  };
+  chunk->bw.pos = 0;
+  return chunk;
+}
+
+
+static void write_row(struct archive_writer *w, const struct archive_row *row) {
+  w->time_us = tstamp_clock_update(&w->clock, row->tstamp);
+
+  // Chunks of channels that are no longer visited are written out once
+  // they get too old, so that chunks stay roughly in time order.
+  for (size_t idx = 0; idx < MAX_OPEN_CHUNKS; idx++) {
+    struct open_chunk *chunk = &w->chunks[idx];
+    if (chunk->used && w->time_us - chunk->header.time_first >= chunk_time) {
+      flush_chunk(w, chunk);
+    }
+  }
+
+  struct open_chunk *chunk = get_chunk(w, row->center_freq, row->bin_pwr_count);
+  const bool first = chunk->header.num_rows == 0;
+  row_codec_encode(&chunk->bw,
+                   (uint32_t)(w->time_us - chunk->header.time_last),
+                   row->bin_pwr, chunk->prev, row->bin_pwr_count, first);
+  memcpy(chunk->prev, row->bin_pwr, row->bin_pwr_count);
+  chunk->header.num_rows++;
+  chunk->header.time_last = w->time_us;
+
+  w->num_rows++;
+  w->raw_bytes += REPORT_BINS_OFFSET + row->bin_pwr_count;
+}
+
+static void *writer_thread(void *arg) {
+  struct archive_writer *w = arg;
+
+  while (true) {
+    sem_wait(&w->items);
+
+    const size_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&w->head, memory_order_acquire);
+    if (tail == head) {
+      if (w->stopping) {
+        break;
+      }
+      continue;
+    }
+
+    write_row(w, &w->queue[tail % QUEUE_SIZE]);
+    atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+  }
+
+  return NULL;
+}
+
+// Only the receive thread pushes, only the writer thread pops, so the
+// queue needs no lock. Rows are dropped rather than stalling the producer.
+bool archive_push(struct archive_writer *w, int32_t tstamp,
+                  uint16_t center_freq, uint16_t bin_pwr_count,
+                  const int8_t bin_pwr[]) {
+  const size_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+  const size_t tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+  if (head - tail >= QUEUE_SIZE) {
+    w->dropped++;
+    return false;
+  }
+
+  struct archive_row *row = &w->queue[head % QUEUE_SIZE];
+  row->tstamp = tstamp;
+  row->center_freq = center_freq;
+  row->bin_pwr_count = bin_pwr_count;
+  memcpy(row->bin_pwr, bin_pwr, bin_pwr_count);
+
+  atomic_store_explicit(&w->head, head + 1, memory_order_release);
+  sem_post(&w->items);
+  return true;
+}
+
+static void free_chunk_bufs(struct archive_writer *w) {
+  for (size_t idx = 0; idx < MAX_OPEN_CHUNKS; idx++) {
+    free(w->chunks[idx].bw.buf);
+  }
+}
+
+struct archive_writer *archive_writer_open(const char *path,
+                                           uint16_t span_width) {
+  struct archive_writer *w = calloc(1, sizeof(struct archive_writer));
+  if (w == NULL) {
+    LOGE("Can't allocate archive writer");
+    return NULL;
+  }
+
+  for (size_t idx = 0; idx < MAX_OPEN_CHUNKS; idx++) {
+    w->chunks[idx].bw.buf = malloc(CHUNK_BUF_SIZE);
+    if (w->chunks[idx].bw.buf == NULL) {
+      LOGE("Can't allocate archive chunk buffer");
+      free_chunk_bufs(w);
+      free(w);
+      return NULL;
+    }
+  }
+
+  w->fp = fopen(path, "wb");
+  if (w->fp == NULL) {
+    LOGE("Can't open %s: %s", path, strerror(errno));
+    free_chunk_bufs(w);
+    free(w);
+    return NULL;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  const struct archive_header header = {
+      .magic = ARCHIVE_MAGIC,
+      .version = ARCHIVE_VERSION,
+      .span_width = span_width,
+      .chunk_time_us = (uint32_t)chunk_time,
+      .start_wall_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+  };
+  write_data(w, &header, sizeof(header));
+
+  sem_init(&w->items, 0, 0);
+  if (pthread_create(&w->thread, 0, writer_thread, w) != 0) {
+    LOGE("Can't create archive writer thread");
+    sem_destroy(&w->items);
+    fclose(w->fp);
+    free_chunk_bufs(w);
+    free(w);
+    return NULL;
+  }
+
+  return w;
+}
+
+void archive_writer_close(struct archive_writer *w) {
+  if (w == NULL) {
+    return;
+  }
+
+  w->stopping = true;
+  sem_post(&w->items);
+  pthread_join(w->thread, NULL);
+  sem_destroy(&w->items);
+
+  while (true) {
+    struct open_chunk *oldest = NULL;
+    for (size_t idx = 0; idx < MAX_OPEN_CHUNKS; idx++) {
+      struct open_chunk *chunk = &w->chunks[idx];
+      if (chunk->used && (oldest == NULL || chunk->header.time_first <
+                                                oldest->header.time_first)) {
+        oldest = chunk;
+      }
+    }
+    if (oldest == NULL) {
+      break;
+    }
+    flush_chunk(w, oldest);
+  }
+
+  const struct archive_footer footer = {
+      .index_offset = w->offset,
+      .num_entries = (uint32_t)w->num_entries,
+      .magic = ARCHIVE_INDEX_MAGIC,
+  };
+  write_data(w, w->index, w->num_entries * sizeof(struct archive_index_entry));
+  write_data(w, &footer, sizeof(footer));
+
+  if (fclose(w->fp) != 0) {
+    LOGW("Can't close archive: %s", strerror(errno));
+  }
+
+  LOGI("Archived %" PRIu64 " rows in %" PRIu64 " chunks, %" PRIu64
+       " bytes from %" PRIu64 " (%.1fx), dropped %" PRId64,
+       w->num_rows, w->num_chunks, w->offset, w->raw_bytes,
+       w->offset > 0 ? (double)w->raw_bytes / (double)w->offset : 0.0,
+       (int64_t)w->dropped);
+
+  free_chunk_bufs(w);
+  free(w->index);
+  free(w);
+}
+
+struct archive_reader {
+  FILE *fp;
+  struct archive_header header;
+  struct archive_index_entry *index;
+  size_t num_entries;
+  uint8_t *payload;
+  size_t payload_capacity;
+};
+
+static bool read_chunk_header(FILE *fp, struct archive_chunk *chunk) {
+  return fread(chunk, sizeof(*chunk), 1, fp) == 1 &&
+         chunk->magic == ARCHIVE_CHUNK_MAGIC &&
+         chunk->bin_pwr_count <= MAX_NUM_BINS;
+}
+
+// Archives whose writer never got to write the index, e.g. because the
+// process was killed, are indexed by walking the chunk headers once.
+static bool rebuild_index(struct archive_reader *r) {
+  if (fseeko(r->fp, sizeof(struct archive_header), SEEK_SET) != 0) {
+    return false;
+  }
+
+  size_t capacity = 0;
+  uint64_t num_chunks = 0;
+  int64_t max_time_last = INT64_MIN;
+  struct archive_chunk chunk;
+  off_t offset = ftello(r->fp);
+  while (read_chunk_header(r->fp, &chunk)) {
+    if (chunk.time_last > max_time_last) {
+      max_time_last = chunk.time_last;
+    }
+    if (num_chunks++ % INDEX_INTERVAL == 0) {
+      if (r->num_entries == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        struct archive_index_entry *index =
+            realloc(r->index, capacity * sizeof(struct archive_index_entry));
+        if (index == NULL) {
+          return false;
+        }
+        r->index = index;
+      }
+      r->index[r->num_entries++].offset = (uint64_t)offset;
+    }
+    r->index[r->num_entries - 1].max_time_last = max_time_last;
+
+    if (fseeko(r->fp, chunk.payload_len, SEEK_CUR) != 0) {
+      break;
+    }
+    offset = ftello(r->fp);
+  }
+
+  return true;
+}
+
+static bool read_index(struct archive_reader *r) {
+  struct archive_footer footer;
+  if (fseeko(r->fp, -(off_t)sizeof(footer), SEEK_END) != 0 ||
+      fread(&footer, sizeof(footer), 1, r->fp) != 1 ||
+      footer.magic != ARCHIVE_INDEX_MAGIC) {
+    return false;
+  }
+
+  r->index = calloc(footer.num_entries + 1, sizeof(struct archive_index_entry));
+  if (r->index == NULL) {
+    return false;
+  }
+  if (fseeko(r->fp, (off_t)footer.index_offset, SEEK_SET) != 0 ||
+      fread(r->index, sizeof(struct archive_index_entry), footer.num_entries,
+            r->fp) != footer.num_entries) {
+    free(r->index);
+    r->index = NULL;
+    return false;
+  }
+  r->num_entries = footer.num_entries;
+  return true;
+}
+
+struct archive_reader *archive_reader_open(const char *path) {
+  struct archive_reader *r = calloc(1, sizeof(struct archive_reader));
+  if (r == NULL) {
+    LOGE("Can't allocate archive reader");
+    return NULL;
+  }
+
+  r->fp = fopen(path, "rb");
+  if (r->fp == NULL) {
+    LOGE("Can't open %s: %s", path, strerror(errno));
+    free(r);
+    return NULL;
+  }
+
+  if (fread(&r->header, sizeof(r->header), 1, r->fp) != 1 ||
+      r->header.magic != ARCHIVE_MAGIC ||
+      r->header.version != ARCHIVE_VERSION) {
+    LOGE("%s is not an archive", path);
+    archive_reader_close(r);
+    return NULL;
+  }
+
+  if (!read_index(r)) {
+    LOGW("%s has no index, rebuilding it", path);
+    r->num_entries = 0;
+    if (!rebuild_index(r)) {
+      LOGE("Can't index %s", path);
+      archive_reader_close(r);
+      return NULL;
+    }
+  }
+
+  return r;
+}
+
+void archive_reader_close(struct archive_reader *r) {
+  if (r == NULL) {
+    return;
+  }
+  fclose(r->fp);
+  free(r->index);
+  free(r->payload);
+  free(r);
+}
+
+int64_t archive_start_wall_us(const struct archive_reader *r) {
+  return r->header.start_wall_us;
+}
+
+uint16_t archive_span_width(const struct archive_reader *r) {
+  return r->header.span_width;
+}
+
+int64_t archive_end_time(const struct archive_reader *r) {
+  return r->num_entries > 0 ? r->index[r->num_entries - 1].max_time_last : 0;
+}
+
+// Calls fn for every row in [start_us, end_us] of every chunk whose span
+// overlaps [start_freq, end_freq]. Only those chunks are decoded. Returns
+// the number of rows passed to fn, or a negative errno.
+int64_t archive_read(struct archive_reader *r, int64_t start_us,
+                     int64_t end_us, uint16_t start_freq, uint16_t end_freq,
+                     archive_row_fn fn, void *arg) {
+  // Entries before the first one whose chunks reach start_us hold nothing
+  // of interest.
+  size_t lo = 0;
+  size_t hi = r->num_entries;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (r->index[mid].max_time_last < start_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == r->num_entries) {
+    return 0;
+  }
+
+  if (fseeko(r->fp, (off_t)r->index[lo].offset, SEEK_SET) != 0) {
+    return -errno;
+  }
+
+  const int64_t half_span = r->header.span_width / 2;
+  int64_t num_rows = 0;
+  struct archive_chunk chunk;
+  while (read_chunk_header(r->fp, &chunk)) {
+    // A chunk is written at most chunk_time after its first row, so once
+    // one starts that late past the window, no later chunk can overlap it.
+    if (chunk.time_first > end_us + (int64_t)r->header.chunk_time_us) {
+      break;
+    }
+
+    if (chunk.time_last < start_us || chunk.time_first > end_us ||
+        chunk.center_freq + half_span <= start_freq ||
+        chunk.center_freq - half_span >= end_freq) {
+      if (fseeko(r->fp, chunk.payload_len, SEEK_CUR) != 0) {
+        return -errno;
+      }
+      continue;
+    }
+
+    if (chunk.payload_len > r->payload_capacity) {
+      uint8_t *payload = realloc(r->payload, chunk.payload_len);
+      if (payload == NULL) {
+        return -ENOMEM;
+      }
+      r->payload = payload;
+      r->payload_capacity = chunk.payload_len;
+    }
+    if (fread(r->payload, chunk.payload_len, 1, r->fp) != 1) {
+      break;
+    }
+
+    struct bit_reader br = {.buf = r->payload, .len = chunk.payload_len};
+    int8_t bin_pwr[MAX_NUM_BINS];
+    int64_t time_us = chunk.time_first;
+    for (uint32_t row = 0; row < chunk.num_rows; row++) {
+      time_us += row_codec_decode(&br, bin_pwr, chunk.bin_pwr_count, row == 0);
+      if (time_us > end_us) {
+        break;
+      }
+      if (time_us >= start_us) {
+        fn(arg, time_us, chunk.center_freq, chunk.bin_pwr_count, bin_pwr);
+        num_rows++;
+      }
+    }
+  }
+
+  return num_rows;
+}
@@ -0,0 +1,74 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An archive is a header followed by chunks of rows of one center frequency
+// and bin count, and ends with a sparse index of chunk offsets. Rows are
+// delta coded against the previous row of their chunk and Rice coded.
+// Times are microseconds since the start of the archive, unwrapped from the
+// 32-bit report timestamps.
+enum { ARCHIVE_MAGIC = 0x76686372 };
+enum { ARCHIVE_CHUNK_MAGIC = 0x6b6e6863 };
+enum { ARCHIVE_INDEX_MAGIC = 0x78646e69 };
+enum { ARCHIVE_VERSION = 1 };
+
+struct archive_header {
+  uint32_t magic;
+  uint32_t version;
+  uint16_t span_width;
+  uint16_t reserved;
+  uint32_t chunk_time_us;
+  int64_t start_wall_us;
+};
+
+struct archive_chunk {
+  uint32_t magic;
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint32_t num_rows;
+  uint32_t payload_len;
+  int64_t time_first;
+  int64_t time_last;
+};
+
+// One entry every few chunks. max_time_last is the latest row time of all
+// chunks up to the end of the entry's group, so it never decreases.
+struct archive_index_entry {
+  uint64_t offset;
+  int64_t max_time_last;
+};
+
+struct archive_footer {
+  uint64_t index_offset;
+  uint32_t num_entries;
+  uint32_t magic;
+};
+
+struct archive_writer;
+
+struct archive_writer *archive_writer_open(const char *path,
+                                           uint16_t span_width);
+void archive_writer_close(struct archive_writer *w);
+bool archive_push(struct archive_writer *w, int32_t tstamp,
+                  uint16_t center_freq, uint16_t bin_pwr_count,
+                  const int8_t bin_pwr[]);
+
+struct archive_reader;
+
+typedef void (*archive_row_fn)(void *arg, int64_t time_us,
+                               uint16_t center_freq, uint16_t bin_pwr_count,
+                               const int8_t bin_pwr[]);
+
+struct archive_reader *archive_reader_open(const char *path);
+void archive_reader_close(struct archive_reader *r);
+int64_t archive_start_wall_us(const struct archive_reader *r);
+uint16_t archive_span_width(const struct archive_reader *r);
+int64_t archive_end_time(const struct archive_reader *r);
+int64_t archive_read(struct archive_reader *r, int64_t start_us,
+                     int64_t end_us, uint16_t start_freq, uint16_t end_freq,
+                     archive_row_fn fn, void *arg);
+
+#endif
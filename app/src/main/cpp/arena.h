@@ -0,0 +1,55 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Buffers that are sized together and freed together, carved from a single
+// block. Every buffer starts on a cache line, so buffers written by the
+// same loop do not share lines.
+//
+// Sizing takes two passes over the same allocations: with no block,
+// arena_alloc only adds up the space needed and returns NULL, then
+// arena_init allocates that much and the second pass hands out buffers.
+enum { ARENA_ALIGN = 64 };
+
+struct arena {
+  uint8_t *base;
+  size_t size;
+  size_t used;
+};
+
+static inline bool arena_init(struct arena *a) {
+  void *base = NULL;
+  if (posix_memalign(&base, ARENA_ALIGN, a->used > 0 ? a->used : 1) != 0) {
+    return false;
+  }
+  memset(base, 0, a->used);
+  a->base = base;
+  a->size = a->used;
+  a->used = 0;
+  return true;
+}
+
+static inline void *arena_alloc(struct arena *a, size_t size) {
+  const size_t pos = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (a->base == NULL) {
+    a->used = pos + size;
+    return NULL;
+  }
+  if (pos + size > a->size) {
+    return NULL;
+  }
+  a->used = pos + size;
+  return a->base + pos;
+}
+
+static inline void arena_free(struct arena *a) {
+  free(a->base);
+  *a = (struct arena){0};
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+#define LOG_TAG "capture"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { SLOT_ALIGN = 64 };
+enum { MIN_SLOTS = 64 };
+
+// While writing the window after a trigger the dump thread polls for new
+// reports this often, and gives up this long after the window should have
+// ended, in case reports stop arriving.
+static const useconds_t follow_interval_us = 20000;
+static const int64_t follow_slack_us = 1000000;
+
+// seq is odd while the receive thread is writing the slot. pos is the
+// position of the report in the stream, so a reader can tell a slot that
+// was overwritten between two reads of seq from one that was not.
+struct capture_slot {
+  atomic_uint seq;
+  uint32_t len;
+  uint64_t pos;
+  int64_t time_us;
+  struct hop_tag tag;
+  uint8_t data[];
+};
+
+struct capture {
+  char dir[PATH_MAX];
+  int64_t pre_us;
+  int64_t post_us;
+  size_t max_len;
+  size_t slot_size;
+  size_t num_slots;
+  uint8_t *slots;
+  struct tstamp_clock clock;
+  atomic_uint_least64_t head;
+  atomic_int_least64_t last_time;
+  atomic_int_least64_t num_skipped;
+  atomic_bool pending;
+  atomic_uint triggers;
+  atomic_uint_least64_t trigger_pos;
+  atomic_int_least64_t trigger_time;
+  atomic_int_least64_t num_ignored;
+  pthread_t thread;
+  sem_t wake;
+  atomic_bool stopping;
+  uint8_t *copy;
+  uint64_t num_dumps;
+  uint64_t num_records;
+  uint64_t num_lost;
+};
+
+static int64_t now_us(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct capture_slot *get_slot(const struct capture *cap, uint64_t pos) {
+  return (struct capture_slot *)(cap->slots +
+                                 (size_t)(pos % cap->num_slots) *
+                                     cap->slot_size);
+}
+
+// Only the receive thread pushes. It never waits for the dump thread: a
+// slot being read is simply overwritten, and the reader notices.
+void capture_push(struct capture *cap, const uint8_t data[], size_t len,
+                  int32_t tstamp, const struct hop_tag *tag) {
+  if (len > cap->max_len) {
+    cap->num_skipped++;
+    return;
+  }
+
+  const int64_t time_us = tstamp_clock_update(&cap->clock, tstamp);
+  const uint64_t pos = atomic_load_explicit(&cap->head, memory_order_relaxed);
+  struct capture_slot *slot = get_slot(cap, pos);
+
+  const unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->len = (uint32_t)len;
+  slot->pos = pos;
+  slot->time_us = time_us;
+  slot->tag = *tag;
+  memcpy(slot->data, data, len);
+  atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+
+  atomic_store_explicit(&cap->last_time, time_us, memory_order_relaxed);
+  atomic_store_explicit(&cap->head, pos + 1, memory_order_release);
+}
+
+// Copies the report at pos to the copy buffer. Returns false if the slot
+// no longer holds it, or was being written.
+static bool read_slot(struct capture *cap, uint64_t pos,
+                      struct capture_record *record) {
+  const struct capture_slot *slot = get_slot(cap, pos);
+  const unsigned seq = atomic_load_explicit(
+      (atomic_uint *)&slot->seq, memory_order_acquire);
+  if (seq & 1) {
+    return false;
+  }
+
+  const uint64_t slot_pos = slot->pos;
+  const uint32_t len = slot->len;
+  record->time_us = slot->time_us;
+  record->len = len;
+  record->reserved = 0;
+  record->tag = slot->tag;
+  if (len <= cap->max_len) {
+    memcpy(cap->copy, slot->data, len);
+  }
+
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit((atomic_uint *)&slot->seq,
+                              memory_order_relaxed) == seq &&
+         slot_pos == pos && len <= cap->max_len;
+}
+
+static bool slot_time(struct capture *cap, uint64_t pos, int64_t *time_us) {
+  const struct capture_slot *slot = get_slot(cap, pos);
+  const unsigned seq = atomic_load_explicit(
+      (atomic_uint *)&slot->seq, memory_order_acquire);
+  const uint64_t slot_pos = slot->pos;
+  *time_us = slot->time_us;
+  atomic_thread_fence(memory_order_acquire);
+  return !(seq & 1) &&
+         atomic_load_explicit((atomic_uint *)&slot->seq,
+                              memory_order_relaxed) == seq &&
+         slot_pos == pos;
+}
+
+static FILE *open_dump(struct capture *cap, uint32_t triggers,
+                       int64_t wall_us, char path[]) {
+  const time_t secs = (time_t)(wall_us / 1000000);
+  struct tm tm;
+  localtime_r(&secs, &tm);
+  char stamp[32];
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+  if (snprintf(path, PATH_MAX, "%s/capture-%s.%03d-%x.bin", cap->dir, stamp,
+               (int)(wall_us / 1000 % 1000), triggers) >= PATH_MAX) {
+    LOGE("Capture directory name too long");
+    return NULL;
+  }
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    LOGE("Can't open %s: %s", path, strerror(errno));
+  }
+  return fp;
+}
+
+static void dump(struct capture *cap) {
+  const uint32_t triggers = cap->triggers;
+  const uint64_t trigger_pos = cap->trigger_pos;
+  const int64_t trigger_time = cap->trigger_time;
+  const int64_t start_time = trigger_time - cap->pre_us;
+  const int64_t end_time = trigger_time + cap->post_us;
+  const int64_t deadline =
+      now_us(CLOCK_MONOTONIC) + cap->post_us + follow_slack_us;
+
+  struct capture_header header = {
+      .magic = CAPTURE_MAGIC,
+      .version = CAPTURE_VERSION,
+      .triggers = triggers,
+      .trigger_wall_us = now_us(CLOCK_REALTIME),
+      .trigger_time_us = trigger_time,
+      .pre_us = cap->pre_us,
+      .post_us = cap->post_us,
+  };
+  char path[PATH_MAX];
+  FILE *fp = open_dump(cap, triggers, header.trigger_wall_us, path);
+  if (fp == NULL) {
+    return;
+  }
+  bool failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+
+  // Walk back to the first report of the window that the ring still holds.
+  uint64_t head = atomic_load_explicit(&cap->head, memory_order_acquire);
+  const uint64_t oldest = head > cap->num_slots ? head - cap->num_slots : 0;
+  uint64_t pos = trigger_pos;
+  int64_t time_us;
+  while (pos > oldest && slot_time(cap, pos - 1, &time_us) &&
+         time_us >= start_time) {
+    pos--;
+  }
+  if (pos > 0 && pos == oldest) {
+    LOGW("Capture ring holds only %" PRId64 " us before the trigger",
+         slot_time(cap, pos, &time_us) ? trigger_time - time_us : 0);
+  }
+
+  // Then follow the head until the window after the trigger has passed.
+  uint32_t num_records = 0;
+  uint64_t num_lost = 0;
+  while (!failed && !cap->stopping && num_records < cap->num_slots) {
+    head = atomic_load_explicit(&cap->head, memory_order_acquire);
+    if (pos == head) {
+      if (now_us(CLOCK_MONOTONIC) > deadline) {
+        break;
+      }
+      usleep(follow_interval_us);
+      continue;
+    }
+    if (head - pos > cap->num_slots) {
+      num_lost += head - cap->num_slots - pos;
+      pos = head - cap->num_slots;
+    }
+
+    struct capture_record record;
+    if (!read_slot(cap, pos++, &record)) {
+      num_lost++;
+      continue;
+    }
+    if (record.time_us > end_time) {
+      break;
+    }
+    if (record.time_us < start_time) {
+      continue;
+    }
+    failed = fwrite(&record, sizeof(record), 1, fp) != 1 ||
+             fwrite(cap->copy, record.len, 1, fp) != 1;
+    num_records++;
+  }
+
+  header.num_records = num_records;
+  failed = failed || fseek(fp, 0, SEEK_SET) != 0 ||
+           fwrite(&header, sizeof(header), 1, fp) != 1;
+  if (fclose(fp) != 0 || failed) {
+    LOGE("Can't write %s: %s", path, strerror(errno));
+    return;
+  }
+
+  LOGI("Captured %" PRIu32 " reports around trigger %#" PRIx32
+       " to %s, lost %" PRIu64,
+       num_records, triggers, path, num_lost);
+  cap->num_dumps++;
+  cap->num_records += num_records;
+  cap->num_lost += num_lost;
+}
+
+static void *dump_thread(void *arg) {
+  struct capture *cap = arg;
+
+  while (true) {
+    sem_wait(&cap->wake);
+    if (cap->stopping) {
+      break;
+    }
+    dump(cap);
+    atomic_store(&cap->pending, false);
+  }
+
+  return NULL;
+}
+
+// Triggers while a window is being written are ignored: the reports around
+// them mostly go to that file anyway, and the ring has no room for more.
+bool capture_trigger(struct capture *cap, uint32_t triggers) {
+  bool idle = false;
+  if (!atomic_compare_exchange_strong(&cap->pending, &idle, true)) {
+    cap->num_ignored++;
+    return false;
+  }
+
+  cap->triggers = triggers;
+  cap->trigger_pos = atomic_load_explicit(&cap->head, memory_order_acquire);
+  cap->trigger_time = cap->last_time;
+  sem_post(&cap->wake);
+  return true;
+}
+
+struct capture *capture_open(const struct capture_config *config) {
+  struct capture *cap = calloc(1, sizeof(struct capture));
+  if (cap == NULL) {
+    LOGE("Can't allocate capture");
+    return NULL;
+  }
+
+  strlcpy(cap->dir, config->dir, sizeof(cap->dir));
+  cap->max_len = config->max_len;
+  cap->slot_size = (sizeof(struct capture_slot) + config->max_len +
+                    SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1);
+  cap->num_slots = config->budget / cap->slot_size;
+  if (cap->num_slots < MIN_SLOTS) {
+    cap->num_slots = MIN_SLOTS;
+  }
+  cap->pre_us = config->pre_us;
+  cap->post_us = config->post_us;
+
+  void *slots = NULL;
+  if (posix_memalign(&slots, SLOT_ALIGN, cap->num_slots * cap->slot_size) !=
+          0 ||
+      (cap->copy = malloc(cap->max_len)) == NULL) {
+    LOGE("Can't allocate capture ring of %zu reports", cap->num_slots);
+    free(slots);
+    free(cap);
+    return NULL;
+  }
+  memset(slots, 0, cap->num_slots * cap->slot_size);
+  cap->slots = slots;
+
+  sem_init(&cap->wake, 0, 0);
+  if (pthread_create(&cap->thread, 0, dump_thread, cap) != 0) {
+    LOGE("Can't create capture thread");
+    sem_destroy(&cap->wake);
+    free(cap->copy);
+    free(cap->slots);
+    free(cap);
+    return NULL;
+  }
+
+  LOGI("Capturing to %s, %zu reports of up to %zu bytes, %" PRId64
+       " us before and %" PRId64 " us after a trigger",
+       cap->dir, cap->num_slots, cap->max_len, cap->pre_us, cap->post_us);
+  return cap;
+}
+
+void capture_close(struct capture *cap) {
+  if (cap == NULL) {
+    return;
+  }
+
+  cap->stopping = true;
+  sem_post(&cap->wake);
+  pthread_join(cap->thread, NULL);
+  sem_destroy(&cap->wake);
+
+  LOGI("Captured %" PRIu64 " reports in %" PRIu64 " files, lost %" PRIu64
+       ", skipped %" PRId64 ", ignored %" PRId64 " triggers",
+       cap->num_records, cap->num_dumps, cap->num_lost,
+       (int64_t)cap->num_skipped, (int64_t)cap->num_ignored);
+
+  free(cap->copy);
+  free(cap->slots);
+  free(cap);
+}
+
+size_t capture_memory(const struct capture *cap) {
+  return sizeof(struct capture) + cap->num_slots * cap->slot_size +
+         cap->max_len;
+}
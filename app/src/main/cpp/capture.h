@@ -0,0 +1,58 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spectral-report.h"
+
+// A capture keeps the latest reports as received in a ring of fixed size.
+// A trigger writes the reports from pre_us before it to post_us after it to
+// a new file in the capture directory: one header, then one record per
+// report, each followed by len bytes of the report. Times are microseconds
+// on the report clock of the capture, unwrapped like the archive's.
+enum { CAPTURE_MAGIC = 0x74706163 };
+enum { CAPTURE_VERSION = 1 };
+
+// triggers is the mask of the detectors that tripped, or 0 for a trigger
+// from the app. num_records is filled in when the file is complete.
+struct capture_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t triggers;
+  uint32_t num_records;
+  int64_t trigger_wall_us;
+  int64_t trigger_time_us;
+  int64_t pre_us;
+  int64_t post_us;
+};
+
+struct capture_record {
+  int64_t time_us;
+  uint32_t len;
+  uint32_t reserved;
+  struct hop_tag tag;
+};
+
+// The ring holds as many reports of up to max_len bytes as fit in budget
+// bytes, which bounds both windows: the one before a trigger to what the
+// ring still holds, the one after it to as many reports as the ring.
+struct capture_config {
+  const char *dir;
+  size_t budget;
+  size_t max_len;
+  int64_t pre_us;
+  int64_t post_us;
+};
+
+struct capture;
+
+struct capture *capture_open(const struct capture_config *config);
+void capture_close(struct capture *cap);
+void capture_push(struct capture *cap, const uint8_t data[], size_t len,
+                  int32_t tstamp, const struct hop_tag *tag);
+bool capture_trigger(struct capture *cap, uint32_t triggers);
+size_t capture_memory(const struct capture *cap);
+
+#endif
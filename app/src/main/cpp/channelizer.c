@@ -0,0 +1,349 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channelizer.h"
+#include "spectral-report.h"
+
+// Weight tables are built once per span and bin count and kept for the
+// channels visited most recently.
+enum { MAX_WEIGHT_TABLES = 8 };
+
+enum { NUM_WIFI_CHANS = 39 };
+enum { NUM_BT_CHANS = MAX_GRID_CHANNELS };
+enum { NUM_ZB_CHANS = 16 };
+enum { NUM_CHANS = NUM_WIFI_CHANS + NUM_BT_CHANS + NUM_ZB_CHANS };
+
+static struct channel_info channels[NUM_CHANS];
+static const size_t grid_start[NUM_GRIDS + 1] = {
+    0,
+    NUM_WIFI_CHANS,
+    NUM_WIFI_CHANS + NUM_BT_CHANS,
+    NUM_CHANS,
+};
+static float pwr_to_mw[256];
+
+// Channels that lie partly outside a report's span are not measured by it.
+struct channel_weights {
+  uint16_t chan;
+  uint16_t bin_start;
+  uint16_t bin_count;
+  uint32_t weight_pos;
+};
+
+struct weight_table {
+  uint16_t center_freq;
+  uint16_t span_width;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  uint16_t num_chans;
+  struct channel_weights chans[NUM_CHANS];
+  float *weights;
+};
+
+struct channelizer {
+  int64_t period;
+  size_t num_frames;
+  struct weight_table *tables[MAX_WEIGHT_TABLES];
+  size_t num_tables;
+  uint64_t clock;
+  int64_t frame_end;
+  double sum[NUM_CHANS];
+  uint32_t count[NUM_CHANS];
+  uint64_t num_published;
+  float *frames;
+};
+
+static pthread_once_t channels_once = PTHREAD_ONCE_INIT;
+
+static void init_channels(void) {
+  size_t idx = 0;
+  for (int num = 1; num <= 13; num++) {
+    channels[idx++] = (struct channel_info){GRID_WIFI, num, 2407 + 5 * num, 20};
+  }
+  channels[idx++] = (struct channel_info){GRID_WIFI, 14, 2484, 20};
+  static const int wifi_5g[] = {36,  40,  44,  48,  52,  56,  60,  64,
+                                100, 104, 108, 112, 116, 120, 124, 128,
+                                132, 136, 140, 144, 149, 153, 157, 161,
+                                165};
+  for (size_t i = 0; i < sizeof(wifi_5g) / sizeof(wifi_5g[0]); i++) {
+    channels[idx++] =
+        (struct channel_info){GRID_WIFI, wifi_5g[i], 5000 + 5 * wifi_5g[i], 20};
+  }
+  for (int num = 0; num < NUM_BT_CHANS; num++) {
+    channels[idx++] = (struct channel_info){GRID_BLUETOOTH, num, 2402 + num, 1};
+  }
+  for (int num = 11; num <= 26; num++) {
+    channels[idx++] =
+        (struct channel_info){GRID_ZIGBEE, num, 2405 + 5 * (num - 11), 2};
+  }
+
+  for (int pwr = -128; pwr < 128; pwr++) {
+    pwr_to_mw[pwr + 128] = powf(10.0f, (float)pwr / 10.0f);
+  }
+}
+
+struct channelizer *channelizer_create(int64_t period, size_t num_frames) {
+  if (period <= 0 || num_frames < 1) {
+    return NULL;
+  }
+  pthread_once(&channels_once, init_channels);
+
+  struct channelizer *ch = calloc(1, sizeof(struct channelizer));
+  if (ch == NULL) {
+    return NULL;
+  }
+  ch->frames = malloc(num_frames * NUM_CHANS * sizeof(float));
+  if (ch->frames == NULL) {
+    free(ch);
+    return NULL;
+  }
+  ch->period = period;
+  ch->num_frames = num_frames;
+  ch->frame_end = -1;
+  return ch;
+}
+
+static void free_table(struct weight_table *table) {
+  if (table != NULL) {
+    free(table->weights);
+    free(table);
+  }
+}
+
+void channelizer_destroy(struct channelizer *ch) {
+  if (ch == NULL) {
+    return;
+  }
+  for (size_t idx = 0; idx < ch->num_tables; idx++) {
+    free_table(ch->tables[idx]);
+  }
+  free(ch->frames);
+  free(ch);
+}
+
+size_t channelizer_memory(const struct channelizer *ch) {
+  size_t memory =
+      sizeof(struct channelizer) + ch->num_frames * NUM_CHANS * sizeof(float);
+  for (size_t idx = 0; idx < ch->num_tables; idx++) {
+    const struct weight_table *table = ch->tables[idx];
+    memory += sizeof(struct weight_table);
+    for (uint16_t i = 0; i < table->num_chans; i++) {
+      memory += table->chans[i].bin_count * sizeof(float);
+    }
+  }
+  return memory;
+}
+
+// A bin's weight for a channel is the fraction of the bin that lies within
+// the channel, so summing weighted bin power integrates over the channel.
+static struct weight_table *build_table(uint16_t center_freq,
+                                        uint16_t span_width,
+                                        uint16_t bin_pwr_count) {
+  struct weight_table *table = calloc(1, sizeof(struct weight_table));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  const double bin_width = (double)span_width / bin_pwr_count;
+  const double span_start = center_freq - span_width / 2.0;
+  const double span_end = center_freq + span_width / 2.0;
+
+  size_t num_weights = 0;
+  for (size_t idx = 0; idx < NUM_CHANS; idx++) {
+    const double lo = channels[idx].freq - channels[idx].width / 2;
+    const double hi = channels[idx].freq + channels[idx].width / 2;
+    if (lo < span_start || hi > span_end) {
+      continue;
+    }
+
+    const int bin_start = (int)floor((lo - span_start) / bin_width);
+    int bin_end = (int)ceil((hi - span_start) / bin_width);
+    if (bin_end > bin_pwr_count) {
+      bin_end = bin_pwr_count;
+    }
+    table->chans[table->num_chans++] = (struct channel_weights){
+        .chan = (uint16_t)idx,
+        .bin_start = (uint16_t)bin_start,
+        .bin_count = (uint16_t)(bin_end - bin_start),
+        .weight_pos = (uint32_t)num_weights,
+    };
+    num_weights += (size_t)(bin_end - bin_start);
+  }
+
+  table->weights = malloc((num_weights + 1) * sizeof(float));
+  if (table->weights == NULL) {
+    free(table);
+    return NULL;
+  }
+
+  for (uint16_t i = 0; i < table->num_chans; i++) {
+    const struct channel_weights *cw = &table->chans[i];
+    const double lo = channels[cw->chan].freq - channels[cw->chan].width / 2;
+    const double hi = channels[cw->chan].freq + channels[cw->chan].width / 2;
+    for (uint16_t j = 0; j < cw->bin_count; j++) {
+      const double bin_lo = span_start + (cw->bin_start + j) * bin_width;
+      const double bin_hi = bin_lo + bin_width;
+      const double overlap =
+          fmin(hi, bin_hi) - fmax(lo, bin_lo);
+      table->weights[cw->weight_pos + j] =
+          overlap > 0 ? (float)(overlap / bin_width) : 0.0f;
+    }
+  }
+
+  table->center_freq = center_freq;
+  table->span_width = span_width;
+  table->bin_pwr_count = bin_pwr_count;
+  return table;
+}
+
+static const struct weight_table *get_table(struct channelizer *ch,
+                                            uint16_t center_freq,
+                                            uint16_t span_width,
+                                            uint16_t bin_pwr_count) {
+  size_t victim = 0;
+  for (size_t idx = 0; idx < ch->num_tables; idx++) {
+    struct weight_table *table = ch->tables[idx];
+    if (table->center_freq == center_freq && table->span_width == span_width &&
+        table->bin_pwr_count == bin_pwr_count) {
+      table->last_used = ++ch->clock;
+      return table;
+    }
+    if (table->last_used < ch->tables[victim]->last_used) {
+      victim = idx;
+    }
+  }
+
+  struct weight_table *table =
+      build_table(center_freq, span_width, bin_pwr_count);
+  if (table == NULL) {
+    return NULL;
+  }
+  if (ch->num_tables < MAX_WEIGHT_TABLES) {
+    victim = ch->num_tables++;
+  } else {
+    free_table(ch->tables[victim]);
+  }
+  ch->tables[victim] = table;
+  table->last_used = ++ch->clock;
+  return table;
+}
+
+// Publishes the mean power of every channel over the frame that just ended
+// and starts the next one. Channels no report covered are NaN.
+static void publish(struct channelizer *ch) {
+  float *frame = &ch->frames[(ch->num_published++ % ch->num_frames) * NUM_CHANS];
+  for (size_t idx = 0; idx < NUM_CHANS; idx++) {
+    frame[idx] = ch->count[idx] > 0
+                     ? 10.0f * log10f((float)(ch->sum[idx] / ch->count[idx]))
+                     : NAN;
+  }
+  memset(ch->sum, 0, sizeof(ch->sum));
+  memset(ch->count, 0, sizeof(ch->count));
+}
+
+// Without -ffast-math the compiler may not reorder a float sum, so a single
+// accumulator keeps the dot product scalar. Independent sums per lane give
+// it the vector form instead, and are added up at the end.
+enum { DOT_LANES = 8 };
+
+static float dot(const float *restrict a, const float *restrict b,
+                 uint16_t n) {
+  float lanes[DOT_LANES] = {0};
+  uint16_t j = 0;
+  for (; j + DOT_LANES <= n; j += DOT_LANES) {
+    for (int k = 0; k < DOT_LANES; k++) {
+      lanes[k] += a[j + k] * b[j + k];
+    }
+  }
+  float sum = 0;
+  for (; j < n; j++) {
+    sum += a[j] * b[j];
+  }
+  for (int k = 0; k < DOT_LANES; k++) {
+    sum += lanes[k];
+  }
+  return sum;
+}
+
+void channelizer_update(struct channelizer *ch, int64_t time_us,
+                        uint16_t center_freq, uint16_t span_width,
+                        uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                        uint32_t weight) {
+  if (ch->frame_end < 0) {
+    ch->frame_end = time_us + ch->period;
+  }
+  // Frames without any report in a long gap are published empty, but no
+  // more than the ring holds.
+  for (size_t n = 0; time_us >= ch->frame_end; n++) {
+    if (n < ch->num_frames) {
+      publish(ch);
+    }
+    ch->frame_end += ch->period;
+  }
+
+  const struct weight_table *table =
+      get_table(ch, center_freq, span_width, bin_pwr_count);
+  if (table == NULL) {
+    return;
+  }
+
+  float mw[MAX_NUM_BINS];
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    mw[bin] = pwr_to_mw[bin_pwr[bin] + 128];
+  }
+
+  for (uint16_t i = 0; i < table->num_chans; i++) {
+    const struct channel_weights *cw = &table->chans[i];
+    const float sum = dot(&table->weights[cw->weight_pos],
+                          &mw[cw->bin_start], cw->bin_count);
+    ch->sum[cw->chan] += (double)sum * weight;
+    ch->count[cw->chan] += weight;
+  }
+}
+
+size_t channelizer_channels(enum channel_grid grid,
+                            const struct channel_info **info) {
+  pthread_once(&channels_once, init_channels);
+  *info = &channels[grid_start[grid]];
+  return grid_start[grid + 1] - grid_start[grid];
+}
+
+// Oldest first, up to max_frames of the most recent frames.
+size_t channelizer_series(const struct channelizer *ch, enum channel_grid grid,
+                          size_t channel, float series[], size_t max_frames) {
+  if (channel >= grid_start[grid + 1] - grid_start[grid]) {
+    return 0;
+  }
+
+  size_t num_frames = ch->num_published < ch->num_frames
+                          ? (size_t)ch->num_published
+                          : ch->num_frames;
+  if (num_frames > max_frames) {
+    num_frames = max_frames;
+  }
+  const size_t idx = grid_start[grid] + channel;
+  for (size_t i = 0; i < num_frames; i++) {
+    const uint64_t frame = ch->num_published - num_frames + i;
+    series[i] = ch->frames[(frame % ch->num_frames) * NUM_CHANS + idx];
+  }
+  return num_frames;
+}
+
+size_t channelizer_latest(const struct channelizer *ch, enum channel_grid grid,
+                          float power[], size_t max_channels) {
+  if (ch->num_published == 0) {
+    return 0;
+  }
+
+  size_t num_chans = grid_start[grid + 1] - grid_start[grid];
+  if (num_chans > max_channels) {
+    num_chans = max_channels;
+  }
+  const float *frame =
+      &ch->frames[((ch->num_published - 1) % ch->num_frames) * NUM_CHANS];
+  memcpy(power, &frame[grid_start[grid]], num_chans * sizeof(float));
+  return num_chans;
+}
@@ -0,0 +1,41 @@
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum channel_grid {
+  GRID_WIFI,
+  GRID_BLUETOOTH,
+  GRID_ZIGBEE,
+  NUM_GRIDS,
+};
+
+// Bluetooth has the most channels of all grids.
+enum { MAX_GRID_CHANNELS = 79 };
+
+struct channel_info {
+  enum channel_grid grid;
+  int number;
+  double freq;
+  double width;
+};
+
+struct channelizer;
+
+struct channelizer *channelizer_create(int64_t period, size_t num_frames);
+void channelizer_destroy(struct channelizer *ch);
+// weight is the number of reports bin_pwr stands for.
+void channelizer_update(struct channelizer *ch, int64_t time_us,
+                        uint16_t center_freq, uint16_t span_width,
+                        uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                        uint32_t weight);
+size_t channelizer_channels(enum channel_grid grid,
+                            const struct channel_info **channels);
+size_t channelizer_series(const struct channelizer *ch, enum channel_grid grid,
+                          size_t channel, float series[], size_t max_frames);
+size_t channelizer_latest(const struct channelizer *ch, enum channel_grid grid,
+                          float power[], size_t max_channels);
+size_t channelizer_memory(const struct channelizer *ch);
+
+#endif
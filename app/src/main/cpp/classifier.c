@@ -0,0 +1,281 @@
+#include <android/log.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "classifier.h"
+#include "trace.h"
+
+#define LOG_TAG "classifier"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { MAX_WORKERS = 4 };
+enum { BATCH_RING_SIZE = 1024 };
+enum { TRACK_RING_SIZE = 4096 };
+enum { MAX_BATCH_TRACKS = 512 };
+
+// Without finished tracks, a batch is still pushed this often so that
+// detectors can age their scores.
+static const int32_t tick_time = 20000;
+
+static const struct detector *const detectors[NUM_DETECTORS] = {
+    [DETECTOR_BLUETOOTH] = &bluetooth_detector,
+    [DETECTOR_ZIGBEE] = &zigbee_detector,
+    [DETECTOR_WIFI] = &wifi_detector,
+    [DETECTOR_MICROWAVE] = &microwave_detector,
+};
+
+struct batch_entry {
+  int32_t tstamp;
+  uint16_t center_freq;
+  uint16_t num_tracks;
+  uint64_t track_seq;
+};
+
+struct detector_slot {
+  const struct detector *det;
+  void *st;
+  bool enabled;
+  bool busy;
+  uint64_t cursor;
+  uint64_t dropped;
+  struct detection result;
+};
+
+struct classifier {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool running;
+  struct batch_entry batches[BATCH_RING_SIZE];
+  uint64_t batch_head;
+  struct track tracks[TRACK_RING_SIZE];
+  uint64_t track_head;
+  int32_t last_tstamp;
+  struct detector_slot slots[NUM_DETECTORS];
+  atomic_uint present;
+  unsigned next_slot;
+  unsigned num_workers;
+  pthread_t workers[MAX_WORKERS];
+};
+
+// The present bit of every detector mirrors its result, so that it can be
+// polled once per report without taking the lock.
+static void set_present(struct classifier *c, struct detector_slot *slot,
+                        bool present) {
+  const unsigned bit = 1u << (slot - c->slots);
+  if (present) {
+    atomic_fetch_or_explicit(&c->present, bit, memory_order_relaxed);
+  } else {
+    atomic_fetch_and_explicit(&c->present, ~bit, memory_order_relaxed);
+  }
+}
+
+static void reset_slot(struct classifier *c, struct detector_slot *slot) {
+  slot->det->reset(slot->st);
+  slot->cursor = c->batch_head;
+  slot->result = (struct detection){.present = false, .pwr = NAN, .freq = NAN};
+  set_present(c, slot, false);
+}
+
+static struct detector_slot *pick_slot(struct classifier *c) {
+  for (unsigned i = 0; i < NUM_DETECTORS; i++) {
+    struct detector_slot *slot = &c->slots[(c->next_slot + i) % NUM_DETECTORS];
+    if (slot->enabled && !slot->busy && slot->cursor < c->batch_head) {
+      c->next_slot = (c->next_slot + i + 1) % NUM_DETECTORS;
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+static void *worker_thread(void *arg) {
+  struct classifier *c = arg;
+  pthread_setname_np(pthread_self(), "classify");
+
+  struct track *tracks = calloc(MAX_BATCH_TRACKS, sizeof(struct track));
+  if (tracks == NULL) {
+    LOGE("Can't allocate worker track buffer");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  while (c->running) {
+    struct detector_slot *slot = pick_slot(c);
+    if (slot == NULL) {
+      pthread_cond_wait(&c->cond, &c->lock);
+      continue;
+    }
+
+    // Skip batches whose entries or tracks have already been overwritten.
+    while (slot->cursor < c->batch_head &&
+           (c->batch_head - slot->cursor > BATCH_RING_SIZE ||
+            c->track_head - c->batches[slot->cursor % BATCH_RING_SIZE]
+                                    .track_seq >
+                TRACK_RING_SIZE)) {
+      slot->cursor++;
+      slot->dropped++;
+    }
+    if (slot->cursor >= c->batch_head) {
+      continue;
+    }
+
+    const struct batch_entry *entry =
+        &c->batches[slot->cursor++ % BATCH_RING_SIZE];
+    for (uint16_t i = 0; i < entry->num_tracks; i++) {
+      tracks[i] = c->tracks[(entry->track_seq + i) % TRACK_RING_SIZE];
+    }
+    const struct track_batch batch = {
+        .tstamp = entry->tstamp,
+        .center_freq = entry->center_freq,
+        .num_tracks = entry->num_tracks,
+        .tracks = tracks,
+    };
+    struct detection result = slot->result;
+    slot->busy = true;
+    pthread_mutex_unlock(&c->lock);
+
+    const int64_t span_start = trace_begin();
+    slot->det->process(slot->st, &batch, &result);
+    trace_end(TRACE_DETECTOR, span_start, slot - c->slots);
+
+    pthread_mutex_lock(&c->lock);
+    slot->busy = false;
+    if (slot->enabled) {
+      slot->result = result;
+      set_present(c, slot, result.present);
+    } else {
+      reset_slot(c, slot);
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  free(tracks);
+
+  return NULL;
+}
+
+struct classifier *classifier_create(unsigned num_workers, unsigned mask) {
+  struct classifier *c = calloc(1, sizeof(struct classifier));
+  if (c == NULL) {
+    LOGE("Can't allocate classifier");
+    return NULL;
+  }
+
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    struct detector_slot *slot = &c->slots[id];
+    slot->det = detectors[id];
+    slot->st = calloc(1, slot->det->state_size);
+    if (slot->st == NULL) {
+      LOGE("Can't allocate %s detector", slot->det->name);
+      for (unsigned i = 0; i < id; i++) {
+        free(c->slots[i].st);
+      }
+      free(c);
+      return NULL;
+    }
+    slot->enabled = (mask & (1u << id)) != 0;
+    reset_slot(c, slot);
+  }
+
+  if (num_workers < 1) {
+    num_workers = 1;
+  } else if (num_workers > MAX_WORKERS) {
+    num_workers = MAX_WORKERS;
+  }
+
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  c->running = true;
+  c->last_tstamp = INT32_MIN;
+  for (c->num_workers = 0; c->num_workers < num_workers; c->num_workers++) {
+    if (pthread_create(&c->workers[c->num_workers], 0, worker_thread, c) !=
+        0) {
+      LOGW("Can't create classifier worker %u", c->num_workers);
+      break;
+    }
+  }
+
+  return c;
+}
+
+void classifier_destroy(struct classifier *c) {
+  if (c == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  c->running = false;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+
+  for (unsigned i = 0; i < c->num_workers; i++) {
+    pthread_join(c->workers[i], NULL);
+  }
+
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    if (c->slots[id].dropped > 0) {
+      LOGI("%s detector dropped %llu batches", c->slots[id].det->name,
+           (unsigned long long)c->slots[id].dropped);
+    }
+    free(c->slots[id].st);
+  }
+
+  pthread_cond_destroy(&c->cond);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
+
+void classifier_enable(struct classifier *c, unsigned mask) {
+  pthread_mutex_lock(&c->lock);
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    struct detector_slot *slot = &c->slots[id];
+    const bool enabled = (mask & (1u << id)) != 0;
+    if (enabled && !slot->enabled && !slot->busy) {
+      reset_slot(c, slot);
+    }
+    slot->enabled = enabled;
+  }
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+void classifier_push(struct classifier *c, int32_t tstamp,
+                     uint16_t center_freq, const struct track tracks[],
+                     uint16_t num_tracks) {
+  if (num_tracks == 0 && tstamp >= c->last_tstamp &&
+      (int64_t)tstamp - c->last_tstamp < tick_time) {
+    return;
+  }
+  c->last_tstamp = tstamp;
+
+  if (num_tracks > MAX_BATCH_TRACKS) {
+    num_tracks = MAX_BATCH_TRACKS;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  struct batch_entry *entry = &c->batches[c->batch_head++ % BATCH_RING_SIZE];
+  entry->tstamp = tstamp;
+  entry->center_freq = center_freq;
+  entry->num_tracks = num_tracks;
+  entry->track_seq = c->track_head;
+  for (uint16_t i = 0; i < num_tracks; i++) {
+    c->tracks[c->track_head++ % TRACK_RING_SIZE] = tracks[i];
+  }
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+void classifier_result(struct classifier *c, enum detector_id id,
+                       struct detection *result) {
+  pthread_mutex_lock(&c->lock);
+  *result = c->slots[id].result;
+  pthread_mutex_unlock(&c->lock);
+}
+
+unsigned classifier_present(struct classifier *c) {
+  return atomic_load_explicit(&c->present, memory_order_relaxed);
+}
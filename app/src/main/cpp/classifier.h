@@ -0,0 +1,67 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A pulse track that has stopped matching new pulses.
+struct track {
+  double center;
+  double bw;
+  double pwr;
+  int32_t tstamp_first;
+  int32_t tstamp_last;
+  int32_t cnt;
+};
+
+struct track_batch {
+  int32_t tstamp;
+  uint16_t center_freq;
+  uint16_t num_tracks;
+  const struct track *tracks;
+};
+
+struct detection {
+  bool present;
+  double pwr;
+  double freq;
+};
+
+// Detectors see every batch in order, one batch at a time, but may run on
+// any worker thread. Their state is only touched through these callbacks.
+struct detector {
+  const char *name;
+  size_t state_size;
+  void (*reset)(void *st);
+  void (*process)(void *st, const struct track_batch *batch,
+                  struct detection *result);
+};
+
+enum detector_id {
+  DETECTOR_BLUETOOTH,
+  DETECTOR_ZIGBEE,
+  DETECTOR_WIFI,
+  DETECTOR_MICROWAVE,
+  NUM_DETECTORS,
+};
+
+extern const struct detector bluetooth_detector;
+extern const struct detector zigbee_detector;
+extern const struct detector wifi_detector;
+extern const struct detector microwave_detector;
+
+struct classifier;
+
+struct classifier *classifier_create(unsigned num_workers, unsigned mask);
+void classifier_destroy(struct classifier *c);
+void classifier_enable(struct classifier *c, unsigned mask);
+void classifier_push(struct classifier *c, int32_t tstamp,
+                     uint16_t center_freq, const struct track tracks[],
+                     uint16_t num_tracks);
+void classifier_result(struct classifier *c, enum detector_id id,
+                       struct detection *result);
+// A mask of the detectors whose latest result is present, by detector_id.
+unsigned classifier_present(struct classifier *c);
+
+#endif
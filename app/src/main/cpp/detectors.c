@@ -0,0 +1,370 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "classifier.h"
+
+enum { PWR_WINDOW_SIZE = 200 };
+
+struct pwr_window {
+  struct {
+    double pwr_total;
+    int32_t length;
+  } entries[PWR_WINDOW_SIZE];
+  size_t start;
+  size_t size;
+  double sum;
+  int32_t length;
+};
+
+static void pwr_window_add(struct pwr_window *w, double pwr, int32_t length,
+                           int32_t max_length) {
+  if (w->size == PWR_WINDOW_SIZE) {
+    w->sum -= w->entries[w->start].pwr_total;
+    w->length -= w->entries[w->start].length;
+    w->start++;
+    w->start %= PWR_WINDOW_SIZE;
+    w->size--;
+  }
+
+  size_t end = w->start + w->size;
+  end %= PWR_WINDOW_SIZE;
+  double pwr_total = pwr * length;
+  w->entries[end].pwr_total = pwr_total;
+  w->entries[end].length = length;
+  w->sum += pwr_total;
+  w->length += length;
+  w->size++;
+
+  while (w->size > 0 && w->length >= max_length) {
+    w->sum -= w->entries[w->start].pwr_total;
+    w->length -= w->entries[w->start].length;
+    w->start++;
+    w->start %= PWR_WINDOW_SIZE;
+    w->size--;
+  }
+}
+
+static double pwr_window_avg(const struct pwr_window *w) {
+  return w->length > 0 ? w->sum / w->length : NAN;
+}
+
+static void decay(int *score, int32_t elapsed) {
+  if (*score > elapsed) {
+    *score -= elapsed;
+  } else {
+    *score = 0;
+  }
+}
+
+// Returns the time elapsed since the previous batch, or 0 if the timestamp
+// went backwards.
+static int32_t advance(int32_t *prev_tstamp, int32_t tstamp) {
+  const int32_t elapsed = tstamp > *prev_tstamp ? tstamp - *prev_tstamp : 0;
+  *prev_tstamp = tstamp;
+  return elapsed;
+}
+
+static double track_length(const struct track *t) {
+  return t->tstamp_last - t->tstamp_first;
+}
+
+// Width of a flat-topped signal whose power-weighted spread is `bw`.
+static double occupied_width(const struct track *t) { return t->bw * sqrt(3); }
+
+enum { NUM_BT_CHANS = 79 };
+
+struct bluetooth_state {
+  int32_t prev_tstamp;
+  int non_bt_score[NUM_BT_CHANS];
+  int last_bt_chan;
+  int bt_score;
+  struct pwr_window window;
+};
+
+static void bluetooth_reset(void *arg) {
+  struct bluetooth_state *st = arg;
+  memset(st, 0, sizeof(*st));
+  st->prev_tstamp = INT32_MAX;
+  st->last_bt_chan = -1;
+}
+
+static void bluetooth_process(void *arg, const struct track_batch *batch,
+                              struct detection *result) {
+  static const int32_t bt_max_window_length = 20000;
+  struct bluetooth_state *st = arg;
+
+  const int32_t elapsed = advance(&st->prev_tstamp, batch->tstamp);
+  for (int bt_chan = 0; bt_chan < NUM_BT_CHANS; bt_chan++) {
+    decay(&st->non_bt_score[bt_chan], elapsed);
+  }
+  decay(&st->bt_score, elapsed);
+
+  for (uint16_t idx = 0; idx < batch->num_tracks; idx++) {
+    const struct track *t = &batch->tracks[idx];
+    int32_t length = t->tstamp_last - t->tstamp_first;
+    int bt_chan_center = (int)round(t->center - 2402);
+    int bt_chan_start = (int)round(t->center - t->bw / 2 - 2402);
+    int bt_chan_end = (int)round(t->center + t->bw / 2 - 2402) + 1;
+
+    if (bt_chan_start < 0) {
+      bt_chan_start = 0;
+    }
+    if (bt_chan_end > NUM_BT_CHANS) {
+      bt_chan_end = NUM_BT_CHANS;
+    }
+
+    if (t->bw > 2) {
+      for (int bt_chan = bt_chan_start; bt_chan < bt_chan_end; bt_chan++) {
+        st->non_bt_score[bt_chan] = 2500;
+      }
+    } else if (length > 150 && length < 3750 && t->bw > 0.5 && t->bw < 1 &&
+               bt_chan_center >= 0 && bt_chan_center < NUM_BT_CHANS &&
+               st->non_bt_score[bt_chan_center] <= 0 &&
+               bt_chan_center != st->last_bt_chan) {
+      st->last_bt_chan = bt_chan_center;
+      st->bt_score += length * 100;
+      if (st->bt_score > 2000000) {
+        st->bt_score = 2000000;
+      }
+      pwr_window_add(&st->window, t->pwr, length, bt_max_window_length);
+    }
+  }
+
+  result->present = st->bt_score >= 1000000;
+  result->pwr = result->present ? pwr_window_avg(&st->window) : NAN;
+  result->freq = result->present ? 2402.0 + st->last_bt_chan : NAN;
+}
+
+const struct detector bluetooth_detector = {
+    .name = "Bluetooth",
+    .state_size = sizeof(struct bluetooth_state),
+    .reset = bluetooth_reset,
+    .process = bluetooth_process,
+};
+
+// IEEE 802.15.4 channels 11 to 26 sit at 2405 + 5 * (k - 11) MHz, which is
+// every fifth Bluetooth channel starting from the fourth.
+enum { NUM_ZB_CHANS = 16 };
+
+struct zigbee_state {
+  int32_t prev_tstamp;
+  int non_zb_score[NUM_ZB_CHANS];
+  int zb_score[NUM_ZB_CHANS];
+  struct pwr_window window;
+};
+
+static void zigbee_reset(void *arg) {
+  struct zigbee_state *st = arg;
+  memset(st, 0, sizeof(*st));
+  st->prev_tstamp = INT32_MAX;
+}
+
+static void zigbee_process(void *arg, const struct track_batch *batch,
+                           struct detection *result) {
+  static const int32_t zb_max_window_length = 50000;
+  struct zigbee_state *st = arg;
+
+  const int32_t elapsed = advance(&st->prev_tstamp, batch->tstamp);
+  for (int zb_chan = 0; zb_chan < NUM_ZB_CHANS; zb_chan++) {
+    decay(&st->non_zb_score[zb_chan], elapsed);
+    decay(&st->zb_score[zb_chan], elapsed);
+  }
+
+  for (uint16_t idx = 0; idx < batch->num_tracks; idx++) {
+    const struct track *t = &batch->tracks[idx];
+    int32_t length = t->tstamp_last - t->tstamp_first;
+    int bt_chan_center = (int)round(t->center - 2402);
+    int bt_chan_start = (int)round(t->center - t->bw / 2 - 2402);
+    int bt_chan_end = (int)round(t->center + t->bw / 2 - 2402) + 1;
+
+    if (bt_chan_start < 0) {
+      bt_chan_start = 0;
+    }
+    if (bt_chan_end > NUM_BT_CHANS) {
+      bt_chan_end = NUM_BT_CHANS;
+    }
+
+    if (t->bw < 1 || t->bw > 2) {
+      for (int bt_chan = bt_chan_start; bt_chan < bt_chan_end; bt_chan++) {
+        if (bt_chan % 5 == 3) {
+          st->non_zb_score[bt_chan / 5] = 2500;
+        }
+      }
+    } else if (length > 150 && length < 6250 && bt_chan_center % 5 == 3 &&
+               bt_chan_center / 5 >= 0 && bt_chan_center / 5 < NUM_ZB_CHANS &&
+               st->non_zb_score[bt_chan_center / 5] <= 0) {
+      const int zb_chan = bt_chan_center / 5;
+      st->zb_score[zb_chan] += length * 100;
+      if (st->zb_score[zb_chan] > 2000000) {
+        st->zb_score[zb_chan] = 2000000;
+      }
+      pwr_window_add(&st->window, t->pwr, length, zb_max_window_length);
+    }
+  }
+
+  // ZigBee does not hop, so unlike Bluetooth the evidence has to pile up on
+  // a single channel.
+  int best_chan = -1;
+  for (int zb_chan = 0; zb_chan < NUM_ZB_CHANS; zb_chan++) {
+    if (best_chan < 0 || st->zb_score[zb_chan] > st->zb_score[best_chan]) {
+      best_chan = zb_chan;
+    }
+  }
+
+  result->present = st->zb_score[best_chan] >= 1000000;
+  result->pwr = result->present ? pwr_window_avg(&st->window) : NAN;
+  result->freq = result->present ? 2405.0 + 5 * best_chan : NAN;
+}
+
+const struct detector zigbee_detector = {
+    .name = "ZigBee",
+    .state_size = sizeof(struct zigbee_state),
+    .reset = zigbee_reset,
+    .process = zigbee_process,
+};
+
+enum { WIFI_WIDTH_20, WIFI_WIDTH_40, NUM_WIFI_WIDTHS };
+
+struct wifi_state {
+  int32_t prev_tstamp;
+  int score[NUM_WIFI_WIDTHS];
+  double last_freq[NUM_WIFI_WIDTHS];
+  struct pwr_window window;
+};
+
+static void wifi_reset(void *arg) {
+  struct wifi_state *st = arg;
+  memset(st, 0, sizeof(*st));
+  st->prev_tstamp = INT32_MAX;
+}
+
+static double wifi_chan_freq(double center) {
+  if (center < 3000) {
+    return 2407 + 5 * round((center - 2407) / 5);
+  }
+  return 5000 + 5 * round((center - 5000) / 5);
+}
+
+static void wifi_process(void *arg, const struct track_batch *batch,
+                         struct detection *result) {
+  // A single PPDU lasts at most 5.484 ms.
+  static const double max_burst_length = 5500;
+  static const int32_t wifi_max_window_length = 50000;
+  struct wifi_state *st = arg;
+
+  const int32_t elapsed = advance(&st->prev_tstamp, batch->tstamp);
+  for (int width = 0; width < NUM_WIFI_WIDTHS; width++) {
+    decay(&st->score[width], elapsed);
+  }
+
+  for (uint16_t idx = 0; idx < batch->num_tracks; idx++) {
+    const struct track *t = &batch->tracks[idx];
+    const double occupied = occupied_width(t);
+    const double length = track_length(t);
+    if (length > max_burst_length) {
+      continue;
+    }
+
+    int width;
+    if (occupied >= 14 && occupied <= 24) {
+      width = WIFI_WIDTH_20;
+    } else if (occupied >= 30 && occupied <= 44) {
+      width = WIFI_WIDTH_40;
+    } else {
+      continue;
+    }
+
+    st->score[width] += 20000;
+    if (st->score[width] > 400000) {
+      st->score[width] = 400000;
+    }
+    st->last_freq[width] = wifi_chan_freq(t->center);
+    pwr_window_add(&st->window, t->pwr, (int32_t)length + 1,
+                   wifi_max_window_length);
+  }
+
+  const int width = st->score[WIFI_WIDTH_40] > st->score[WIFI_WIDTH_20]
+                        ? WIFI_WIDTH_40
+                        : WIFI_WIDTH_20;
+  result->present = st->score[width] >= 100000;
+  result->pwr = result->present ? pwr_window_avg(&st->window) : NAN;
+  result->freq = result->present ? st->last_freq[width] : NAN;
+}
+
+const struct detector wifi_detector = {
+    .name = "Wi-Fi",
+    .state_size = sizeof(struct wifi_state),
+    .reset = wifi_reset,
+    .process = wifi_process,
+};
+
+// Magnetrons run off unfiltered mains, so they emit in bursts of a few
+// milliseconds that repeat every 16.7 ms (60 Hz) or 20 ms (50 Hz).
+struct microwave_state {
+  int32_t prev_tstamp;
+  int32_t last_start;
+  bool has_last_start;
+  int score;
+  double last_freq;
+  struct pwr_window window;
+};
+
+static void microwave_reset(void *arg) {
+  struct microwave_state *st = arg;
+  memset(st, 0, sizeof(*st));
+  st->prev_tstamp = INT32_MAX;
+}
+
+static bool is_mains_period(int32_t interval) {
+  static const int32_t periods[] = {16667, 20000, 33333, 40000};
+  static const int32_t tolerance = 1500;
+  for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+    if (interval > periods[i] - tolerance && interval < periods[i] + tolerance) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void microwave_process(void *arg, const struct track_batch *batch,
+                              struct detection *result) {
+  static const int32_t mw_max_window_length = 200000;
+  struct microwave_state *st = arg;
+
+  const int32_t elapsed = advance(&st->prev_tstamp, batch->tstamp);
+  decay(&st->score, elapsed);
+
+  for (uint16_t idx = 0; idx < batch->num_tracks; idx++) {
+    const struct track *t = &batch->tracks[idx];
+    const double length = track_length(t);
+    if (t->center < 2430 || t->center > 2480 || t->bw <= 2 || length < 2000 ||
+        length > 12000) {
+      continue;
+    }
+
+    if (st->has_last_start && is_mains_period(t->tstamp_first - st->last_start)) {
+      st->score += 200000;
+      if (st->score > 2000000) {
+        st->score = 2000000;
+      }
+      st->last_freq = t->center;
+      pwr_window_add(&st->window, t->pwr, (int32_t)length,
+                     mw_max_window_length);
+    }
+    st->last_start = t->tstamp_first;
+    st->has_last_start = true;
+  }
+
+  result->present = st->score >= 1000000;
+  result->pwr = result->present ? pwr_window_avg(&st->window) : NAN;
+  result->freq = result->present ? st->last_freq : NAN;
+}
+
+const struct detector microwave_detector = {
+    .name = "Microwave",
+    .state_size = sizeof(struct microwave_state),
+    .reset = microwave_reset,
+    .process = microwave_process,
+};
@@ -0,0 +1,35 @@
+#ifndef EXPORT_PROTOCOL_H
+#define EXPORT_PROTOCOL_H
+
+#include <stdint.h>
+
+// The exporter sends reports in batches, one batch per UDP datagram or
+// back to back on a TCP stream. A batch is a header and a bit stream with,
+// for each row, its center frequency (16 bits), bin count (12 bits) and
+// hop tag flags (3 bits), followed by the row coded with row_codec_encode.
+// Time deltas are from the previous row of the batch, or from base_tstamp
+// for the first. Rows are coded against the previous row of the batch
+// with the same center frequency and bin count, of which the last
+// EXPORT_MAX_CHANNELS are kept, so that every batch decodes on its own.
+// A squelch summary (HOP_TAG_SUMMARY) has the number of reports it stands
+// for (16 bits) before its row of maxima, and its row of means after,
+// coded against the maxima with a time delta of 0.
+enum { EXPORT_MAGIC = 0x78707365 };
+enum { EXPORT_VERSION = 3 };
+enum { EXPORT_FLAG_BITS = 3 };
+enum { EXPORT_MAX_CHANNELS = 4 };
+enum { EXPORT_MAX_PACKET = 60000 };
+
+struct export_batch {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t num_rows;
+  uint32_t device_id;
+  uint32_t seq;
+  uint32_t first_report;
+  int32_t base_tstamp;
+  uint32_t payload_len;
+  uint32_t reserved;
+};
+
+#endif
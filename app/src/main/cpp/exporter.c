@@ -0,0 +1,326 @@
+#include <android/log.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "export-protocol.h"
+#include "exporter.h"
+#include "row-codec.h"
+
+#define LOG_TAG "exporter"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// Reconnecting backs off exponentially between these.
+static const int64_t min_backoff = 100000;
+static const int64_t max_backoff = 5000000;
+
+// A collector that accepts nothing for this long loses the connection, and
+// the batch being sent is lost.
+static const int send_timeout_ms = 1000;
+
+struct channel {
+  bool used;
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  int8_t prev[MAX_NUM_BINS];
+};
+
+struct exporter {
+  struct exporter_config config;
+  int fd;
+  int64_t next_connect;
+  int64_t backoff;
+  struct export_batch header;
+  struct bit_writer bw;
+  int64_t batch_start;
+  int32_t last_tstamp;
+  struct channel channels[EXPORT_MAX_CHANNELS];
+  uint64_t clock;
+  uint32_t seq;
+  struct exporter_stats stats;
+  uint8_t packet[sizeof(struct export_batch) + EXPORT_MAX_PACKET];
+};
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool exporter_parse_url(const char *url, struct exporter_config *config) {
+  if (strncmp(url, "tcp://", 6) == 0) {
+    config->transport = EXPORT_TCP;
+  } else if (strncmp(url, "udp://", 6) == 0) {
+    config->transport = EXPORT_UDP;
+  } else {
+    return false;
+  }
+
+  const char *host = url + 6;
+  const char *sep = strrchr(host, ':');
+  if (sep == NULL || sep == host || sep[1] == '\0') {
+    return false;
+  }
+  size_t host_len = (size_t)(sep - host);
+  if (host[0] == '[' && sep[-1] == ']') {
+    host++;
+    host_len -= 2;
+  }
+  if (host_len >= sizeof(config->host) ||
+      strlen(sep + 1) >= sizeof(config->port)) {
+    return false;
+  }
+  memcpy(config->host, host, host_len);
+  config->host[host_len] = '\0';
+  strlcpy(config->port, sep + 1, sizeof(config->port));
+  return true;
+}
+
+static void disconnect(struct exporter *ex) {
+  if (ex->fd >= 0) {
+    close(ex->fd);
+    ex->fd = -1;
+  }
+  ex->backoff = ex->backoff > 0 ? ex->backoff * 2 : min_backoff;
+  if (ex->backoff > max_backoff) {
+    ex->backoff = max_backoff;
+  }
+  ex->next_connect = now_us() + ex->backoff;
+}
+
+static void try_connect(struct exporter *ex) {
+  if (ex->fd >= 0 || now_us() < ex->next_connect) {
+    return;
+  }
+
+  const struct addrinfo hints = {
+      .ai_socktype =
+          ex->config.transport == EXPORT_TCP ? SOCK_STREAM : SOCK_DGRAM,
+  };
+  struct addrinfo *res;
+  const int rc = getaddrinfo(ex->config.host, ex->config.port, &hints, &res);
+  if (rc != 0) {
+    LOGW("Can't resolve %s: %s", ex->config.host, gai_strerror(rc));
+    disconnect(ex);
+    return;
+  }
+
+  for (const struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+    ex->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (ex->fd < 0) {
+      continue;
+    }
+    const struct timeval timeout = {
+        .tv_sec = send_timeout_ms / 1000,
+        .tv_usec = send_timeout_ms % 1000 * 1000,
+    };
+    setsockopt(ex->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(ex->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(ex->fd);
+    ex->fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (ex->fd < 0) {
+    LOGW("Can't connect to %s:%s: %s", ex->config.host, ex->config.port,
+         strerror(errno));
+    disconnect(ex);
+    return;
+  }
+
+  LOGI("Exporting to %s:%s", ex->config.host, ex->config.port);
+  ex->backoff = 0;
+  ex->stats.num_connects++;
+}
+
+struct exporter *exporter_open(const struct exporter_config *config) {
+  struct exporter *ex = calloc(1, sizeof(struct exporter));
+  if (ex == NULL) {
+    LOGE("Can't allocate exporter");
+    return NULL;
+  }
+  ex->config = *config;
+  if (ex->config.max_rows == 0) {
+    ex->config.max_rows = UINT16_MAX;
+  }
+  ex->fd = -1;
+  ex->bw.buf = ex->packet + sizeof(struct export_batch);
+  try_connect(ex);
+  return ex;
+}
+
+void exporter_close(struct exporter *ex, struct exporter_stats *stats) {
+  if (ex == NULL) {
+    return;
+  }
+  exporter_flush(ex);
+  if (ex->fd >= 0) {
+    close(ex->fd);
+  }
+  if (stats != NULL) {
+    *stats = ex->stats;
+  }
+  free(ex);
+}
+
+static bool send_batch(struct exporter *ex, size_t len) {
+  try_connect(ex);
+  if (ex->fd < 0) {
+    return false;
+  }
+
+  // A short write leaves the stream out of frame, so TCP reconnects on any
+  // failure. A UDP datagram is either sent or not.
+  size_t pos = 0;
+  while (pos < len) {
+    const ssize_t n = send(ex->fd, ex->packet + pos, len - pos, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      if (ex->config.transport == EXPORT_TCP) {
+        LOGW("Can't send to %s:%s: %s", ex->config.host, ex->config.port,
+             strerror(errno));
+        disconnect(ex);
+      }
+      return false;
+    }
+    pos += (size_t)n;
+  }
+  return true;
+}
+
+void exporter_flush(struct exporter *ex) {
+  if (ex->header.num_rows == 0) {
+    return;
+  }
+
+  flush_bits(&ex->bw);
+  ex->header.magic = EXPORT_MAGIC;
+  ex->header.version = EXPORT_VERSION;
+  ex->header.device_id = ex->config.device_id;
+  ex->header.seq = ex->seq++;
+  ex->header.payload_len = (uint32_t)ex->bw.pos;
+  memcpy(ex->packet, &ex->header, sizeof(ex->header));
+
+  const size_t len = sizeof(ex->header) + ex->bw.pos;
+  if (send_batch(ex, len)) {
+    ex->stats.num_batches++;
+    ex->stats.num_bytes += (int64_t)len;
+  } else {
+    ex->stats.num_lost++;
+  }
+
+  ex->header.num_rows = 0;
+  ex->bw.pos = 0;
+  ex->bw.acc = 0;
+  ex->bw.num_bits = 0;
+}
+
+static struct channel *find_channel(struct exporter *ex, uint16_t center_freq,
+                                    uint16_t bin_pwr_count, bool *first) {
+  struct channel *victim = &ex->channels[0];
+  for (size_t idx = 0; idx < EXPORT_MAX_CHANNELS; idx++) {
+    struct channel *ch = &ex->channels[idx];
+    if (ch->used && ch->center_freq == center_freq &&
+        ch->bin_pwr_count == bin_pwr_count) {
+      *first = false;
+      return ch;
+    }
+    if (!ch->used || (victim->used && ch->last_used < victim->last_used)) {
+      victim = ch;
+    }
+  }
+
+  victim->used = true;
+  victim->center_freq = center_freq;
+  victim->bin_pwr_count = bin_pwr_count;
+  *first = true;
+  return victim;
+}
+
+// Sends the batch once batch_us has passed since it started, when no report
+// came along to do so.
+void exporter_tick(struct exporter *ex) {
+  if (ex->header.num_rows > 0 &&
+      now_us() - ex->batch_start >= ex->config.batch_us) {
+    exporter_flush(ex);
+  }
+}
+
+// Batches are sent once full, on the first report after batch_us has passed
+// since the batch started, or by exporter_tick. Only the first segment of a
+// report is exported, and of a summary its maxima and means.
+void exporter_push(struct exporter *ex, uint32_t seq,
+                   const struct report_view *report,
+                   const struct hop_tag *tag) {
+  const int32_t tstamp = report->tstamp;
+  const uint16_t center_freq = report->segments[0].center_freq;
+  const uint16_t bin_pwr_count = report->segments[0].bin_pwr_count;
+  const int8_t *bin_pwr = report->segments[0].bin_pwr;
+  const uint32_t flags = tag != NULL ? tag->flags : 0;
+  const int8_t *mean_pwr = NULL;
+  if (flags & HOP_TAG_SUMMARY) {
+    mean_pwr = report_summary_mean(report, report->len);
+    if (mean_pwr == NULL) {
+      return;
+    }
+  }
+  const size_t max_size =
+      6 + (mean_pwr != NULL ? 2 : 1) * row_codec_max_size(bin_pwr_count);
+
+  const int32_t delta =
+      (int32_t)((uint32_t)tstamp - (uint32_t)ex->last_tstamp);
+  if (ex->header.num_rows > 0 &&
+      (delta < 0 || now_us() - ex->batch_start >= ex->config.batch_us ||
+       ex->bw.pos + max_size > EXPORT_MAX_PACKET)) {
+    exporter_flush(ex);
+  }
+
+  if (ex->header.num_rows == 0) {
+    ex->header.first_report = seq;
+    ex->header.base_tstamp = tstamp;
+    ex->last_tstamp = tstamp;
+    ex->batch_start = now_us();
+    for (size_t idx = 0; idx < EXPORT_MAX_CHANNELS; idx++) {
+      ex->channels[idx].used = false;
+    }
+  }
+
+  bool first;
+  struct channel *ch = find_channel(ex, center_freq, bin_pwr_count, &first);
+  ch->last_used = ++ex->clock;
+
+  put_bits(&ex->bw, center_freq, 16);
+  put_bits(&ex->bw, bin_pwr_count, 12);
+  put_bits(&ex->bw, flags & ((1u << EXPORT_FLAG_BITS) - 1), EXPORT_FLAG_BITS);
+  if (mean_pwr != NULL) {
+    put_bits(&ex->bw,
+             tag->num_squelched < UINT16_MAX ? tag->num_squelched
+                                             : UINT16_MAX,
+             16);
+  }
+  row_codec_encode(&ex->bw, (uint32_t)tstamp - (uint32_t)ex->last_tstamp,
+                   bin_pwr, ch->prev, bin_pwr_count, first);
+  memcpy(ch->prev, bin_pwr, bin_pwr_count);
+  if (mean_pwr != NULL) {
+    row_codec_encode(&ex->bw, 0, mean_pwr, bin_pwr, bin_pwr_count, false);
+  }
+  ex->last_tstamp = tstamp;
+  ex->header.num_rows++;
+  ex->stats.num_reports++;
+
+  if (ex->header.num_rows >= ex->config.max_rows) {
+    exporter_flush(ex);
+  }
+}
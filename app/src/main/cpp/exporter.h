@@ -0,0 +1,44 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spectral-report.h"
+
+enum export_transport {
+  EXPORT_TCP,
+  EXPORT_UDP,
+};
+
+struct exporter_config {
+  enum export_transport transport;
+  char host[64];
+  char port[8];
+  uint32_t device_id;
+  int64_t batch_us;
+  uint16_t max_rows;
+};
+
+struct exporter_stats {
+  int64_t num_reports;
+  int64_t num_batches;
+  int64_t num_bytes;
+  int64_t num_lost;
+  int64_t num_connects;
+};
+
+struct exporter;
+
+// Parses tcp://host:port or udp://host:port.
+bool exporter_parse_url(const char *url, struct exporter_config *config);
+struct exporter *exporter_open(const struct exporter_config *config);
+void exporter_close(struct exporter *ex, struct exporter_stats *stats);
+void exporter_push(struct exporter *ex, uint32_t seq,
+                   const struct report_view *report,
+                   const struct hop_tag *tag);
+void exporter_flush(struct exporter *ex);
+void exporter_tick(struct exporter *ex);
+
+#endif
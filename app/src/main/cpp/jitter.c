@@ -0,0 +1,147 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "jitter.h"
+
+void jitter_init(struct jitter *j, int64_t intended_us) {
+  j->intended_us = intended_us;
+  atomic_init(&j->count, 0);
+  atomic_init(&j->early, 0);
+  atomic_init(&j->sum_us, 0);
+  atomic_init(&j->min_us, INT64_MAX);
+  atomic_init(&j->max_us, 0);
+  for (int idx = 0; idx < JITTER_BUCKETS; idx++) {
+    atomic_init(&j->buckets[idx], 0);
+  }
+}
+
+static int bucket_of(int64_t deviation_us) {
+  int bucket = 0;
+  while (bucket < JITTER_BUCKETS - 1 &&
+         deviation_us >= (int64_t)JITTER_BASE_US << bucket) {
+    bucket++;
+  }
+  return bucket;
+}
+
+// Only the recording thread writes, so plain stores of updated values
+// suffice and readers see each field whole.
+void jitter_record(struct jitter *j, int64_t actual_us) {
+  const int64_t deviation_us = actual_us - j->intended_us;
+  atomic_int_least64_t *bucket =
+      &j->buckets[bucket_of(deviation_us < 0 ? -deviation_us : deviation_us)];
+  atomic_store_explicit(
+      bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  if (deviation_us < 0) {
+    atomic_store_explicit(
+        &j->early, atomic_load_explicit(&j->early, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+  }
+  atomic_store_explicit(
+      &j->sum_us,
+      atomic_load_explicit(&j->sum_us, memory_order_relaxed) + actual_us,
+      memory_order_relaxed);
+  if (actual_us < atomic_load_explicit(&j->min_us, memory_order_relaxed)) {
+    atomic_store_explicit(&j->min_us, actual_us, memory_order_relaxed);
+  }
+  if (actual_us > atomic_load_explicit(&j->max_us, memory_order_relaxed)) {
+    atomic_store_explicit(&j->max_us, actual_us, memory_order_relaxed);
+  }
+  atomic_store_explicit(
+      &j->count, atomic_load_explicit(&j->count, memory_order_relaxed) + 1,
+      memory_order_release);
+}
+
+void jitter_read(const struct jitter *j, struct jitter_stats *stats) {
+  stats->intended_us = j->intended_us;
+  stats->count = atomic_load_explicit(&j->count, memory_order_acquire);
+  stats->early = atomic_load_explicit(&j->early, memory_order_relaxed);
+  stats->sum_us = atomic_load_explicit(&j->sum_us, memory_order_relaxed);
+  stats->min_us = atomic_load_explicit(&j->min_us, memory_order_relaxed);
+  stats->max_us = atomic_load_explicit(&j->max_us, memory_order_relaxed);
+  for (int idx = 0; idx < JITTER_BUCKETS; idx++) {
+    stats->buckets[idx] =
+        atomic_load_explicit(&j->buckets[idx], memory_order_relaxed);
+  }
+}
+
+int64_t jitter_percentile(const struct jitter_stats *stats, double fraction) {
+  int64_t total = 0;
+  for (int idx = 0; idx < JITTER_BUCKETS; idx++) {
+    total += stats->buckets[idx];
+  }
+  int64_t seen = 0;
+  for (int idx = 0; idx < JITTER_BUCKETS - 1; idx++) {
+    seen += stats->buckets[idx];
+    if ((double)seen >= fraction * (double)total) {
+      return (int64_t)JITTER_BASE_US << idx;
+    }
+  }
+  return -1;
+}
+
+// Appends to buf, which stays terminated once it runs out of room.
+static void append(char *buf, size_t size, size_t *len, const char *format,
+                   ...) {
+  if (*len >= size) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  const int n = vsnprintf(buf + *len, size - *len, format, args);
+  va_end(args);
+  *len = n < 0 ? size : *len + (size_t)n;
+}
+
+static void append_percentile(char *buf, size_t size, size_t *len,
+                              const struct jitter_stats *stats,
+                              const char *name, double fraction) {
+  const int64_t bound = jitter_percentile(stats, fraction);
+  if (bound >= 0) {
+    append(buf, size, len, ", %s within %" PRId64 " us", name, bound);
+  } else {
+    append(buf, size, len, ", %s beyond %" PRId64 " us", name,
+           (int64_t)JITTER_BASE_US << (JITTER_BUCKETS - 2));
+  }
+}
+
+void jitter_format(const struct jitter_stats *stats, bool histogram,
+                   char *buf, size_t size) {
+  size_t len = 0;
+  if (size == 0) {
+    return;
+  }
+  buf[0] = '\0';
+  if (stats->count == 0) {
+    append(buf, size, &len, "no intervals of %" PRId64 " us",
+           stats->intended_us);
+    return;
+  }
+
+  append(buf, size, &len,
+         "%" PRId64 " intervals of %" PRId64 " us: mean %" PRId64
+         " us, min %" PRId64 " us, max %" PRId64 " us, %" PRId64 " early",
+         stats->count, stats->intended_us, stats->sum_us / stats->count,
+         stats->min_us, stats->max_us, stats->early);
+  append_percentile(buf, size, &len, stats, "50%", 0.5);
+  append_percentile(buf, size, &len, stats, "99%", 0.99);
+  if (!histogram) {
+    return;
+  }
+
+  append(buf, size, &len, ";");
+  for (int idx = 0; idx < JITTER_BUCKETS; idx++) {
+    if (stats->buckets[idx] == 0) {
+      continue;
+    }
+    if (idx < JITTER_BUCKETS - 1) {
+      append(buf, size, &len, " <%" PRId64 ":%" PRId64,
+             (int64_t)JITTER_BASE_US << idx, stats->buckets[idx]);
+    } else {
+      append(buf, size, &len, " >=%" PRId64 ":%" PRId64,
+             (int64_t)JITTER_BASE_US << (idx - 1), stats->buckets[idx]);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Histogram of how far the actual intervals of a periodic task, such as the
+// dwell of a spectral scan or the period of the channel hops, are from the
+// intended interval. Bucket 0 counts deviations of less than JITTER_BASE_US
+// either way, bucket n those up to JITTER_BASE_US << n, and the last bucket
+// everything beyond. Recorded by one thread and read by any.
+enum { JITTER_BUCKETS = 16 };
+enum { JITTER_BASE_US = 16 };
+
+struct jitter {
+  int64_t intended_us;
+  atomic_int_least64_t count;
+  atomic_int_least64_t early;
+  atomic_int_least64_t sum_us;
+  atomic_int_least64_t min_us;
+  atomic_int_least64_t max_us;
+  atomic_int_least64_t buckets[JITTER_BUCKETS];
+};
+
+// min_us, max_us and sum_us are of the actual intervals, and early counts
+// those shorter than intended.
+struct jitter_stats {
+  int64_t intended_us;
+  int64_t count;
+  int64_t early;
+  int64_t sum_us;
+  int64_t min_us;
+  int64_t max_us;
+  int64_t buckets[JITTER_BUCKETS];
+};
+
+void jitter_init(struct jitter *j, int64_t intended_us);
+void jitter_record(struct jitter *j, int64_t actual_us);
+void jitter_read(const struct jitter *j, struct jitter_stats *stats);
+// Returns the deviation in microseconds that at least fraction of the
+// intervals stay within, rounded up to a bucket bound, or -1 past the last
+// bound.
+int64_t jitter_percentile(const struct jitter_stats *stats, double fraction);
+// Formats the intervals and their percentiles, and with histogram also the
+// non-empty buckets, for the log.
+void jitter_format(const struct jitter_stats *stats, bool histogram,
+                   char *buf, size_t size);
+
+#endif
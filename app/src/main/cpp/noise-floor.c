@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "noise-floor.h"
+#include "spectral-report.h"
+
+// One table per channel visited, evicted least recently used.
+enum { MAX_FLOOR_TABLES = 32 };
+
+// Moving up by 1/9 of the step down makes each floor settle where one in
+// ten samples lies below it, i.e. on the 10th percentile of the bin.
+static const int floor_step_up = 7;
+static const int floor_step_down = 63;
+
+struct floor_table {
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  int16_t floor[MAX_NUM_BINS];
+};
+
+struct noise_floor {
+  struct floor_table tables[MAX_FLOOR_TABLES];
+  size_t num_tables;
+  size_t last_table;
+  uint64_t clock;
+};
+
+struct noise_floor *noise_floor_create(void) {
+  return calloc(1, sizeof(struct noise_floor));
+}
+
+void noise_floor_destroy(struct noise_floor *nf) { free(nf); }
+
+size_t noise_floor_memory(void) { return sizeof(struct noise_floor); }
+
+static struct floor_table *find_table(struct noise_floor *nf,
+                                      uint16_t center_freq,
+                                      uint16_t bin_pwr_count, bool *fresh) {
+  struct floor_table *table = &nf->tables[nf->last_table];
+  if (nf->num_tables > 0 && table->center_freq == center_freq &&
+      table->bin_pwr_count == bin_pwr_count) {
+    *fresh = false;
+    return table;
+  }
+
+  size_t victim = 0;
+  for (size_t idx = 0; idx < nf->num_tables; idx++) {
+    table = &nf->tables[idx];
+    if (table->center_freq == center_freq &&
+        table->bin_pwr_count == bin_pwr_count) {
+      nf->last_table = idx;
+      *fresh = false;
+      return table;
+    }
+    if (table->last_used < nf->tables[victim].last_used) {
+      victim = idx;
+    }
+  }
+
+  if (nf->num_tables < MAX_FLOOR_TABLES) {
+    victim = nf->num_tables++;
+  }
+
+  table = &nf->tables[victim];
+  table->center_freq = center_freq;
+  table->bin_pwr_count = bin_pwr_count;
+  nf->last_table = victim;
+  *fresh = true;
+  return table;
+}
+
+const int16_t *noise_floor_update(struct noise_floor *nf, uint16_t center_freq,
+                                  uint16_t bin_pwr_count,
+                                  const int8_t bin_pwr[], uint32_t weight) {
+  bool fresh;
+  struct floor_table *table =
+      find_table(nf, center_freq, bin_pwr_count, &fresh);
+  table->last_used = ++nf->clock;
+
+  int16_t *const floor = table->floor;
+  if (fresh) {
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      floor[bin] = (int16_t)(bin_pwr[bin] * (1 << NOISE_FLOOR_SHIFT));
+    }
+    return floor;
+  }
+
+  // Branch-free so that the compiler turns it into SIMD compares and
+  // selects. Clamping the step down at the sample keeps the floor in range,
+  // and so does clamping the step up once it spans several reports.
+  const int steps = weight < UINT16_MAX ? (int)weight : UINT16_MAX;
+  const int step_up = floor_step_up * steps;
+  const int step_down = floor_step_down * steps;
+  if (steps == 1) {
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      const int x = bin_pwr[bin] * (1 << NOISE_FLOOR_SHIFT);
+      const int up = floor[bin] + floor_step_up;
+      const int down = floor[bin] - floor_step_down;
+      floor[bin] = (int16_t)(x > floor[bin] ? up : down > x ? down : x);
+    }
+    return floor;
+  }
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int x = bin_pwr[bin] * (1 << NOISE_FLOOR_SHIFT);
+    const int up = floor[bin] + step_up;
+    const int down = floor[bin] - step_down;
+    floor[bin] = (int16_t)(x > floor[bin] ? (up < x ? up : x)
+                           : down > x     ? down
+                                          : x);
+  }
+
+  return floor;
+}
+
+// Highest excess of a bin over its floor, in 1/256 dB, as a cheap test for
+// whether a report holds anything but noise.
+int noise_floor_peak(const int16_t floor[], uint16_t bin_pwr_count,
+                     const int8_t bin_pwr[]) {
+  int peak = INT16_MIN;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int excess = bin_pwr[bin] * (1 << NOISE_FLOOR_SHIFT) - floor[bin];
+    peak = excess > peak ? excess : peak;
+  }
+  return peak;
+}
+
+void noise_floor_thresholds(const int16_t floor[], uint16_t bin_pwr_count,
+                            double margin, double thres[]) {
+  const double scale = 1.0 / (1 << NOISE_FLOOR_SHIFT);
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    thres[bin] = floor[bin] * scale + margin;
+  }
+}
+
+uint16_t noise_floor_trace(const struct noise_floor *nf, uint16_t center_freq,
+                           float trace[], uint16_t max_bins) {
+  const struct floor_table *best = NULL;
+  for (size_t idx = 0; idx < nf->num_tables; idx++) {
+    const struct floor_table *table = &nf->tables[idx];
+    if (table->center_freq == center_freq &&
+        (best == NULL || table->last_used > best->last_used)) {
+      best = table;
+    }
+  }
+  if (best == NULL) {
+    return 0;
+  }
+
+  const uint16_t num_bins =
+      best->bin_pwr_count < max_bins ? best->bin_pwr_count : max_bins;
+  const float scale = 1.0f / (1 << NOISE_FLOOR_SHIFT);
+  for (uint16_t bin = 0; bin < num_bins; bin++) {
+    trace[bin] = best->floor[bin] * scale;
+  }
+  return num_bins;
+}
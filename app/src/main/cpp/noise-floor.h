@@ -0,0 +1,28 @@
+#ifndef NOISE_FLOOR_H
+#define NOISE_FLOOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Floors are kept in 1/256 dB so that the per-bin update is a cheap,
+// vectorizable integer add.
+enum { NOISE_FLOOR_SHIFT = 8 };
+
+struct noise_floor;
+
+struct noise_floor *noise_floor_create(void);
+void noise_floor_destroy(struct noise_floor *nf);
+// weight is the number of reports bin_pwr stands for, and moves the floor
+// as far as that many reports of the same power would.
+const int16_t *noise_floor_update(struct noise_floor *nf, uint16_t center_freq,
+                                  uint16_t bin_pwr_count,
+                                  const int8_t bin_pwr[], uint32_t weight);
+int noise_floor_peak(const int16_t floor[], uint16_t bin_pwr_count,
+                     const int8_t bin_pwr[]);
+void noise_floor_thresholds(const int16_t floor[], uint16_t bin_pwr_count,
+                            double margin, double thres[]);
+uint16_t noise_floor_trace(const struct noise_floor *nf, uint16_t center_freq,
+                           float trace[], uint16_t max_bins);
+size_t noise_floor_memory(void);
+
+#endif
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "occupancy.h"
+
+struct band {
+  uint32_t start_khz;
+  uint32_t end_khz;
+};
+
+// Wide enough for a 40 MHz span around any 2.4 GHz or 5 GHz channel.
+static const struct band bands[] = {
+    {2380000, 2520000},
+    {5140000, 5880000},
+};
+
+enum { NUM_BANDS = sizeof(bands) / sizeof(bands[0]) };
+enum {
+  NUM_CELLS = (2520000 - 2380000 + 5880000 - 5140000) / OCCUPANCY_CELL_KHZ,
+};
+
+struct cell {
+  uint64_t samples;
+  uint64_t busy;
+  int64_t pwr_sum;
+  int8_t max_pwr;
+  uint32_t hour_samples[OCCUPANCY_HOURS];
+  uint32_t hour_busy[OCCUPANCY_HOURS];
+};
+
+struct occupancy {
+  struct cell cells[NUM_CELLS];
+  time_t start_time;
+  time_t end_time;
+  time_t hour_end;
+  int hour;
+  time_t report_time;
+};
+
+struct occupancy *occupancy_create(void) {
+  struct occupancy *occ = calloc(1, sizeof(struct occupancy));
+  if (occ == NULL) {
+    return NULL;
+  }
+  for (size_t idx = 0; idx < NUM_CELLS; idx++) {
+    occ->cells[idx].max_pwr = INT8_MIN;
+  }
+  return occ;
+}
+
+void occupancy_destroy(struct occupancy *occ) { free(occ); }
+
+void occupancy_copy(struct occupancy *dst, const struct occupancy *src) {
+  memcpy(dst, src, sizeof(struct occupancy));
+}
+
+size_t occupancy_memory(void) { return sizeof(struct occupancy); }
+
+static int64_t cell_index(uint32_t freq_khz) {
+  int64_t base = 0;
+  for (size_t idx = 0; idx < NUM_BANDS; idx++) {
+    if (freq_khz >= bands[idx].start_khz && freq_khz < bands[idx].end_khz) {
+      return base + (freq_khz - bands[idx].start_khz) / OCCUPANCY_CELL_KHZ;
+    }
+    base += (bands[idx].end_khz - bands[idx].start_khz) / OCCUPANCY_CELL_KHZ;
+  }
+  return -1;
+}
+
+static uint32_t cell_freq(size_t cell) {
+  for (size_t idx = 0; idx < NUM_BANDS; idx++) {
+    const size_t num_cells =
+        (bands[idx].end_khz - bands[idx].start_khz) / OCCUPANCY_CELL_KHZ;
+    if (cell < num_cells) {
+      return bands[idx].start_khz + (uint32_t)cell * OCCUPANCY_CELL_KHZ +
+             OCCUPANCY_CELL_KHZ / 2;
+    }
+    cell -= num_cells;
+  }
+  return 0;
+}
+
+// Offline, statistics are kept on the clock of the reports instead of the
+// clock of the device.
+void occupancy_set_time(struct occupancy *occ, time_t now) {
+  occ->report_time = now;
+}
+
+// localtime_r() is only called when the hour may have changed.
+static void update_clock(struct occupancy *occ) {
+  const time_t now = occ->report_time != 0 ? occ->report_time : time(NULL);
+  if (occ->start_time == 0) {
+    occ->start_time = now;
+  }
+  occ->end_time = now;
+  if (now < occ->hour_end && now >= occ->hour_end - 3600) {
+    return;
+  }
+
+  struct tm tm;
+  localtime_r(&now, &tm);
+  occ->hour = tm.tm_hour;
+  occ->hour_end = now + 3600 - tm.tm_min * 60 - tm.tm_sec;
+}
+
+void occupancy_update(struct occupancy *occ, uint16_t center_freq,
+                      uint16_t span_width, uint16_t bin_pwr_count,
+                      const int8_t bin_pwr[], const double thres[],
+                      uint32_t weight) {
+  if (bin_pwr_count == 0) {
+    return;
+  }
+  update_clock(occ);
+  const int hour = occ->hour;
+
+  const uint32_t start_khz = center_freq * 1000u - span_width * 500u;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const uint32_t freq_khz =
+        start_khz + (2u * bin + 1) * span_width * 500u / bin_pwr_count;
+    const int64_t idx = cell_index(freq_khz);
+    if (idx < 0) {
+      continue;
+    }
+
+    struct cell *cell = &occ->cells[idx];
+    const int8_t pwr = bin_pwr[bin];
+    const bool busy = pwr > thres[bin];
+    cell->samples += weight;
+    cell->busy += busy ? weight : 0;
+    cell->pwr_sum += (int64_t)pwr * weight;
+    cell->max_pwr = pwr > cell->max_pwr ? pwr : cell->max_pwr;
+
+    // Halving both counts keeps the hourly ratio when a bucket would
+    // overflow, which only happens after weeks of scanning.
+    if (cell->hour_samples[hour] > UINT32_MAX - weight) {
+      cell->hour_samples[hour] /= 2;
+      cell->hour_busy[hour] /= 2;
+    }
+    cell->hour_samples[hour] += weight;
+    cell->hour_busy[hour] += busy ? weight : 0;
+  }
+}
+
+// Counts only add up, so statistics merged in any order come out the same
+// unless an hourly bucket had to be halved.
+void occupancy_merge(struct occupancy *dst, const struct occupancy *src) {
+  for (size_t idx = 0; idx < NUM_CELLS; idx++) {
+    struct cell *to = &dst->cells[idx];
+    const struct cell *from = &src->cells[idx];
+    to->samples += from->samples;
+    to->busy += from->busy;
+    to->pwr_sum += from->pwr_sum;
+    to->max_pwr = from->max_pwr > to->max_pwr ? from->max_pwr : to->max_pwr;
+    for (int hour = 0; hour < OCCUPANCY_HOURS; hour++) {
+      if (to->hour_samples[hour] > UINT32_MAX - from->hour_samples[hour]) {
+        to->hour_samples[hour] /= 2;
+        to->hour_busy[hour] /= 2;
+      }
+      to->hour_samples[hour] += from->hour_samples[hour];
+      to->hour_busy[hour] += from->hour_busy[hour];
+    }
+  }
+
+  if (src->start_time != 0 &&
+      (dst->start_time == 0 || src->start_time < dst->start_time)) {
+    dst->start_time = src->start_time;
+  }
+  if (src->end_time > dst->end_time) {
+    dst->end_time = src->end_time;
+  }
+}
+
+uint16_t occupancy_query(const struct occupancy *occ, uint16_t start_freq,
+                         uint16_t end_freq, int hour,
+                         struct occupancy_stats stats[], uint16_t max_cells) {
+  uint16_t num_cells = 0;
+  for (size_t idx = 0; idx < NUM_CELLS && num_cells < max_cells; idx++) {
+    const uint32_t freq_khz = cell_freq(idx);
+    if (freq_khz < start_freq * 1000u || freq_khz >= end_freq * 1000u) {
+      continue;
+    }
+
+    const struct cell *cell = &occ->cells[idx];
+    struct occupancy_stats *out = &stats[num_cells++];
+    out->freq = (float)freq_khz / 1000.0f;
+    if (cell->samples == 0) {
+      out->duty = 0;
+      out->mean_pwr = out->max_pwr = -128.0f;
+      continue;
+    }
+
+    if (hour >= 0 && hour < OCCUPANCY_HOURS) {
+      out->duty = cell->hour_samples[hour] > 0
+                      ? (float)cell->hour_busy[hour] /
+                            (float)cell->hour_samples[hour]
+                      : 0.0f;
+    } else {
+      out->duty = (float)cell->busy / (float)cell->samples;
+    }
+    out->mean_pwr = (float)cell->pwr_sum / (float)cell->samples;
+    out->max_pwr = cell->max_pwr;
+  }
+  return num_cells;
+}
+
+int occupancy_dump(const struct occupancy *occ, const char *path) {
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return -errno;
+  }
+
+  struct occupancy_header header = {
+      .magic = OCCUPANCY_MAGIC,
+      .version = OCCUPANCY_VERSION,
+      .cell_khz = OCCUPANCY_CELL_KHZ,
+      .start_time = occ->start_time,
+      .end_time = occ->end_time,
+  };
+  for (size_t idx = 0; idx < NUM_CELLS; idx++) {
+    header.num_records += occ->cells[idx].samples > 0;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  for (size_t idx = 0; ok && idx < NUM_CELLS; idx++) {
+    const struct cell *cell = &occ->cells[idx];
+    if (cell->samples == 0) {
+      continue;
+    }
+
+    struct occupancy_record record = {
+        .freq_khz = cell_freq(idx),
+        .max_pwr = cell->max_pwr,
+        .samples = cell->samples,
+        .busy = cell->busy,
+        .pwr_sum = cell->pwr_sum,
+    };
+    memcpy(record.hour_samples, cell->hour_samples, sizeof(record.hour_samples));
+    memcpy(record.hour_busy, cell->hour_busy, sizeof(record.hour_busy));
+    ok = fwrite(&record, sizeof(record), 1, fp) == 1;
+  }
+
+  const int err = ok ? 0 : -errno;
+  if (fclose(fp) != 0 && ok) {
+    return -errno;
+  }
+  return err;
+}
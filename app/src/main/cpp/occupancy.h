@@ -0,0 +1,62 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Statistics are kept in cells of fixed absolute frequency, so that every
+// hop that covers a frequency adds to the same cell.
+enum { OCCUPANCY_CELL_KHZ = 500 };
+enum { OCCUPANCY_HOURS = 24 };
+
+struct occupancy_stats {
+  float freq;
+  float duty;
+  float mean_pwr;
+  float max_pwr;
+};
+
+// Dump file layout, all fields little-endian: one header, then one record
+// for every cell that has seen at least one sample.
+enum { OCCUPANCY_MAGIC = 0x7563636f };
+enum { OCCUPANCY_VERSION = 1 };
+
+struct occupancy_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t cell_khz;
+  uint32_t num_records;
+  int64_t start_time;
+  int64_t end_time;
+};
+
+struct occupancy_record {
+  uint32_t freq_khz;
+  int32_t max_pwr;
+  uint64_t samples;
+  uint64_t busy;
+  int64_t pwr_sum;
+  uint32_t hour_samples[OCCUPANCY_HOURS];
+  uint32_t hour_busy[OCCUPANCY_HOURS];
+};
+
+struct occupancy;
+
+struct occupancy *occupancy_create(void);
+void occupancy_destroy(struct occupancy *occ);
+void occupancy_copy(struct occupancy *dst, const struct occupancy *src);
+void occupancy_merge(struct occupancy *dst, const struct occupancy *src);
+void occupancy_set_time(struct occupancy *occ, time_t now);
+// weight is the number of reports bin_pwr stands for.
+void occupancy_update(struct occupancy *occ, uint16_t center_freq,
+                      uint16_t span_width, uint16_t bin_pwr_count,
+                      const int8_t bin_pwr[], const double thres[],
+                      uint32_t weight);
+uint16_t occupancy_query(const struct occupancy *occ, uint16_t start_freq,
+                         uint16_t end_freq, int hour,
+                         struct occupancy_stats stats[], uint16_t max_cells);
+int occupancy_dump(const struct occupancy *occ, const char *path);
+size_t occupancy_memory(void);
+
+#endif
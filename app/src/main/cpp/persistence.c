@@ -0,0 +1,196 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "persistence.h"
+#include "spectral-report.h"
+
+// One grid per channel visited, evicted least recently used. Grids are
+// large, so they are only allocated once a channel is seen, and sized for
+// its bin count.
+enum { MAX_PERSIST_GRIDS = 4 };
+
+// Counts halve once per epoch, and shifting by more than this clears them.
+enum { MAX_DECAY_SHIFT = 16 };
+
+struct persist_grid {
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  int64_t epoch;
+  uint32_t *total;
+  uint16_t hits[][PERSIST_LEVELS];
+};
+
+struct persistence {
+  struct persist_grid *grids[MAX_PERSIST_GRIDS];
+  size_t num_grids;
+  size_t last_grid;
+  uint64_t clock;
+  int32_t half_life;
+  int32_t last_tstamp;
+  int64_t elapsed;
+};
+
+struct persistence *persistence_create(int32_t half_life) {
+  struct persistence *p = calloc(1, sizeof(struct persistence));
+  if (p == NULL) {
+    return NULL;
+  }
+  p->half_life = half_life > 0 ? half_life : 1;
+  p->last_tstamp = INT32_MIN;
+  return p;
+}
+
+void persistence_destroy(struct persistence *p) {
+  if (p == NULL) {
+    return;
+  }
+  for (size_t idx = 0; idx < p->num_grids; idx++) {
+    free(p->grids[idx]);
+  }
+  free(p);
+}
+
+static size_t grid_size(uint16_t bin_pwr_count) {
+  return sizeof(struct persist_grid) +
+         bin_pwr_count * (PERSIST_LEVELS * sizeof(uint16_t) + sizeof(uint32_t));
+}
+
+size_t persistence_memory(const struct persistence *p) {
+  size_t size = sizeof(struct persistence);
+  for (size_t idx = 0; idx < p->num_grids; idx++) {
+    size += grid_size(p->grids[idx]->bin_pwr_count);
+  }
+  return size;
+}
+
+static struct persist_grid *find_grid(struct persistence *p,
+                                      uint16_t center_freq,
+                                      uint16_t bin_pwr_count) {
+  struct persist_grid *grid = p->grids[p->last_grid];
+  if (p->num_grids > 0 && grid->center_freq == center_freq &&
+      grid->bin_pwr_count == bin_pwr_count) {
+    return grid;
+  }
+
+  size_t victim = 0;
+  for (size_t idx = 0; idx < p->num_grids; idx++) {
+    grid = p->grids[idx];
+    if (grid->center_freq == center_freq &&
+        grid->bin_pwr_count == bin_pwr_count) {
+      p->last_grid = idx;
+      return grid;
+    }
+    if (grid->last_used < p->grids[victim]->last_used) {
+      victim = idx;
+    }
+  }
+
+  const size_t size = grid_size(bin_pwr_count);
+  grid = malloc(size);
+  if (grid == NULL) {
+    return NULL;
+  }
+  if (p->num_grids < MAX_PERSIST_GRIDS) {
+    victim = p->num_grids++;
+  } else {
+    free(p->grids[victim]);
+  }
+  p->grids[victim] = grid;
+
+  memset(grid, 0, size);
+  grid->total = (uint32_t *)grid->hits[bin_pwr_count];
+  grid->center_freq = center_freq;
+  grid->bin_pwr_count = bin_pwr_count;
+  grid->epoch = p->elapsed / p->half_life;
+  p->last_grid = victim;
+  return grid;
+}
+
+// Decay is only applied when a grid is next updated in a later epoch, so
+// the cost of a report does not depend on the size of the grid.
+static void decay_grid(struct persist_grid *grid, int64_t epoch) {
+  const int64_t epochs = epoch - grid->epoch;
+  grid->epoch = epoch;
+  if (epochs <= 0) {
+    return;
+  }
+
+  if (epochs >= MAX_DECAY_SHIFT) {
+    memset(grid->total, 0, grid->bin_pwr_count * sizeof(uint32_t));
+    memset(grid->hits, 0, grid->bin_pwr_count * sizeof(grid->hits[0]));
+    return;
+  }
+
+  const unsigned shift = (unsigned)epochs;
+  for (uint16_t bin = 0; bin < grid->bin_pwr_count; bin++) {
+    if (grid->total[bin] == 0) {
+      continue;
+    }
+    grid->total[bin] >>= shift;
+    uint16_t *const hits = grid->hits[bin];
+    for (int level = 0; level < PERSIST_LEVELS; level++) {
+      hits[level] = (uint16_t)(hits[level] >> shift);
+    }
+  }
+}
+
+void persistence_update(struct persistence *p, uint16_t center_freq,
+                        uint16_t bin_pwr_count, int32_t tstamp,
+                        const int8_t bin_pwr[]) {
+  if (p->last_tstamp != INT32_MIN && tstamp > p->last_tstamp) {
+    p->elapsed += tstamp - p->last_tstamp;
+  }
+  p->last_tstamp = tstamp;
+
+  struct persist_grid *grid = find_grid(p, center_freq, bin_pwr_count);
+  if (grid == NULL) {
+    return;
+  }
+  grid->last_used = ++p->clock;
+  decay_grid(grid, p->elapsed / p->half_life);
+
+  // Levels are indexed from -128 dBm, anything at or above 0 dBm is clamped
+  // into the top level. Counts saturate rather than wrap.
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int pwr = bin_pwr[bin] < 0 ? bin_pwr[bin] : -1;
+    uint16_t *const hit = &grid->hits[bin][pwr + PERSIST_LEVELS];
+    *hit = (uint16_t)(*hit + (*hit != UINT16_MAX));
+    grid->total[bin]++;
+  }
+}
+
+uint16_t persistence_row(const struct persistence *p, uint16_t center_freq,
+                         int pwr, uint8_t density[], uint16_t max_bins) {
+  const struct persist_grid *best = NULL;
+  for (size_t idx = 0; idx < p->num_grids; idx++) {
+    const struct persist_grid *grid = p->grids[idx];
+    if (grid->center_freq == center_freq &&
+        (best == NULL || grid->last_used > best->last_used)) {
+      best = grid;
+    }
+  }
+  if (best == NULL) {
+    return 0;
+  }
+
+  const uint16_t num_bins =
+      best->bin_pwr_count < max_bins ? best->bin_pwr_count : max_bins;
+  const int level = pwr + PERSIST_LEVELS;
+  if (level < 0 || level >= PERSIST_LEVELS) {
+    memset(density, 0, num_bins);
+    return num_bins;
+  }
+
+  // The square root lifts rare levels so that intermittent signals stand
+  // out against the noise that dominates every bin.
+  for (uint16_t bin = 0; bin < num_bins; bin++) {
+    const uint32_t total = best->total[bin];
+    const float frac = total > 0 ? (float)best->hits[bin][level] / (float)total
+                                 : 0.0f;
+    density[bin] = (uint8_t)(255.0f * sqrtf(frac));
+  }
+  return num_bins;
+}
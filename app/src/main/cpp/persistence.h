@@ -0,0 +1,22 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hit counts are kept per bin and per dB from -128 to -1 dBm, stronger
+// samples land in the top level.
+enum { PERSIST_LEVELS = 128 };
+
+struct persistence;
+
+struct persistence *persistence_create(int32_t half_life);
+void persistence_destroy(struct persistence *p);
+void persistence_update(struct persistence *p, uint16_t center_freq,
+                        uint16_t bin_pwr_count, int32_t tstamp,
+                        const int8_t bin_pwr[]);
+uint16_t persistence_row(const struct persistence *p, uint16_t center_freq,
+                         int pwr, uint8_t density[], uint16_t max_bins);
+size_t persistence_memory(const struct persistence *p);
+
+#endif
@@ -0,0 +1,459 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pulse-chain.h"
+
+struct scan_data {
+  uint16_t bin_pwr_count;
+  uint16_t center_freq;
+  int32_t tstamp;
+  uint32_t epoch;
+  uint32_t weight;
+  int8_t bin_pwr[];
+};
+
+const struct detect_params default_detect_params[NUM_DETECT_MODES] = {
+    [DETECT_MODE_CLASSIFY] =
+        {
+            .thres_min = -100,
+            .floor_margin = 6.0,
+            .thres_diff = 10,
+            .thres_freq = 1.0,
+            .thres_pwr = 3.0,
+            .thres_time = 150,
+            .max_window_time = 625,
+            .max_window_size = MAX_WINDOW_SIZE,
+        },
+    [DETECT_MODE_PULSE] =
+        {
+            .thres_min = -80,
+            .floor_margin = 10.0,
+            .thres_diff = 10,
+            .thres_freq = 1.0,
+            .thres_pwr = 3.0,
+            .thres_time = 150,
+            .max_window_time = 625,
+            .max_window_size = MAX_WINDOW_SIZE,
+        },
+};
+
+static struct pulse_single make_pulse(const struct window_avg_data *data,
+                                      const uint16_t bin_start,
+                                      const uint16_t bin_end,
+                                      const uint16_t bin_peak) {
+  const double *const bin_pwr = data->bin_pwr;
+  const uint16_t bin_pwr_count = data->bin_pwr_count;
+  const uint16_t center_freq = data->center_freq;
+
+  double sum_pwr = 0;
+  double sum_prod = 0;
+  for (uint16_t bin = bin_start; bin < bin_end; bin++) {
+    sum_pwr += bin_pwr[bin];
+    sum_prod += bin * bin_pwr[bin];
+  }
+  double center_bin = sum_prod / sum_pwr;
+
+  double sum_dis = 0;
+  for (uint16_t bin = bin_start; bin < bin_end; bin++) {
+    sum_dis += pow(bin - center_bin, 2.0) * bin_pwr[bin];
+  }
+  double bw_bin = 2 * sqrt(sum_dis / sum_pwr);
+
+  return (struct pulse_single){
+      .center = (center_bin / bin_pwr_count - 0.5) * SPAN_WIDTH + center_freq,
+      .bw = bw_bin / bin_pwr_count * SPAN_WIDTH,
+      .pwr = bin_pwr[bin_peak],
+      .tstamp = data->tstamp,
+  };
+}
+
+// The kernels below are always inlined into wrappers that pass a constant
+// bin count and detection mode, so that each supported configuration gets
+// its own copy with the loop bounds and mode checks folded away.
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static ALWAYS_INLINE uint16_t
+detect_pulses_impl(const struct window_avg_data *data, const double thres[],
+                   struct pulse_single pulses[], const uint16_t bin_pwr_count,
+                   const enum detect_mode mode,
+                   const struct detect_params *params) {
+  const double *const bin_pwr = data->bin_pwr;
+  const int thres_diff = params->thres_diff;
+  const uint16_t min_width = mode == DETECT_MODE_CLASSIFY ? 2 : 1;
+
+  uint16_t num_pulses = 0;
+
+  for (uint16_t bin_start = 0, bin_end = 0, bin_peak = 0, bin_next = 0;
+       bin_end < bin_pwr_count; bin_start = bin_peak = bin_end = bin_next) {
+    while (bin_start > 0 &&
+           bin_pwr[bin_start - 1] > bin_pwr[bin_peak] - thres_diff &&
+           bin_pwr[bin_start - 1] < bin_pwr[bin_peak]) {
+      bin_start--;
+    }
+    if (bin_start > 0 && bin_pwr[bin_start - 1] >= bin_pwr[bin_peak]) {
+      bin_next++;
+      continue;
+    }
+
+    while (bin_end < bin_pwr_count &&
+           bin_pwr[bin_end] > bin_pwr[bin_peak] - thres_diff &&
+           bin_pwr[bin_end] <= bin_pwr[bin_peak]) {
+      bin_end++;
+    }
+    bin_next = bin_end;
+    if (bin_end < bin_pwr_count && bin_pwr[bin_end] > bin_pwr[bin_peak]) {
+      continue;
+    }
+    if (bin_pwr[bin_peak] <= thres[bin_peak]) {
+      continue;
+    }
+
+    while (bin_start < bin_peak && bin_pwr[bin_start] <= thres[bin_start]) {
+      bin_start++;
+    }
+    while (bin_end > bin_peak && bin_pwr[bin_end - 1] <= thres[bin_end - 1]) {
+      bin_end--;
+    }
+    if (bin_start + min_width > bin_end) {
+      continue;
+    }
+
+    pulses[num_pulses++] = make_pulse(data, bin_start, bin_end, bin_peak);
+  }
+
+  return num_pulses;
+}
+
+static ALWAYS_INLINE void window_add_impl(int window_sum[],
+                                           const int8_t bin_pwr[], int weight,
+                                           const uint16_t bin_pwr_count) {
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    window_sum[bin] += bin_pwr[bin] * weight;
+  }
+}
+
+static ALWAYS_INLINE void window_sub_impl(int window_sum[],
+                                           const int8_t bin_pwr[], int weight,
+                                           const uint16_t bin_pwr_count) {
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    window_sum[bin] -= bin_pwr[bin] * weight;
+  }
+}
+
+static ALWAYS_INLINE void ema_impl(double avg_pwr[], const int8_t bin_pwr[],
+                                    const double alpha,
+                                    const uint16_t bin_pwr_count) {
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    avg_pwr[bin] += alpha * (bin_pwr[bin] - avg_pwr[bin]);
+  }
+}
+
+static ALWAYS_INLINE void peak_hold_impl(double avg_pwr[],
+                                          const int8_t bin_pwr[],
+                                          const double decay,
+                                          const uint16_t bin_pwr_count) {
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const double held = avg_pwr[bin] - decay;
+    avg_pwr[bin] = bin_pwr[bin] > held ? bin_pwr[bin] : held;
+  }
+}
+
+static ALWAYS_INLINE void min_hold_impl(double avg_pwr[],
+                                         const int8_t bin_pwr[],
+                                         const double decay,
+                                         const uint16_t bin_pwr_count) {
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const double held = avg_pwr[bin] + decay;
+    avg_pwr[bin] = bin_pwr[bin] < held ? bin_pwr[bin] : held;
+  }
+}
+
+static ALWAYS_INLINE void window_avg_impl(const int window_sum[],
+                                           const size_t window_size,
+                                           double avg_pwr[],
+                                           const uint16_t bin_pwr_count) {
+  const double scale = 1.0 / (double)window_size;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    avg_pwr[bin] = window_sum[bin] * scale;
+  }
+}
+
+#define DEFINE_DETECT_KERNEL(n, mode, count)                                   \
+  static uint16_t detect_pulses_##n##_##mode(                                  \
+      const struct window_avg_data *data, const double thres[],                \
+      struct pulse_single pulses[], uint16_t bin_pwr_count,                    \
+      const struct detect_params *params) {                                    \
+    return detect_pulses_impl(data, thres, pulses, (count),                    \
+                              DETECT_MODE_##mode, params);                     \
+  }
+
+#define DEFINE_BIN_KERNELS(n, count)                                           \
+  static void window_add_##n(int window_sum[], const int8_t bin_pwr[],         \
+                             int weight, uint16_t bin_pwr_count) {             \
+    window_add_impl(window_sum, bin_pwr, weight, (count));                     \
+  }                                                                            \
+  static void window_sub_##n(int window_sum[], const int8_t bin_pwr[],         \
+                             int weight, uint16_t bin_pwr_count) {             \
+    window_sub_impl(window_sum, bin_pwr, weight, (count));                     \
+  }                                                                            \
+  static void window_avg_##n(const int window_sum[], size_t window_size,       \
+                             double avg_pwr[], uint16_t bin_pwr_count) {       \
+    window_avg_impl(window_sum, window_size, avg_pwr, (count));                \
+  }                                                                            \
+  static void ema_##n(double avg_pwr[], const int8_t bin_pwr[], double k,      \
+                      uint16_t bin_pwr_count) {                                \
+    ema_impl(avg_pwr, bin_pwr, k, (count));                                    \
+  }                                                                            \
+  static void peak_hold_##n(double avg_pwr[], const int8_t bin_pwr[],          \
+                            double k, uint16_t bin_pwr_count) {                \
+    peak_hold_impl(avg_pwr, bin_pwr, k, (count));                              \
+  }                                                                            \
+  static void min_hold_##n(double avg_pwr[], const int8_t bin_pwr[], double k, \
+                           uint16_t bin_pwr_count) {                           \
+    min_hold_impl(avg_pwr, bin_pwr, k, (count));                               \
+  }                                                                            \
+  DEFINE_DETECT_KERNEL(n, CLASSIFY, count)                                     \
+  DEFINE_DETECT_KERNEL(n, PULSE, count)
+
+#define BIN_KERNELS(n)                                                         \
+  {                                                                            \
+    .window_add = window_add_##n, .window_sub = window_sub_##n,                \
+    .window_avg = window_avg_##n,                                              \
+    .trace_update = {                                                          \
+        [AVG_MODE_EMA] = ema_##n,                                              \
+        [AVG_MODE_PEAK_HOLD] = peak_hold_##n,                                  \
+        [AVG_MODE_MIN_HOLD] = min_hold_##n,                                    \
+    },                                                                         \
+    .detect_pulses = {                                                         \
+        [DETECT_MODE_CLASSIFY] = detect_pulses_##n##_CLASSIFY,                 \
+        [DETECT_MODE_PULSE] = detect_pulses_##n##_PULSE,                       \
+    },                                                                         \
+  }
+
+DEFINE_BIN_KERNELS(generic, bin_pwr_count)
+DEFINE_BIN_KERNELS(4, 4)
+DEFINE_BIN_KERNELS(8, 8)
+DEFINE_BIN_KERNELS(16, 16)
+DEFINE_BIN_KERNELS(32, 32)
+DEFINE_BIN_KERNELS(64, 64)
+DEFINE_BIN_KERNELS(128, 128)
+DEFINE_BIN_KERNELS(256, 256)
+DEFINE_BIN_KERNELS(512, 512)
+DEFINE_BIN_KERNELS(1024, 1024)
+DEFINE_BIN_KERNELS(2048, 2048)
+
+// Indexed by log2 of the bin count; index 0 handles every other count.
+static const struct bin_kernels bin_kernels[] = {
+    BIN_KERNELS(generic), BIN_KERNELS(generic), BIN_KERNELS(4),
+    BIN_KERNELS(8),       BIN_KERNELS(16),      BIN_KERNELS(32),
+    BIN_KERNELS(64),      BIN_KERNELS(128),     BIN_KERNELS(256),
+    BIN_KERNELS(512),     BIN_KERNELS(1024),    BIN_KERNELS(2048),
+};
+
+const struct bin_kernels *get_bin_kernels(uint16_t bin_pwr_count) {
+  if (bin_pwr_count < 4 || (bin_pwr_count & (bin_pwr_count - 1)) != 0) {
+    return &bin_kernels[0];
+  }
+  size_t idx = (size_t)__builtin_ctz(bin_pwr_count);
+  if (idx >= sizeof(bin_kernels) / sizeof(bin_kernels[0])) {
+    return &bin_kernels[0];
+  }
+  return &bin_kernels[idx];
+}
+
+static size_t scan_size(uint16_t max_bins) {
+  return (sizeof(struct scan_data) + max_bins + 7) & ~(size_t)7;
+}
+
+static struct scan_data *get_scan(const struct averager *avg, size_t idx) {
+  return (struct scan_data *)(avg->scans + idx * avg->scan_size);
+}
+
+size_t averager_memory(enum avg_mode mode, uint16_t max_bins) {
+  if (mode == AVG_MODE_BOXCAR) {
+    return MAX_WINDOW_SIZE * scan_size(max_bins) +
+           max_bins * (sizeof(int) + sizeof(double));
+  }
+  return max_bins * sizeof(double);
+}
+
+// Only the boxcar needs a history of reports, so it is allocated while the
+// boxcar is in use and released when switching to a constant-memory mode.
+bool averager_set_mode(struct averager *avg, enum avg_mode mode) {
+  if (mode == AVG_MODE_BOXCAR && avg->scans == NULL) {
+    avg->scan_size = scan_size(avg->max_bins);
+    avg->scans = calloc(MAX_WINDOW_SIZE, avg->scan_size);
+    if (avg->scans == NULL) {
+      return false;
+    }
+  } else if (mode != AVG_MODE_BOXCAR) {
+    free(avg->scans);
+    avg->scans = NULL;
+  }
+
+  avg->mode = mode;
+  avg->window_start = 0;
+  avg->window_size = 0;
+  avg->window_reports = 0;
+  memset(avg->window_sum, 0, avg->max_bins * sizeof(int));
+  avg->valid = false;
+  return true;
+}
+
+static void boxcar_update(struct averager *avg,
+                          const struct bin_kernels *kernels,
+                          const int8_t bin_pwr[], uint16_t bin_pwr_count,
+                          uint32_t weight, uint16_t center_freq,
+                          uint32_t epoch, int32_t tstamp,
+                          const struct detect_params *params) {
+  while (avg->window_size > 0) {
+    const struct scan_data *old = get_scan(avg, avg->window_start);
+    if (old->bin_pwr_count == bin_pwr_count &&
+        old->center_freq == center_freq && old->epoch == epoch &&
+        old->tstamp > tstamp - params->max_window_time &&
+        avg->window_reports + weight <= params->max_window_size) {
+      break;
+    }
+    avg->window_start++;
+    avg->window_start %= MAX_WINDOW_SIZE;
+    get_bin_kernels(old->bin_pwr_count)
+        ->window_sub(avg->window_sum, old->bin_pwr, (int)old->weight,
+                     old->bin_pwr_count);
+    avg->window_size--;
+    avg->window_reports -= old->weight;
+  }
+
+  size_t window_end = avg->window_start + avg->window_size;
+  window_end %= MAX_WINDOW_SIZE;
+  struct scan_data *scan_data = get_scan(avg, window_end);
+
+  memcpy(scan_data->bin_pwr, bin_pwr, bin_pwr_count);
+  scan_data->bin_pwr_count = bin_pwr_count;
+  scan_data->center_freq = center_freq;
+  scan_data->tstamp = tstamp;
+  scan_data->epoch = epoch;
+  scan_data->weight = weight;
+
+  kernels->window_add(avg->window_sum, bin_pwr, (int)weight, bin_pwr_count);
+  avg->window_size++;
+  avg->window_reports += weight;
+
+  kernels->window_avg(avg->window_sum, avg->window_reports, avg->data.bin_pwr,
+                      bin_pwr_count);
+  avg->first_tstamp = get_scan(avg, avg->window_start)->tstamp;
+}
+
+static void trace_update(struct averager *avg,
+                         const struct bin_kernels *kernels,
+                         const int8_t bin_pwr[], uint16_t bin_pwr_count,
+                         uint16_t center_freq, uint32_t epoch, int32_t tstamp,
+                         const struct avg_params *avg_params) {
+  if (!avg->valid || avg->data.bin_pwr_count != bin_pwr_count ||
+      avg->data.center_freq != center_freq || avg->epoch != epoch ||
+      tstamp < avg->data.tstamp) {
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      avg->data.bin_pwr[bin] = bin_pwr[bin];
+    }
+    avg->first_tstamp = tstamp;
+    return;
+  }
+
+  const double elapsed = tstamp - avg->data.tstamp;
+  double k;
+  if (avg->mode == AVG_MODE_EMA) {
+    k = avg_params->avg_time > 0 ? -expm1(-elapsed / avg_params->avg_time) : 1;
+  } else {
+    k = avg_params->hold_decay * elapsed / 1000;
+  }
+  kernels->trace_update[avg->mode](avg->data.bin_pwr, bin_pwr, k,
+                                   bin_pwr_count);
+  avg->first_tstamp = tstamp - avg_params->avg_time;
+}
+
+const struct window_avg_data *
+averager_update(struct averager *avg, const struct bin_kernels *kernels,
+                const int8_t bin_pwr[], uint16_t bin_pwr_count,
+                uint32_t weight, uint16_t center_freq, uint32_t epoch,
+                int32_t tstamp, const struct detect_params *params,
+                const struct avg_params *avg_params) {
+  const int64_t start = stage_now_ns();
+
+  // The traces follow the time between reports, so a summary needs no
+  // weight there.
+  if (avg->mode == AVG_MODE_BOXCAR) {
+    boxcar_update(avg, kernels, bin_pwr, bin_pwr_count, weight, center_freq,
+                  epoch, tstamp, params);
+  } else {
+    trace_update(avg, kernels, bin_pwr, bin_pwr_count, center_freq, epoch,
+                 tstamp, avg_params);
+  }
+
+  avg->data.bin_pwr_count = bin_pwr_count;
+  avg->data.center_freq = center_freq;
+  avg->data.tstamp = tstamp;
+  avg->epoch = epoch;
+  avg->valid = true;
+
+  stage_timer_add(&avg->timers[avg->mode], start);
+  return &avg->data;
+}
+
+uint16_t match_pulses(const struct pulse_single new_pulses[],
+                      const uint16_t new_num_pulses,
+                      const uint16_t bin_pwr_count, struct pulse old_pulses[],
+                      const uint16_t old_num_pulses, struct pulse pulses[],
+                      const struct detect_params *params) {
+  const double thres_freq = params->thres_freq;
+  const double thres_pwr = params->thres_pwr;
+  const int32_t thres_time = params->thres_time;
+  uint16_t num_pulses = 0;
+
+  for (uint16_t new_idx = 0, old_idx = 0; new_idx < new_num_pulses; new_idx++) {
+    double center = new_pulses[new_idx].center;
+    double bw = new_pulses[new_idx].bw;
+    double pwr = new_pulses[new_idx].pwr;
+    int32_t tstamp = new_pulses[new_idx].tstamp;
+
+    while (old_idx < old_num_pulses &&
+           old_pulses[old_idx].center <= center - thres_freq) {
+      old_idx++;
+    }
+
+    if (old_idx < old_num_pulses &&
+        old_pulses[old_idx].center < center + thres_freq &&
+        fabs(old_pulses[old_idx].bw - bw) < thres_freq * 2 &&
+        fabs(old_pulses[old_idx].pwr - pwr) < thres_pwr &&
+        tstamp < old_pulses[old_idx].tstamp_last + thres_time) {
+      double old_center = old_pulses[old_idx].center;
+      double old_bw = old_pulses[old_idx].bw;
+      double old_pwr = old_pulses[old_idx].pwr;
+      int32_t old_cnt = old_pulses[old_idx].cnt;
+      center = (center + old_cnt * old_center) / (old_cnt + 1);
+      bw = (bw + old_cnt * old_bw) / (old_cnt + 1);
+      pwr = (pwr + old_cnt * old_pwr) / (old_cnt + 1);
+      pulses[num_pulses++] = (struct pulse){
+          .center = center,
+          .bw = bw,
+          .pwr = pwr,
+          .tstamp_first = old_pulses[old_idx].tstamp_first,
+          .tstamp_last = tstamp,
+          .cnt = old_cnt + 1,
+          .matched = false,
+      };
+      old_pulses[old_idx++].matched = true;
+    } else {
+      pulses[num_pulses++] = (struct pulse){
+          .center = center,
+          .bw = bw,
+          .pwr = pwr,
+          .tstamp_first = tstamp,
+          .tstamp_last = tstamp,
+          .cnt = 1,
+          .matched = false,
+      };
+    }
+  }
+
+  return num_pulses;
+}
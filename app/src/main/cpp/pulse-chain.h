@@ -0,0 +1,133 @@
+#ifndef PULSE_CHAIN_H
+#define PULSE_CHAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stage-timer.h"
+
+// The per-report chain that turns reports into pulse tracks: averaging,
+// pulse detection on the average and matching pulses against the tracks
+// of the previous report. The receive thread of a plot engine and the
+// batch analyzer run the same chain.
+enum { MAX_WINDOW_SIZE = 200 };
+enum { SPAN_WIDTH = 40 };
+
+struct window_avg_data {
+  double *bin_pwr;
+  uint16_t bin_pwr_count;
+  uint16_t center_freq;
+  int32_t tstamp;
+};
+
+enum detect_mode {
+  DETECT_MODE_CLASSIFY,
+  DETECT_MODE_PULSE,
+  NUM_DETECT_MODES,
+};
+
+// With a positive floor_margin, pulses have to rise that far above the
+// noise floor of each bin, otherwise above the fixed thres_min.
+struct detect_params {
+  int thres_min;
+  double floor_margin;
+  int thres_diff;
+  double thres_freq;
+  double thres_pwr;
+  int32_t thres_time;
+  int32_t max_window_time;
+  size_t max_window_size;
+};
+
+extern const struct detect_params default_detect_params[NUM_DETECT_MODES];
+
+enum avg_mode {
+  AVG_MODE_BOXCAR,
+  AVG_MODE_EMA,
+  AVG_MODE_PEAK_HOLD,
+  AVG_MODE_MIN_HOLD,
+  NUM_AVG_MODES,
+};
+
+// avg_time is the EMA time constant and, for all modes but the boxcar, how
+// often an averaged row is drawn. hold_decay is in dB per millisecond.
+struct avg_params {
+  enum avg_mode mode;
+  int32_t avg_time;
+  double hold_decay;
+};
+
+struct pulse_single {
+  double center;
+  double bw;
+  double pwr;
+  int32_t tstamp;
+};
+
+struct pulse {
+  double center;
+  double bw;
+  double pwr;
+  int32_t tstamp_first;
+  int32_t tstamp_last;
+  int32_t cnt;
+  bool matched;
+};
+
+struct bin_kernels {
+  void (*window_add)(int window_sum[], const int8_t bin_pwr[], int weight,
+                     uint16_t bin_pwr_count);
+  void (*window_sub)(int window_sum[], const int8_t bin_pwr[], int weight,
+                     uint16_t bin_pwr_count);
+  void (*window_avg)(const int window_sum[], size_t window_size,
+                     double avg_pwr[], uint16_t bin_pwr_count);
+  void (*trace_update[NUM_AVG_MODES])(double avg_pwr[], const int8_t bin_pwr[],
+                                      double k, uint16_t bin_pwr_count);
+  uint16_t (*detect_pulses[NUM_DETECT_MODES])(
+      const struct window_avg_data *data, const double thres[],
+      struct pulse_single pulses[], uint16_t bin_pwr_count,
+      const struct detect_params *params);
+};
+
+const struct bin_kernels *get_bin_kernels(uint16_t bin_pwr_count);
+
+// The boxcar history holds MAX_WINDOW_SIZE reports of up to max_bins bins,
+// scan_size bytes apart. window_sum and data.bin_pwr hold max_bins values
+// and belong to the caller. A squelch summary is one entry that counts as
+// all the reports it stands for, so window_reports can exceed window_size.
+struct averager {
+  enum avg_mode mode;
+  uint16_t max_bins;
+  size_t scan_size;
+  uint8_t *scans;
+  size_t window_start;
+  size_t window_size;
+  size_t window_reports;
+  int *window_sum;
+  struct window_avg_data data;
+  uint32_t epoch;
+  bool valid;
+  int32_t first_tstamp;
+  struct stage_timer timers[NUM_AVG_MODES];
+};
+
+size_t averager_memory(enum avg_mode mode, uint16_t max_bins);
+bool averager_set_mode(struct averager *avg, enum avg_mode mode);
+const struct window_avg_data *
+averager_update(struct averager *avg, const struct bin_kernels *kernels,
+                const int8_t bin_pwr[], uint16_t bin_pwr_count,
+                uint32_t weight, uint16_t center_freq, uint32_t epoch,
+                int32_t tstamp, const struct detect_params *params,
+                const struct avg_params *avg_params);
+
+// Matches the pulses of a report against the tracks of the previous one,
+// both sorted by center, and writes the continued and new tracks to
+// pulses. Tracks of the previous report left unmatched have finished.
+uint16_t match_pulses(const struct pulse_single new_pulses[],
+                      uint16_t new_num_pulses, uint16_t bin_pwr_count,
+                      struct pulse old_pulses[], uint16_t old_num_pulses,
+                      struct pulse pulses[],
+                      const struct detect_params *params);
+
+#endif
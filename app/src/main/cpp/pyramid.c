@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyramid.h"
+#include "spectral-report.h"
+
+// One stack of levels per channel visited, evicted least recently used once
+// this many channels or the memory budget are reached.
+enum { MAX_PYRAMID_CHANNELS = 16 };
+
+struct level {
+  uint64_t num_rows;
+  int64_t *time_first;
+  int64_t *time_last;
+  int8_t *max_pwr;
+  int16_t *mean_pwr;
+};
+
+// The buffers of a channel have room for max_bins bins, so that an evicted
+// channel can be reused for another with up to as many.
+struct channel {
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint16_t max_bins;
+  uint64_t last_used;
+  struct level *levels;
+};
+
+struct pyramid {
+  struct channel *channels[MAX_PYRAMID_CHANNELS];
+  size_t num_channels;
+  size_t last_channel;
+  uint64_t clock;
+  unsigned num_levels;
+  size_t rows_per_level;
+  size_t max_memory;
+  size_t memory;
+  struct tstamp_clock tstamp_clock;
+};
+
+struct pyramid *pyramid_create(unsigned num_levels, size_t rows_per_level,
+                               size_t max_memory) {
+  if (num_levels < 1 || rows_per_level < 2) {
+    return NULL;
+  }
+
+  struct pyramid *p = calloc(1, sizeof(struct pyramid));
+  if (p == NULL) {
+    return NULL;
+  }
+  p->num_levels = num_levels;
+  p->rows_per_level = rows_per_level;
+  p->max_memory = max_memory;
+  p->memory = sizeof(struct pyramid);
+  return p;
+}
+
+static void free_channel(struct channel *ch, unsigned num_levels) {
+  if (ch == NULL) {
+    return;
+  }
+  for (unsigned idx = 0; ch->levels != NULL && idx < num_levels; idx++) {
+    free(ch->levels[idx].time_first);
+    free(ch->levels[idx].time_last);
+    free(ch->levels[idx].max_pwr);
+    free(ch->levels[idx].mean_pwr);
+  }
+  free(ch->levels);
+  free(ch);
+}
+
+void pyramid_destroy(struct pyramid *p) {
+  if (p == NULL) {
+    return;
+  }
+  for (size_t idx = 0; idx < p->num_channels; idx++) {
+    free_channel(p->channels[idx], p->num_levels);
+  }
+  free(p);
+}
+
+unsigned pyramid_levels(const struct pyramid *p) { return p->num_levels; }
+
+static size_t channel_memory(const struct pyramid *p, uint16_t bin_pwr_count) {
+  const size_t row_size =
+      2 * sizeof(int64_t) + bin_pwr_count * (sizeof(int8_t) + sizeof(int16_t));
+  return sizeof(struct channel) + p->num_levels * sizeof(struct level) +
+         p->num_levels * p->rows_per_level * row_size;
+}
+
+size_t pyramid_memory(const struct pyramid *p) { return p->memory; }
+
+static struct channel *alloc_channel(const struct pyramid *p,
+                                     uint16_t bin_pwr_count) {
+  struct channel *ch = calloc(1, sizeof(struct channel));
+  if (ch == NULL) {
+    return NULL;
+  }
+  ch->levels = calloc(p->num_levels, sizeof(struct level));
+  if (ch->levels == NULL) {
+    free(ch);
+    return NULL;
+  }
+
+  const size_t rows = p->rows_per_level;
+  for (unsigned idx = 0; idx < p->num_levels; idx++) {
+    struct level *level = &ch->levels[idx];
+    level->time_first = malloc(rows * sizeof(int64_t));
+    level->time_last = malloc(rows * sizeof(int64_t));
+    level->max_pwr = malloc(rows * bin_pwr_count * sizeof(int8_t));
+    level->mean_pwr = malloc(rows * bin_pwr_count * sizeof(int16_t));
+    if (level->time_first == NULL || level->time_last == NULL ||
+        level->max_pwr == NULL || level->mean_pwr == NULL) {
+      free_channel(ch, p->num_levels);
+      return NULL;
+    }
+  }
+  ch->bin_pwr_count = bin_pwr_count;
+  ch->max_bins = bin_pwr_count;
+  return ch;
+}
+
+// Frees the channels with room for fewer than bin_pwr_count bins, which
+// hold reports of a smaller FFT size than the current one.
+static void free_small_channels(struct pyramid *p, uint16_t bin_pwr_count) {
+  size_t kept = 0;
+  for (size_t idx = 0; idx < p->num_channels; idx++) {
+    struct channel *ch = p->channels[idx];
+    if (ch->max_bins < bin_pwr_count) {
+      p->memory -= channel_memory(p, ch->max_bins);
+      free_channel(ch, p->num_levels);
+    } else {
+      p->channels[kept++] = ch;
+    }
+  }
+  p->num_channels = kept;
+  p->last_channel = 0;
+}
+
+static struct channel *find_channel(struct pyramid *p, uint16_t center_freq,
+                                    uint16_t bin_pwr_count) {
+  struct channel *ch = p->channels[p->last_channel];
+  if (p->num_channels > 0 && ch->center_freq == center_freq &&
+      ch->bin_pwr_count == bin_pwr_count) {
+    return ch;
+  }
+
+  for (size_t idx = 0; idx < p->num_channels; idx++) {
+    ch = p->channels[idx];
+    if (ch->center_freq == center_freq && ch->bin_pwr_count == bin_pwr_count) {
+      p->last_channel = idx;
+      return ch;
+    }
+  }
+
+  size_t victim = 0;
+  for (size_t idx = 1; idx < p->num_channels; idx++) {
+    if (p->channels[idx]->last_used < p->channels[victim]->last_used) {
+      victim = idx;
+    }
+  }
+  if (p->num_channels > 0 && p->channels[victim]->max_bins < bin_pwr_count) {
+    free_small_channels(p, bin_pwr_count);
+    victim = 0;
+    for (size_t idx = 1; idx < p->num_channels; idx++) {
+      if (p->channels[idx]->last_used < p->channels[victim]->last_used) {
+        victim = idx;
+      }
+    }
+  }
+
+  // A new channel is only allocated while it fits into the budget, and
+  // otherwise the least recently used one is cleared and reused in place,
+  // so hopping over more channels than fit costs no allocations.
+  const size_t needed = channel_memory(p, bin_pwr_count);
+  if (p->num_channels < MAX_PYRAMID_CHANNELS &&
+      p->memory + needed <= p->max_memory) {
+    ch = alloc_channel(p, bin_pwr_count);
+    if (ch == NULL) {
+      return NULL;
+    }
+    p->memory += needed;
+    victim = p->num_channels++;
+    p->channels[victim] = ch;
+  } else if (p->num_channels > 0) {
+    ch = p->channels[victim];
+    for (unsigned idx = 0; idx < p->num_levels; idx++) {
+      ch->levels[idx].num_rows = 0;
+    }
+    ch->bin_pwr_count = bin_pwr_count;
+  } else {
+    return NULL;
+  }
+
+  ch->center_freq = center_freq;
+  p->last_channel = victim;
+  return ch;
+}
+
+// Merges the two newest rows of level idx into a new row of level idx + 1,
+// and so on upwards while levels complete a pair.
+static void merge_up(const struct pyramid *p, struct channel *ch,
+                     unsigned idx) {
+  const uint16_t n = ch->bin_pwr_count;
+  const size_t rows = p->rows_per_level;
+
+  for (; idx + 1 < p->num_levels; idx++) {
+    const struct level *lower = &ch->levels[idx];
+    if (lower->num_rows % 2 != 0) {
+      return;
+    }
+
+    const size_t a = (lower->num_rows - 2) % rows;
+    const size_t b = (lower->num_rows - 1) % rows;
+    struct level *upper = &ch->levels[idx + 1];
+    const size_t dst = upper->num_rows % rows;
+
+    upper->time_first[dst] = lower->time_first[a];
+    upper->time_last[dst] = lower->time_last[b];
+
+    const int8_t *max_a = &lower->max_pwr[a * n];
+    const int8_t *max_b = &lower->max_pwr[b * n];
+    const int16_t *mean_a = &lower->mean_pwr[a * n];
+    const int16_t *mean_b = &lower->mean_pwr[b * n];
+    int8_t *max_dst = &upper->max_pwr[dst * n];
+    int16_t *mean_dst = &upper->mean_pwr[dst * n];
+    for (uint16_t bin = 0; bin < n; bin++) {
+      max_dst[bin] = max_a[bin] > max_b[bin] ? max_a[bin] : max_b[bin];
+      mean_dst[bin] = (int16_t)((mean_a[bin] + mean_b[bin]) / 2);
+    }
+
+    upper->num_rows++;
+  }
+}
+
+void pyramid_update(struct pyramid *p, uint16_t center_freq,
+                    uint16_t bin_pwr_count, int32_t tstamp,
+                    const int8_t bin_pwr[]) {
+  const int64_t time_us = tstamp_clock_update(&p->tstamp_clock, tstamp);
+
+  struct channel *ch = find_channel(p, center_freq, bin_pwr_count);
+  if (ch == NULL) {
+    return;
+  }
+  ch->last_used = ++p->clock;
+
+  struct level *base = &ch->levels[0];
+  const size_t dst = base->num_rows % p->rows_per_level;
+  base->time_first[dst] = time_us;
+  base->time_last[dst] = time_us;
+  int8_t *max_dst = &base->max_pwr[dst * bin_pwr_count];
+  int16_t *mean_dst = &base->mean_pwr[dst * bin_pwr_count];
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    max_dst[bin] = bin_pwr[bin];
+    mean_dst[bin] = (int16_t)(bin_pwr[bin] * (1 << PYRAMID_MEAN_SHIFT));
+  }
+  base->num_rows++;
+
+  merge_up(p, ch, 0);
+}
+
+// age 0 is the newest row of the level.
+bool pyramid_row(const struct pyramid *p, uint16_t center_freq,
+                 unsigned level, size_t age, struct pyramid_row *row) {
+  if (level >= p->num_levels || age >= p->rows_per_level) {
+    return false;
+  }
+
+  const struct channel *best = NULL;
+  for (size_t idx = 0; idx < p->num_channels; idx++) {
+    const struct channel *ch = p->channels[idx];
+    if (ch->center_freq == center_freq &&
+        (best == NULL || ch->last_used > best->last_used)) {
+      best = ch;
+    }
+  }
+  if (best == NULL || age >= best->levels[level].num_rows) {
+    return false;
+  }
+
+  const struct level *lvl = &best->levels[level];
+  const size_t pos = (lvl->num_rows - 1 - age) % p->rows_per_level;
+  row->bin_pwr_count = best->bin_pwr_count;
+  row->time_first = lvl->time_first[pos];
+  row->time_last = lvl->time_last[pos];
+  row->max_pwr = &lvl->max_pwr[pos * best->bin_pwr_count];
+  row->mean_pwr = &lvl->mean_pwr[pos * best->bin_pwr_count];
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Means are kept in 1/16 dB so that averaging pairs over many levels does
+// not drift from rounding.
+enum { PYRAMID_MEAN_SHIFT = 4 };
+
+// Level 0 holds one row per report, each level above one row per two rows
+// of the level below, with the max and mean of each bin. Every level keeps
+// the same number of most recent rows, so memory is fixed per channel, and
+// channels are kept while they fit into max_memory together.
+struct pyramid_row {
+  uint16_t bin_pwr_count;
+  int64_t time_first;
+  int64_t time_last;
+  const int8_t *max_pwr;
+  const int16_t *mean_pwr;
+};
+
+struct pyramid;
+
+struct pyramid *pyramid_create(unsigned num_levels, size_t rows_per_level,
+                               size_t max_memory);
+void pyramid_destroy(struct pyramid *p);
+void pyramid_update(struct pyramid *p, uint16_t center_freq,
+                    uint16_t bin_pwr_count, int32_t tstamp,
+                    const int8_t bin_pwr[]);
+bool pyramid_row(const struct pyramid *p, uint16_t center_freq,
+                 unsigned level, size_t age, struct pyramid_row *row);
+unsigned pyramid_levels(const struct pyramid *p);
+size_t pyramid_memory(const struct pyramid *p);
+
+#endif
@@ -0,0 +1,325 @@
+#include <android/log.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "report-bus.h"
+#include "trace.h"
+
+#define LOG_TAG "report-bus"
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// Each slot carries a sequence word that is odd while the publisher writes
+// it, so that a subscriber which drops the oldest reports can tell when a
+// slot was overwritten while it copied it out. The view of a slot points
+// into its own data, and is moved onto every copy.
+struct slot {
+  atomic_uint_least64_t seq;
+  struct hop_tag tag;
+  uint32_t bus_seq;
+  struct report_view view;
+  uint8_t data[];
+};
+
+struct subscriber {
+  struct report_bus *bus;
+  enum drop_policy policy;
+  report_sink_fn fn;
+  report_tick_fn tick_fn;
+  int64_t tick_us;
+  void *arg;
+  size_t capacity;
+  size_t slot_size;
+  uint8_t *slots;
+  atomic_uint_least64_t head;
+  atomic_uint_least64_t tail;
+  atomic_int_least64_t num_delivered;
+  atomic_int_least64_t num_dropped;
+  atomic_bool stopping;
+  atomic_bool closed;
+  sem_t items;
+  pthread_t thread;
+};
+
+struct report_bus {
+  pthread_mutex_t lock;
+  _Atomic(struct subscriber *) subs[MAX_SUBSCRIBERS];
+  atomic_uint_least64_t publish_gen;
+  uint32_t seq;
+  size_t max_len;
+};
+
+struct report_bus *report_bus_create(size_t max_len) {
+  struct report_bus *bus = calloc(1, sizeof(struct report_bus));
+  if (bus == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&bus->lock, NULL);
+  bus->max_len = max_len;
+  return bus;
+}
+
+void report_bus_destroy(struct report_bus *bus) {
+  if (bus == NULL) {
+    return;
+  }
+  for (int id = 0; id < MAX_SUBSCRIBERS; id++) {
+    report_bus_unsubscribe(bus, id, NULL);
+  }
+  pthread_mutex_destroy(&bus->lock);
+  free(bus);
+}
+
+static struct slot *get_slot(const struct subscriber *sub, uint64_t pos) {
+  return (struct slot *)(sub->slots + pos % sub->capacity * sub->slot_size);
+}
+
+static bool read_slot(struct subscriber *sub, uint64_t pos, struct slot *out) {
+  const struct slot *slot = get_slot(sub, pos);
+  const uint64_t seq =
+      atomic_load_explicit(&slot->seq, memory_order_acquire);
+  if (seq != 2 * pos + 2) {
+    return false;
+  }
+  out->bus_seq = slot->bus_seq;
+  out->tag = slot->tag;
+  out->view = slot->view;
+  if (out->view.len > sub->bus->max_len) {
+    return false;
+  }
+  memcpy(out->data, slot->data, out->view.len);
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+    return false;
+  }
+  report_view_move(&out->view, out->data);
+  return true;
+}
+
+static void add_us(struct timespec *ts, int64_t us) {
+  const int64_t nsec = ts->tv_nsec + us % 1000000 * 1000;
+  ts->tv_sec += (time_t)(us / 1000000 + nsec / 1000000000);
+  ts->tv_nsec = (long)(nsec % 1000000000);
+}
+
+// sem_timedwait only takes the realtime clock before API 28, so a clock
+// step can shift a tick, but never stops them.
+static void wait_items(struct subscriber *sub, struct timespec *next_tick) {
+  if (sub->tick_fn == NULL) {
+    sem_wait(&sub->items);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (now.tv_sec > next_tick->tv_sec ||
+      (now.tv_sec == next_tick->tv_sec && now.tv_nsec >= next_tick->tv_nsec)) {
+    sub->tick_fn(sub->arg);
+    *next_tick = now;
+    add_us(next_tick, sub->tick_us);
+  }
+  sem_timedwait(&sub->items, next_tick);
+}
+
+static void *subscriber_thread(void *arg) {
+  struct subscriber *sub = arg;
+  struct slot *buf = malloc(sub->slot_size);
+  pthread_setname_np(pthread_self(), "report-sub");
+
+  struct timespec next_tick;
+  clock_gettime(CLOCK_REALTIME, &next_tick);
+  add_us(&next_tick, sub->tick_us);
+  while (buf != NULL && !sub->stopping) {
+    wait_items(sub, &next_tick);
+
+    uint64_t tail = atomic_load_explicit(&sub->tail, memory_order_relaxed);
+    while (!sub->stopping) {
+      const uint64_t head =
+          atomic_load_explicit(&sub->head, memory_order_acquire);
+      if (tail == head) {
+        break;
+      }
+      // Only possible when dropping the oldest, as the publisher never
+      // gets further ahead otherwise.
+      if (head - tail > sub->capacity) {
+        sub->num_dropped += (int64_t)(head - sub->capacity - tail);
+        tail = head - sub->capacity;
+      }
+      if (!read_slot(sub, tail, buf)) {
+        sub->num_dropped++;
+        atomic_store_explicit(&sub->tail, ++tail, memory_order_release);
+        continue;
+      }
+      atomic_store_explicit(&sub->tail, ++tail, memory_order_release);
+
+      const int64_t span_start = trace_begin();
+      const bool delivered =
+          sub->fn(sub->arg, buf->bus_seq, &buf->view, &buf->tag);
+      trace_end(TRACE_REPORT_DELIVER, span_start, buf->bus_seq);
+      if (!delivered) {
+        sub->closed = true;
+        free(buf);
+        return NULL;
+      }
+      sub->num_delivered++;
+    }
+  }
+
+  free(buf);
+  return NULL;
+}
+
+int report_bus_subscribe(struct report_bus *bus, size_t capacity,
+                         enum drop_policy policy, report_sink_fn fn,
+                         report_tick_fn tick_fn, int64_t tick_us, void *arg) {
+  if (capacity < 1 || (tick_fn != NULL && tick_us < 1)) {
+    return -1;
+  }
+
+  struct subscriber *sub = calloc(1, sizeof(struct subscriber));
+  if (sub == NULL) {
+    LOGE("Can't allocate subscriber");
+    return -1;
+  }
+  // Slots stay 8-byte aligned for their sequence words.
+  sub->slot_size = (sizeof(struct slot) + bus->max_len + 7) & ~(size_t)7;
+  sub->slots = calloc(capacity, sub->slot_size);
+  if (sub->slots == NULL) {
+    LOGE("Can't allocate subscriber queue");
+    free(sub);
+    return -1;
+  }
+  sub->bus = bus;
+  sub->policy = policy;
+  sub->fn = fn;
+  sub->tick_fn = tick_fn;
+  sub->tick_us = tick_us;
+  sub->arg = arg;
+  sub->capacity = capacity;
+
+  pthread_mutex_lock(&bus->lock);
+  int id = 0;
+  while (id < MAX_SUBSCRIBERS && bus->subs[id] != NULL) {
+    id++;
+  }
+  if (id == MAX_SUBSCRIBERS) {
+    pthread_mutex_unlock(&bus->lock);
+    LOGE("Can't add more than %d subscribers", MAX_SUBSCRIBERS);
+    free(sub->slots);
+    free(sub);
+    return -1;
+  }
+
+  sem_init(&sub->items, 0, 0);
+  if (pthread_create(&sub->thread, 0, subscriber_thread, sub) != 0) {
+    pthread_mutex_unlock(&bus->lock);
+    LOGE("Can't create subscriber thread");
+    sem_destroy(&sub->items);
+    free(sub->slots);
+    free(sub);
+    return -1;
+  }
+  atomic_store_explicit(&bus->subs[id], sub, memory_order_release);
+  pthread_mutex_unlock(&bus->lock);
+  return id;
+}
+
+bool report_bus_stats(struct report_bus *bus, int id,
+                      struct subscriber_stats *stats) {
+  if (id < 0 || id >= MAX_SUBSCRIBERS) {
+    return false;
+  }
+
+  pthread_mutex_lock(&bus->lock);
+  const struct subscriber *sub = bus->subs[id];
+  if (sub != NULL) {
+    stats->num_delivered = sub->num_delivered;
+    stats->num_dropped = sub->num_dropped;
+    stats->closed = sub->closed;
+  }
+  pthread_mutex_unlock(&bus->lock);
+  return sub != NULL;
+}
+
+void report_bus_unsubscribe(struct report_bus *bus, int id,
+                            struct subscriber_stats *stats) {
+  if (id < 0 || id >= MAX_SUBSCRIBERS) {
+    return;
+  }
+
+  pthread_mutex_lock(&bus->lock);
+  struct subscriber *sub = bus->subs[id];
+  atomic_store_explicit(&bus->subs[id], NULL, memory_order_release);
+  pthread_mutex_unlock(&bus->lock);
+  if (sub == NULL) {
+    return;
+  }
+
+  // Wait for a publish in progress to finish with the subscriber, which is
+  // while the generation is odd.
+  const uint64_t gen = atomic_load(&bus->publish_gen);
+  if (gen & 1) {
+    while (atomic_load(&bus->publish_gen) == gen) {
+      sched_yield();
+    }
+  }
+
+  sub->stopping = true;
+  sem_post(&sub->items);
+  pthread_join(sub->thread, NULL);
+  sem_destroy(&sub->items);
+
+  if (stats != NULL) {
+    stats->num_delivered = sub->num_delivered;
+    stats->num_dropped = sub->num_dropped;
+    stats->closed = sub->closed;
+  }
+  free(sub->slots);
+  free(sub);
+}
+
+// Called from a single thread. Each subscriber only costs a copy into its
+// own queue here, and a full queue never blocks.
+void report_bus_publish(struct report_bus *bus,
+                        const struct report_view *report,
+                        const struct hop_tag *tag) {
+  struct report_view view = *report;
+  if (!report_view_truncate(&view, bus->max_len)) {
+    return;
+  }
+
+  atomic_fetch_add(&bus->publish_gen, 1);
+  const uint32_t seq = bus->seq++;
+  for (int id = 0; id < MAX_SUBSCRIBERS; id++) {
+    struct subscriber *sub =
+        atomic_load_explicit(&bus->subs[id], memory_order_acquire);
+    if (sub == NULL || sub->closed) {
+      continue;
+    }
+
+    const uint64_t head = atomic_load_explicit(&sub->head, memory_order_relaxed);
+    if (sub->policy == DROP_NEWEST &&
+        head - atomic_load_explicit(&sub->tail, memory_order_acquire) >=
+            sub->capacity) {
+      sub->num_dropped++;
+      continue;
+    }
+
+    struct slot *slot = get_slot(sub, head);
+    atomic_store_explicit(&slot->seq, 2 * head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->bus_seq = seq;
+    slot->tag = *tag;
+    slot->view = view;
+    memcpy(slot->data, view.data, view.len);
+    report_view_move(&slot->view, slot->data);
+    atomic_store_explicit(&slot->seq, 2 * head + 2, memory_order_release);
+    atomic_store_explicit(&sub->head, head + 1, memory_order_release);
+    sem_post(&sub->items);
+  }
+  atomic_fetch_add(&bus->publish_gen, 1);
+}
@@ -0,0 +1,50 @@
+#ifndef REPORT_BUS_H
+#define REPORT_BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spectral-report.h"
+
+enum { MAX_SUBSCRIBERS = 16 };
+
+enum drop_policy {
+  DROP_NEWEST,
+  DROP_OLDEST,
+};
+
+// Called on the subscriber's own thread, with a view of the subscriber's
+// copy of the report. seq counts all published reports, so gaps show what
+// the subscriber lost. Returning false unsubscribes it.
+typedef bool (*report_sink_fn)(void *arg, uint32_t seq,
+                               const struct report_view *report,
+                               const struct hop_tag *tag);
+// Called on the subscriber's own thread about every tick_us, whether or not
+// reports arrive, for sinks that must act on time alone.
+typedef void (*report_tick_fn)(void *arg);
+
+struct subscriber_stats {
+  int64_t num_delivered;
+  int64_t num_dropped;
+  bool closed;
+};
+
+struct report_bus;
+
+// Queue slots hold reports of up to max_len bytes. Longer ones lose their
+// second segment, or are dropped if that is not enough.
+struct report_bus *report_bus_create(size_t max_len);
+void report_bus_destroy(struct report_bus *bus);
+int report_bus_subscribe(struct report_bus *bus, size_t capacity,
+                         enum drop_policy policy, report_sink_fn fn,
+                         report_tick_fn tick_fn, int64_t tick_us, void *arg);
+void report_bus_unsubscribe(struct report_bus *bus, int id,
+                            struct subscriber_stats *stats);
+bool report_bus_stats(struct report_bus *bus, int id,
+                      struct subscriber_stats *stats);
+void report_bus_publish(struct report_bus *bus,
+                        const struct report_view *report,
+                        const struct hop_tag *tag);
+
+#endif
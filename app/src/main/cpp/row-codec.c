@@ -0,0 +1,89 @@
+#include "row-codec.h"
+#include "spectral-report.h"
+
+// Residuals whose Rice quotient reaches this are escaped and stored raw.
+enum { RICE_ESCAPE = 24 };
+enum { RAW_BITS = 9 };
+enum { MAX_RICE_K = 8 };
+enum { DELTA_LEN_BITS = 5 };
+enum { RICE_K_BITS = 4 };
+
+static uint32_t zigzag(int value) {
+  return (uint32_t)(value * 2) ^ (uint32_t)(value >> 31);
+}
+
+static int unzigzag(uint32_t value) {
+  return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static unsigned bit_length(uint32_t value) {
+  unsigned n = 0;
+  while (value >> n) {
+    n++;
+  }
+  return n;
+}
+
+size_t row_codec_max_size(uint16_t bin_pwr_count) {
+  const size_t bits = DELTA_LEN_BITS + 32 + RICE_K_BITS +
+                      (size_t)bin_pwr_count * (RICE_ESCAPE + RAW_BITS);
+  return bits / 8 + 2;
+}
+
+// The time delta is stored as a bit length and the bits themselves, then
+// one Rice parameter for the row and one residual per bin. The first row of
+// a chunk or batch is coded against its neighbouring bin, later rows against the
+// same bin of the previous row.
+void row_codec_encode(struct bit_writer *bw, uint32_t delta,
+                      const int8_t bin_pwr[], const int8_t prev[],
+                      uint16_t bin_pwr_count, bool first) {
+  const unsigned delta_len = bit_length(delta);
+  put_bits(bw, delta_len, DELTA_LEN_BITS);
+  put_bits(bw, delta, delta_len);
+
+  uint32_t residuals[MAX_NUM_BINS];
+  uint64_t sum = 0;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int pred = first ? (bin > 0 ? bin_pwr[bin - 1] : 0) : prev[bin];
+    residuals[bin] = zigzag(bin_pwr[bin] - pred);
+    sum += residuals[bin];
+  }
+
+  unsigned k = 0;
+  while (k < MAX_RICE_K && ((uint64_t)bin_pwr_count << (k + 1)) < sum) {
+    k++;
+  }
+  put_bits(bw, k, RICE_K_BITS);
+
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const uint32_t q = residuals[bin] >> k;
+    if (q < RICE_ESCAPE) {
+      put_bits(bw, (1u << q) - 1, q + 1);
+      put_bits(bw, residuals[bin] & ((1u << k) - 1), k);
+    } else {
+      put_bits(bw, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+      put_bits(bw, residuals[bin], RAW_BITS);
+    }
+  }
+}
+
+uint32_t row_codec_decode(struct bit_reader *br, int8_t bin_pwr[],
+                          uint16_t bin_pwr_count, bool first) {
+  const unsigned delta_len = get_bits(br, DELTA_LEN_BITS);
+  const uint32_t delta = get_bits(br, delta_len);
+  const unsigned k = get_bits(br, RICE_K_BITS);
+
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    uint32_t q = 0;
+    while (q < RICE_ESCAPE && get_bits(br, 1)) {
+      q++;
+    }
+    const uint32_t residual = q < RICE_ESCAPE
+                                  ? (q << k) | get_bits(br, k)
+                                  : get_bits(br, RAW_BITS);
+    const int pred = first ? (bin > 0 ? bin_pwr[bin - 1] : 0) : bin_pwr[bin];
+    bin_pwr[bin] = (int8_t)(pred + unzigzag(residual));
+  }
+
+  return delta;
+}
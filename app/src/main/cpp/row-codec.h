@@ -0,0 +1,67 @@
+#ifndef ROW_CODEC_H
+#define ROW_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lossless coding of rows of bin power, shared by the archive and the
+// exporter. Bits are packed LSB first.
+
+struct bit_writer {
+  uint8_t *buf;
+  size_t pos;
+  uint64_t acc;
+  unsigned num_bits;
+};
+
+static inline void put_bits(struct bit_writer *bw, uint32_t value,
+                            unsigned n) {
+  bw->acc |= (uint64_t)value << bw->num_bits;
+  bw->num_bits += n;
+  while (bw->num_bits >= 8) {
+    bw->buf[bw->pos++] = (uint8_t)bw->acc;
+    bw->acc >>= 8;
+    bw->num_bits -= 8;
+  }
+}
+
+static inline void flush_bits(struct bit_writer *bw) {
+  if (bw->num_bits > 0) {
+    bw->buf[bw->pos++] = (uint8_t)bw->acc;
+  }
+  bw->acc = 0;
+  bw->num_bits = 0;
+}
+
+// Reading past the end yields zero bits, which callers detect by pos
+// exceeding len.
+struct bit_reader {
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  uint64_t acc;
+  unsigned num_bits;
+};
+
+static inline uint32_t get_bits(struct bit_reader *br, unsigned n) {
+  while (br->num_bits < n) {
+    const uint64_t byte = br->pos < br->len ? br->buf[br->pos] : 0;
+    br->pos++;
+    br->acc |= byte << br->num_bits;
+    br->num_bits += 8;
+  }
+  const uint32_t value = (uint32_t)(br->acc & ((1ull << n) - 1));
+  br->acc >>= n;
+  br->num_bits -= n;
+  return value;
+}
+
+size_t row_codec_max_size(uint16_t bin_pwr_count);
+void row_codec_encode(struct bit_writer *bw, uint32_t delta,
+                      const int8_t bin_pwr[], const int8_t prev[],
+                      uint16_t bin_pwr_count, bool first);
+uint32_t row_codec_decode(struct bit_reader *br, int8_t bin_pwr[],
+                          uint16_t bin_pwr_count, bool first);
+
+#endif
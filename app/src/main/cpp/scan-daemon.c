@@ -0,0 +1,751 @@
+#include <android/log.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exporter.h"
+#include "jitter.h"
+#include "report-bus.h"
+#include "scan-engine.h"
+#include "scan-protocol.h"
+#include "spectral-report.h"
+#include "thread-sched.h"
+#include "trace.h"
+
+#define LOG_TAG "spectral-scand"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { MAX_AP_FREQS = 64 };
+enum { MAX_FORWARDS = 8 };
+
+// A consumer stalled for this long loses the report being sent.
+static const int send_timeout_ms = 1000;
+
+// How often the throughput of each radio is logged.
+static const int64_t stats_interval_us = 10000000;
+
+struct daemon_radio {
+  char ifname[IF_NAMESIZE];
+  char ap_ifname[IF_NAMESIZE];
+  int ap_freqs[MAX_AP_FREQS];
+  int ap_freqs_count;
+};
+
+struct daemon_config {
+  struct daemon_radio radios[MAX_RADIOS];
+  int num_radios;
+  uint32_t fft_size;
+  int guard_time;
+  bool guard_drop;
+  int squelch;
+  int squelch_run;
+  bool squelch_drop;
+  char sock_path[108];
+  char forward_paths[MAX_FORWARDS][108];
+  int forwards_count;
+  int queue_size;
+  enum drop_policy drop_policy;
+  bool export_enabled;
+  struct exporter_config export_config;
+  char trace_path[256];
+  struct thread_sched scheds[NUM_THREAD_ROLES];
+};
+
+// Consumers and forward sockets are all subscribers of the report bus,
+// each with its own queue and thread. Forwards don't block, and num_refused
+// counts the reports their socket had no room for.
+struct output {
+  int fd;
+  struct sockaddr_un saddr;
+  int64_t num_refused;
+  bool is_consumer;
+  struct exporter *exporter;
+};
+
+static struct {
+  struct radio_config radios[MAX_RADIOS];
+  struct scan_config config;
+  struct report_bus *bus;
+  int sock_listen;
+  int sock_forward;
+  struct output *outputs[MAX_SUBSCRIBERS];
+} state;
+
+static volatile sig_atomic_t quit;
+
+static void handle_signal(int sig) { quit = 1; }
+
+static char *trim(char *s) {
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return s;
+}
+
+static bool parse_int(const char *value, long min, long max, long *out) {
+  char *end;
+  errno = 0;
+  const long n = strtol(value, &end, 0);
+  if (errno != 0 || end == value || *trim(end) != '\0' || n < min ||
+      n > max) {
+    return false;
+  }
+  *out = n;
+  return true;
+}
+
+static bool parse_ap_freqs(char *value, struct daemon_radio *radio) {
+  radio->ap_freqs_count = 0;
+  for (char *tok = strtok(value, " \t,"); tok != NULL;
+       tok = strtok(NULL, " \t,")) {
+    long freq;
+    if (radio->ap_freqs_count >= MAX_AP_FREQS ||
+        !parse_int(tok, 2000, 7200, &freq)) {
+      return false;
+    }
+    radio->ap_freqs[radio->ap_freqs_count++] = (int)freq;
+  }
+  return true;
+}
+
+// "radio = IFNAME [AP_IFNAME]" adds a radio.
+static bool parse_radio(char *value, struct daemon_config *cfg) {
+  if (cfg->num_radios >= MAX_RADIOS) {
+    return false;
+  }
+  struct daemon_radio *radio = &cfg->radios[cfg->num_radios++];
+  const char *ifname = strtok(value, " \t");
+  const char *ap_ifname = strtok(NULL, " \t");
+  return ifname != NULL && strtok(NULL, " \t") == NULL &&
+         strlcpy(radio->ifname, ifname, sizeof(radio->ifname)) <
+             sizeof(radio->ifname) &&
+         (ap_ifname == NULL ||
+          strlcpy(radio->ap_ifname, ap_ifname, sizeof(radio->ap_ifname)) <
+              sizeof(radio->ap_ifname));
+}
+
+// Lines are "key = value", blank or starting with '#'. The interface,
+// ap_interface and ap_freqs keys set up the radio added last, and before any
+// radio line they set up the first one.
+static bool read_config(const char *path, struct daemon_config *cfg) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[1024];
+  int line_num = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f) != NULL) {
+    line_num++;
+    char *key = trim(line);
+    if (*key == '\0' || *key == '#') {
+      continue;
+    }
+
+    char *sep = strchr(key, '=');
+    if (sep == NULL) {
+      ok = false;
+      break;
+    }
+    *sep = '\0';
+    key = trim(key);
+    char *value = trim(sep + 1);
+
+    long n;
+    if (cfg->num_radios == 0 && (strcmp(key, "interface") == 0 ||
+                                 strcmp(key, "ap_interface") == 0 ||
+                                 strcmp(key, "ap_freqs") == 0)) {
+      cfg->num_radios = 1;
+    }
+    struct daemon_radio *radio =
+        &cfg->radios[cfg->num_radios > 0 ? cfg->num_radios - 1 : 0];
+    if (strcmp(key, "radio") == 0) {
+      ok = parse_radio(value, cfg);
+    } else if (strcmp(key, "interface") == 0) {
+      ok = strlcpy(radio->ifname, value, sizeof(radio->ifname)) <
+           sizeof(radio->ifname);
+    } else if (strcmp(key, "ap_interface") == 0) {
+      ok = strlcpy(radio->ap_ifname, value, sizeof(radio->ap_ifname)) <
+           sizeof(radio->ap_ifname);
+    } else if (strcmp(key, "ap_freqs") == 0) {
+      ok = parse_ap_freqs(value, radio);
+    } else if (strcmp(key, "fft_size") == 0) {
+      ok = parse_int(value, 0, MAX_FFT_SIZE, &n);
+      cfg->fft_size = (uint32_t)n;
+    } else if (strcmp(key, "guard_time") == 0) {
+      ok = parse_int(value, 0, 10000, &n);
+      cfg->guard_time = (int)n;
+    } else if (strcmp(key, "guard_drop") == 0) {
+      ok = parse_int(value, 0, 1, &n);
+      cfg->guard_drop = n != 0;
+    } else if (strcmp(key, "squelch") == 0) {
+      ok = parse_int(value, 0, 60, &n);
+      cfg->squelch = (int)n;
+    } else if (strcmp(key, "squelch_run") == 0) {
+      ok = parse_int(value, 1, MAX_SQUELCH_RUN, &n);
+      cfg->squelch_run = (int)n;
+    } else if (strcmp(key, "squelch_drop") == 0) {
+      ok = parse_int(value, 0, 1, &n);
+      cfg->squelch_drop = n != 0;
+    } else if (strcmp(key, "socket") == 0) {
+      ok = strlcpy(cfg->sock_path, value, sizeof(cfg->sock_path)) <
+           sizeof(cfg->sock_path);
+    } else if (strcmp(key, "queue_size") == 0) {
+      ok = parse_int(value, 1, 65536, &n);
+      cfg->queue_size = (int)n;
+    } else if (strcmp(key, "drop_policy") == 0) {
+      if (strcmp(value, "oldest") == 0) {
+        cfg->drop_policy = DROP_OLDEST;
+      } else if (strcmp(value, "newest") == 0) {
+        cfg->drop_policy = DROP_NEWEST;
+      } else {
+        ok = false;
+      }
+    } else if (strcmp(key, "export") == 0) {
+      ok = exporter_parse_url(value, &cfg->export_config);
+      cfg->export_enabled = ok;
+    } else if (strcmp(key, "export_latency") == 0) {
+      ok = parse_int(value, 1, 60000, &n);
+      cfg->export_config.batch_us = n * 1000;
+    } else if (strcmp(key, "export_rows") == 0) {
+      ok = parse_int(value, 1, UINT16_MAX, &n);
+      cfg->export_config.max_rows = (uint16_t)n;
+    } else if (strcmp(key, "device_id") == 0) {
+      ok = parse_int(value, 0, INT32_MAX, &n);
+      cfg->export_config.device_id = (uint32_t)n;
+    } else if (strcmp(key, "sched_scan") == 0) {
+      ok = thread_sched_parse(value, &cfg->scheds[THREAD_SCAN]);
+    } else if (strcmp(key, "sched_hop") == 0) {
+      ok = thread_sched_parse(value, &cfg->scheds[THREAD_HOP]);
+    } else if (strcmp(key, "sched_forward") == 0) {
+      ok = thread_sched_parse(value, &cfg->scheds[THREAD_FORWARD]);
+    } else if (strcmp(key, "trace") == 0) {
+      ok = strlcpy(cfg->trace_path, value, sizeof(cfg->trace_path)) <
+           sizeof(cfg->trace_path);
+    } else if (strcmp(key, "forward") == 0) {
+      ok = cfg->forwards_count < MAX_FORWARDS &&
+           strlcpy(cfg->forward_paths[cfg->forwards_count++], value,
+                   sizeof(cfg->forward_paths[0])) <
+               sizeof(cfg->forward_paths[0]);
+    } else {
+      ok = false;
+    }
+  }
+  fclose(f);
+
+  if (!ok) {
+    fprintf(stderr, "%s:%d: invalid setting\n", path, line_num);
+    return false;
+  }
+  if (cfg->num_radios == 0) {
+    cfg->num_radios = 1;
+  }
+  if (cfg->sock_path[0] == '\0' && cfg->forwards_count == 0 &&
+      !cfg->export_enabled) {
+    fprintf(stderr, "%s: no socket, forward or export output\n", path);
+    return false;
+  }
+  return true;
+}
+
+static bool send_consumer(void *arg, uint32_t seq,
+                          const struct report_view *report,
+                          const struct hop_tag *tag) {
+  const struct output *out = arg;
+  struct scan_frame frame = {
+      .magic = SCAN_PROTO_MAGIC,
+      .version = SCAN_PROTO_VERSION,
+      .type = SCAN_FRAME_REPORT,
+      .length = (uint32_t)(report->len + sizeof(*tag)),
+      .seq = seq,
+  };
+  struct iovec iov[] = {
+      {.iov_base = &frame, .iov_len = sizeof(frame)},
+      {.iov_base = (void *)report->data, .iov_len = report->len},
+      {.iov_base = (void *)tag, .iov_len = sizeof(*tag)},
+  };
+  const struct msghdr msgh = {
+      .msg_iov = iov,
+      .msg_iovlen = sizeof(iov) / sizeof(iov[0]),
+  };
+  return sendmsg(out->fd, &msgh, MSG_NOSIGNAL) >= 0 || errno == EAGAIN ||
+         errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static bool send_forward(void *arg, uint32_t seq,
+                         const struct report_view *report,
+                         const struct hop_tag *tag) {
+  struct output *out = arg;
+  struct iovec iov[] = {
+      {.iov_base = (void *)report->data, .iov_len = report->len},
+      {.iov_base = (void *)tag, .iov_len = sizeof(*tag)},
+  };
+  const struct msghdr msgh = {
+      .msg_name = (void *)&out->saddr,
+      .msg_namelen = sizeof(out->saddr),
+      .msg_iov = iov,
+      .msg_iovlen = sizeof(iov) / sizeof(iov[0]),
+  };
+  if (sendmsg(state.sock_forward, &msgh, MSG_DONTWAIT) < 0 &&
+      (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    out->num_refused++;
+  }
+  return true;
+}
+
+static bool send_export(void *arg, uint32_t seq,
+                        const struct report_view *report,
+                        const struct hop_tag *tag) {
+  const struct output *out = arg;
+  exporter_push(out->exporter, seq, report, tag);
+  return true;
+}
+
+static void tick_export(void *arg) {
+  const struct output *out = arg;
+  exporter_tick(out->exporter);
+}
+
+static void remove_output(int id) {
+  struct output *out = state.outputs[id];
+  struct subscriber_stats stats = {0};
+  report_bus_unsubscribe(state.bus, id, &stats);
+  if (out->exporter != NULL) {
+    struct exporter_stats ex_stats;
+    exporter_close(out->exporter, &ex_stats);
+    LOGI("Exported %" PRId64 " reports in %" PRId64 " batches of %" PRId64
+         " bytes, %" PRId64 " batches lost, %" PRId64 " dropped",
+         ex_stats.num_reports, ex_stats.num_batches, ex_stats.num_bytes,
+         ex_stats.num_lost, stats.num_dropped);
+  } else if (out->is_consumer) {
+    LOGI("Consumer %d left after %" PRId64 " reports, %" PRId64 " dropped",
+         id, stats.num_delivered, stats.num_dropped);
+    close(out->fd);
+  } else {
+    LOGI("Forwarded %" PRId64 " reports to %s, %" PRId64 " dropped, %" PRId64
+         " refused",
+         stats.num_delivered, out->saddr.sun_path, stats.num_dropped,
+         out->num_refused);
+  }
+  free(out);
+  state.outputs[id] = NULL;
+}
+
+static bool add_output(struct output *out, const struct daemon_config *cfg) {
+  // Ticking at half the export latency sends a batch at most half of it
+  // late when the reports stop.
+  const int id = report_bus_subscribe(
+      state.bus, (size_t)cfg->queue_size, cfg->drop_policy,
+      out->exporter != NULL ? send_export
+      : out->is_consumer    ? send_consumer
+                            : send_forward,
+      out->exporter != NULL ? tick_export : NULL,
+      cfg->export_config.batch_us / 2, out);
+  if (id < 0) {
+    return false;
+  }
+  state.outputs[id] = out;
+  if (out->is_consumer) {
+    LOGI("Consumer %d joined", id);
+  }
+  return true;
+}
+
+static void accept_consumer(const struct daemon_config *cfg) {
+  const int fd = accept(state.sock_listen, NULL, NULL);
+  if (fd < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      LOGW("Can't accept consumer: %s", strerror(errno));
+    }
+    return;
+  }
+
+  const struct timeval timeout = {
+      .tv_sec = send_timeout_ms / 1000,
+      .tv_usec = send_timeout_ms % 1000 * 1000,
+  };
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  const struct scan_config *config = &state.config;
+  struct {
+    struct scan_frame frame;
+    struct scan_hello hello;
+    int32_t radio_freqs[MAX_RADIOS * (1 + MAX_AP_FREQS)];
+  } msg = {
+      .frame =
+          {
+              .magic = SCAN_PROTO_MAGIC,
+              .version = SCAN_PROTO_VERSION,
+              .type = SCAN_FRAME_HELLO,
+          },
+      .hello =
+          {
+              .fft_size = config->fft_size,
+              .guard_us = (uint32_t)config->guard_us,
+              .flags = (config->guard_drop ? SCAN_HELLO_GUARD_DROP : 0) |
+                       (config->squelch_drop ? SCAN_HELLO_SQUELCH_DROP : 0),
+              .num_radios = (uint32_t)config->num_radios,
+              .squelch_db = (uint32_t)config->squelch_db,
+              .squelch_run = config->squelch_run,
+          },
+  };
+  size_t num_words = 0;
+  for (int idx = 0; idx < config->num_radios; idx++) {
+    const struct radio_config *radio = &config->radios[idx];
+    msg.radio_freqs[num_words++] = radio->ap_freqs_count;
+    for (int freq_idx = 0; freq_idx < radio->ap_freqs_count; freq_idx++) {
+      msg.radio_freqs[num_words++] = radio->ap_freqs[freq_idx];
+    }
+    msg.hello.num_ap_freqs += (uint32_t)radio->ap_freqs_count;
+  }
+  msg.frame.length =
+      (uint32_t)(sizeof(msg.hello) + num_words * sizeof(int32_t));
+  if (send(fd, &msg, sizeof(msg.frame) + msg.frame.length, MSG_NOSIGNAL) < 0) {
+    LOGW("Can't greet consumer: %s", strerror(errno));
+    close(fd);
+    return;
+  }
+
+  struct output *out = calloc(1, sizeof(struct output));
+  if (out == NULL) {
+    LOGE("Can't allocate consumer");
+    close(fd);
+    return;
+  }
+  out->fd = fd;
+  out->is_consumer = true;
+  if (!add_output(out, cfg)) {
+    close(fd);
+    free(out);
+  }
+}
+
+// Consumers whose socket failed unsubscribed themselves and are reaped here.
+static void reap_consumers(void) {
+  for (int id = 0; id < MAX_SUBSCRIBERS; id++) {
+    struct subscriber_stats stats;
+    if (state.outputs[id] != NULL &&
+        report_bus_stats(state.bus, id, &stats) && stats.closed) {
+      remove_output(id);
+    }
+  }
+}
+
+static bool open_outputs(const struct daemon_config *cfg) {
+  state.sock_listen = -1;
+  state.sock_forward = -1;
+
+  if (cfg->forwards_count > 0) {
+    state.sock_forward = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (state.sock_forward < 0) {
+      LOGE("Can't create forward socket: %s", strerror(errno));
+      return false;
+    }
+    for (int idx = 0; idx < cfg->forwards_count; idx++) {
+      struct output *out = calloc(1, sizeof(struct output));
+      if (out == NULL) {
+        LOGE("Can't allocate forward output");
+        return false;
+      }
+      out->saddr.sun_family = AF_UNIX;
+      strlcpy(out->saddr.sun_path, cfg->forward_paths[idx],
+              sizeof(out->saddr.sun_path));
+      if (!add_output(out, cfg)) {
+        free(out);
+        return false;
+      }
+    }
+  }
+
+  if (cfg->export_enabled) {
+    struct output *out = calloc(1, sizeof(struct output));
+    if (out == NULL) {
+      LOGE("Can't allocate export output");
+      return false;
+    }
+    out->exporter = exporter_open(&cfg->export_config);
+    if (out->exporter == NULL) {
+      free(out);
+      return false;
+    }
+    if (!add_output(out, cfg)) {
+      exporter_close(out->exporter, NULL);
+      free(out);
+      return false;
+    }
+  }
+
+  if (cfg->sock_path[0] == '\0') {
+    return true;
+  }
+
+  state.sock_listen =
+      socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (state.sock_listen < 0) {
+    LOGE("Can't create consumer socket: %s", strerror(errno));
+    return false;
+  }
+
+  struct sockaddr_un saddr = {.sun_family = AF_UNIX};
+  strlcpy(saddr.sun_path, cfg->sock_path, sizeof(saddr.sun_path));
+  unlink(cfg->sock_path);
+  if (bind(state.sock_listen, (struct sockaddr *)&saddr, sizeof(saddr)) < 0) {
+    LOGE("Can't bind consumer socket: %s", strerror(errno));
+    return false;
+  }
+  if (chmod(cfg->sock_path, 0660) < 0) {
+    LOGW("Can't set consumer socket mode: %s", strerror(errno));
+  }
+  if (listen(state.sock_listen, MAX_SUBSCRIBERS) < 0) {
+    LOGE("Can't listen on consumer socket: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void close_outputs(const struct daemon_config *cfg) {
+  for (int id = 0; id < MAX_SUBSCRIBERS; id++) {
+    if (state.outputs[id] != NULL) {
+      remove_output(id);
+    }
+  }
+  if (state.sock_listen >= 0) {
+    close(state.sock_listen);
+    unlink(cfg->sock_path);
+  }
+  if (state.sock_forward >= 0) {
+    close(state.sock_forward);
+  }
+}
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void log_radio_stats(struct radio_stats last[], double elapsed) {
+  struct radio_stats stats[MAX_RADIOS];
+  const int count = scan_engine_stats(stats, MAX_RADIOS);
+  for (int idx = 0; idx < count; idx++) {
+    const int64_t reports = stats[idx].num_reports - last[idx].num_reports;
+    const int64_t squelched =
+        stats[idx].num_squelched - last[idx].num_squelched;
+    LOGI("%s: %.0f reports/s, %.0f published/s, %" PRId64 " in guard, "
+         "%.1f%% squelched into %" PRId64 " summaries",
+         stats[idx].ifname, (double)reports / elapsed,
+         (double)(stats[idx].num_published - last[idx].num_published) /
+             elapsed,
+         stats[idx].num_guarded - last[idx].num_guarded,
+         reports > 0 ? 100.0 * (double)squelched / (double)reports : 0.0,
+         stats[idx].num_summaries - last[idx].num_summaries);
+    char text[256];
+    jitter_format(&stats[idx].scan_jitter, false, text, sizeof(text));
+    LOGI("%s: scan dwell %s", stats[idx].ifname, text);
+    jitter_format(&stats[idx].hop_jitter, false, text, sizeof(text));
+    LOGI("%s: hop period %s", stats[idx].ifname, text);
+    last[idx] = stats[idx];
+  }
+}
+
+// Pushes synthetic reports through the configured exporter as fast as it
+// takes them: a noise floor with a few carriers, hopping between channels.
+static int bench_export(const struct daemon_config *cfg, long num_reports) {
+  if (!cfg->export_enabled) {
+    fprintf(stderr, "No export configured\n");
+    return 2;
+  }
+
+  struct exporter *ex = exporter_open(&cfg->export_config);
+  if (ex == NULL) {
+    return 1;
+  }
+
+  enum { BENCH_BINS = 128 };
+  static const uint16_t freqs[] = {2412, 2437, 2462};
+  uint8_t report[REPORT_BINS_OFFSET + BENCH_BINS] = {0};
+  const uint32_t signature = REPORT_SIGNATURE;
+  memcpy(report, &signature, sizeof(signature));
+  struct hop_tag tag = {.magic = HOP_TAG_MAGIC};
+  int32_t tstamp = 0;
+  uint32_t rand_state = 1;
+  int64_t raw_bytes = 0;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long idx = 0; idx < num_reports; idx++) {
+    const uint16_t center_freq = freqs[idx / 64 % 3];
+    const uint16_t bin_pwr_count = BENCH_BINS;
+    tstamp += 150;
+    memcpy(report + REPORT_FREQ_OFFSET, &center_freq, sizeof(center_freq));
+    memcpy(report + REPORT_TSTAMP_OFFSET, &tstamp, sizeof(tstamp));
+    memcpy(report + REPORT_BIN_COUNT_OFFSET, &bin_pwr_count,
+           sizeof(bin_pwr_count));
+    for (int bin = 0; bin < BENCH_BINS; bin++) {
+      rand_state = rand_state * 1103515245 + 12345;
+      int pwr = -95 + (int)(rand_state >> 16) % 7 - 3;
+      if (bin % 40 == 10 && idx % 8 < 3) {
+        pwr += 30;
+      }
+      report[REPORT_BINS_OFFSET + bin] = (uint8_t)(int8_t)pwr;
+    }
+    struct report_view view;
+    report_view_parse(&view, report, sizeof(report));
+    exporter_push(ex, (uint32_t)idx, &view, &tag);
+    raw_bytes += (int64_t)sizeof(report);
+  }
+  struct exporter_stats stats;
+  exporter_close(ex, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  const double elapsed = (double)(end.tv_sec - start.tv_sec) +
+                         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("Exported %" PRId64 " reports in %.3f s: %.0f reports/s, "
+         "%.1f bytes/report (%.1fx), %" PRId64 " batches, %" PRId64
+         " lost\n",
+         stats.num_reports, elapsed, (double)stats.num_reports / elapsed,
+         (double)stats.num_bytes / (double)stats.num_reports,
+         stats.num_bytes > 0 ? (double)raw_bytes / (double)stats.num_bytes
+                             : 0.0,
+         stats.num_batches,
+         stats.num_lost);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *prog = argv[0];
+  long bench_reports = 0;
+  if (argc == 4 && strcmp(argv[1], "--bench-export") == 0) {
+    bench_reports = strtol(argv[2], NULL, 0);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc != 2 || bench_reports < 0) {
+    fprintf(stderr, "Usage: %s [--bench-export NUM_REPORTS] CONFIG\n", prog);
+    return 2;
+  }
+
+  static struct daemon_config cfg = {
+      .fft_size = 6,
+      .squelch_run = DEFAULT_SQUELCH_RUN,
+      .queue_size = 256,
+      .drop_policy = DROP_OLDEST,
+      .export_config =
+          {
+              .batch_us = 50000,
+              .max_rows = 256,
+          },
+  };
+  if (!read_config(argv[1], &cfg)) {
+    return 2;
+  }
+
+  if (bench_reports > 0) {
+    return bench_export(&cfg, bench_reports);
+  }
+
+  if (cfg.trace_path[0] != '\0' &&
+      !trace_start(cfg.trace_path, "spectral-scand")) {
+    fprintf(stderr, "Can't start trace to %s, see logcat\n", cfg.trace_path);
+    return 1;
+  }
+
+  state.bus = report_bus_create(report_max_len(cfg.fft_size));
+  if (state.bus == NULL) {
+    fprintf(stderr, "Can't allocate report bus\n");
+    trace_stop();
+    return 1;
+  }
+
+  if (!open_outputs(&cfg)) {
+    fprintf(stderr, "Can't open outputs, see logcat\n");
+    close_outputs(&cfg);
+    report_bus_destroy(state.bus);
+    trace_stop();
+    return 1;
+  }
+
+  for (int idx = 0; idx < cfg.num_radios; idx++) {
+    const struct daemon_radio *radio = &cfg.radios[idx];
+    state.radios[idx] = (struct radio_config){
+        .ifname = radio->ifname[0] != '\0' ? radio->ifname : NULL,
+        .ap_ifname = radio->ap_ifname[0] != '\0' ? radio->ap_ifname : NULL,
+        .ap_freqs = radio->ap_freqs,
+        .ap_freqs_count = radio->ap_freqs_count,
+    };
+  }
+  state.config = (struct scan_config){
+      .radios = state.radios,
+      .num_radios = cfg.num_radios,
+      .fft_size = cfg.fft_size,
+      .guard_us = (int64_t)cfg.guard_time * 1000,
+      .guard_drop = cfg.guard_drop,
+      .squelch_db = cfg.squelch,
+      .squelch_run = (uint32_t)cfg.squelch_run,
+      .squelch_drop = cfg.squelch_drop,
+  };
+  memcpy(state.config.scheds, cfg.scheds, sizeof(state.config.scheds));
+  if (!scan_engine_start(&state.config, state.bus)) {
+    fprintf(stderr, "Can't start spectral scan, see logcat\n");
+    close_outputs(&cfg);
+    report_bus_destroy(state.bus);
+    trace_stop();
+    return 1;
+  }
+
+  // Installed after the engine's own SIGINT handler, without SA_RESTART so
+  // that poll returns on a signal.
+  struct sigaction sa = {.sa_handler = handle_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  LOGI("Scanning with FFT size %" PRIu32 " on %d radios", cfg.fft_size,
+       cfg.num_radios);
+
+  struct radio_stats last_stats[MAX_RADIOS];
+  scan_engine_stats(last_stats, MAX_RADIOS);
+  int64_t last_log = now_us();
+  while (!quit) {
+    struct pollfd pfd = {.fd = state.sock_listen, .events = POLLIN};
+    if (poll(&pfd, state.sock_listen >= 0 ? 1 : 0, 1000) > 0) {
+      accept_consumer(&cfg);
+    }
+    reap_consumers();
+
+    const int64_t now = now_us();
+    if (now - last_log >= stats_interval_us) {
+      log_radio_stats(last_stats, (double)(now - last_log) / 1e6);
+      last_log = now;
+    }
+  }
+
+  scan_engine_stop();
+  close_outputs(&cfg);
+  report_bus_destroy(state.bus);
+  trace_stop();
+  return 0;
+}
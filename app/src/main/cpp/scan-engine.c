@@ -0,0 +1,1038 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/nl80211.h>
+#include <math.h>
+#include <net/if.h>
+#include <netlink/attr.h>
+#include <netlink/errno.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+#include <netlink/msg.h>
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+#include <pthread.h>
+#include <qca-vendor.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/system_properties.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "noise-floor.h"
+#include "scan-engine.h"
+#include "spectral-report.h"
+#include "trace.h"
+
+#define LOG_TAG "spectral-scan"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// A scan runs for scan_dwell_us between its start and stop. The hotspot
+// switches channels every hop_ticks ticks of hop_tick_us.
+static const int64_t scan_dwell_us = 10000;
+static const int64_t hop_tick_us = 20000;
+static const unsigned hop_ticks = 50;
+
+// How far in MHz the center of a report may be from the channel its radio
+// is tuned to, as for an 80 MHz channel.
+enum { MAX_AP_FREQ_OFFSET = 30 };
+
+// The quiet reports of a radio held back since its last summary, and the
+// noise floor they are judged against.
+struct squelch {
+  struct noise_floor *floor;
+  uint32_t count;
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  struct hop_tag tag;
+  uint8_t header[REPORT_BINS_OFFSET];
+  int8_t max_pwr[MAX_NUM_BINS];
+  int32_t sum_pwr[MAX_NUM_BINS];
+  float sum_mw[MAX_NUM_BINS];
+  uint8_t summary[REPORT_BINS_OFFSET + REPORT_SUMMARY_BLOCKS * MAX_NUM_BINS];
+};
+
+static float pwr_to_mw[256];
+
+struct radio {
+  char ifname[PROP_VALUE_MAX];
+  unsigned ifindex;
+  bool has_mac;
+  uint8_t mac[REPORT_MAC_LEN];
+  atomic_uint_least32_t ap_ifindex;
+  int *ap_freqs;
+  int ap_freqs_count;
+  atomic_uint_least32_t ap_freq;
+  atomic_uint_least32_t scan_freq;
+  atomic_int_least64_t hop_request_time;
+  pthread_mutex_t hop_lock;
+  uint32_t hop_epoch;
+  uint32_t hop_switch_us;
+  int64_t hop_switch_time;
+  atomic_int_least64_t num_reports;
+  atomic_int_least64_t num_guarded;
+  atomic_int_least64_t num_squelched;
+  atomic_int_least64_t num_summaries;
+  atomic_int_least64_t num_published;
+  struct jitter scan_jitter;
+  struct jitter hop_jitter;
+  struct squelch *squelch;
+  int send_fam;
+  struct nl_sock *nl_sock_send;
+  struct nl_sock *nl_sock_ap_ctrl;
+  struct nl_sock *nl_sock_ap_event;
+  pthread_t ap_ctrl_thread;
+  pthread_t scan_thread;
+};
+
+static struct {
+  atomic_bool running;
+  uint32_t fft_size;
+  int64_t guard_us;
+  bool guard_drop;
+  int squelch_db;
+  uint32_t squelch_run;
+  bool squelch_drop;
+  struct thread_sched scheds[NUM_THREAD_ROLES];
+  size_t max_len;
+  struct report_bus *bus;
+  struct radio radios[MAX_RADIOS];
+  int num_radios;
+  atomic_int_least64_t num_unattributed;
+  struct nl_sock *nl_sock_recv;
+  pthread_t forward_thread;
+} engine;
+
+static void handle_sigint(int sig) {}
+
+static int64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void switch_ap_freq(struct radio *radio, int freq) {
+  if (radio->ap_ifindex == 0) {
+    LOGE("Can't get AP interface index: %s", strerror(errno));
+    return;
+  }
+
+  struct nl_msg *msg = nlmsg_alloc();
+  if (msg == NULL) {
+    LOGE("Can't allocate Netlink message for AP channel switch");
+    return;
+  }
+
+  if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, radio->send_fam, 0,
+                  NLM_F_REQUEST, NL80211_CMD_CHANNEL_SWITCH, 0) == NULL) {
+    LOGE("Can't add Generic Netlink header for AP channel switch");
+    goto nla_put_failure;
+  }
+
+  NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, radio->ap_ifindex);
+  NLA_PUT_U32(msg, NL80211_ATTR_CH_SWITCH_COUNT, 1);
+  NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, (uint32_t)freq);
+  NLA_PUT(msg, NL80211_ATTR_BEACON_TAIL, 0, NULL);
+
+  struct nlattr *nest = nla_nest_start(msg, NL80211_ATTR_CSA_IES);
+  if (nest == NULL) {
+    goto nla_put_failure;
+  }
+
+  const uint8_t tail[] = {37, 3, 0, 0, 1};
+  NLA_PUT(msg, NL80211_ATTR_BEACON_TAIL, sizeof(tail), tail);
+  NLA_PUT_U16(msg, NL80211_ATTR_CSA_C_OFF_BEACON, sizeof(tail) - 1);
+
+  if (nla_nest_end(msg, nest) < 0) {
+    goto nla_put_failure;
+  }
+
+  if ((int)radio->ap_freq != freq) {
+    radio->hop_request_time = now_us();
+  }
+
+  const int64_t span_start = trace_begin();
+  int nl_err = nl_send_sync(radio->nl_sock_ap_ctrl, msg);
+  trace_end(TRACE_CHANNEL_SWITCH, span_start, freq);
+  if (nl_err < 0) {
+    radio->hop_request_time = 0;
+  }
+  if (nl_err < 0 && (nl_err != -NLE_INVAL || (int)radio->ap_freq != freq)) {
+    LOGW("Can't switch AP channel to %d MHz: %s", freq, nl_geterror(nl_err));
+  }
+
+  return;
+nla_put_failure:
+  nlmsg_free(msg);
+}
+
+static void *ap_ctrl_thread(void *arg) {
+  struct radio *radio = arg;
+  if (radio->ap_freqs_count <= 0) {
+    return NULL;
+  }
+  char name[16];
+  snprintf(name, sizeof(name), "ap-%s", radio->ifname);
+  pthread_setname_np(pthread_self(), name);
+  thread_sched_apply(&engine.scheds[THREAD_HOP]);
+
+  // Ticks are counted from fixed deadlines, so that the time a switch takes
+  // does not add up over the hops.
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  int64_t last_request = 0;
+  int chan_idx = 0;
+  unsigned counter = 0;
+  while (engine.running) {
+    if (counter == 0) {
+      const int64_t request = now_us();
+      if (last_request != 0) {
+        jitter_record(&radio->hop_jitter, request - last_request);
+      }
+      last_request = request;
+      switch_ap_freq(radio, radio->ap_freqs[chan_idx]);
+    }
+    deadline.tv_nsec += hop_tick_us * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    // A signal wakes the thread to check for stopping, and otherwise the
+    // same deadline is slept to again.
+    int rc;
+    do {
+      rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    } while (rc == EINTR && engine.running);
+    if (++counter >= hop_ticks) {
+      counter = 0;
+      chan_idx++;
+      chan_idx %= radio->ap_freqs_count;
+    }
+  }
+
+  return NULL;
+}
+
+// Must be called with hop_lock held.
+static void check_ap_freq(struct radio *radio) {
+  static const int64_t max_switch_us = 500000;
+  const int sock = nl_socket_get_fd(radio->nl_sock_ap_event);
+
+  for (;;) {
+    uint8_t msg[4096];
+    const ssize_t msg_len = recv(sock, msg, sizeof(msg), MSG_DONTWAIT);
+    if (msg_len < 0) {
+      const int64_t request_time = radio->hop_request_time;
+      if (request_time != 0 && now_us() - request_time > max_switch_us) {
+        LOGW("AP channel switch not confirmed, giving up");
+        radio->hop_request_time = 0;
+      }
+      return;
+    }
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
+    if (!nlmsg_ok(nlh, (int)msg_len)) {
+      continue;
+    }
+    if (!genlmsg_valid_hdr(nlh, 0)) {
+      continue;
+    }
+
+    const struct genlmsghdr *gnlh = genlmsg_hdr(nlh);
+    if (gnlh->cmd != NL80211_CMD_CH_SWITCH_NOTIFY) {
+      continue;
+    }
+
+    uint32_t ifindex = 0;
+    uint32_t freq = 0;
+    const struct nlattr *nla;
+    int rem;
+    nla_for_each_attr(nla, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+                      rem) {
+      if (nla_type(nla) == NL80211_ATTR_IFINDEX) {
+        ifindex = nla_get_u32(nla);
+      } else if (nla_type(nla) == NL80211_ATTR_WIPHY_FREQ) {
+        freq = nla_get_u32(nla);
+      }
+    }
+
+    // Every radio sees the notifications of all interfaces. A single radio
+    // follows the hotspot wherever it is recreated.
+    if (engine.num_radios == 1 && ifindex != 0) {
+      radio->ap_ifindex = ifindex;
+    } else if (ifindex != radio->ap_ifindex && ifindex != radio->ifindex) {
+      continue;
+    }
+
+    if (freq == 0) {
+      continue;
+    }
+
+    const int64_t switch_time = now_us();
+    const int64_t request_time = radio->hop_request_time;
+    radio->hop_switch_us =
+        request_time != 0 ? (uint32_t)(switch_time - request_time) : 0;
+    radio->hop_switch_time = switch_time;
+    radio->hop_request_time = 0;
+    radio->hop_epoch++;
+    radio->ap_freq = freq;
+    radio->scan_freq = freq;
+    trace_instant(TRACE_SWITCH_NOTIFY, radio->hop_epoch);
+  }
+}
+
+static void *scan_thread(void *arg) {
+  struct radio *radio = arg;
+  char name[16];
+  snprintf(name, sizeof(name), "scan-%s", radio->ifname);
+  pthread_setname_np(pthread_self(), name);
+  thread_sched_apply(&engine.scheds[THREAD_SCAN]);
+
+  while (engine.running) {
+    struct nl_msg *msg_start = nlmsg_alloc();
+    if (msg_start == NULL) {
+      LOGE("Can't allocate Netlink message for scan start");
+      continue;
+    }
+
+    struct nl_msg *msg_stop = nlmsg_alloc();
+    if (msg_stop == NULL) {
+      LOGE("Can't allocate Netlink message for scan stop");
+      nlmsg_free(msg_start);
+      continue;
+    }
+
+    if (genlmsg_put(msg_start, NL_AUTO_PORT, NL_AUTO_SEQ, radio->send_fam, 0, 0,
+                    NL80211_CMD_VENDOR, 0) == NULL) {
+      LOGE("Can't add Generic Netlink header for scan start");
+      goto nla_put_failure;
+    }
+    if (genlmsg_put(msg_stop, NL_AUTO_PORT, NL_AUTO_SEQ, radio->send_fam, 0, 0,
+                    NL80211_CMD_VENDOR, 0) == NULL) {
+      LOGE("Can't add Generic Netlink header for scan stop");
+      goto nla_put_failure;
+    }
+
+    NLA_PUT_U32(msg_start, NL80211_ATTR_IFINDEX, radio->ifindex);
+    NLA_PUT_U32(msg_stop, NL80211_ATTR_IFINDEX, radio->ifindex);
+
+    NLA_PUT_U32(msg_start, NL80211_ATTR_VENDOR_ID, OUI_QCA);
+    NLA_PUT_U32(msg_stop, NL80211_ATTR_VENDOR_ID, OUI_QCA);
+
+    NLA_PUT_U32(msg_start, NL80211_ATTR_VENDOR_SUBCMD,
+                QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_START);
+    NLA_PUT_U32(msg_stop, NL80211_ATTR_VENDOR_SUBCMD,
+                QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_STOP);
+
+    struct nlattr *nest = nla_nest_start(msg_start, NL80211_ATTR_VENDOR_DATA);
+    if (nest == NULL) {
+      LOGE("Can't start config data");
+      goto nla_put_failure;
+    }
+
+#define SPECTRAL_CONFIG(k, v)                                                  \
+  NLA_PUT_U32(msg_start, QCA_WLAN_VENDOR_ATTR_SPECTRAL_SCAN_CONFIG_##k, (v))
+
+    SPECTRAL_CONFIG(SCAN_COUNT, 0);
+    SPECTRAL_CONFIG(SCAN_PERIOD, 0);
+    SPECTRAL_CONFIG(FFT_SIZE, engine.fft_size);
+    SPECTRAL_CONFIG(INIT_DELAY, 0);
+    SPECTRAL_CONFIG(PWR_FORMAT, 1);
+    SPECTRAL_CONFIG(RPT_MODE, 3);
+    SPECTRAL_CONFIG(DBM_ADJ, 1);
+
+#undef SPECTRAL_CONFIG
+
+    int nl_err = nla_nest_end(msg_start, nest);
+    if (nl_err < 0) {
+      LOGE("Can't end config data: %s", nl_geterror(nl_err));
+      goto nla_put_failure;
+    }
+
+    pthread_mutex_lock(&radio->hop_lock);
+    check_ap_freq(radio);
+    pthread_mutex_unlock(&radio->hop_lock);
+
+    const uint32_t scan_freq = radio->scan_freq;
+    int64_t span_start = trace_begin();
+    nl_err = nl_send_sync(radio->nl_sock_send, msg_start);
+    trace_end(TRACE_SCAN_START, span_start, scan_freq);
+    if (nl_err < 0) {
+      LOGW("Can't start spectral scan: %s", nl_geterror(nl_err));
+    }
+
+    const int64_t dwell_start = now_us();
+    usleep((useconds_t)scan_dwell_us);
+    jitter_record(&radio->scan_jitter, now_us() - dwell_start);
+
+    span_start = trace_begin();
+    nl_err = nl_send_sync(radio->nl_sock_send, msg_stop);
+    trace_end(TRACE_SCAN_STOP, span_start, scan_freq);
+    if (nl_err < 0) {
+      LOGW("Can't stop spectral scan: %s", nl_geterror(nl_err));
+    }
+
+    continue;
+  nla_put_failure:
+    nlmsg_free(msg_start);
+    nlmsg_free(msg_stop);
+  }
+
+  return NULL;
+}
+
+// The driver sends the reports of all its radios to the same cld80211
+// multicast group, and a report names its radio by the MAC address of the
+// interface scanned on. Reports with an address of no radio only go to the
+// one radio tuned within MAX_AP_FREQ_OFFSET of them, and to none when that
+// is several radios or none, as they can't be told apart.
+static struct radio *find_radio(const struct report_view *report) {
+  if (engine.num_radios == 1) {
+    return &engine.radios[0];
+  }
+
+  const uint8_t *mac = report->data + REPORT_MAC_OFFSET;
+  for (int idx = 0; idx < engine.num_radios; idx++) {
+    struct radio *radio = &engine.radios[idx];
+    if (radio->has_mac && memcmp(radio->mac, mac, REPORT_MAC_LEN) == 0) {
+      return radio;
+    }
+  }
+
+  struct radio *match = NULL;
+  for (int idx = 0; report->center_freq != 0 && idx < engine.num_radios;
+       idx++) {
+    struct radio *radio = &engine.radios[idx];
+    if (abs((int)radio->scan_freq - report->center_freq) <=
+        MAX_AP_FREQ_OFFSET) {
+      if (match != NULL) {
+        return NULL;
+      }
+      match = radio;
+    }
+  }
+  return match;
+}
+
+// Publishes the quiet reports held back for a radio as one summary.
+static void flush_squelch(struct radio *radio) {
+  struct squelch *sq = radio->squelch;
+  if (sq->count == 0) {
+    return;
+  }
+
+  const uint16_t bin_pwr_count = sq->bin_pwr_count;
+  uint8_t *const summary = sq->summary;
+  memcpy(summary, sq->header, REPORT_BINS_OFFSET);
+  const uint16_t sec80_count = 0;
+  memcpy(summary + REPORT_BIN_COUNT_SEC80_OFFSET, &sec80_count,
+         sizeof(sec80_count));
+  int8_t *const max_pwr = (int8_t *)summary + REPORT_BINS_OFFSET;
+  int8_t *const mean_pwr = max_pwr + bin_pwr_count;
+  int8_t *const mean_mw = mean_pwr + bin_pwr_count;
+  memcpy(max_pwr, sq->max_pwr, bin_pwr_count);
+  const double scale = 1.0 / sq->count;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    mean_pwr[bin] = (int8_t)lround(sq->sum_pwr[bin] * scale);
+    mean_mw[bin] = (int8_t)lround(10 * log10(sq->sum_mw[bin] * scale));
+  }
+
+  const size_t len =
+      REPORT_BINS_OFFSET + REPORT_SUMMARY_BLOCKS * (size_t)bin_pwr_count;
+  struct report_view view;
+  if (report_view_parse(&view, summary, len)) {
+    view.len = len;
+    struct hop_tag tag = sq->tag;
+    tag.flags |= HOP_TAG_SUMMARY;
+    tag.num_squelched = sq->count;
+    const int64_t span_start = trace_begin();
+    report_bus_publish(engine.bus, &view, &tag);
+    trace_end(TRACE_SQUELCH_FLUSH, span_start, sq->count);
+    radio->num_summaries++;
+    radio->num_published++;
+  }
+  sq->count = 0;
+}
+
+// Returns true if the report is quiet and was held back or dropped.
+static bool squelch_report(struct radio *radio,
+                           const struct report_view *report,
+                           const struct hop_tag *tag) {
+  struct squelch *sq = radio->squelch;
+  const struct report_segment *seg = &report->segments[0];
+  const uint16_t bin_pwr_count = seg->bin_pwr_count;
+  const int16_t *floor = noise_floor_update(sq->floor, seg->center_freq,
+                                            bin_pwr_count, seg->bin_pwr, 1);
+
+  // A summary has room for the bins of a segment of up to half of the bins
+  // of a report. Reports in the channel guard are left for consumers to
+  // judge.
+  const bool quiet =
+      report->num_segments == 1 && !(tag->flags & HOP_TAG_GUARD) &&
+      REPORT_BINS_OFFSET + REPORT_SUMMARY_BLOCKS * (size_t)bin_pwr_count <=
+          engine.max_len &&
+      noise_floor_peak(floor, bin_pwr_count, seg->bin_pwr) <
+          engine.squelch_db * (1 << NOISE_FLOOR_SHIFT);
+
+  // A run covers one channel and hop, and ends before the next report that
+  // is published so that the reports of a radio stay in order.
+  if (sq->count > 0 &&
+      (!quiet || seg->center_freq != sq->center_freq ||
+       bin_pwr_count != sq->bin_pwr_count || tag->epoch != sq->tag.epoch)) {
+    flush_squelch(radio);
+  }
+  if (!quiet) {
+    return false;
+  }
+
+  radio->num_squelched++;
+  if (engine.squelch_drop) {
+    return true;
+  }
+
+  if (sq->count == 0) {
+    sq->center_freq = seg->center_freq;
+    sq->bin_pwr_count = bin_pwr_count;
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      sq->max_pwr[bin] = seg->bin_pwr[bin];
+      sq->sum_pwr[bin] = seg->bin_pwr[bin];
+      sq->sum_mw[bin] = pwr_to_mw[seg->bin_pwr[bin] + 128];
+    }
+  } else {
+    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+      const int8_t pwr = seg->bin_pwr[bin];
+      sq->max_pwr[bin] = pwr > sq->max_pwr[bin] ? pwr : sq->max_pwr[bin];
+      sq->sum_pwr[bin] += pwr;
+      sq->sum_mw[bin] += pwr_to_mw[pwr + 128];
+    }
+  }
+  memcpy(sq->header, report->data, REPORT_BINS_OFFSET);
+  sq->tag = *tag;
+  if (++sq->count >= engine.squelch_run) {
+    flush_squelch(radio);
+  }
+  return true;
+}
+
+static void *forward_thread(void *arg) {
+  pthread_setname_np(pthread_self(), "scan-forward");
+  thread_sched_apply(&engine.scheds[THREAD_FORWARD]);
+  const int sock_recv = nl_socket_get_fd(engine.nl_sock_recv);
+
+  // Room for the Netlink, Generic Netlink and attribute headers around the
+  // largest report of the FFT size.
+  const size_t msg_size = report_max_len(engine.fft_size) + 256;
+  uint8_t *msg = malloc(msg_size);
+  if (msg == NULL) {
+    LOGE("Can't allocate receive buffer");
+    return NULL;
+  }
+
+  // A received report is traced from recv() returning until the next
+  // recv(), whichever way it leaves the loop.
+  int64_t recv_start = 0;
+  uint16_t recv_freq = 0;
+  while (engine.running) {
+    trace_end(TRACE_REPORT_RECV, recv_start, recv_freq);
+    const ssize_t msg_len = recv(sock_recv, msg, msg_size, 0);
+    recv_start = trace_begin();
+    recv_freq = 0;
+    if (msg_len < 0) {
+      continue;
+    }
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
+    if (!nlmsg_ok(nlh, (int)msg_len)) {
+      continue;
+    }
+    if (!genlmsg_valid_hdr(nlh, 0)) {
+      continue;
+    }
+
+    enum { WLAN_NL_MSG_SPECTRAL_SCAN = 29 };
+
+    const struct genlmsghdr *gnlh = genlmsg_hdr(nlh);
+    if (gnlh->cmd != WLAN_NL_MSG_SPECTRAL_SCAN) {
+      continue;
+    }
+
+    enum cld80211_attr {
+      CLD80211_ATTR_VENDOR_DATA = 1,
+      CLD80211_ATTR_DATA,
+      CLD80211_ATTR_META_DATA,
+      CLD80211_ATTR_CMD,
+      CLD80211_ATTR_CMD_TAG_DATA,
+    };
+
+    const struct nlattr *nest_nla = genlmsg_attrdata(gnlh, 0);
+    if (!nla_ok(nest_nla, genlmsg_attrlen(gnlh, 0))) {
+      continue;
+    }
+    if (nla_type(nest_nla) != CLD80211_ATTR_VENDOR_DATA) {
+      continue;
+    }
+
+    const struct nlattr *nla = nla_data(nest_nla);
+    if (!nla_ok(nla, nla_len(nest_nla))) {
+      continue;
+    }
+    if (nla_type(nla) != CLD80211_ATTR_DATA) {
+      continue;
+    }
+
+    uint8_t *samp_buf = nla_data(nla);
+    struct report_view report;
+    if (!report_view_parse(&report, samp_buf, (size_t)nla_len(nla))) {
+      continue;
+    }
+
+    recv_freq = report.center_freq;
+    struct radio *radio = find_radio(&report);
+    if (radio == NULL) {
+      engine.num_unattributed++;
+      continue;
+    }
+    radio->num_reports++;
+    struct hop_tag tag = {
+        .magic = HOP_TAG_MAGIC,
+        .radio = (uint32_t)(radio - engine.radios),
+    };
+
+    // While a switch is pending, poll for its notification on every report
+    // so that the epoch flips as close to the actual switch as possible.
+    pthread_mutex_lock(&radio->hop_lock);
+    if (radio->hop_request_time != 0) {
+      check_ap_freq(radio);
+    }
+    if (radio->hop_request_time != 0) {
+      tag.flags |= HOP_TAG_PENDING;
+    }
+    tag.epoch = radio->hop_epoch;
+    tag.switch_us = radio->hop_switch_us;
+    tag.since_switch_us = now_us() - radio->hop_switch_time;
+    const uint16_t scan_freq = (uint16_t)radio->scan_freq;
+    pthread_mutex_unlock(&radio->hop_lock);
+
+    if (engine.guard_us > 0 && ((tag.flags & HOP_TAG_PENDING) ||
+                                tag.since_switch_us < engine.guard_us)) {
+      tag.flags |= HOP_TAG_GUARD;
+      radio->num_guarded++;
+      if (engine.guard_drop) {
+        continue;
+      }
+    }
+
+    // Consumers read the report itself, so a missing frequency is filled in
+    // there and not only in the view.
+    if (report.center_freq == 0) {
+      memcpy(samp_buf + REPORT_FREQ_OFFSET, &scan_freq, sizeof(scan_freq));
+      report.center_freq = scan_freq;
+      report.segments[0].center_freq = scan_freq;
+      recv_freq = scan_freq;
+    }
+
+    if (radio->squelch != NULL && squelch_report(radio, &report, &tag)) {
+      continue;
+    }
+
+    const int64_t publish_start = trace_begin();
+    report_bus_publish(engine.bus, &report, &tag);
+    trace_end(TRACE_REPORT_PUBLISH, publish_start, report.center_freq);
+    radio->num_published++;
+  }
+
+  for (int idx = 0; idx < engine.num_radios; idx++) {
+    if (engine.radios[idx].squelch != NULL) {
+      flush_squelch(&engine.radios[idx]);
+    }
+  }
+
+  free(msg);
+  return NULL;
+}
+
+// freq is 0 for an interface that is not operating.
+struct interface_info {
+  uint32_t freq;
+  bool has_mac;
+  uint8_t mac[REPORT_MAC_LEN];
+};
+
+static int handle_interface(struct nl_msg *msg, void *arg) {
+  struct interface_info *info = arg;
+  const struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+  const struct nlattr *nla;
+  int rem;
+  nla_for_each_attr(nla, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+                    rem) {
+    if (nla_type(nla) == NL80211_ATTR_WIPHY_FREQ) {
+      info->freq = nla_get_u32(nla);
+    } else if (nla_type(nla) == NL80211_ATTR_MAC &&
+               nla_len(nla) == REPORT_MAC_LEN) {
+      memcpy(info->mac, nla_data(nla), REPORT_MAC_LEN);
+      info->has_mac = true;
+    }
+  }
+  return NL_SKIP;
+}
+
+// Leaves info zeroed when the interface can't be queried.
+static void get_interface(struct radio *radio, unsigned ifindex,
+                          struct interface_info *info) {
+  *info = (struct interface_info){0};
+  if (ifindex == 0) {
+    return;
+  }
+
+  struct nl_msg *msg = nlmsg_alloc();
+  if (msg == NULL) {
+    return;
+  }
+  if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, radio->send_fam, 0, 0,
+                  NL80211_CMD_GET_INTERFACE, 0) == NULL ||
+      nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) < 0) {
+    nlmsg_free(msg);
+    return;
+  }
+
+  nl_socket_modify_cb(radio->nl_sock_send, NL_CB_VALID, NL_CB_CUSTOM,
+                      handle_interface, info);
+  const int64_t span_start = trace_begin();
+  nl_send_sync(radio->nl_sock_send, msg);
+  trace_end(TRACE_GET_INTERFACE, span_start, ifindex);
+  nl_socket_modify_cb(radio->nl_sock_send, NL_CB_VALID, NL_CB_DEFAULT, NULL,
+                      NULL);
+}
+
+static void read_property(const char *name, char value[PROP_VALUE_MAX]) {
+  const prop_info *pi = __system_property_find(name);
+  if (pi != NULL) {
+    __system_property_read(pi, NULL, value);
+  }
+}
+
+static void close_radio(struct radio *radio) {
+  free(radio->ap_freqs);
+  radio->ap_freqs = NULL;
+
+  if (radio->squelch != NULL) {
+    noise_floor_destroy(radio->squelch->floor);
+    free(radio->squelch);
+    radio->squelch = NULL;
+  }
+
+  nl_socket_free(radio->nl_sock_ap_event);
+  nl_socket_free(radio->nl_sock_ap_ctrl);
+  nl_socket_free(radio->nl_sock_send);
+
+  radio->nl_sock_ap_event = NULL;
+  radio->nl_sock_ap_ctrl = NULL;
+  radio->nl_sock_send = NULL;
+}
+
+// NULL interface names are looked up from the system properties.
+static bool open_radio(struct radio *radio, const struct radio_config *config) {
+  *radio = (struct radio){0};
+
+  if (config->ifname != NULL) {
+    strlcpy(radio->ifname, config->ifname, sizeof(radio->ifname));
+  } else {
+    read_property("wifi.interface", radio->ifname);
+  }
+  if (radio->ifname[0] == '\0') {
+    strlcpy(radio->ifname, "wlan0", sizeof(radio->ifname));
+  }
+  radio->ifindex = if_nametoindex(radio->ifname);
+  if (radio->ifindex == 0) {
+    LOGE("Can't get index of WLAN interface %s: %s", radio->ifname,
+         strerror(errno));
+    return false;
+  }
+
+  char ap_ifname[PROP_VALUE_MAX] = "";
+  if (config->ap_ifname != NULL) {
+    strlcpy(ap_ifname, config->ap_ifname, sizeof(ap_ifname));
+  } else {
+    read_property("ro.vendor.wifi.sap.interface", ap_ifname);
+    if (ap_ifname[0] == '\0') {
+      read_property("wifi.concurrent.interface", ap_ifname);
+    }
+  }
+  if (ap_ifname[0] == '\0') {
+    strlcpy(ap_ifname, "wlan1", sizeof(ap_ifname));
+  }
+  radio->ap_ifindex = if_nametoindex(ap_ifname);
+
+  radio->nl_sock_send = nl_socket_alloc();
+  if (radio->nl_sock_send == NULL) {
+    LOGE("Can't allocate send socket");
+    return false;
+  }
+
+  int nl_err = genl_connect(radio->nl_sock_send);
+  if (nl_err < 0) {
+    LOGE("Can't connect send socket: %s", nl_geterror(nl_err));
+    close_radio(radio);
+    return false;
+  }
+
+  radio->send_fam = genl_ctrl_resolve(radio->nl_sock_send, "nl80211");
+  if (radio->send_fam < 0) {
+    LOGE("Can't resolve nl80211 family: %s", nl_geterror(radio->send_fam));
+    close_radio(radio);
+    return false;
+  }
+
+  nl_socket_disable_seq_check(radio->nl_sock_send);
+
+  radio->nl_sock_ap_ctrl = nl_socket_alloc();
+  if (radio->nl_sock_ap_ctrl == NULL) {
+    LOGE("Can't allocate AP control socket");
+    close_radio(radio);
+    return false;
+  }
+
+  nl_err = genl_connect(radio->nl_sock_ap_ctrl);
+  if (nl_err < 0) {
+    LOGE("Can't connect AP control socket: %s", nl_geterror(nl_err));
+    close_radio(radio);
+    return false;
+  }
+
+  nl_socket_disable_seq_check(radio->nl_sock_ap_ctrl);
+
+  radio->nl_sock_ap_event = nl_socket_alloc();
+  if (radio->nl_sock_ap_event == NULL) {
+    LOGE("Can't allocate AP event socket");
+    close_radio(radio);
+    return false;
+  }
+
+  nl_err = genl_connect(radio->nl_sock_ap_event);
+  if (nl_err < 0) {
+    LOGE("Can't connect AP event socket: %s", nl_geterror(nl_err));
+    close_radio(radio);
+    return false;
+  }
+
+  int mlme_grp = genl_ctrl_resolve_grp(radio->nl_sock_ap_event, "nl80211",
+                                       "mlme");
+  if (mlme_grp < 0) {
+    LOGE("Can't resolve nl80211 mlme group: %s", nl_geterror(mlme_grp));
+    close_radio(radio);
+    return false;
+  }
+
+  nl_err = nl_socket_add_membership(radio->nl_sock_ap_event, mlme_grp);
+  if (nl_err < 0) {
+    LOGE("Can't join nl80211 mlme group: %s", nl_geterror(nl_err));
+    close_radio(radio);
+    return false;
+  }
+
+  nl_socket_disable_seq_check(radio->nl_sock_ap_event);
+
+  if (config->ap_freqs_count > 0) {
+    radio->ap_freqs = calloc((size_t)config->ap_freqs_count, sizeof(int));
+    if (radio->ap_freqs == NULL) {
+      LOGE("Can't allocate array of AP frequencies");
+      close_radio(radio);
+      return false;
+    }
+    memcpy(radio->ap_freqs, config->ap_freqs,
+           (size_t)config->ap_freqs_count * sizeof(int));
+    radio->ap_freqs_count = config->ap_freqs_count;
+  }
+
+  // Reports are told apart by the address of the scanned interface, or else
+  // by frequency, so start from where the radio is tuned rather than
+  // waiting for its first channel switch.
+  struct interface_info info;
+  get_interface(radio, radio->ifindex, &info);
+  radio->has_mac = info.has_mac;
+  memcpy(radio->mac, info.mac, sizeof(radio->mac));
+  if (info.freq == 0) {
+    get_interface(radio, radio->ap_ifindex, &info);
+  }
+  radio->scan_freq = info.freq;
+  jitter_init(&radio->scan_jitter, scan_dwell_us);
+  jitter_init(&radio->hop_jitter, hop_tick_us * hop_ticks);
+  return true;
+}
+
+static bool open_squelch(struct radio *radio) {
+  for (int pwr = -128; pwr < 128; pwr++) {
+    pwr_to_mw[pwr + 128] = powf(10.0f, (float)pwr / 10.0f);
+  }
+
+  radio->squelch = calloc(1, sizeof(struct squelch));
+  if (radio->squelch == NULL) {
+    LOGE("Can't allocate squelch of %s", radio->ifname);
+    return false;
+  }
+  radio->squelch->floor = noise_floor_create();
+  if (radio->squelch->floor == NULL) {
+    LOGE("Can't allocate noise floor of %s", radio->ifname);
+    free(radio->squelch);
+    radio->squelch = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool scan_engine_start(const struct scan_config *config,
+                       struct report_bus *bus) {
+  if (engine.running || config->num_radios < 1 ||
+      config->num_radios > MAX_RADIOS) {
+    return false;
+  }
+
+  struct nl_sock *nl_sock_recv = nl_socket_alloc();
+  if (nl_sock_recv == NULL) {
+    LOGE("Can't allocate receive socket");
+    return false;
+  }
+
+  int nl_err = genl_connect(nl_sock_recv);
+  if (nl_err < 0) {
+    LOGE("Can't connect receive socket: %s", nl_geterror(nl_err));
+    nl_socket_free(nl_sock_recv);
+    return false;
+  }
+
+  int recv_grp = genl_ctrl_resolve_grp(nl_sock_recv, "cld80211", "oem_msgs");
+  if (recv_grp < 0) {
+    LOGE("Can't resolve cld80211 oem_msgs group: %s", nl_geterror(recv_grp));
+    nl_socket_free(nl_sock_recv);
+    return false;
+  }
+
+  nl_err = nl_socket_add_membership(nl_sock_recv, recv_grp);
+  if (nl_err < 0) {
+    LOGE("Can't join cld80211 oem_msgs group: %s", nl_geterror(nl_err));
+    nl_socket_free(nl_sock_recv);
+    return false;
+  }
+
+  nl_socket_disable_seq_check(nl_sock_recv);
+
+  for (int idx = 0; idx < config->num_radios; idx++) {
+    if (!open_radio(&engine.radios[idx], &config->radios[idx]) ||
+        (config->squelch_db > 0 && !open_squelch(&engine.radios[idx]))) {
+      close_radio(&engine.radios[idx]);
+      while (idx-- > 0) {
+        close_radio(&engine.radios[idx]);
+      }
+      nl_socket_free(nl_sock_recv);
+      return false;
+    }
+  }
+
+  engine.num_radios = config->num_radios;
+  engine.num_unattributed = 0;
+  engine.fft_size = config->fft_size;
+  engine.bus = bus;
+  engine.nl_sock_recv = nl_sock_recv;
+  engine.guard_us = config->guard_us > 0 ? config->guard_us : 0;
+  engine.guard_drop = config->guard_drop;
+  engine.squelch_db = config->squelch_db;
+  engine.squelch_run = config->squelch_run == 0 ? DEFAULT_SQUELCH_RUN
+                       : config->squelch_run > MAX_SQUELCH_RUN
+                           ? MAX_SQUELCH_RUN
+                           : config->squelch_run;
+  engine.squelch_drop = config->squelch_drop;
+  memcpy(engine.scheds, config->scheds, sizeof(engine.scheds));
+  engine.max_len = report_max_len(config->fft_size);
+
+  // The threads are woken from blocking calls by SIGINT when stopping.
+  struct sigaction sa = {.sa_handler = handle_sigint};
+  sigaction(SIGINT, &sa, NULL);
+
+  engine.running = true;
+  for (int idx = 0; idx < engine.num_radios; idx++) {
+    struct radio *radio = &engine.radios[idx];
+    pthread_mutex_init(&radio->hop_lock, NULL);
+    pthread_create(&radio->ap_ctrl_thread, 0, ap_ctrl_thread, radio);
+    pthread_create(&radio->scan_thread, 0, scan_thread, radio);
+  }
+  pthread_create(&engine.forward_thread, 0, forward_thread, NULL);
+  return true;
+}
+
+void scan_engine_stop(void) {
+  if (!engine.running) {
+    return;
+  }
+
+  engine.running = false;
+  pthread_kill(engine.forward_thread, SIGINT);
+  pthread_join(engine.forward_thread, NULL);
+
+  for (int idx = 0; idx < engine.num_radios; idx++) {
+    struct radio *radio = &engine.radios[idx];
+    pthread_kill(radio->scan_thread, SIGINT);
+    pthread_kill(radio->ap_ctrl_thread, SIGINT);
+    pthread_join(radio->scan_thread, NULL);
+    pthread_join(radio->ap_ctrl_thread, NULL);
+    pthread_mutex_destroy(&radio->hop_lock);
+
+    LOGI("Published %" PRId64 " of %" PRId64 " reports from %s, %" PRId64
+         " in channel guard (%s)",
+         (int64_t)radio->num_published, (int64_t)radio->num_reports,
+         radio->ifname, (int64_t)radio->num_guarded,
+         engine.guard_drop ? "dropped" : "flagged");
+    if (radio->squelch != NULL) {
+      LOGI("Squelched %" PRId64 " reports from %s (%s), %" PRId64
+           " summaries",
+           (int64_t)radio->num_squelched, radio->ifname,
+           engine.squelch_drop ? "dropped" : "summarized",
+           (int64_t)radio->num_summaries);
+    }
+
+    struct jitter_stats jitter;
+    char text[512];
+    jitter_read(&radio->scan_jitter, &jitter);
+    jitter_format(&jitter, true, text, sizeof(text));
+    LOGI("Scan dwell of %s: %s", radio->ifname, text);
+    jitter_read(&radio->hop_jitter, &jitter);
+    jitter_format(&jitter, true, text, sizeof(text));
+    LOGI("Hop period of %s: %s", radio->ifname, text);
+
+    close_radio(radio);
+  }
+  if (engine.num_unattributed > 0) {
+    LOGI("Dropped %" PRId64 " reports of no single radio",
+         (int64_t)engine.num_unattributed);
+  }
+  engine.num_radios = 0;
+
+  nl_socket_free(engine.nl_sock_recv);
+  engine.nl_sock_recv = NULL;
+}
+
+int scan_engine_stats(struct radio_stats stats[], int max_radios) {
+  int count = 0;
+  for (; count < engine.num_radios && count < max_radios; count++) {
+    const struct radio *radio = &engine.radios[count];
+    strlcpy(stats[count].ifname, radio->ifname, sizeof(stats[count].ifname));
+    stats[count].num_reports = radio->num_reports;
+    stats[count].num_guarded = radio->num_guarded;
+    stats[count].num_squelched = radio->num_squelched;
+    stats[count].num_summaries = radio->num_summaries;
+    stats[count].num_published = radio->num_published;
+    jitter_read(&radio->scan_jitter, &stats[count].scan_jitter);
+    jitter_read(&radio->hop_jitter, &stats[count].hop_jitter);
+  }
+  return count;
+}
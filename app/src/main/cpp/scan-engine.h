@@ -0,0 +1,72 @@
+#ifndef SCAN_ENGINE_H
+#define SCAN_ENGINE_H
+
+#include <net/if.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jitter.h"
+#include "report-bus.h"
+#include "thread-sched.h"
+
+enum { MAX_RADIOS = 4 };
+
+// Quiet reports per summary unless configured, and at most.
+enum { DEFAULT_SQUELCH_RUN = 64 };
+enum { MAX_SQUELCH_RUN = 4096 };
+
+// NULL interface names are looked up from the system properties.
+struct radio_config {
+  const char *ifname;
+  const char *ap_ifname;
+  const int *ap_freqs;
+  int ap_freqs_count;
+};
+
+// A report is quiet when no bin of it is squelch_db or more above the noise
+// floor of that bin. Runs of up to squelch_run quiet reports are published
+// as one summary, or dropped with squelch_drop. A squelch_db of 0 turns the
+// squelch off. The threads of every radio are scheduled as in scheds,
+// indexed by THREAD_SCAN, THREAD_HOP and THREAD_FORWARD.
+struct scan_config {
+  const struct radio_config *radios;
+  int num_radios;
+  uint32_t fft_size;
+  int64_t guard_us;
+  bool guard_drop;
+  int squelch_db;
+  uint32_t squelch_run;
+  bool squelch_drop;
+  struct thread_sched scheds[NUM_THREAD_ROLES];
+};
+
+// num_published counts summaries once, and num_squelched counts the quiet
+// reports that were summarized or dropped. scan_jitter measures the time
+// each scan runs between its start and stop, and hop_jitter the time between
+// channel switch requests.
+struct radio_stats {
+  char ifname[IF_NAMESIZE];
+  int64_t num_reports;
+  int64_t num_guarded;
+  int64_t num_squelched;
+  int64_t num_summaries;
+  int64_t num_published;
+  struct jitter_stats scan_jitter;
+  struct jitter_stats hop_jitter;
+};
+
+// Every radio scans on its own threads, and the reports of all radios are
+// published to the bus in the order they arrive, tagged with the index of
+// their radio. The reports of each radio are in order, but reports of
+// different radios are not in time order with each other, as every radio
+// stamps them with its own clock. Reports that can't be attributed to one
+// radio are dropped. Subscribers may join and leave the bus while
+// scanning.
+bool scan_engine_start(const struct scan_config *config,
+                       struct report_bus *bus);
+void scan_engine_stop(void);
+// Returns the number of radios filled in, which is 0 when not scanning.
+int scan_engine_stats(struct radio_stats stats[], int max_radios);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SCAN_PROTOCOL_H
+#define SCAN_PROTOCOL_H
+
+#include <stdint.h>
+
+// Consumers of spectral-scand connect to its SOCK_SEQPACKET socket and get
+// one frame per packet: a hello describing the scan, then every report.
+// A consumer that reads too slowly misses reports, which shows as a gap in
+// the sequence numbers.
+enum { SCAN_PROTO_MAGIC = 0x64616373 };
+enum { SCAN_PROTO_VERSION = 5 };
+
+enum scan_frame_type {
+  SCAN_FRAME_HELLO = 1,
+  SCAN_FRAME_REPORT = 2,
+};
+
+struct scan_frame {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+  uint32_t length;
+  uint32_t seq;
+};
+
+// Followed by a run for each of the num_radios radios in turn: a uint32
+// count, then that many int32 AP frequencies in MHz. num_ap_freqs is the
+// sum of the counts. squelch_db is 0 unless quiet reports are squelched.
+struct scan_hello {
+  uint32_t fft_size;
+  uint32_t guard_us;
+  uint32_t flags;
+  uint32_t num_ap_freqs;
+  uint32_t num_radios;
+  uint32_t squelch_db;
+  uint32_t squelch_run;
+};
+
+enum scan_hello_flags {
+  SCAN_HELLO_GUARD_DROP = 1 << 0,
+  SCAN_HELLO_SQUELCH_DROP = 1 << 1,
+};
+
+// A report frame carries the report as received from the driver followed
+// by its struct hop_tag, the same layout the app forwards to spectral-plot.
+// With the squelch on, it may carry a summary of quiet reports instead, see
+// report_summary_mean().
+
+#endif
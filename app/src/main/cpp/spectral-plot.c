@@ -1,9 +1,11 @@
 #include <android/bitmap.h>
 #include <android/log.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <jni.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -16,494 +18,581 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "alerts.h"
+#include "archive.h"
+#include "capture.h"
+#include "channelizer.h"
+#include "classifier.h"
+#include "noise-floor.h"
+#include "occupancy.h"
+#include "persistence.h"
+#include "pulse-chain.h"
+#include "pyramid.h"
+#include "spectral-report.h"
+#include "stage-timer.h"
+#include "summed-area.h"
+#include "thread-sched.h"
+#include "trace.h"
+
 #define LOG_TAG "spectral-plot"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
-#define SPECTRAL_DETECT
-
-enum { MAX_NUM_BINS = 512 };
-enum { SPAN_WIDTH = 40 };
-
-struct scan_data {
-  int8_t bin_pwr[MAX_NUM_BINS];
-  uint16_t bin_pwr_count;
-  uint16_t center_freq;
-  int32_t tstamp;
-};
-
-struct window_avg_data {
-  double bin_pwr[MAX_NUM_BINS];
-  uint16_t bin_pwr_count;
-  uint16_t center_freq;
-  int32_t tstamp;
-};
+// Until configFftSize is called, engines take reports of up to 512 bins.
+enum { DEFAULT_FFT_SIZE = 8 };
 
-#ifdef SPECTRAL_DETECT
-static const int thres_min = -100;
-#else
-static const int thres_min = -80;
-#endif
-static const int thres_diff = 10;
+// The pyramid and capture budgets of an engine may take this much together.
+// The other stages, the archive writer among them, are of fixed size.
+enum { MAX_ENGINE_MEMORY_MB = 256 };
 
-struct pulse_single {
-  double center;
-  double bw;
-  double pwr;
-  int32_t tstamp;
+static const char *const avg_mode_names[NUM_AVG_MODES] = {
+    [AVG_MODE_BOXCAR] = "boxcar",
+    [AVG_MODE_EMA] = "EMA",
+    [AVG_MODE_PEAK_HOLD] = "peak hold",
+    [AVG_MODE_MIN_HOLD] = "min hold",
 };
 
-static struct pulse_single make_pulse(const struct window_avg_data *data,
-                                      const uint16_t bin_start,
-                                      const uint16_t bin_end,
-                                      const uint16_t bin_peak) {
-  const double *const bin_pwr = data->bin_pwr;
-  const uint16_t bin_pwr_count = data->bin_pwr_count;
-  const uint16_t center_freq = data->center_freq;
-
-  double sum_pwr = 0;
-  double sum_prod = 0;
-  for (uint16_t bin = bin_start; bin < bin_end; bin++) {
-    sum_pwr += bin_pwr[bin];
-    sum_prod += bin * bin_pwr[bin];
-  }
-  double center_bin = sum_prod / sum_pwr;
-
-  double sum_dis = 0;
-  for (uint16_t bin = bin_start; bin < bin_end; bin++) {
-    sum_dis += pow(bin - center_bin, 2.0) * bin_pwr[bin];
-  }
-  double bw_bin = 2 * sqrt(sum_dis / sum_pwr);
-
-  return (struct pulse_single){
-      .center = (center_bin / bin_pwr_count - 0.5) * SPAN_WIDTH + center_freq,
-      .bw = bw_bin / bin_pwr_count * SPAN_WIDTH,
-      .pwr = bin_pwr[bin_peak],
-      .tstamp = data->tstamp,
-  };
+static uint16_t make565(int red, int green, int blue) {
+  return (uint16_t)(((red << 8) & 0xf800) | ((green << 3) & 0x07e0) |
+                    ((blue >> 3) & 0x001f));
 }
 
-static uint16_t detect_pulses(const struct window_avg_data *data,
-                              struct pulse_single pulses[]) {
-  const double *const bin_pwr = data->bin_pwr;
-  const uint16_t bin_pwr_count = data->bin_pwr_count;
-
-  uint16_t num_pulses = 0;
-
-  for (uint16_t bin_start = 0, bin_end = 0, bin_peak = 0, bin_next = 0;
-       bin_end < bin_pwr_count; bin_start = bin_peak = bin_end = bin_next) {
-    while (bin_start > 0 &&
-           bin_pwr[bin_start - 1] > bin_pwr[bin_peak] - thres_diff &&
-           bin_pwr[bin_start - 1] < bin_pwr[bin_peak]) {
-      bin_start--;
-    }
-    if (bin_start > 0 && bin_pwr[bin_start - 1] >= bin_pwr[bin_peak]) {
-      bin_next++;
-      continue;
-    }
+// The persistence display spans these power levels from top to bottom, the
+// same scale the noise floor trace is drawn on.
+enum { PERSIST_TOP = -20, PERSIST_RANGE = 100 };
 
-    while (bin_end < bin_pwr_count &&
-           bin_pwr[bin_end] > bin_pwr[bin_peak] - thres_diff &&
-           bin_pwr[bin_end] <= bin_pwr[bin_peak]) {
-      bin_end++;
-    }
-    bin_next = bin_end;
-    if (bin_end < bin_pwr_count && bin_pwr[bin_end] > bin_pwr[bin_peak]) {
-      continue;
-    }
-    if (bin_pwr[bin_peak] <= thres_min) {
-      continue;
-    }
+// The live band power index keeps this many rows of this length.
+enum { BAND_INDEX_ROWS = 256 };
+static const int64_t band_index_row_time = 200000;
 
-    while (bin_start < bin_peak && bin_pwr[bin_start] <= thres_min) {
-      bin_start++;
-    }
-    while (bin_end > bin_peak && bin_pwr[bin_end - 1] <= thres_min) {
-      bin_end--;
-    }
-#ifdef SPECTRAL_DETECT
-    if (bin_start + 1 >= bin_end) {
-#else
-    if (bin_start >= bin_end) {
-#endif
-      continue;
-    }
+// Channel power is published at this rate and kept for this many frames.
+enum { CHANNEL_FRAMES = 600 };
+static const int64_t channel_period = 100000;
 
-    pulses[num_pulses++] = make_pulse(data, bin_start, bin_end, bin_peak);
-  }
+// How long hits take to fade to half their weight, in microseconds.
+static const int32_t persist_half_life = 500000;
 
-  return num_pulses;
-}
+struct plot_data {
+  uint16_t num_pixels;
+  int32_t tstamp;
+  uint16_t pixels[];
+};
 
-struct pulse {
+static struct {
+  JavaVM *vm;
+  jfieldID engine_fid;
+  jfieldID plotBitmap_fid;
+  jmethodID onAlert_mid;
+} jni;
+
+// What Java reads of an engine, shared through a direct ByteBuffer so that
+// reading it takes no JNI calls. The layout is mirrored by PlotSnapshot.
+// seq is odd while a writer updates the snapshot, so readers copy what they
+// need and retry if seq was odd or changed meanwhile. Writers hold the
+// semaphore of the engine: the receive thread publishes the spectrum and
+// tracks of every report, updatePlot the per-frame fields.
+enum { SNAPSHOT_VERSION = 1 };
+enum { MAX_SNAPSHOT_TRACKS = 64 };
+
+struct snapshot_track {
   double center;
   double bw;
   double pwr;
   int32_t tstamp_first;
   int32_t tstamp_last;
   int32_t cnt;
-  bool matched;
+  int32_t reserved;
 };
 
-static uint16_t match_pulses(const struct pulse_single new_pulses[],
-                             const uint16_t new_num_pulses,
-                             const uint16_t bin_pwr_count,
-                             struct pulse old_pulses[],
-                             const uint16_t old_num_pulses,
-                             struct pulse pulses[]) {
-  static const double thres_freq = 1.0;
-  static const double thres_pwr = 3.0;
-  static const int32_t thres_time = 150;
-  uint16_t num_pulses = 0;
-
-  for (uint16_t new_idx = 0, old_idx = 0; new_idx < new_num_pulses; new_idx++) {
-    double center = new_pulses[new_idx].center;
-    double bw = new_pulses[new_idx].bw;
-    double pwr = new_pulses[new_idx].pwr;
-    int32_t tstamp = new_pulses[new_idx].tstamp;
-
-    while (old_idx < old_num_pulses &&
-           old_pulses[old_idx].center <= center - thres_freq) {
-      old_idx++;
-    }
-
-    if (old_idx < old_num_pulses &&
-        old_pulses[old_idx].center < center + thres_freq &&
-        fabs(old_pulses[old_idx].bw - bw) < thres_freq * 2 &&
-        fabs(old_pulses[old_idx].pwr - pwr) < thres_pwr &&
-        tstamp < old_pulses[old_idx].tstamp_last + thres_time) {
-      double old_center = old_pulses[old_idx].center;
-      double old_bw = old_pulses[old_idx].bw;
-      double old_pwr = old_pulses[old_idx].pwr;
-      int32_t old_cnt = old_pulses[old_idx].cnt;
-      center = (center + old_cnt * old_center) / (old_cnt + 1);
-      bw = (bw + old_cnt * old_bw) / (old_cnt + 1);
-      pwr = (pwr + old_cnt * old_pwr) / (old_cnt + 1);
-      pulses[num_pulses++] = (struct pulse){
-          .center = center,
-          .bw = bw,
-          .pwr = pwr,
-          .tstamp_first = old_pulses[old_idx].tstamp_first,
-          .tstamp_last = tstamp,
-          .cnt = old_cnt + 1,
-          .matched = false,
-      };
-      old_pulses[old_idx++].matched = true;
-    } else {
-      pulses[num_pulses++] = (struct pulse){
-          .center = center,
-          .bw = bw,
-          .pwr = pwr,
-          .tstamp_first = tstamp,
-          .tstamp_last = tstamp,
-          .cnt = 1,
-          .matched = false,
-      };
-    }
-  }
+struct plot_snapshot {
+  atomic_uint seq;
+  uint32_t version;
+  int64_t elapsed[3];
+  float center_pos;
+  int32_t center_freq;
+  int32_t span_width;
+  int32_t num_bins;
+  double pulse_freq;
+  double detector_pwr[NUM_DETECTORS];
+  int32_t tstamp;
+  int32_t num_tracks;
+  int64_t num_scans;
+  float spectrum[MAX_NUM_BINS];
+  struct snapshot_track tracks[MAX_SNAPSHOT_TRACKS];
+};
 
-  return num_pulses;
+_Static_assert(offsetof(struct plot_snapshot, detector_pwr) == 56 &&
+                   offsetof(struct plot_snapshot, tstamp) == 88 &&
+                   offsetof(struct plot_snapshot, spectrum) == 104 &&
+                   offsetof(struct plot_snapshot, tracks) == 8296 &&
+                   sizeof(struct snapshot_track) == 40,
+               "PlotSnapshot mirrors this layout");
+
+static void snapshot_begin(struct plot_snapshot *snap) {
+  const unsigned seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+  atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
 }
 
-static uint16_t make565(int red, int green, int blue) {
-  return (uint16_t)(((red << 8) & 0xf800) | ((green << 3) & 0x07e0) |
-                    ((blue >> 3) & 0x001f));
+static void snapshot_end(struct plot_snapshot *snap) {
+  const unsigned seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+  atomic_store_explicit(&snap->seq, seq + 1, memory_order_release);
 }
 
-struct plot_data {
-  uint16_t pixels[MAX_NUM_BINS];
-  uint16_t num_pixels;
-  int32_t tstamp;
-};
-
-static struct {
+// Every PlotView owns an engine with its own socket, receive thread and
+// buffers, so several pipelines can process the same reports with
+// different parameters.
+struct plot_engine {
   atomic_bool running;
   atomic_bool show_average;
   atomic_bool show_pulses;
-  jfieldID plotBitmap_fid;
-  jfieldID elapsedQ1_fid;
-  jfieldID elapsedQ2_fid;
-  jfieldID elapsedQ3_fid;
-  jfieldID centerPos_fid;
-  jfieldID centerFreq_fid;
-  jfieldID spanWidth_fid;
-#ifdef SPECTRAL_DETECT
-  jfieldID bluetoothPower_fid;
-#else
-  jfieldID pulseFreq_fid;
-#endif
+  atomic_bool show_persistence;
   struct sockaddr_un saddr;
   int sock_fd;
   const char *sock_path;
   int64_t num_scans;
-  struct plot_data *rbuffer;
+  int64_t num_guarded;
+  int64_t num_squelched;
+  int64_t num_summaries;
+  struct noise_floor *noise_floor;
+  struct stage_timer floor_timer;
+  struct persistence *persistence;
+  struct occupancy *occupancy;
+  struct archive_writer *archive;
+  struct capture *capture;
+  size_t capture_budget;
+  unsigned capture_mask;
+  struct alerts *alerts;
+  jobject alert_view;
+  struct pyramid *pyramid;
+  unsigned pyramid_levels;
+  size_t pyramid_rows;
+  size_t pyramid_budget;
+  atomic_uint time_scale;
+  struct summed_area *band_index;
+  struct tstamp_clock band_clock;
+  struct channelizer *channelizer;
+  struct stage_timer channel_timer;
+  uint16_t max_bins;
+  uint8_t *rbuffer;
+  size_t rbuffer_stride;
+  uint16_t rbuffer_bins;
   size_t rbuffer_capacity;
   size_t rbuffer_size;
   size_t rbuffer_pos;
   uint16_t center_freq;
-#ifdef SPECTRAL_DETECT
-  double bt_pwr;
-#else
+  struct plot_snapshot *snapshot;
+  int64_t total_scans;
+  struct classifier *classifier;
+  atomic_uint detector_mask;
   double pulse_freq;
-#endif
+  pthread_mutex_t params_lock;
+  atomic_uint params_gen;
+  enum detect_mode detect_mode;
+  struct detect_params params;
+  struct avg_params avg_params;
+  struct thread_sched sched;
   sem_t sem;
   pthread_t recv_thread;
-} state;
+};
+
+// Rows of the ring buffer are rbuffer_stride bytes apart, with room for
+// rbuffer_bins pixels each.
+static struct plot_data *get_plot_data(const struct plot_engine *eng,
+                                       size_t pos) {
+  return (struct plot_data *)(eng->rbuffer + pos * eng->rbuffer_stride);
+}
+
+// The per-report buffers of a receive thread, sized for reports of up to
+// max_bins bins and carved from one arena.
+struct recv_bufs {
+  struct arena arena;
+  uint16_t max_bins;
+  size_t samp_size;
+  uint8_t *samp_buf;
+  double *thres;
+  struct pulse_single *new_pulses;
+  struct pulse *old_pulses;
+  struct pulse *pulses;
+  struct track *finished;
+  int *window_sum;
+  double *avg_pwr;
+};
+
+static bool recv_bufs_alloc(struct recv_bufs *bufs, uint16_t max_bins) {
+  struct recv_bufs new_bufs = {.max_bins = max_bins};
+  struct arena *a = &new_bufs.arena;
+  new_bufs.samp_size = report_len_for_bins(max_bins) + sizeof(struct hop_tag);
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1 && !arena_init(a)) {
+      return false;
+    }
+    new_bufs.samp_buf = arena_alloc(a, new_bufs.samp_size);
+    new_bufs.thres = arena_alloc(a, max_bins * sizeof(double));
+    new_bufs.new_pulses =
+        arena_alloc(a, max_bins * sizeof(struct pulse_single));
+    new_bufs.old_pulses = arena_alloc(a, max_bins * sizeof(struct pulse));
+    new_bufs.pulses = arena_alloc(a, max_bins * sizeof(struct pulse));
+    new_bufs.finished = arena_alloc(a, max_bins * sizeof(struct track));
+    new_bufs.window_sum = arena_alloc(a, max_bins * sizeof(int));
+    new_bufs.avg_pwr = arena_alloc(a, max_bins * sizeof(double));
+  }
+
+  arena_free(&bufs->arena);
+  *bufs = new_bufs;
+  return true;
+}
+
+// Moves the averager onto new buffers, dropping its history.
+static bool averager_resize(struct averager *avg,
+                            const struct recv_bufs *bufs) {
+  free(avg->scans);
+  avg->scans = NULL;
+  avg->max_bins = bufs->max_bins;
+  avg->window_sum = bufs->window_sum;
+  avg->data.bin_pwr = bufs->avg_pwr;
+  return averager_set_mode(avg, avg->mode);
+}
+
+// Publishes the averaged spectrum of the latest report and the tracks it
+// left active.
+static void publish_snapshot(struct plot_engine *eng,
+                             const struct window_avg_data *avg_data,
+                             const struct pulse pulses[],
+                             uint16_t num_pulses) {
+  struct plot_snapshot *snap = eng->snapshot;
+  const uint16_t num_tracks =
+      num_pulses < MAX_SNAPSHOT_TRACKS ? num_pulses : MAX_SNAPSHOT_TRACKS;
+
+  snapshot_begin(snap);
+  snap->center_freq = avg_data->center_freq;
+  snap->span_width = SPAN_WIDTH;
+  snap->tstamp = avg_data->tstamp;
+  snap->num_scans = eng->total_scans;
+  snap->num_bins = avg_data->bin_pwr_count;
+  for (uint16_t bin = 0; bin < avg_data->bin_pwr_count; bin++) {
+    snap->spectrum[bin] = (float)avg_data->bin_pwr[bin];
+  }
+  snap->num_tracks = num_tracks;
+  for (uint16_t idx = 0; idx < num_tracks; idx++) {
+    snap->tracks[idx] = (struct snapshot_track){
+        .center = pulses[idx].center,
+        .bw = pulses[idx].bw,
+        .pwr = pulses[idx].pwr,
+        .tstamp_first = pulses[idx].tstamp_first,
+        .tstamp_last = pulses[idx].tstamp_last,
+        .cnt = pulses[idx].cnt,
+    };
+  }
+  snapshot_end(snap);
+}
 
 static void handle_sigint(int sig) {}
 
 static void *recv_thread(void *arg) {
+  struct plot_engine *eng = arg;
   struct sigaction sa = {.sa_handler = handle_sigint};
   sigaction(SIGINT, &sa, NULL);
 
-  enum { MAX_WINDOW_SIZE = 200 };
-  static const int32_t max_window_time = 625;
-  struct scan_data scans[MAX_WINDOW_SIZE];
-  size_t window_start = 0;
-  size_t window_size = 0;
-  int window_sum[MAX_NUM_BINS] = {0};
-  struct pulse pulses[MAX_NUM_BINS] = {0};
+  struct averager avg = {.mode = AVG_MODE_BOXCAR};
+  struct recv_bufs bufs = {0};
+  uint16_t failed_bins = 0;
   uint16_t num_pulses = 0;
-#ifdef SPECTRAL_DETECT
-  int32_t prev_tstamp = INT32_MAX;
-  enum { NUM_BT_CHANS = 79 };
-  enum { NUM_ZB_CHANS = 16 };
-  int non_bt_score[NUM_BT_CHANS] = {0};
-  int non_zb_score[NUM_ZB_CHANS] = {0};
-  int last_bt_chan = -1;
-  int bt_score = 0;
-  static const int32_t bt_max_window_length = 20000;
-  struct bt_pwr_data {
-    double pwr_total;
-    int32_t length;
-  } bt_window[MAX_WINDOW_SIZE];
-  size_t bt_window_start = 0;
-  size_t bt_window_size = 0;
-  double bt_window_sum = 0;
-  int32_t bt_window_length = 0;
-#endif
   size_t rbuffer_last_pos = SIZE_MAX;
+  unsigned params_gen = 0;
+  enum detect_mode mode = DETECT_MODE_CLASSIFY;
+  struct detect_params params = default_detect_params[mode];
+  struct avg_params avg_params = {.mode = AVG_MODE_BOXCAR};
+  struct thread_sched sched = {0};
+  const struct bin_kernels *kernels = get_bin_kernels(0);
+  uint16_t kernels_bin_count = 0;
+  unsigned capture_present = 0;
+
+  if (!recv_bufs_alloc(&bufs, eng->max_bins) ||
+      !averager_resize(&avg, &bufs)) {
+    LOGE("Can't allocate receive buffers");
+    arena_free(&bufs.arena);
+    return NULL;
+  }
 
-  sem_wait(&state.sem);
-
-  while (state.running) {
-    sem_post(&state.sem);
-    uint8_t samp_buf[1216];
-    const ssize_t samp_len = recv(state.sock_fd, samp_buf, sizeof(samp_buf), 0);
-    sem_wait(&state.sem);
-
-    if (samp_len < 93) {
+  pthread_setname_np(pthread_self(), "plot-recv");
+  sem_wait(&eng->sem);
+
+  // A report is traced from taking the lock after recv() until releasing
+  // it before the next, whichever way it leaves the loop.
+  int64_t report_start = 0;
+  uint16_t report_freq = 0;
+  while (eng->running) {
+    trace_end(TRACE_PLOT_REPORT, report_start, report_freq);
+    sem_post(&eng->sem);
+    // With MSG_TRUNC, a report too long for the buffer shows its full
+    // length and is dropped below.
+    uint8_t *const samp_buf = bufs.samp_buf;
+    const ssize_t samp_len =
+        recv(eng->sock_fd, samp_buf, bufs.samp_size, MSG_TRUNC);
+    int64_t span_start = trace_begin();
+    sem_wait(&eng->sem);
+    trace_end(TRACE_PLOT_LOCK, span_start, 0);
+    report_start = trace_begin();
+    report_freq = 0;
+
+    // A failed receive, stopPlot's signal included, leaves the buffer
+    // holding the previous report.
+    if (samp_len < 0) {
       continue;
     }
-    if (*(uint32_t *)samp_buf != 0xdeadbeef) {
+    const bool fits = samp_len <= (ssize_t)bufs.samp_size;
+    if (eng->max_bins != bufs.max_bins && eng->max_bins != failed_bins) {
+      if (recv_bufs_alloc(&bufs, eng->max_bins) &&
+          averager_resize(&avg, &bufs)) {
+        LOGI("Receive buffers: %zu bytes for %u bins", bufs.arena.size,
+             bufs.max_bins);
+        num_pulses = 0;
+        failed_bins = 0;
+      } else {
+        LOGW("Can't resize receive buffers for %u bins", eng->max_bins);
+        failed_bins = eng->max_bins;
+      }
       continue;
     }
-
-    const int32_t tstamp = *(int32_t *)(samp_buf + 44);
-    const uint16_t bin_pwr_count = *(uint16_t *)(samp_buf + 87);
-    if (samp_len < 93 + bin_pwr_count || bin_pwr_count > MAX_NUM_BINS) {
+    if (!fits) {
       continue;
     }
 
-    state.num_scans++;
-    const int8_t *bin_pwr = (int8_t *)samp_buf + 93;
-    const uint16_t center_freq = *(uint16_t *)(samp_buf + 4);
-
-    while (window_size > 0 &&
-           (scans[window_start].bin_pwr_count != bin_pwr_count ||
-            scans[window_start].center_freq != center_freq ||
-            scans[window_start].tstamp <= tstamp - max_window_time)) {
-      const struct scan_data *old = &scans[window_start++];
-      window_start %= MAX_WINDOW_SIZE;
-      for (uint16_t bin = 0; bin < old->bin_pwr_count; bin++) {
-        window_sum[bin] -= old->bin_pwr[bin];
+    struct hop_tag tag = {0};
+    ssize_t report_len = samp_len;
+    if (samp_len >= (ssize_t)sizeof(tag)) {
+      memcpy(&tag, samp_buf + samp_len - (ssize_t)sizeof(tag), sizeof(tag));
+      if (tag.magic == HOP_TAG_MAGIC) {
+        report_len -= (ssize_t)sizeof(tag);
+      } else {
+        memset(&tag, 0, sizeof(tag));
       }
-      window_size--;
     }
 
-    size_t window_end = window_start + window_size;
-    window_end %= MAX_WINDOW_SIZE;
-    struct scan_data *scan_data = &scans[window_end];
-
-    if (window_size > 0 && window_end == window_start) {
-      window_start++;
-      window_start %= MAX_WINDOW_SIZE;
-      for (uint16_t bin = 0; bin < scan_data->bin_pwr_count; bin++) {
-        window_sum[bin] -= scan_data->bin_pwr[bin];
+    // Every stage works on the first segment, which covers the span that
+    // is drawn.
+    struct report_view report;
+    if (!report_view_parse(&report, samp_buf, (size_t)report_len)) {
+      continue;
+    }
+    const int32_t tstamp = report.tstamp;
+
+    // The capture keeps every report as received, guard hops and squelch
+    // summaries included, and triggers when a detector it watches turns
+    // present.
+    if (eng->capture != NULL) {
+      span_start = trace_begin();
+      capture_push(eng->capture, samp_buf, (size_t)report_len, tstamp, &tag);
+      const unsigned present =
+          classifier_present(eng->classifier) & eng->capture_mask;
+      if (present & ~capture_present) {
+        capture_trigger(eng->capture, present & ~capture_present);
       }
-      window_size--;
+      capture_present = present;
+      trace_end(TRACE_STAGE_CAPTURE, span_start, 0);
+    }
+    const uint16_t bin_pwr_count = report.segments[0].bin_pwr_count;
+    if (bin_pwr_count > bufs.max_bins) {
+      continue;
     }
 
-    memcpy(scan_data->bin_pwr, bin_pwr, bin_pwr_count);
-    scan_data->bin_pwr_count = bin_pwr_count;
-    scan_data->center_freq = center_freq;
-    scan_data->tstamp = tstamp;
-
-    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
-      window_sum[bin] += bin_pwr[bin];
+    // The statistics take the means of a squelch summary as often as the
+    // reports it stands for, the stages that add up power in mW its mean
+    // power. Its maxima go wherever a peak must not be lost: the
+    // spectrogram pyramid and the persistence.
+    const int8_t *bin_pwr = report.segments[0].bin_pwr;
+    const int8_t *mean_pwr = bin_pwr;
+    const int8_t *mean_mw = bin_pwr;
+    uint32_t weight = 1;
+    if (tag.flags & HOP_TAG_SUMMARY) {
+      mean_pwr = report_summary_mean(&report, (size_t)report_len);
+      mean_mw = report_summary_power(&report, (size_t)report_len);
+      if (mean_pwr == NULL || mean_mw == NULL) {
+        continue;
+      }
+      weight = tag.num_squelched > 0 ? tag.num_squelched : 1;
+      eng->num_squelched += weight;
+      eng->num_summaries++;
     }
-    window_size++;
 
-    struct window_avg_data avg_data;
-    for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
-      avg_data.bin_pwr[bin] = window_sum[bin] / (double)window_size;
+    eng->num_scans += weight;
+    eng->total_scans += weight;
+    if (tag.flags & HOP_TAG_GUARD) {
+      eng->num_guarded++;
+      continue;
     }
-    avg_data.bin_pwr_count = bin_pwr_count;
-    avg_data.center_freq = center_freq;
-    avg_data.tstamp = tstamp;
 
-    struct pulse_single new_pulses[MAX_NUM_BINS];
-    const uint16_t new_num_pulses = detect_pulses(&avg_data, new_pulses);
+    if (eng->params_gen != params_gen) {
+      pthread_mutex_lock(&eng->params_lock);
+      params_gen = eng->params_gen;
+      if (eng->detect_mode != mode) {
+        mode = eng->detect_mode;
+        num_pulses = 0;
+      }
+      params = eng->params;
+      avg_params = eng->avg_params;
+      const struct thread_sched new_sched = eng->sched;
+      pthread_mutex_unlock(&eng->params_lock);
+      if (memcmp(&new_sched, &sched, sizeof(sched)) != 0) {
+        sched = new_sched;
+        thread_sched_apply(&sched);
+      }
+      if (avg_params.mode != avg.mode &&
+          !averager_set_mode(&avg, avg_params.mode)) {
+        LOGE("Can't allocate boxcar window");
+        averager_set_mode(&avg, AVG_MODE_EMA);
+      }
+    }
 
-    struct pulse old_pulses[MAX_NUM_BINS];
-    const uint16_t old_num_pulses = num_pulses;
-    memcpy(old_pulses, pulses, old_num_pulses * sizeof(struct pulse));
-    num_pulses = match_pulses(new_pulses, new_num_pulses, bin_pwr_count,
-                              old_pulses, old_num_pulses, pulses);
+    const uint16_t center_freq = report.segments[0].center_freq;
+    report_freq = center_freq;
 
-#ifdef SPECTRAL_DETECT
-    if (tstamp > prev_tstamp) {
-      const int32_t elapsed = tstamp - prev_tstamp;
+    span_start = trace_begin();
+    if (eng->archive != NULL) {
+      archive_push(eng->archive, tstamp, center_freq, bin_pwr_count, mean_pwr);
+    }
+    if (eng->pyramid != NULL) {
+      pyramid_update(eng->pyramid, center_freq, bin_pwr_count, tstamp,
+                     bin_pwr);
+    }
+    const int64_t time_us = tstamp_clock_update(&eng->band_clock, tstamp);
+    summed_area_update(eng->band_index, time_us, center_freq, SPAN_WIDTH,
+                       bin_pwr_count, mean_pwr, weight);
+    trace_end(TRACE_STAGE_INDEX, span_start, 0);
+    if (eng->channelizer != NULL) {
+      span_start = trace_begin();
+      const int64_t channel_start = stage_now_ns();
+      channelizer_update(eng->channelizer, time_us, center_freq, SPAN_WIDTH,
+                         bin_pwr_count, mean_mw, weight);
+      stage_timer_add(&eng->channel_timer, channel_start);
+      trace_end(TRACE_STAGE_CHANNELS, span_start, 0);
+    }
+    if (eng->alerts != NULL) {
+      span_start = trace_begin();
+      alerts_update(eng->alerts, time_us, tag.epoch, center_freq, SPAN_WIDTH,
+                    bin_pwr_count, mean_mw,
+                    classifier_present(eng->classifier));
+      trace_end(TRACE_STAGE_ALERTS, span_start, 0);
+    }
 
-      for (int bt_chan = 0; bt_chan < NUM_BT_CHANS; bt_chan++) {
-        if (non_bt_score[bt_chan] > elapsed) {
-          non_bt_score[bt_chan] -= elapsed;
-        } else {
-          non_bt_score[bt_chan] = 0;
-        }
+    span_start = trace_begin();
+    const int64_t floor_start = stage_now_ns();
+    const int16_t *floor = noise_floor_update(
+        eng->noise_floor, center_freq, bin_pwr_count, mean_pwr, weight);
+    double *const thres = bufs.thres;
+    if (params.floor_margin > 0) {
+      noise_floor_thresholds(floor, bin_pwr_count, params.floor_margin, thres);
+    } else {
+      for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+        thres[bin] = params.thres_min;
       }
+    }
+    stage_timer_add(&eng->floor_timer, floor_start);
+    trace_end(TRACE_STAGE_FLOOR, span_start, 0);
 
-      for (int zb_chan = 0; zb_chan < NUM_ZB_CHANS; zb_chan++) {
-        if (non_zb_score[zb_chan] > elapsed) {
-          non_zb_score[zb_chan] -= elapsed;
-        } else {
-          non_zb_score[zb_chan] = 0;
-        }
-      }
+    occupancy_update(eng->occupancy, center_freq, SPAN_WIDTH, bin_pwr_count,
+                     mean_pwr, thres, weight);
 
-      if (bt_score > elapsed) {
-        bt_score -= elapsed;
-      } else {
-        bt_score = 0;
-      }
+    if (eng->show_persistence) {
+      persistence_update(eng->persistence, center_freq, bin_pwr_count, tstamp,
+                         bin_pwr);
     }
-#else
-    int32_t max_pulse_length = -1;
-    double max_pulse_freq = 0;
-#endif
 
-#ifdef SPECTRAL_DETECT
-    for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
-      if (old_pulses[pulse_idx].matched) {
-        continue;
-      }
+    if (bin_pwr_count != kernels_bin_count) {
+      kernels = get_bin_kernels(bin_pwr_count);
+      kernels_bin_count = bin_pwr_count;
+    }
 
-      int32_t length = old_pulses[pulse_idx].tstamp_last -
-                       old_pulses[pulse_idx].tstamp_first;
-      double center = old_pulses[pulse_idx].center;
-      double bw = old_pulses[pulse_idx].bw;
-      double pwr = old_pulses[pulse_idx].pwr;
-      int bt_chan_center = (int)round(center - 2402);
-      int bt_chan_start = (int)round(center - bw / 2 - 2402);
-      int bt_chan_end = (int)round(center + bw / 2 - 2402) + 1;
-
-      if (bt_chan_start < 0) {
-        bt_chan_start = 0;
-      }
-      if (bt_chan_end > NUM_BT_CHANS) {
-        bt_chan_end = NUM_BT_CHANS;
-      }
+    span_start = trace_begin();
+    const struct window_avg_data *avg_data =
+        averager_update(&avg, kernels, mean_pwr, bin_pwr_count, weight,
+                        center_freq, tag.epoch, tstamp, &params, &avg_params);
+    trace_end(TRACE_STAGE_AVERAGE, span_start, avg.mode);
 
-      if (bw > 2) {
-        for (int bt_chan = bt_chan_start; bt_chan < bt_chan_end; bt_chan++) {
-          non_bt_score[bt_chan] = 2500;
-        }
-      } else if (length > 150 && length < 3750 && bw > 0.5 && bw < 1 &&
-                 bt_chan_center >= 0 && bt_chan_center < NUM_BT_CHANS &&
-                 non_bt_score[bt_chan_center] <= 0 &&
-                 bt_chan_center != last_bt_chan) {
-        last_bt_chan = bt_chan_center;
-        bt_score += length * 100;
-        if (bt_score > 2000000) {
-          bt_score = 2000000;
-        }
+    span_start = trace_begin();
+    struct pulse_single *const new_pulses = bufs.new_pulses;
+    const uint16_t new_num_pulses = kernels->detect_pulses[mode](
+        avg_data, thres, new_pulses, bin_pwr_count, &params);
+    trace_end(TRACE_STAGE_DETECT, span_start, new_num_pulses);
 
-        size_t bt_window_end = bt_window_start + bt_window_size;
-        bt_window_end %= MAX_WINDOW_SIZE;
-        double pwr_total = pwr * length;
-        bt_window[bt_window_end].pwr_total = pwr_total;
-        bt_window[bt_window_end].length = length;
-        bt_window_sum += pwr_total;
-        bt_window_length += length;
-        bt_window_size++;
-
-        while (bt_window_size > 0 && bt_window_length >= bt_max_window_length) {
-          bt_window_sum -= bt_window[bt_window_start].pwr_total;
-          bt_window_length -= bt_window[bt_window_start].length;
-          bt_window_start++;
-          bt_window_start %= MAX_WINDOW_SIZE;
-          bt_window_size--;
-        }
-      }
+    span_start = trace_begin();
+    struct pulse *const old_pulses = bufs.old_pulses;
+    const uint16_t old_num_pulses = num_pulses;
+    memcpy(old_pulses, bufs.pulses, old_num_pulses * sizeof(struct pulse));
+    num_pulses = match_pulses(new_pulses, new_num_pulses, bin_pwr_count,
+                              old_pulses, old_num_pulses, bufs.pulses,
+                              &params);
+    trace_end(TRACE_STAGE_MATCH, span_start, num_pulses);
 
-      if (bw < 1 || bw > 2) {
-        for (int bt_chan = bt_chan_start; bt_chan < bt_chan_end; bt_chan++) {
-          if (bt_chan % 5 == 3) {
-            non_zb_score[bt_chan / 5] = 2500;
-          }
+    eng->center_freq = center_freq;
+
+    if (mode == DETECT_MODE_CLASSIFY) {
+      span_start = trace_begin();
+      struct track *const finished = bufs.finished;
+      uint16_t num_finished = 0;
+      for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
+        if (old_pulses[pulse_idx].matched) {
+          continue;
         }
-      } else if (length > 150 && length < 6250 && bt_chan_center % 5 == 3 &&
-                 bt_chan_center / 5 >= 0 && bt_chan_center / 5 < NUM_ZB_CHANS &&
-                 non_zb_score[bt_chan_center / 5] <= 0) {
-        // LOGI("Chan: %d, Center: %.4f, BW: %.4f, Length: %d",
-        //      bt_chan_center / 5 + 11, center, bw, length);
+
+        finished[num_finished++] = (struct track){
+            .center = old_pulses[pulse_idx].center,
+            .bw = old_pulses[pulse_idx].bw,
+            .pwr = old_pulses[pulse_idx].pwr,
+            .tstamp_first = old_pulses[pulse_idx].tstamp_first,
+            .tstamp_last = old_pulses[pulse_idx].tstamp_last,
+            .cnt = old_pulses[pulse_idx].cnt,
+        };
       }
-    }
-#else
-    for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
-      int32_t length = old_pulses[pulse_idx].tstamp_last -
-                       old_pulses[pulse_idx].tstamp_first;
-      double center = old_pulses[pulse_idx].center;
-      if (length > max_pulse_length) {
-        max_pulse_length = length;
-        max_pulse_freq = center;
+      classifier_push(eng->classifier, tstamp, center_freq, finished,
+                      num_finished);
+      trace_end(TRACE_STAGE_CLASSIFY, span_start, num_finished);
+      eng->pulse_freq = NAN;
+    } else {
+      int32_t max_pulse_length = -1;
+      double max_pulse_freq = 0;
+      for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
+        int32_t length = old_pulses[pulse_idx].tstamp_last -
+                         old_pulses[pulse_idx].tstamp_first;
+        double center = old_pulses[pulse_idx].center;
+        if (length > max_pulse_length) {
+          max_pulse_length = length;
+          max_pulse_freq = center;
+        }
       }
+      eng->pulse_freq = max_pulse_length >= 0 ? max_pulse_freq : NAN;
     }
-#endif
 
-    state.center_freq = center_freq;
-#ifdef SPECTRAL_DETECT
-    prev_tstamp = tstamp;
-    state.bt_pwr = bt_score >= 1000000 ? bt_window_sum / bt_window_length : NAN;
-#else
-    state.pulse_freq = max_pulse_length >= 0 ? max_pulse_freq : NAN;
-#endif
+    publish_snapshot(eng, avg_data, bufs.pulses, num_pulses);
 
-    if (state.rbuffer_capacity == 0) {
+    if (eng->rbuffer_capacity == 0 || bin_pwr_count > eng->rbuffer_bins) {
       continue;
     }
-    if (state.show_average && rbuffer_last_pos < state.rbuffer_capacity &&
-        scans[window_start].tstamp <= state.rbuffer[rbuffer_last_pos].tstamp) {
+    if (eng->show_average && rbuffer_last_pos < eng->rbuffer_capacity &&
+        avg.first_tstamp <= get_plot_data(eng, rbuffer_last_pos)->tstamp) {
       continue;
     }
 
-    size_t rbuffer_write_pos = state.rbuffer_pos + state.rbuffer_size;
-    rbuffer_write_pos %= state.rbuffer_capacity;
+    span_start = trace_begin();
+    size_t rbuffer_write_pos = eng->rbuffer_pos + eng->rbuffer_size;
+    rbuffer_write_pos %= eng->rbuffer_capacity;
     rbuffer_last_pos = rbuffer_write_pos;
 
-    struct plot_data *plot_data = &state.rbuffer[rbuffer_write_pos];
+    struct plot_data *plot_data = get_plot_data(eng, rbuffer_write_pos);
     plot_data->num_pixels = bin_pwr_count;
     plot_data->tstamp = tstamp;
 
     for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
-      int8_t pwr = state.show_average ? (int8_t)round(avg_data.bin_pwr[bin])
+      int8_t pwr = eng->show_average ? (int8_t)round(avg_data->bin_pwr[bin])
                                       : bin_pwr[bin];
       uint16_t pixel = make565(0x80 + pwr, 0x40 + pwr / 2, 0xc0 + pwr / 2);
       plot_data->pixels[bin] = pixel;
     }
 
-    if (state.show_pulses) {
+    if (eng->show_pulses) {
       for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
         if (old_pulses[pulse_idx].matched) {
           continue;
@@ -547,7 +636,7 @@ static void *recv_thread(void *arg) {
         }
 
         for (int bin = bin_start; bin < bin_end; bin++) {
-          int8_t pwr = state.show_average ? (int8_t)round(avg_data.bin_pwr[bin])
+          int8_t pwr = eng->show_average ? (int8_t)round(avg_data->bin_pwr[bin])
                                           : bin_pwr[bin];
           uint16_t pixel = make565(0x80 + pwr, 0xc0 + pwr / 2, 0x40 + pwr / 2);
           plot_data->pixels[bin] = pixel;
@@ -555,40 +644,160 @@ static void *recv_thread(void *arg) {
       }
     }
 
-    if (state.rbuffer_size < state.rbuffer_capacity) {
-      state.rbuffer_size++;
+    if (eng->rbuffer_size < eng->rbuffer_capacity) {
+      eng->rbuffer_size++;
     } else {
-      state.rbuffer_pos++;
-      state.rbuffer_pos %= state.rbuffer_capacity;
+      eng->rbuffer_pos++;
+      eng->rbuffer_pos %= eng->rbuffer_capacity;
     }
+    trace_end(TRACE_STAGE_DRAW, span_start, 0);
   }
 
-  sem_post(&state.sem);
+  sem_post(&eng->sem);
+
+  for (int m = 0; m < NUM_AVG_MODES; m++) {
+    const struct stage_timer *timer = &avg.timers[m];
+    if (timer->count > 0) {
+      LOGI("Average (%s): %zu bytes, %.0f ns/report (max %" PRId64 " ns) over "
+           "%" PRId64 " reports",
+           avg_mode_names[m], averager_memory((enum avg_mode)m, avg.max_bins),
+           stage_timer_avg(timer), timer->max_ns, timer->count);
+    }
+  }
+  free(avg.scans);
+  arena_free(&bufs.arena);
 
   return NULL;
 }
 
-static void resize_rbuffer(int32_t height) {
+static void resize_rbuffer(struct plot_engine *eng, int32_t height) {
+  eng->rbuffer_bins = eng->max_bins;
+  eng->rbuffer_stride = (sizeof(struct plot_data) +
+                         eng->rbuffer_bins * sizeof(uint16_t) + 7) &
+                        ~(size_t)7;
   if (height > 0) {
-    free(state.rbuffer);
-    state.rbuffer = calloc((size_t)height, sizeof(struct plot_data));
-    if (state.rbuffer == NULL) {
+    free(eng->rbuffer);
+    eng->rbuffer = calloc((size_t)height, eng->rbuffer_stride);
+    if (eng->rbuffer == NULL) {
       LOGE("Can't allocate ring buffer");
       height = 0;
     }
   } else {
-    free(state.rbuffer);
-    state.rbuffer = NULL;
+    free(eng->rbuffer);
+    eng->rbuffer = NULL;
     height = 0;
   }
 
-  state.rbuffer_capacity = (size_t)height;
-  state.rbuffer_size = 0;
-  state.rbuffer_pos = 0;
+  eng->rbuffer_capacity = (size_t)height;
+  eng->rbuffer_size = 0;
+  eng->rbuffer_pos = 0;
+}
+
+// Bins are drawn bin_width pixels wide. With more bins than pixels, only
+// every bin_step-th bin is drawn, one pixel wide.
+struct bin_layout {
+  uint32_t bin_width;
+  uint16_t bin_step;
+  uint32_t used_width;
+};
+
+static struct bin_layout layout_bins(uint32_t width, uint16_t num_bins) {
+  struct bin_layout layout = {.bin_width = 1, .bin_step = 1};
+  if (num_bins <= width) {
+    layout.bin_width = width / num_bins;
+  } else {
+    layout.bin_step = (uint16_t)((num_bins + width - 1) / width);
+  }
+  layout.used_width =
+      (num_bins + layout.bin_step - 1U) / layout.bin_step * layout.bin_width;
+  return layout;
+}
+
+static void update_persistence(struct plot_engine *eng,
+                               const AndroidBitmapInfo *info,
+                               uint8_t *const pixels) {
+  for (uint32_t row = 0; row < info->height; row++) {
+    const int pwr = PERSIST_TOP - (int)(row * PERSIST_RANGE / info->height);
+    uint8_t density[MAX_NUM_BINS];
+    const uint16_t num_bins = persistence_row(
+        eng->persistence, eng->center_freq, pwr, density, MAX_NUM_BINS);
+
+    uint16_t *ptr = (uint16_t *)(pixels + row * info->stride);
+    uint16_t *ptr_end = ptr + info->width;
+
+    if (num_bins > 0) {
+      const struct bin_layout layout = layout_bins(info->width, num_bins);
+      for (uint16_t idx = 0; idx < num_bins;
+           idx += layout.bin_step, ptr += layout.bin_width) {
+        const int val = density[idx];
+        const uint16_t pixel =
+            val > 0 ? make565(val, 0x40 + val * 3 / 4, 0xff - val) : 0;
+
+        for (uint32_t i = 0; i < layout.bin_width; i++) {
+          ptr[i] = pixel;
+        }
+      }
+    }
+
+    for (; ptr < ptr_end; ptr++) {
+      *ptr = 0;
+    }
+  }
+}
+
+// Draws the newest rows of the pyramid level of the time scale, one row per
+// pixel row, so the cost does not depend on how many reports they cover.
+static void update_pyramid(struct plot_engine *eng,
+                           const AndroidBitmapInfo *info,
+                           uint8_t *const pixels, unsigned level) {
+  for (uint32_t y = 0; y < info->height; y++) {
+    uint16_t *ptr = (uint16_t *)(pixels + y * info->stride);
+    uint16_t *ptr_end = ptr + info->width;
+
+    struct pyramid_row row;
+    if (pyramid_row(eng->pyramid, eng->center_freq, level, y, &row)) {
+      const struct bin_layout layout =
+          layout_bins(info->width, row.bin_pwr_count);
+      for (uint16_t idx = 0; idx < row.bin_pwr_count;
+           idx += layout.bin_step, ptr += layout.bin_width) {
+        const int pwr = eng->show_average
+                            ? row.mean_pwr[idx] / (1 << PYRAMID_MEAN_SHIFT)
+                            : row.max_pwr[idx];
+        const uint16_t pixel = make565(0x80 + pwr, 0x40 + pwr / 2,
+                                       0xc0 + pwr / 2);
+
+        for (uint32_t i = 0; i < layout.bin_width; i++) {
+          ptr[i] = pixel;
+        }
+      }
+    }
+
+    for (; ptr < ptr_end; ptr++) {
+      *ptr = 0;
+    }
+  }
 }
 
-static void update_plot(const AndroidBitmapInfo *info, uint8_t *const pixels) {
-  const size_t num_rows = state.rbuffer_size;
+static void update_plot(struct plot_engine *eng, const AndroidBitmapInfo *info,
+                        uint8_t *const pixels) {
+  const unsigned time_scale = eng->time_scale;
+  if (eng->show_persistence ||
+      (time_scale > 0 && eng->pyramid != NULL &&
+       time_scale < pyramid_levels(eng->pyramid))) {
+    eng->rbuffer_pos += eng->rbuffer_size;
+    if (eng->rbuffer_capacity > 0) {
+      eng->rbuffer_pos %= eng->rbuffer_capacity;
+    }
+    eng->rbuffer_size = 0;
+    if (eng->show_persistence) {
+      update_persistence(eng, info, pixels);
+    } else {
+      update_pyramid(eng, info, pixels, time_scale);
+    }
+    return;
+  }
+
+  const size_t num_rows = eng->rbuffer_size;
 
   if (num_rows == 0) {
     return;
@@ -597,24 +806,25 @@ static void update_plot(const AndroidBitmapInfo *info, uint8_t *const pixels) {
             (info->height - num_rows) * info->stride);
   }
 
-  while (state.rbuffer_size > 0) {
-    const struct plot_data *plot_data = &state.rbuffer[state.rbuffer_pos++];
-    state.rbuffer_pos %= state.rbuffer_capacity;
-    state.rbuffer_size--;
+  while (eng->rbuffer_size > 0) {
+    const struct plot_data *plot_data = get_plot_data(eng, eng->rbuffer_pos++);
+    eng->rbuffer_pos %= eng->rbuffer_capacity;
+    eng->rbuffer_size--;
 
-    if (state.rbuffer_size >= info->height) {
+    if (eng->rbuffer_size >= info->height) {
       continue;
     }
 
-    const uint32_t bin_width = info->width / plot_data->num_pixels;
-    uint16_t *ptr = (uint16_t *)(pixels + state.rbuffer_size * info->stride);
+    const struct bin_layout layout =
+        layout_bins(info->width, plot_data->num_pixels);
+    uint16_t *ptr = (uint16_t *)(pixels + eng->rbuffer_size * info->stride);
     uint16_t *ptr_end = ptr + info->width;
 
     for (uint16_t idx = 0; idx < plot_data->num_pixels;
-         idx++, ptr += bin_width) {
+         idx += layout.bin_step, ptr += layout.bin_width) {
       const uint16_t pixel = plot_data->pixels[idx];
 
-      for (uint32_t i = 0; i < bin_width; i++) {
+      for (uint32_t i = 0; i < layout.bin_width; i++) {
         ptr[i] = pixel;
       }
     }
@@ -627,8 +837,54 @@ static void update_plot(const AndroidBitmapInfo *info, uint8_t *const pixels) {
   return;
 }
 
-static void JNICALL startPlot(JNIEnv *env, jclass cls, jstring sockPath) {
-  if (state.running) {
+// The engine of a view is set when the view is constructed, and is NULL
+// once the view is destroyed, for native calls that come after.
+static struct plot_engine *get_engine(JNIEnv *env, jobject view) {
+  return (struct plot_engine *)(intptr_t)(*env)->GetLongField(
+      env, view, jni.engine_fid);
+}
+
+static jlong JNICALL createEngine(JNIEnv *env, jclass cls) {
+  struct plot_engine *eng = calloc(1, sizeof(struct plot_engine));
+  struct plot_snapshot *snap = calloc(1, sizeof(struct plot_snapshot));
+  if (eng == NULL || snap == NULL) {
+    free(eng);
+    free(snap);
+    jclass oom = (*env)->FindClass(env, "java/lang/OutOfMemoryError");
+    (*env)->ThrowNew(env, oom, "Can't allocate plot engine");
+    return 0;
+  }
+
+  snap->version = SNAPSHOT_VERSION;
+  snap->center_pos = NAN;
+  snap->pulse_freq = NAN;
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    snap->detector_pwr[id] = NAN;
+  }
+  eng->snapshot = snap;
+
+  pthread_mutex_init(&eng->params_lock, NULL);
+  eng->detect_mode = DETECT_MODE_CLASSIFY;
+  eng->params = default_detect_params[DETECT_MODE_CLASSIFY];
+  eng->avg_params = (struct avg_params){
+      .mode = AVG_MODE_BOXCAR,
+      .avg_time = default_detect_params[DETECT_MODE_CLASSIFY].max_window_time,
+      .hold_decay = 0.02,
+  };
+  eng->params_gen = 1;
+  eng->pyramid_levels = 10;
+  eng->pyramid_rows = 256;
+  eng->pyramid_budget = (size_t)16 << 20;
+  eng->max_bins = (uint16_t)report_max_bins(DEFAULT_FFT_SIZE);
+  return (jlong)(intptr_t)eng;
+}
+
+static void JNICALL startPlot(JNIEnv *env, jobject view, jstring sockPath) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  if (eng->running) {
     return;
   }
 
@@ -638,11 +894,11 @@ static void JNICALL startPlot(JNIEnv *env, jclass cls, jstring sockPath) {
     return;
   }
 
-  memset(&state.saddr, 0, sizeof(state.saddr));
-  state.saddr.sun_family = AF_UNIX;
+  memset(&eng->saddr, 0, sizeof(eng->saddr));
+  eng->saddr.sun_family = AF_UNIX;
   const size_t sun_path_len =
       sizeof(struct sockaddr_un) - offsetof(struct sockaddr_un, sun_path);
-  strlcpy(state.saddr.sun_path, sock_path, sun_path_len);
+  strlcpy(eng->saddr.sun_path, sock_path, sun_path_len);
 
   (*env)->ReleaseStringUTFChars(env, sockPath, sock_path);
   sock_path = NULL;
@@ -653,71 +909,955 @@ static void JNICALL startPlot(JNIEnv *env, jclass cls, jstring sockPath) {
     return;
   }
 
-  if (bind(sock_fd, (struct sockaddr *)&state.saddr, sizeof(state.saddr)) < 0) {
+  if (bind(sock_fd, (struct sockaddr *)&eng->saddr, sizeof(eng->saddr)) < 0) {
     LOGE("Can't bind socket: %s", strerror(errno));
     return;
   }
 
-  state.sock_fd = sock_fd;
-  state.sock_path = state.saddr.sun_path;
+  eng->sock_fd = sock_fd;
+  eng->sock_path = eng->saddr.sun_path;
+
+  eng->classifier = classifier_create(2, eng->detector_mask);
+  if (eng->classifier == NULL) {
+    close(sock_fd);
+    unlink(eng->sock_path);
+    return;
+  }
+
+  eng->noise_floor = noise_floor_create();
+  if (eng->noise_floor == NULL) {
+    LOGE("Can't allocate noise floor estimator");
+    classifier_destroy(eng->classifier);
+    eng->classifier = NULL;
+    close(sock_fd);
+    unlink(eng->sock_path);
+    return;
+  }
+  eng->floor_timer = (struct stage_timer){0};
+
+  eng->occupancy = occupancy_create();
+  if (eng->occupancy == NULL) {
+    LOGE("Can't allocate occupancy statistics");
+    noise_floor_destroy(eng->noise_floor);
+    eng->noise_floor = NULL;
+    classifier_destroy(eng->classifier);
+    eng->classifier = NULL;
+    close(sock_fd);
+    unlink(eng->sock_path);
+    return;
+  }
+
+  eng->band_index =
+      summed_area_create(BAND_INDEX_ROWS, band_index_row_time);
+  if (eng->band_index == NULL) {
+    LOGE("Can't allocate band power index");
+    occupancy_destroy(eng->occupancy);
+    eng->occupancy = NULL;
+    noise_floor_destroy(eng->noise_floor);
+    eng->noise_floor = NULL;
+    classifier_destroy(eng->classifier);
+    eng->classifier = NULL;
+    close(sock_fd);
+    unlink(eng->sock_path);
+    return;
+  }
+  eng->band_clock = (struct tstamp_clock){0};
+
+  eng->channelizer = channelizer_create(channel_period, CHANNEL_FRAMES);
+  if (eng->channelizer == NULL) {
+    LOGW("Can't allocate channelizer");
+  }
+  eng->channel_timer = (struct stage_timer){0};
+
+  eng->pyramid = pyramid_create(eng->pyramid_levels, eng->pyramid_rows,
+                                eng->pyramid_budget);
+  if (eng->pyramid == NULL) {
+    LOGW("Can't allocate spectrogram pyramid");
+  }
+
+  eng->persistence = persistence_create(persist_half_life);
+  if (eng->persistence == NULL) {
+    LOGE("Can't allocate persistence display");
+    channelizer_destroy(eng->channelizer);
+    eng->channelizer = NULL;
+    pyramid_destroy(eng->pyramid);
+    eng->pyramid = NULL;
+    summed_area_destroy(eng->band_index);
+    eng->band_index = NULL;
+    occupancy_destroy(eng->occupancy);
+    eng->occupancy = NULL;
+    noise_floor_destroy(eng->noise_floor);
+    eng->noise_floor = NULL;
+    classifier_destroy(eng->classifier);
+    eng->classifier = NULL;
+    close(sock_fd);
+    unlink(eng->sock_path);
+    return;
+  }
+  eng->pulse_freq = NAN;
+  sem_init(&eng->sem, 0, 1);
+  eng->running = true;
+  pthread_create(&eng->recv_thread, 0, recv_thread, eng);
+}
+
+// Everything an engine allocates for its pipeline, apart from the archive
+// writer, the capture ring and the thread stack.
+static size_t engine_memory(const struct plot_engine *eng) {
+  size_t memory = sizeof(struct plot_engine) + sizeof(struct plot_snapshot) +
+                  eng->rbuffer_capacity * eng->rbuffer_stride +
+                  noise_floor_memory() + occupancy_memory() +
+                  summed_area_memory(eng->band_index) +
+                  persistence_memory(eng->persistence);
+  if (eng->channelizer != NULL) {
+    memory += channelizer_memory(eng->channelizer);
+  }
+  if (eng->pyramid != NULL) {
+    memory += pyramid_memory(eng->pyramid);
+  }
+  if (eng->alerts != NULL) {
+    memory += alerts_memory(eng->alerts);
+  }
+  return memory;
+}
+
+// Alert events reach Java on the alert thread, which is attached to the
+// VM on its first event.
+static void notify_alert(void *ctx, const struct alert_event *event) {
+  jobject view = ctx;
+  JNIEnv *env;
+  if ((*jni.vm)->GetEnv(jni.vm, (void **)&env, JNI_VERSION_1_6) != JNI_OK &&
+      (*jni.vm)->AttachCurrentThread(jni.vm, &env, NULL) != JNI_OK) {
+    LOGE("Can't attach alert thread");
+    return;
+  }
+  (*env)->CallVoidMethod(env, view, jni.onAlert_mid, (jint)event->rule,
+                         (jboolean)event->raised, (jlong)event->time_us,
+                         (jdouble)event->pwr);
+  if ((*env)->ExceptionCheck(env)) {
+    LOGW("Alert listener threw");
+    (*env)->ExceptionClear(env);
+  }
+}
+
+static void detach_alert_thread(void *ctx) {
+  JNIEnv *env;
+  if ((*jni.vm)->GetEnv(jni.vm, (void **)&env, JNI_VERSION_1_6) == JNI_OK) {
+    (*jni.vm)->DetachCurrentThread(jni.vm);
+  }
+}
 
-#ifdef SPECTRAL_DETECT
-  state.bt_pwr = NAN;
-#else
-  state.pulse_freq = NAN;
-#endif
-  sem_init(&state.sem, 0, 1);
-  state.running = true;
-  pthread_create(&state.recv_thread, 0, recv_thread, NULL);
+// The alerts are destroyed, and their thread joined, before the view they
+// call back is released.
+static void close_alerts(JNIEnv *env, struct alerts *alerts, jobject view) {
+  alerts_destroy(alerts);
+  if (view != NULL) {
+    (*env)->DeleteGlobalRef(env, view);
+  }
 }
 
-static void JNICALL stopPlot(JNIEnv *env, jclass cls) {
-  if (!state.running) {
+static void stop_engine(JNIEnv *env, struct plot_engine *eng) {
+  if (eng == NULL || !eng->running) {
     return;
   }
 
-  state.running = false;
-  pthread_kill(state.recv_thread, SIGINT);
-  pthread_join(state.recv_thread, NULL);
-  sem_destroy(&state.sem);
-  resize_rbuffer(0);
+  eng->running = false;
+  pthread_kill(eng->recv_thread, SIGINT);
+  pthread_join(eng->recv_thread, NULL);
+  sem_destroy(&eng->sem);
+  LOGI("Engine on %s: %zu bytes", eng->sock_path, engine_memory(eng));
+  archive_writer_close(eng->archive);
+  eng->archive = NULL;
+  capture_close(eng->capture);
+  eng->capture = NULL;
+  eng->capture_budget = 0;
+  close_alerts(env, eng->alerts, eng->alert_view);
+  eng->alerts = NULL;
+  eng->alert_view = NULL;
+  resize_rbuffer(eng, 0);
+  classifier_destroy(eng->classifier);
+  eng->classifier = NULL;
+  noise_floor_destroy(eng->noise_floor);
+  eng->noise_floor = NULL;
+
+  LOGI("Band index: %zu bytes", summed_area_memory(eng->band_index));
+  summed_area_destroy(eng->band_index);
+  eng->band_index = NULL;
+
+  if (eng->channelizer != NULL) {
+    LOGI("Channelizer: %zu bytes, %.0f ns/report (max %" PRId64 " ns)",
+         channelizer_memory(eng->channelizer),
+         stage_timer_avg(&eng->channel_timer), eng->channel_timer.max_ns);
+    channelizer_destroy(eng->channelizer);
+    eng->channelizer = NULL;
+  }
+
+  LOGI("Occupancy: %zu bytes", occupancy_memory());
+  occupancy_destroy(eng->occupancy);
+  eng->occupancy = NULL;
+
+  if (eng->pyramid != NULL) {
+    LOGI("Pyramid: %zu bytes", pyramid_memory(eng->pyramid));
+    pyramid_destroy(eng->pyramid);
+    eng->pyramid = NULL;
+  }
+
+  LOGI("Persistence: %zu bytes", persistence_memory(eng->persistence));
+  persistence_destroy(eng->persistence);
+  eng->persistence = NULL;
 
-  if (close(state.sock_fd) < 0) {
+  LOGI("Noise floor: %zu bytes, %.0f ns/report (max %" PRId64 " ns) over "
+       "%" PRId64 " reports",
+       noise_floor_memory(), stage_timer_avg(&eng->floor_timer),
+       eng->floor_timer.max_ns, eng->floor_timer.count);
+
+  if (eng->num_guarded > 0) {
+    LOGI("Skipped %" PRId64 " reports in channel guard", eng->num_guarded);
+    eng->num_guarded = 0;
+  }
+  if (eng->num_summaries > 0) {
+    LOGI("Received %" PRId64 " squelched reports in %" PRId64 " summaries",
+         eng->num_squelched, eng->num_summaries);
+    eng->num_squelched = 0;
+    eng->num_summaries = 0;
+  }
+
+  if (close(eng->sock_fd) < 0) {
     LOGW("Can't close socket: %s", strerror(errno));
   }
 
-  if (unlink(state.sock_path) < 0) {
+  if (unlink(eng->sock_path) < 0) {
     LOGW("Can't unlink socket: %s", strerror(errno));
   }
 
-  state.sock_fd = 0;
-  state.sock_path = NULL;
+  eng->sock_fd = 0;
+  eng->sock_path = NULL;
+}
+
+static void JNICALL stopPlot(JNIEnv *env, jobject view) {
+  stop_engine(env, get_engine(env, view));
+}
+
+static void JNICALL destroyEngine(JNIEnv *env, jclass cls, jlong handle) {
+  struct plot_engine *eng = (struct plot_engine *)(intptr_t)handle;
+  if (eng == NULL) {
+    return;
+  }
+  stop_engine(env, eng);
+  pthread_mutex_destroy(&eng->params_lock);
+  free(eng->snapshot);
+  free(eng);
+}
+
+// Copies the snapshot in src into dst under its seqlock, for readers that
+// can't order their own loads around seq.
+static void JNICALL copySnapshot(JNIEnv *env, jclass cls, jobject src,
+                                 jobject dst) {
+  const struct plot_snapshot *snap = (*env)->GetDirectBufferAddress(env, src);
+  void *copy = (*env)->GetDirectBufferAddress(env, dst);
+  if (snap == NULL || copy == NULL ||
+      (*env)->GetDirectBufferCapacity(env, dst) <
+          (jlong)sizeof(struct plot_snapshot)) {
+    return;
+  }
+
+  unsigned seq;
+  do {
+    while (((seq = atomic_load_explicit(&snap->seq, memory_order_acquire)) &
+            1) != 0) {
+      sched_yield();
+    }
+    memcpy(copy, (const void *)snap, sizeof(struct plot_snapshot));
+    atomic_thread_fence(memory_order_acquire);
+  } while (atomic_load_explicit(&snap->seq, memory_order_relaxed) != seq);
+}
+
+// The buffer stays valid until the engine is destroyed.
+static jobject JNICALL getSnapshot(JNIEnv *env, jobject view) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return NULL;
+  }
+  return (*env)->NewDirectByteBuffer(env, eng->snapshot,
+                                     sizeof(struct plot_snapshot));
+}
+
+static void JNICALL configPlot(JNIEnv *env, jobject view, jboolean showAverage,
+                               jboolean showPulses, jboolean showPersistence) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  eng->show_average = showAverage;
+  eng->show_pulses = showPulses;
+  eng->show_persistence = showPersistence;
+}
+
+static void JNICALL configDetectors(JNIEnv *env, jobject view, jint mask) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  eng->detector_mask = (unsigned)mask;
+  if (eng->running) {
+    classifier_enable(eng->classifier, (unsigned)mask);
+  }
 }
 
-static void JNICALL configPlot(JNIEnv *env, jclass cls, jboolean showAverage,
-                               jboolean showPulses) {
-  state.show_average = showAverage;
-  state.show_pulses = showPulses;
+static double clamp_threshold(double value, double min, double max) {
+  return value < min ? min : value > max ? max : value;
 }
 
-static void JNICALL changeHeight(JNIEnv *env, jclass cls, jint height) {
-  if (!state.running) {
+// Thresholds are given in the order of struct detect_params. A null array
+// restores the defaults of the mode, and an array with a value that isn't
+// finite is ignored. Integer thresholds are clamped to their range. The
+// receive thread picks up the new values with the next report.
+static void JNICALL configDetect(JNIEnv *env, jobject view, jint mode,
+                                 jdoubleArray thresholds) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
     return;
   }
+  enum { NUM_THRESHOLDS = 8 };
 
-  sem_wait(&state.sem);
-  if (height >= 0 && (size_t)height != state.rbuffer_capacity) {
-    resize_rbuffer(height);
+  if (mode < 0 || mode >= NUM_DETECT_MODES) {
+    LOGW("Unknown detection mode %d", mode);
+    return;
+  }
+
+  struct detect_params params = default_detect_params[mode];
+  if (thresholds != NULL) {
+    if ((*env)->GetArrayLength(env, thresholds) != NUM_THRESHOLDS) {
+      LOGW("Expected %d detection thresholds", NUM_THRESHOLDS);
+      return;
+    }
+    jdouble values[NUM_THRESHOLDS];
+    (*env)->GetDoubleArrayRegion(env, thresholds, 0, NUM_THRESHOLDS, values);
+    for (int idx = 0; idx < NUM_THRESHOLDS; idx++) {
+      if (!isfinite(values[idx])) {
+        LOGW("Detection threshold %d is not finite", idx);
+        return;
+      }
+    }
+    params.thres_min = (int)clamp_threshold(values[0], -128, 127);
+    params.thres_diff = (int)clamp_threshold(values[1], 0, 255);
+    params.thres_freq = values[2];
+    params.thres_pwr = values[3];
+    params.thres_time = (int32_t)clamp_threshold(values[4], 0, INT32_MAX);
+    params.max_window_time =
+        (int32_t)clamp_threshold(values[5], 0, INT32_MAX);
+    params.max_window_size =
+        (size_t)clamp_threshold(values[6], 1, MAX_WINDOW_SIZE);
+    params.floor_margin = values[7];
+  }
+
+  pthread_mutex_lock(&eng->params_lock);
+  eng->detect_mode = (enum detect_mode)mode;
+  eng->params = params;
+  eng->params_gen++;
+  pthread_mutex_unlock(&eng->params_lock);
+}
+
+// avgTime is in microseconds and holdDecay in dB per millisecond.
+static void JNICALL configAverage(JNIEnv *env, jobject view, jint mode,
+                                  jint avgTime, jdouble holdDecay) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
   }
-  sem_post(&state.sem);
+  if (mode < 0 || mode >= NUM_AVG_MODES) {
+    LOGW("Unknown averaging mode %d", mode);
+    return;
+  }
+
+  pthread_mutex_lock(&eng->params_lock);
+  eng->avg_params.mode = (enum avg_mode)mode;
+  eng->avg_params.avg_time = avgTime > 0 ? avgTime : 0;
+  eng->avg_params.hold_decay = holdDecay > 0 ? holdDecay : 0;
+  eng->params_gen++;
+  pthread_mutex_unlock(&eng->params_lock);
 }
 
-static jlong JNICALL updatePlot(JNIEnv *env, jclass cls, jobject view) {
-  if (!state.running) {
+// stats receives {freq, duty, meanPwr, maxPwr} for each cell in
+// [startFreq, endFreq), hour selects a time-of-day bucket or -1 for all.
+static jint JNICALL getOccupancy(JNIEnv *env, jobject view, jint startFreq,
+                                 jint endFreq, jint hour, jfloatArray stats) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running || startFreq < 0 || endFreq > UINT16_MAX) {
     return 0;
   }
 
-  jobject bitmap = (*env)->GetObjectField(env, view, state.plotBitmap_fid);
+  const jsize max_cells = (*env)->GetArrayLength(env, stats) / 4;
+  struct occupancy_stats *cells =
+      calloc((size_t)max_cells + 1, sizeof(struct occupancy_stats));
+  if (cells == NULL) {
+    LOGE("Can't allocate occupancy query");
+    return 0;
+  }
+
+  sem_wait(&eng->sem);
+  const uint16_t num_cells = occupancy_query(
+      eng->occupancy, (uint16_t)startFreq, (uint16_t)endFreq, hour, cells,
+      max_cells > UINT16_MAX ? UINT16_MAX : (uint16_t)max_cells);
+  sem_post(&eng->sem);
+
+  (*env)->SetFloatArrayRegion(env, stats, 0, num_cells * 4, (jfloat *)cells);
+  free(cells);
+
+  return num_cells;
+}
+
+// The statistics are copied under the lock so that the receive thread is
+// not held up by file I/O.
+static jboolean JNICALL dumpOccupancy(JNIEnv *env, jobject view, jstring path) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return JNI_FALSE;
+  }
+
+  struct occupancy *snapshot = occupancy_create();
+  if (snapshot == NULL) {
+    LOGE("Can't allocate occupancy snapshot");
+    return JNI_FALSE;
+  }
+
+  sem_wait(&eng->sem);
+  occupancy_copy(snapshot, eng->occupancy);
+  sem_post(&eng->sem);
+
+  const char *file_path = (*env)->GetStringUTFChars(env, path, NULL);
+  if (file_path == NULL) {
+    LOGE("Can't get occupancy file path");
+    occupancy_destroy(snapshot);
+    return JNI_FALSE;
+  }
+
+  const int err = occupancy_dump(snapshot, file_path);
+  if (err < 0) {
+    LOGE("Can't write %s: %s", file_path, strerror(-err));
+  }
+
+  (*env)->ReleaseStringUTFChars(env, path, file_path);
+  occupancy_destroy(snapshot);
+
+  return err < 0 ? JNI_FALSE : JNI_TRUE;
+}
+
+static jboolean JNICALL startArchive(JNIEnv *env, jobject view, jstring path) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return JNI_FALSE;
+  }
+
+  const char *file_path = (*env)->GetStringUTFChars(env, path, NULL);
+  if (file_path == NULL) {
+    LOGE("Can't get archive path");
+    return JNI_FALSE;
+  }
+  struct archive_writer *archive = archive_writer_open(file_path, SPAN_WIDTH);
+  (*env)->ReleaseStringUTFChars(env, path, file_path);
+  if (archive == NULL) {
+    return JNI_FALSE;
+  }
+
+  sem_wait(&eng->sem);
+  struct archive_writer *old = eng->archive;
+  eng->archive = archive;
+  sem_post(&eng->sem);
+
+  archive_writer_close(old);
+  return JNI_TRUE;
+}
+
+static void JNICALL stopArchive(JNIEnv *env, jobject view) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return;
+  }
+
+  sem_wait(&eng->sem);
+  struct archive_writer *archive = eng->archive;
+  eng->archive = NULL;
+  sem_post(&eng->sem);
+
+  archive_writer_close(archive);
+}
+
+// The ring takes up to budgetMb MiB, in slots for reports of the current
+// FFT size; after a larger FFT size is configured, the capture must be
+// restarted to keep the longer reports. detectorMask selects the
+// detectors that trigger it when they turn present.
+static jboolean JNICALL startCapture(JNIEnv *env, jobject view, jstring dir,
+                                     jint budgetMb, jint preMs, jint postMs,
+                                     jint detectorMask) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running || budgetMb <= 0 || preMs < 0 ||
+      postMs < 0) {
+    return JNI_FALSE;
+  }
+  if (budgetMb > MAX_ENGINE_MEMORY_MB - (int)(eng->pyramid_budget >> 20)) {
+    LOGW("Capture of %d MiB exceeds the engine limit of %d MiB", budgetMb,
+         MAX_ENGINE_MEMORY_MB);
+    return JNI_FALSE;
+  }
+
+  const char *dir_path = (*env)->GetStringUTFChars(env, dir, NULL);
+  if (dir_path == NULL) {
+    LOGE("Can't get capture directory");
+    return JNI_FALSE;
+  }
+  const struct capture_config config = {
+      .dir = dir_path,
+      .budget = (size_t)budgetMb << 20,
+      .max_len = report_len_for_bins(eng->max_bins),
+      .pre_us = (int64_t)preMs * 1000,
+      .post_us = (int64_t)postMs * 1000,
+  };
+  struct capture *capture = capture_open(&config);
+  (*env)->ReleaseStringUTFChars(env, dir, dir_path);
+  if (capture == NULL) {
+    return JNI_FALSE;
+  }
+
+  sem_wait(&eng->sem);
+  struct capture *old = eng->capture;
+  eng->capture = capture;
+  eng->capture_mask = (unsigned)detectorMask;
+  sem_post(&eng->sem);
+  eng->capture_budget = config.budget;
+
+  capture_close(old);
+  return JNI_TRUE;
+}
+
+static void JNICALL stopCapture(JNIEnv *env, jobject view) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return;
+  }
+
+  sem_wait(&eng->sem);
+  struct capture *capture = eng->capture;
+  eng->capture = NULL;
+  sem_post(&eng->sem);
+  eng->capture_budget = 0;
+
+  capture_close(capture);
+}
+
+// Replaces the alert rules, see alerts.h. Returns the number of rules, or
+// -1 if they can't be parsed, which keeps the previous rules. Empty rules
+// remove the alerts.
+static jint JNICALL configAlerts(JNIEnv *env, jobject view, jstring rules) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return -1;
+  }
+
+  const char *rule_text = (*env)->GetStringUTFChars(env, rules, NULL);
+  if (rule_text == NULL) {
+    LOGE("Can't get alert rules");
+    return -1;
+  }
+  jobject alert_view = (*env)->NewGlobalRef(env, view);
+  const struct alerts_config config = {
+      .notify = notify_alert,
+      .done = detach_alert_thread,
+      .ctx = alert_view,
+  };
+  struct alerts *alerts = alerts_create(rule_text, &config);
+  (*env)->ReleaseStringUTFChars(env, rules, rule_text);
+  if (alerts == NULL) {
+    (*env)->DeleteGlobalRef(env, alert_view);
+    return -1;
+  }
+  const jint num_rules = (jint)alerts_num_rules(alerts);
+  if (num_rules == 0) {
+    close_alerts(env, alerts, alert_view);
+    alerts = NULL;
+    alert_view = NULL;
+  }
+
+  sem_wait(&eng->sem);
+  struct alerts *old = eng->alerts;
+  jobject old_view = eng->alert_view;
+  eng->alerts = alerts;
+  eng->alert_view = alert_view;
+  sem_post(&eng->sem);
+
+  close_alerts(env, old, old_view);
+  return num_rules;
+}
+
+// Takes lines of "ROLE = SETTINGS" as described in thread-sched.h, and
+// schedules the receive thread as the plot role. Returns false if they can't
+// be parsed, which keeps the previous settings.
+static jboolean JNICALL configSched(JNIEnv *env, jobject view, jstring text) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return JNI_FALSE;
+  }
+  const char *sched_text = (*env)->GetStringUTFChars(env, text, NULL);
+  if (sched_text == NULL) {
+    LOGE("Can't get scheduling settings");
+    return JNI_FALSE;
+  }
+  struct thread_sched scheds[NUM_THREAD_ROLES];
+  const bool parsed = thread_sched_parse_roles(sched_text, scheds);
+  (*env)->ReleaseStringUTFChars(env, text, sched_text);
+  if (!parsed) {
+    return JNI_FALSE;
+  }
+
+  pthread_mutex_lock(&eng->params_lock);
+  eng->sched = scheds[THREAD_PLOT];
+  eng->params_gen++;
+  pthread_mutex_unlock(&eng->params_lock);
+  return JNI_TRUE;
+}
+
+static jboolean JNICALL triggerCapture(JNIEnv *env, jobject view) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return JNI_FALSE;
+  }
+
+  sem_wait(&eng->sem);
+  const bool triggered =
+      eng->capture != NULL && capture_trigger(eng->capture, 0);
+  sem_post(&eng->sem);
+  return triggered ? JNI_TRUE : JNI_FALSE;
+}
+
+// Every level keeps rowsPerLevel rows per channel, so a channel takes
+// levels * rowsPerLevel * (3 bytes per bin + 16), and channels are kept
+// while they fit into budgetMb MiB together. Changing it drops the history.
+static void JNICALL configPyramid(JNIEnv *env, jobject view, jint levels,
+                                  jint rowsPerLevel, jint budgetMb) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  if (levels < 1 || rowsPerLevel < 2 || budgetMb < 1) {
+    LOGW("Invalid pyramid size %d x %d in %d MiB", levels, rowsPerLevel,
+         budgetMb);
+    return;
+  }
+  if (budgetMb > MAX_ENGINE_MEMORY_MB - (int)(eng->capture_budget >> 20)) {
+    LOGW("Pyramid of %d MiB exceeds the engine limit of %d MiB", budgetMb,
+         MAX_ENGINE_MEMORY_MB);
+    return;
+  }
+
+  eng->pyramid_levels = (unsigned)levels;
+  eng->pyramid_rows = (size_t)rowsPerLevel;
+  eng->pyramid_budget = (size_t)budgetMb << 20;
+  if (!eng->running) {
+    return;
+  }
+
+  struct pyramid *pyramid = pyramid_create(
+      eng->pyramid_levels, eng->pyramid_rows, eng->pyramid_budget);
+  if (pyramid == NULL) {
+    LOGW("Can't allocate spectrogram pyramid");
+  }
+
+  sem_wait(&eng->sem);
+  struct pyramid *old = eng->pyramid;
+  eng->pyramid = pyramid;
+  sem_post(&eng->sem);
+
+  pyramid_destroy(old);
+}
+
+// Reports of up to 2^fftSize bins per segment are taken from now on. The
+// waterfall is cleared if its rows change size.
+static void JNICALL configFftSize(JNIEnv *env, jobject view, jint fftSize) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  if (fftSize < 0 || fftSize > MAX_FFT_SIZE) {
+    LOGW("Invalid FFT size %d", fftSize);
+    return;
+  }
+
+  const uint16_t max_bins = (uint16_t)report_max_bins((uint32_t)fftSize);
+  if (!eng->running) {
+    eng->max_bins = max_bins;
+    return;
+  }
+
+  sem_wait(&eng->sem);
+  eng->max_bins = max_bins;
+  if (eng->rbuffer_capacity > 0 && eng->rbuffer_bins != max_bins) {
+    resize_rbuffer(eng, (int32_t)eng->rbuffer_capacity);
+  }
+  sem_post(&eng->sem);
+}
+
+// Level 0 is the live waterfall, level n shows 2^n reports per row.
+static void JNICALL configTimeScale(JNIEnv *env, jobject view, jint level) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return;
+  }
+  eng->time_scale = level > 0 ? (unsigned)level : 0;
+}
+
+// Mean power in dBm over [startFreq, endFreq] MHz between startAgo and
+// endAgo milliseconds before the newest finished row, or NaN without data.
+static jdouble JNICALL getBandPower(JNIEnv *env, jobject view, jint startAgo,
+                                    jint endAgo, jdouble startFreq,
+                                    jdouble endFreq) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return NAN;
+  }
+
+  double mean_pwr = NAN;
+  uint64_t num_samples;
+  sem_wait(&eng->sem);
+  const int64_t last = summed_area_last_time(eng->band_index) - 1;
+  if (!summed_area_query(eng->band_index, last - startAgo * 1000LL,
+                         last - endAgo * 1000LL, startFreq, endFreq,
+                         &mean_pwr, &num_samples)) {
+    mean_pwr = NAN;
+  }
+  sem_post(&eng->sem);
+
+  return mean_pwr;
+}
+
+// Power in dBm of every channel of a grid over the newest published frame,
+// NaN for channels not measured in it. Returns the number of channels.
+static jint JNICALL getChannelPower(JNIEnv *env, jobject view, jint grid,
+                                    jfloatArray power) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return 0;
+  }
+  if (grid < 0 || grid >= NUM_GRIDS) {
+    return 0;
+  }
+
+  float buf[MAX_GRID_CHANNELS];
+  size_t num_chans = 0;
+  const jsize len = (*env)->GetArrayLength(env, power);
+  sem_wait(&eng->sem);
+  if (eng->running && eng->channelizer != NULL) {
+    num_chans = channelizer_latest(eng->channelizer, (enum channel_grid)grid,
+                                   buf, (size_t)len);
+  }
+  sem_post(&eng->sem);
+
+  (*env)->SetFloatArrayRegion(env, power, 0, (jsize)num_chans, buf);
+  return (jint)num_chans;
+}
+
+// Power in dBm of one channel over the newest frames, oldest first.
+static jint JNICALL getChannelSeries(JNIEnv *env, jobject view, jint grid,
+                                     jint channel, jfloatArray series) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL) {
+    return 0;
+  }
+  if (grid < 0 || grid >= NUM_GRIDS || channel < 0) {
+    return 0;
+  }
+
+  float buf[CHANNEL_FRAMES];
+  size_t num_frames = 0;
+  const jsize len = (*env)->GetArrayLength(env, series);
+  sem_wait(&eng->sem);
+  if (eng->running && eng->channelizer != NULL) {
+    num_frames = channelizer_series(eng->channelizer, (enum channel_grid)grid,
+                                    (size_t)channel, buf,
+                                    len < CHANNEL_FRAMES ? (size_t)len
+                                                         : CHANNEL_FRAMES);
+  }
+  sem_post(&eng->sem);
+
+  (*env)->SetFloatArrayRegion(env, series, 0, (jsize)num_frames, buf);
+  return (jint)num_frames;
+}
+
+struct band_scan {
+  int cell_start;
+  int cell_end;
+  uint16_t span_width;
+  int64_t sum;
+  uint64_t count;
+};
+
+struct band_build {
+  struct summed_area *index;
+  uint16_t span_width;
+};
+
+static void build_band_index(void *arg, int64_t time_us, uint16_t center_freq,
+                             uint16_t bin_pwr_count, const int8_t bin_pwr[]) {
+  const struct band_build *build = arg;
+  summed_area_update(build->index, time_us, center_freq, build->span_width,
+                     bin_pwr_count, bin_pwr, 1);
+}
+
+static void scan_band(void *arg, int64_t time_us, uint16_t center_freq,
+                      uint16_t bin_pwr_count, const int8_t bin_pwr[]) {
+  struct band_scan *scan = arg;
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int cell = summed_area_cell(
+        summed_area_bin_khz(center_freq, scan->span_width, bin_pwr_count,
+                            bin) /
+        1000.0);
+    if (cell >= scan->cell_start && cell <= scan->cell_end) {
+      scan->sum += bin_pwr[bin];
+      scan->count++;
+    }
+  }
+}
+
+// Builds a band power index from a recorded archive, then answers the same
+// random band and time queries from the index and by scanning the archive,
+// and logs the time per query of both and whether they agree.
+static void JNICALL benchmarkBandQuery(JNIEnv *env, jclass cls,
+                                       jstring archivePath, jint numQueries) {
+  enum { MAX_BENCH_ROWS = 4096 };
+
+  const char *path = (*env)->GetStringUTFChars(env, archivePath, NULL);
+  if (path == NULL) {
+    LOGE("Can't get archive path");
+    return;
+  }
+  struct archive_reader *reader = archive_reader_open(path);
+  (*env)->ReleaseStringUTFChars(env, archivePath, path);
+  if (reader == NULL) {
+    return;
+  }
+
+  const int64_t end_time = archive_end_time(reader);
+  int64_t row_time = band_index_row_time;
+  if (end_time / row_time + 2 > MAX_BENCH_ROWS) {
+    row_time = end_time / (MAX_BENCH_ROWS - 2) + 1;
+  }
+  const size_t num_rows = (size_t)(end_time / row_time + 2);
+  struct summed_area *index = summed_area_create(num_rows, row_time);
+  if (index == NULL) {
+    LOGE("Can't allocate band power index");
+    archive_reader_close(reader);
+    return;
+  }
+
+  struct band_build build = {
+      .index = index,
+      .span_width = archive_span_width(reader),
+  };
+  int64_t start = stage_now_ns();
+  archive_read(reader, 0, end_time, 0, UINT16_MAX, build_band_index, &build);
+  const int64_t build_ns = stage_now_ns() - start;
+
+  const int64_t first_row = summed_area_first_time(index) / row_time + 1;
+  const int64_t last_row = summed_area_last_time(index) / row_time - 1;
+  if (last_row < first_row) {
+    LOGW("Archive is too short to query");
+    summed_area_destroy(index);
+    archive_reader_close(reader);
+    return;
+  }
+
+  struct stage_timer index_timer = {0};
+  struct stage_timer scan_timer = {0};
+  unsigned seed = 1;
+  int num_mismatches = 0;
+  for (jint query = 0; query < numQueries; query++) {
+    const int64_t span = last_row - first_row + 1;
+    int64_t row_start = first_row + rand_r(&seed) % span;
+    int64_t row_end = first_row + rand_r(&seed) % span;
+    if (row_start > row_end) {
+      const int64_t tmp = row_start;
+      row_start = row_end;
+      row_end = tmp;
+    }
+    const double start_freq = 2402 + rand_r(&seed) % 80;
+    const double end_freq = start_freq + rand_r(&seed) % 40;
+
+    double mean_pwr = 0;
+    uint64_t num_samples = 0;
+    start = stage_now_ns();
+    summed_area_query(index, row_start * row_time, row_end * row_time,
+                      start_freq, end_freq, &mean_pwr, &num_samples);
+    stage_timer_add(&index_timer, start);
+
+    struct band_scan scan = {
+        .cell_start = summed_area_cell(start_freq),
+        .cell_end = summed_area_cell(end_freq),
+        .span_width = archive_span_width(reader),
+    };
+    start = stage_now_ns();
+    archive_read(reader, row_start * row_time, (row_end + 1) * row_time - 1,
+                 (uint16_t)start_freq, (uint16_t)(end_freq + 1), scan_band,
+                 &scan);
+    stage_timer_add(&scan_timer, start);
+
+    if (scan.count != num_samples ||
+        (num_samples > 0 &&
+         fabs((double)scan.sum / (double)scan.count - mean_pwr) > 1e-9)) {
+      num_mismatches++;
+    }
+  }
+
+  LOGI("Band index: built from archive in %" PRId64 " ms, %zu bytes",
+       build_ns / 1000000, summed_area_memory(index));
+  LOGI("Band query: index %.0f ns, archive scan %.0f ns per query over %d "
+       "queries, %d mismatches",
+       stage_timer_avg(&index_timer), stage_timer_avg(&scan_timer),
+       numQueries, num_mismatches);
+
+  summed_area_destroy(index);
+  archive_reader_close(reader);
+}
+
+static jint JNICALL getNoiseFloor(JNIEnv *env, jobject view,
+                                  jfloatArray trace) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return 0;
+  }
+
+  float floor[MAX_NUM_BINS];
+  jsize max_bins = (*env)->GetArrayLength(env, trace);
+  if (max_bins > MAX_NUM_BINS) {
+    max_bins = MAX_NUM_BINS;
+  }
+
+  sem_wait(&eng->sem);
+  const uint16_t num_bins = noise_floor_trace(
+      eng->noise_floor, eng->center_freq, floor, (uint16_t)max_bins);
+  sem_post(&eng->sem);
+
+  (*env)->SetFloatArrayRegion(env, trace, 0, num_bins, floor);
+  return num_bins;
+}
+
+static void JNICALL changeHeight(JNIEnv *env, jobject view, jint height) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return;
+  }
+
+  sem_wait(&eng->sem);
+  if (height >= 0 && (size_t)height != eng->rbuffer_capacity) {
+    resize_rbuffer(eng, height);
+  }
+  sem_post(&eng->sem);
+}
+
+static jlong JNICALL updatePlot(JNIEnv *env, jobject view) {
+  struct plot_engine *eng = get_engine(env, view);
+  if (eng == NULL || !eng->running) {
+    return 0;
+  }
+
+  jobject bitmap = (*env)->GetObjectField(env, view, jni.plotBitmap_fid);
   AndroidBitmapInfo info;
   void *pixels;
   int ret;
@@ -737,75 +1877,141 @@ static jlong JNICALL updatePlot(JNIEnv *env, jclass cls, jobject view) {
     return 0;
   }
 
-  sem_wait(&state.sem);
+  int64_t span_start = trace_begin();
+  sem_wait(&eng->sem);
+  trace_end(TRACE_RENDER_LOCK, span_start, 0);
 
-  update_plot(&info, pixels);
+  span_start = trace_begin();
+  const size_t num_rows = eng->rbuffer_size;
+  update_plot(eng, &info, pixels);
 
-  int64_t num_scans = state.num_scans;
-  state.num_scans = 0;
+  int64_t num_scans = eng->num_scans;
+  eng->num_scans = 0;
 
   int64_t tstamp_q0 = INT32_MIN;
   int64_t tstamp_q1 = INT32_MAX;
   int64_t tstamp_q2 = INT32_MAX;
   int64_t tstamp_q3 = INT32_MAX;
   float center_pos = NAN;
-  if (state.rbuffer_capacity == info.height) {
-    size_t pos = state.rbuffer_pos + info.height - 1;
-    pos %= state.rbuffer_capacity;
-    size_t num_pixels = state.rbuffer[pos].num_pixels;
+  if (eng->rbuffer_capacity == info.height) {
+    size_t pos = eng->rbuffer_pos + info.height - 1;
+    pos %= eng->rbuffer_capacity;
+    size_t num_pixels = get_plot_data(eng, pos)->num_pixels;
     if (num_pixels > 0) {
-      tstamp_q0 = state.rbuffer[pos].tstamp;
-      size_t used_width = info.width - info.width % num_pixels;
+      tstamp_q0 = get_plot_data(eng, pos)->tstamp;
+      size_t used_width =
+          layout_bins(info.width, (uint16_t)num_pixels).used_width;
       center_pos = (float)used_width / 2.0f / (float)info.width;
     }
     pos += info.height - info.height / 4;
-    pos %= state.rbuffer_capacity;
-    if (state.rbuffer[pos].num_pixels > 0) {
-      tstamp_q1 = state.rbuffer[pos].tstamp;
+    pos %= eng->rbuffer_capacity;
+    if (get_plot_data(eng, pos)->num_pixels > 0) {
+      tstamp_q1 = get_plot_data(eng, pos)->tstamp;
     }
     pos += info.height - info.height / 4;
-    pos %= state.rbuffer_capacity;
-    if (state.rbuffer[pos].num_pixels > 0) {
-      tstamp_q2 = state.rbuffer[pos].tstamp;
+    pos %= eng->rbuffer_capacity;
+    if (get_plot_data(eng, pos)->num_pixels > 0) {
+      tstamp_q2 = get_plot_data(eng, pos)->tstamp;
     }
     pos += info.height - info.height / 4;
-    pos %= state.rbuffer_capacity;
-    if (state.rbuffer[pos].num_pixels > 0) {
-      tstamp_q3 = state.rbuffer[pos].tstamp;
+    pos %= eng->rbuffer_capacity;
+    if (get_plot_data(eng, pos)->num_pixels > 0) {
+      tstamp_q3 = get_plot_data(eng, pos)->tstamp;
     }
   }
-  uint16_t center_freq = state.center_freq;
-#ifdef SPECTRAL_DETECT
-  double bt_pwr = state.bt_pwr;
-#else
-  double pulse_freq = state.pulse_freq;
-#endif
+  const unsigned time_scale = eng->time_scale;
+  struct pyramid_row newest;
+  if (!eng->show_persistence && time_scale > 0 && eng->pyramid != NULL &&
+      pyramid_row(eng->pyramid, eng->center_freq, time_scale, 0, &newest)) {
+    size_t used_width =
+        layout_bins(info.width, newest.bin_pwr_count).used_width;
+    center_pos = (float)used_width / 2.0f / (float)info.width;
+    tstamp_q0 = newest.time_last;
+    struct pyramid_row row;
+    tstamp_q1 = pyramid_row(eng->pyramid, eng->center_freq, time_scale,
+                            info.height / 4, &row)
+                    ? row.time_last
+                    : INT64_MAX;
+    tstamp_q2 = pyramid_row(eng->pyramid, eng->center_freq, time_scale,
+                            info.height / 2, &row)
+                    ? row.time_last
+                    : INT64_MAX;
+    tstamp_q3 = pyramid_row(eng->pyramid, eng->center_freq, time_scale,
+                            info.height - info.height / 4, &row)
+                    ? row.time_last
+                    : INT64_MAX;
+  }
+  struct plot_snapshot *snap = eng->snapshot;
+  snapshot_begin(snap);
+  snap->elapsed[0] = tstamp_q0 - tstamp_q1;
+  snap->elapsed[1] = tstamp_q0 - tstamp_q2;
+  snap->elapsed[2] = tstamp_q0 - tstamp_q3;
+  snap->center_pos = center_pos;
+  snap->center_freq = eng->center_freq;
+  snap->span_width = SPAN_WIDTH;
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    struct detection result;
+    classifier_result(eng->classifier, id, &result);
+    snap->detector_pwr[id] = result.present ? result.pwr : NAN;
+  }
+  snap->pulse_freq = eng->pulse_freq;
+  snapshot_end(snap);
+  trace_end(TRACE_RENDER, span_start, (int64_t)num_rows);
 
-  sem_post(&state.sem);
+  sem_post(&eng->sem);
 
   AndroidBitmap_unlockPixels(env, bitmap);
 
-  (*env)->SetLongField(env, view, state.elapsedQ1_fid, tstamp_q0 - tstamp_q1);
-  (*env)->SetLongField(env, view, state.elapsedQ2_fid, tstamp_q0 - tstamp_q2);
-  (*env)->SetLongField(env, view, state.elapsedQ3_fid, tstamp_q0 - tstamp_q3);
-  (*env)->SetFloatField(env, view, state.centerPos_fid, center_pos);
-  (*env)->SetIntField(env, view, state.centerFreq_fid, center_freq);
-  (*env)->SetIntField(env, view, state.spanWidth_fid, SPAN_WIDTH);
-#ifdef SPECTRAL_DETECT
-  (*env)->SetDoubleField(env, view, state.bluetoothPower_fid, bt_pwr);
-#else
-  (*env)->SetDoubleField(env, view, state.pulseFreq_fid, pulse_freq);
-#endif
-
   return num_scans;
 }
 
+// Records a timeline of every plot engine to a trace file, see trace.h.
+static jboolean JNICALL startTrace(JNIEnv *env, jclass cls, jstring path) {
+  const char *file_path = (*env)->GetStringUTFChars(env, path, NULL);
+  if (file_path == NULL) {
+    LOGE("Can't get trace path");
+    return JNI_FALSE;
+  }
+  const bool started = trace_start(file_path, "spectral-plot");
+  (*env)->ReleaseStringUTFChars(env, path, file_path);
+  return started ? JNI_TRUE : JNI_FALSE;
+}
+
+static void JNICALL stopTrace(JNIEnv *env, jclass cls) { trace_stop(); }
+
 static const JNINativeMethod methods[] = {
+    {"createEngine", "()J", createEngine},
+    {"destroyEngine", "(J)V", destroyEngine},
+    {"getSnapshot", "()Ljava/nio/ByteBuffer;", getSnapshot},
+    {"copySnapshot", "(Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V",
+     copySnapshot},
     {"startPlot", "(Ljava/lang/String;)V", startPlot},
     {"stopPlot", "()V", stopPlot},
-    {"configPlot", "(ZZ)V", configPlot},
+    {"configPlot", "(ZZZ)V", configPlot},
+    {"configDetectors", "(I)V", configDetectors},
+    {"configDetect", "(I[D)V", configDetect},
+    {"configAverage", "(IID)V", configAverage},
+    {"getNoiseFloor", "([F)I", getNoiseFloor},
+    {"getOccupancy", "(III[F)I", getOccupancy},
+    {"dumpOccupancy", "(Ljava/lang/String;)Z", dumpOccupancy},
+    {"startArchive", "(Ljava/lang/String;)Z", startArchive},
+    {"stopArchive", "()V", stopArchive},
+    {"startCapture", "(Ljava/lang/String;IIII)Z", startCapture},
+    {"stopCapture", "()V", stopCapture},
+    {"triggerCapture", "()Z", triggerCapture},
+    {"configAlerts", "(Ljava/lang/String;)I", configAlerts},
+    {"configSched", "(Ljava/lang/String;)Z", configSched},
+    {"configPyramid", "(III)V", configPyramid},
+    {"configFftSize", "(I)V", configFftSize},
+    {"configTimeScale", "(I)V", configTimeScale},
+    {"getBandPower", "(IIDD)D", getBandPower},
+    {"benchmarkBandQuery", "(Ljava/lang/String;I)V", benchmarkBandQuery},
+    {"getChannelPower", "(I[F)I", getChannelPower},
+    {"getChannelSeries", "(II[F)I", getChannelSeries},
     {"changeHeight", "(I)V", changeHeight},
-    {"updatePlot", "(Lcom/example/softsa/PlotView;)J", updatePlot},
+    {"updatePlot", "()J", updatePlot},
+    {"startTrace", "(Ljava/lang/String;)Z", startTrace},
+    {"stopTrace", "()V", stopTrace},
 };
 
 JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
@@ -830,27 +2036,24 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
 
 #define GET_FIELD_ID(name, sig)                                                \
   do {                                                                         \
-    state.name##_fid = (*env)->GetFieldID(env, cls, #name, (sig));             \
-    if (state.name##_fid == NULL) {                                            \
+    jni.name##_fid = (*env)->GetFieldID(env, cls, #name, (sig));               \
+    if (jni.name##_fid == NULL) {                                              \
       LOGE("Can't get field ID for " #name " field of PlotView class");        \
       return JNI_ERR;                                                          \
     }                                                                          \
   } while (0)
 
+  GET_FIELD_ID(engine, "J");
   GET_FIELD_ID(plotBitmap, "Landroid/graphics/Bitmap;");
-  GET_FIELD_ID(elapsedQ1, "J");
-  GET_FIELD_ID(elapsedQ2, "J");
-  GET_FIELD_ID(elapsedQ3, "J");
-  GET_FIELD_ID(centerPos, "F");
-  GET_FIELD_ID(centerFreq, "I");
-  GET_FIELD_ID(spanWidth, "I");
-#ifdef SPECTRAL_DETECT
-  GET_FIELD_ID(bluetoothPower, "D");
-#else
-  GET_FIELD_ID(pulseFreq, "D");
-#endif
 
 #undef GET_FIELD_ID
 
+  jni.onAlert_mid = (*env)->GetMethodID(env, cls, "onAlert", "(IZJD)V");
+  if (jni.onAlert_mid == NULL) {
+    LOGE("Can't get method ID for onAlert method of PlotView class");
+    return JNI_ERR;
+  }
+  jni.vm = vm;
+
   return JNI_VERSION_1_6;
 }
@@ -0,0 +1,209 @@
+#ifndef SPECTRAL_REPORT_H
+#define SPECTRAL_REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The most bins any stage accepts in a report. Buffers are sized for the
+// configured FFT size instead wherever they are per report.
+enum { MAX_NUM_BINS = 2048 };
+enum { MAX_FFT_SIZE = 10 };
+
+// Byte offsets of the fields of a report as the driver sends it. Reports
+// of 160 MHz and 80+80 MHz scans carry a second segment, whose bins follow
+// those of the first. The MAC address is that of the interface scanned on.
+enum {
+  REPORT_SIGNATURE = 0xdeadbeef,
+  REPORT_FREQ_OFFSET = 4,
+  REPORT_SEG2_FREQ_OFFSET = 8,
+  REPORT_MAC_OFFSET = 18,
+  REPORT_MAC_LEN = 6,
+  REPORT_TSTAMP_OFFSET = 44,
+  REPORT_BIN_COUNT_OFFSET = 87,
+  REPORT_BIN_COUNT_SEC80_OFFSET = 89,
+  REPORT_BINS_OFFSET = 93,
+};
+
+// A squelch summary holds the bins of its segment this many times over,
+// see report_summary_mean().
+enum { REPORT_SUMMARY_BLOCKS = 3 };
+
+// Most bins of a report for an FFT size, with room for a second segment.
+static inline size_t report_max_bins(uint32_t fft_size) {
+  return fft_size < MAX_FFT_SIZE ? (size_t)2 << fft_size
+                                 : (size_t)MAX_NUM_BINS;
+}
+
+// Longest report of up to max_bins bins, or summary of a segment of up to
+// half of them.
+static inline size_t report_len_for_bins(size_t max_bins) {
+  return REPORT_BINS_OFFSET + max_bins / 2 * REPORT_SUMMARY_BLOCKS;
+}
+
+static inline size_t report_max_len(uint32_t fft_size) {
+  return report_len_for_bins(report_max_bins(fft_size));
+}
+
+enum { MAX_REPORT_SEGMENTS = 2 };
+
+struct report_segment {
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  const int8_t *bin_pwr;
+};
+
+// A report checked once where it is received and then read in place. len
+// covers the header and the bins of every segment, which is all of the
+// report that is passed on.
+struct report_view {
+  const uint8_t *data;
+  size_t len;
+  uint16_t center_freq;
+  int32_t tstamp;
+  unsigned num_segments;
+  struct report_segment segments[MAX_REPORT_SEGMENTS];
+};
+
+static inline uint16_t report_get_u16(const uint8_t data[], size_t offset) {
+  uint16_t val;
+  memcpy(&val, data + offset, sizeof(val));
+  return val;
+}
+
+// Fails unless the report has the signature and is long enough for the
+// bins of its first segment. A second segment is only taken if its bins
+// are there as well, since layouts without one leave its count undefined.
+static inline bool report_view_parse(struct report_view *view,
+                                     const uint8_t data[], size_t len) {
+  if (len < REPORT_BINS_OFFSET) {
+    return false;
+  }
+  uint32_t signature;
+  memcpy(&signature, data, sizeof(signature));
+  const uint16_t bin_pwr_count = report_get_u16(data, REPORT_BIN_COUNT_OFFSET);
+  size_t end = REPORT_BINS_OFFSET + (size_t)bin_pwr_count;
+  if (signature != REPORT_SIGNATURE || bin_pwr_count > MAX_NUM_BINS ||
+      end > len) {
+    return false;
+  }
+
+  view->data = data;
+  view->center_freq = report_get_u16(data, REPORT_FREQ_OFFSET);
+  memcpy(&view->tstamp, data + REPORT_TSTAMP_OFFSET, sizeof(view->tstamp));
+  view->num_segments = 1;
+  view->segments[0] = (struct report_segment){
+      .center_freq = view->center_freq,
+      .bin_pwr_count = bin_pwr_count,
+      .bin_pwr = (const int8_t *)data + REPORT_BINS_OFFSET,
+  };
+
+  const uint16_t sec80_count =
+      report_get_u16(data, REPORT_BIN_COUNT_SEC80_OFFSET);
+  if (sec80_count > 0 && bin_pwr_count + sec80_count <= MAX_NUM_BINS &&
+      end + sec80_count <= len) {
+    view->segments[view->num_segments++] = (struct report_segment){
+        .center_freq = report_get_u16(data, REPORT_SEG2_FREQ_OFFSET),
+        .bin_pwr_count = sec80_count,
+        .bin_pwr = (const int8_t *)data + end,
+    };
+    end += sec80_count;
+  }
+  view->len = end;
+  return true;
+}
+
+// Drops trailing segments until the report is at most max_len bytes long.
+// Fails if even the first segment does not fit.
+static inline bool report_view_truncate(struct report_view *view,
+                                        size_t max_len) {
+  while (view->len > max_len && view->num_segments > 1) {
+    view->len -= view->segments[--view->num_segments].bin_pwr_count;
+  }
+  return view->len <= max_len;
+}
+
+// Points a view at a copy of the bytes it was parsed from.
+static inline void report_view_move(struct report_view *view,
+                                    const uint8_t data[]) {
+  for (unsigned idx = 0; idx < view->num_segments; idx++) {
+    struct report_segment *seg = &view->segments[idx];
+    seg->bin_pwr = (const int8_t *)data +
+                   ((const uint8_t *)seg->bin_pwr - view->data);
+  }
+  view->data = data;
+}
+
+// Appended by spectral-scan to every report it forwards, so that consumers
+// can tell which radio and hop a report belongs to without trusting its
+// frequency.
+enum { HOP_TAG_MAGIC = 0x676f7068 };
+
+enum hop_tag_flags {
+  HOP_TAG_GUARD = 1 << 0,
+  HOP_TAG_PENDING = 1 << 1,
+  HOP_TAG_SUMMARY = 1 << 2,
+};
+
+struct hop_tag {
+  uint32_t magic;
+  uint32_t epoch;
+  uint32_t flags;
+  uint32_t switch_us;
+  int64_t since_switch_us;
+  uint32_t radio;
+  uint32_t num_squelched;
+};
+
+// A squelch summary (HOP_TAG_SUMMARY) stands for num_squelched quiet
+// reports of one radio, channel and hop, and carries the header of the
+// last of them. Its bins hold the maximum of each bin over those reports.
+// The rounded mean of each bin in dBm follows as many bytes again, and
+// then the mean power of each bin in mW, rounded back to dBm, for stages
+// that add up power. Returns the block, or NULL if the len bytes received
+// are too short for it.
+static inline const int8_t *report_summary_block(const struct report_view *view,
+                                                 size_t len, size_t block) {
+  const uint16_t bin_pwr_count = view->segments[0].bin_pwr_count;
+  if (view->num_segments != 1 ||
+      len < REPORT_BINS_OFFSET + (block + 1) * bin_pwr_count) {
+    return NULL;
+  }
+  return view->segments[0].bin_pwr + block * bin_pwr_count;
+}
+
+static inline const int8_t *report_summary_mean(const struct report_view *view,
+                                                size_t len) {
+  return report_summary_block(view, len, 1);
+}
+
+static inline const int8_t *
+report_summary_power(const struct report_view *view, size_t len) {
+  return report_summary_block(view, len, 2);
+}
+
+// Report timestamps are 32-bit microseconds and wrap after about 71
+// minutes. This turns them into a 64-bit time since the first report,
+// treating a step backwards as a restart of the counter.
+struct tstamp_clock {
+  int64_t time_us;
+  int32_t last_tstamp;
+  bool valid;
+};
+
+static inline int64_t tstamp_clock_update(struct tstamp_clock *clock,
+                                          int32_t tstamp) {
+  if (clock->valid) {
+    const int32_t delta =
+        (int32_t)((uint32_t)tstamp - (uint32_t)clock->last_tstamp);
+    if (delta > 0) {
+      clock->time_us += delta;
+    }
+  }
+  clock->last_tstamp = tstamp;
+  clock->valid = true;
+  return clock->time_us;
+}
+
+#endif
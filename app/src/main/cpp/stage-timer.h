@@ -0,0 +1,34 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Accumulates the wall time spent in one pipeline stage, so that its cost
+// per report can be logged when the pipeline stops.
+struct stage_timer {
+  int64_t total_ns;
+  int64_t max_ns;
+  int64_t count;
+};
+
+static inline int64_t stage_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void stage_timer_add(struct stage_timer *t, int64_t start_ns) {
+  const int64_t elapsed = stage_now_ns() - start_ns;
+  t->total_ns += elapsed;
+  t->count++;
+  if (elapsed > t->max_ns) {
+    t->max_ns = elapsed;
+  }
+}
+
+static inline double stage_timer_avg(const struct stage_timer *t) {
+  return t->count > 0 ? (double)t->total_ns / (double)t->count : 0;
+}
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "summed-area.h"
+
+struct band {
+  uint32_t start_khz;
+  uint32_t end_khz;
+};
+
+// Wide enough for a 40 MHz span around any 2.4 GHz or 5 GHz channel.
+static const struct band bands[] = {
+    {2380000, 2520000},
+    {5140000, 5880000},
+};
+
+enum { NUM_BANDS = sizeof(bands) / sizeof(bands[0]) };
+enum {
+  NUM_CELLS = (2520000 - 2380000 + 5880000 - 5140000) / SUMMED_AREA_CELL_KHZ,
+};
+
+// Each finished row stores NUM_CELLS + 1 prefix sums, the first being
+// zero, so that a band query needs no special case at its lower edge.
+struct summed_area {
+  size_t num_rows;
+  int64_t row_time;
+  int64_t *sum;
+  uint64_t *count;
+  int64_t first_row;
+  int64_t next_row;
+  int64_t cur_sum[NUM_CELLS];
+  uint32_t cur_count[NUM_CELLS];
+};
+
+static int cell_of_khz(uint32_t freq_khz) {
+  int base = 0;
+  for (size_t idx = 0; idx < NUM_BANDS; idx++) {
+    if (freq_khz >= bands[idx].start_khz && freq_khz < bands[idx].end_khz) {
+      return base +
+             (int)((freq_khz - bands[idx].start_khz) / SUMMED_AREA_CELL_KHZ);
+    }
+    base += (int)((bands[idx].end_khz - bands[idx].start_khz) /
+                  SUMMED_AREA_CELL_KHZ);
+  }
+  return -1;
+}
+
+// Returns the cell a frequency in MHz falls in, or -1 outside both bands.
+int summed_area_cell(double freq) {
+  if (freq < 0) {
+    return -1;
+  }
+  return cell_of_khz((uint32_t)(freq * 1000));
+}
+
+uint32_t summed_area_bin_khz(uint16_t center_freq, uint16_t span_width,
+                             uint16_t bin_pwr_count, uint16_t bin) {
+  return center_freq * 1000u - span_width * 500u +
+         (2u * bin + 1) * span_width * 500u / bin_pwr_count;
+}
+
+struct summed_area *summed_area_create(size_t num_rows, int64_t row_time) {
+  if (num_rows < 2 || row_time <= 0) {
+    return NULL;
+  }
+
+  struct summed_area *sa = calloc(1, sizeof(struct summed_area));
+  if (sa == NULL) {
+    return NULL;
+  }
+  sa->sum = calloc(num_rows * (NUM_CELLS + 1), sizeof(int64_t));
+  sa->count = calloc(num_rows * (NUM_CELLS + 1), sizeof(uint64_t));
+  if (sa->sum == NULL || sa->count == NULL) {
+    summed_area_destroy(sa);
+    return NULL;
+  }
+  sa->num_rows = num_rows;
+  sa->row_time = row_time;
+  sa->first_row = -1;
+  return sa;
+}
+
+void summed_area_destroy(struct summed_area *sa) {
+  if (sa == NULL) {
+    return;
+  }
+  free(sa->sum);
+  free(sa->count);
+  free(sa);
+}
+
+size_t summed_area_memory(const struct summed_area *sa) {
+  return sizeof(struct summed_area) +
+         sa->num_rows * (NUM_CELLS + 1) * (sizeof(int64_t) + sizeof(uint64_t));
+}
+
+static size_t row_offset(const struct summed_area *sa, int64_t row) {
+  return (size_t)(row % (int64_t)sa->num_rows) * (NUM_CELLS + 1);
+}
+
+// Folds the row being collected into the running sums, then adds empty
+// rows up to row, rolling the oldest rows out once the ring is full.
+static void finish_rows(struct summed_area *sa, int64_t row) {
+  if (sa->first_row < 0) {
+    sa->first_row = sa->next_row = row;
+  }
+
+  while (sa->next_row < row) {
+    int64_t *sum = &sa->sum[row_offset(sa, sa->next_row)];
+    uint64_t *count = &sa->count[row_offset(sa, sa->next_row)];
+    const bool has_prev = sa->next_row > sa->first_row;
+    const int64_t *prev_sum =
+        has_prev ? &sa->sum[row_offset(sa, sa->next_row - 1)] : NULL;
+    const uint64_t *prev_count =
+        has_prev ? &sa->count[row_offset(sa, sa->next_row - 1)] : NULL;
+
+    int64_t row_sum = 0;
+    uint64_t row_count = 0;
+    sum[0] = has_prev ? prev_sum[0] : 0;
+    count[0] = has_prev ? prev_count[0] : 0;
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+      row_sum += sa->cur_sum[cell];
+      row_count += sa->cur_count[cell];
+      sum[cell + 1] = (has_prev ? prev_sum[cell + 1] : 0) + row_sum;
+      count[cell + 1] = (has_prev ? prev_count[cell + 1] : 0) + row_count;
+    }
+    memset(sa->cur_sum, 0, sizeof(sa->cur_sum));
+    memset(sa->cur_count, 0, sizeof(sa->cur_count));
+
+    sa->next_row++;
+    if (sa->next_row - sa->first_row > (int64_t)sa->num_rows) {
+      sa->first_row = sa->next_row - (int64_t)sa->num_rows;
+    }
+  }
+}
+
+void summed_area_update(struct summed_area *sa, int64_t time_us,
+                        uint16_t center_freq, uint16_t span_width,
+                        uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                        uint32_t weight) {
+  const int64_t row = time_us / sa->row_time;
+  if (sa->first_row >= 0 && row < sa->next_row) {
+    return;
+  }
+
+  // After a gap longer than the ring, the skipped rows would be rolled out
+  // right away. The last sums are moved to just before the rows that will
+  // be kept, and only those are filled in.
+  if (sa->first_row >= 0 && row - sa->next_row > (int64_t)sa->num_rows) {
+    finish_rows(sa, sa->next_row + 1);
+    const int64_t skip = row - (int64_t)sa->num_rows - sa->next_row;
+    const size_t from = row_offset(sa, sa->next_row - 1);
+    sa->next_row += skip;
+    const size_t to = row_offset(sa, sa->next_row - 1);
+    memmove(&sa->sum[to], &sa->sum[from], (NUM_CELLS + 1) * sizeof(int64_t));
+    memmove(&sa->count[to], &sa->count[from],
+            (NUM_CELLS + 1) * sizeof(uint64_t));
+    sa->first_row = sa->next_row - 1;
+  }
+  finish_rows(sa, row);
+
+  for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+    const int cell = cell_of_khz(
+        summed_area_bin_khz(center_freq, span_width, bin_pwr_count, bin));
+    if (cell < 0) {
+      continue;
+    }
+    sa->cur_sum[cell] += (int64_t)bin_pwr[bin] * weight;
+    sa->cur_count[cell] += weight;
+  }
+}
+
+int64_t summed_area_first_time(const struct summed_area *sa) {
+  return sa->first_row < 0 ? 0 : sa->first_row * sa->row_time;
+}
+
+// The end of the last finished row. The row being collected is not part of
+// any query yet.
+int64_t summed_area_last_time(const struct summed_area *sa) {
+  return sa->first_row < 0 ? 0 : sa->next_row * sa->row_time;
+}
+
+// Rows are whole, so the time range is widened to row boundaries and
+// clamped to the retained rows. Cells are whole as well.
+bool summed_area_query(const struct summed_area *sa, int64_t start_us,
+                       int64_t end_us, double start_freq, double end_freq,
+                       double *mean_pwr, uint64_t *num_samples) {
+  if (sa->first_row < 0 || sa->next_row == sa->first_row) {
+    return false;
+  }
+
+  int64_t row_start = start_us / sa->row_time;
+  int64_t row_end = end_us / sa->row_time;
+  if (row_start < sa->first_row + 1) {
+    row_start = sa->first_row + 1;
+  }
+  if (row_end > sa->next_row - 1) {
+    row_end = sa->next_row - 1;
+  }
+
+  const int cell_start = summed_area_cell(start_freq);
+  const int cell_end = summed_area_cell(end_freq);
+  if (row_start > row_end || cell_start < 0 || cell_end < 0 ||
+      cell_start > cell_end) {
+    return false;
+  }
+
+  const size_t hi = row_offset(sa, row_end);
+  const size_t lo = row_offset(sa, row_start - 1);
+  const size_t c0 = (size_t)cell_start;
+  const size_t c1 = (size_t)cell_end + 1;
+  const int64_t sum = sa->sum[hi + c1] - sa->sum[hi + c0] - sa->sum[lo + c1] +
+                      sa->sum[lo + c0];
+  const uint64_t count = sa->count[hi + c1] - sa->count[hi + c0] -
+                         sa->count[lo + c1] + sa->count[lo + c0];
+
+  *num_samples = count;
+  *mean_pwr = count > 0 ? (double)sum / (double)count : 0;
+  return count > 0;
+}
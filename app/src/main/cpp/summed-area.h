@@ -0,0 +1,33 @@
+#ifndef SUMMED_AREA_H
+#define SUMMED_AREA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Power is binned into rows of row_time and cells of absolute frequency,
+// and every row holds sums over all earlier rows and lower cells. The sum
+// over any band and time range is then four lookups.
+enum { SUMMED_AREA_CELL_KHZ = 1000 };
+
+struct summed_area;
+
+struct summed_area *summed_area_create(size_t num_rows, int64_t row_time);
+void summed_area_destroy(struct summed_area *sa);
+// weight is the number of reports bin_pwr stands for.
+void summed_area_update(struct summed_area *sa, int64_t time_us,
+                        uint16_t center_freq, uint16_t span_width,
+                        uint16_t bin_pwr_count, const int8_t bin_pwr[],
+                        uint32_t weight);
+bool summed_area_query(const struct summed_area *sa, int64_t start_us,
+                       int64_t end_us, double start_freq, double end_freq,
+                       double *mean_pwr, uint64_t *num_samples);
+int64_t summed_area_first_time(const struct summed_area *sa);
+int64_t summed_area_last_time(const struct summed_area *sa);
+size_t summed_area_memory(const struct summed_area *sa);
+
+int summed_area_cell(double freq);
+uint32_t summed_area_bin_khz(uint16_t center_freq, uint16_t span_width,
+                             uint16_t bin_pwr_count, uint16_t bin);
+
+#endif
@@ -0,0 +1,181 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "thread-sched.h"
+
+#define LOG_TAG "thread-sched"
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+enum { MAX_SCHED_LEN = 128 };
+enum { MAX_CPUS = 64 };
+
+static const char *const role_names[NUM_THREAD_ROLES] = {
+    [THREAD_SCAN] = "scan",
+    [THREAD_HOP] = "hop",
+    [THREAD_FORWARD] = "forward",
+    [THREAD_PLOT] = "plot",
+};
+
+static bool parse_long(const char *tok, long min, long max, long *out) {
+  char *end;
+  if (tok == NULL) {
+    return false;
+  }
+  errno = 0;
+  const long n = strtol(tok, &end, 10);
+  if (errno != 0 || end == tok || *end != '\0' || n < min || n > max) {
+    return false;
+  }
+  *out = n;
+  return true;
+}
+
+// Parses a list of CPUs and ranges of CPUs, separated by commas.
+static bool parse_cpus(char *list, uint64_t *cpus) {
+  char *save;
+  *cpus = 0;
+  for (char *tok = strtok_r(list, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    long first, last;
+    char *dash = strchr(tok, '-');
+    if (dash != NULL) {
+      *dash = '\0';
+    }
+    if (!parse_long(tok, 0, MAX_CPUS - 1, &first) ||
+        !parse_long(dash != NULL ? dash + 1 : tok, first, MAX_CPUS - 1,
+                    &last)) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      *cpus |= (uint64_t)1 << cpu;
+    }
+  }
+  return *cpus != 0;
+}
+
+bool thread_sched_parse(const char *value, struct thread_sched *sched) {
+  char buf[MAX_SCHED_LEN];
+  if (strlcpy(buf, value, sizeof(buf)) >= sizeof(buf)) {
+    return false;
+  }
+
+  *sched = (struct thread_sched){0};
+  char *save;
+  for (const char *key = strtok_r(buf, " \t\r", &save); key != NULL;
+       key = strtok_r(NULL, " \t\r", &save)) {
+    char *arg = strtok_r(NULL, " \t\r", &save);
+    long n;
+    if (strcmp(key, "cpus") == 0 && arg != NULL) {
+      if (!parse_cpus(arg, &sched->cpus)) {
+        return false;
+      }
+    } else if (strcmp(key, "fifo") == 0 && sched->nice == 0) {
+      if (!parse_long(arg, 1, 99, &n)) {
+        return false;
+      }
+      sched->fifo_priority = (int)n;
+    } else if (strcmp(key, "nice") == 0 && sched->fifo_priority == 0) {
+      if (!parse_long(arg, -20, 19, &n)) {
+        return false;
+      }
+      sched->nice = (int)n;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool thread_sched_parse_roles(const char *text,
+                              struct thread_sched scheds[NUM_THREAD_ROLES]) {
+  for (int role = 0; role < NUM_THREAD_ROLES; role++) {
+    scheds[role] = (struct thread_sched){0};
+  }
+
+  int line_num = 0;
+  while (*text != '\0') {
+    const size_t len = strcspn(text, "\n");
+    char line[MAX_SCHED_LEN];
+    line_num++;
+    if (len >= sizeof(line)) {
+      LOGE("Scheduling line %d too long", line_num);
+      return false;
+    }
+    memcpy(line, text, len);
+    line[len] = '\0';
+    text += text[len] == '\n' ? len + 1 : len;
+
+    char *start = line + strspn(line, " \t\r");
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+    char *sep = strchr(start, '=');
+    if (sep == NULL) {
+      LOGE("Can't parse scheduling line %d", line_num);
+      return false;
+    }
+    *sep = '\0';
+    const size_t name_len = strcspn(start, " \t");
+    start[name_len] = '\0';
+    int role = 0;
+    while (role < NUM_THREAD_ROLES && strcmp(start, role_names[role]) != 0) {
+      role++;
+    }
+    if (role == NUM_THREAD_ROLES ||
+        !thread_sched_parse(sep + 1, &scheds[role])) {
+      LOGE("Can't parse scheduling line %d", line_num);
+      return false;
+    }
+  }
+  return true;
+}
+
+void thread_sched_apply(const struct thread_sched *sched) {
+  const pid_t tid = gettid();
+  char name[16] = "";
+  prctl(PR_GET_NAME, name);
+
+  // The kernel narrows the mask down to the CPUs the cpuset of the thread
+  // allows, so all CPUs undo an earlier pinning.
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (sched->cpus == 0 ||
+        (cpu < MAX_CPUS && (sched->cpus & (uint64_t)1 << cpu))) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  if (sched_setaffinity(tid, sizeof(set), &set) < 0) {
+    LOGW("Can't pin %s to CPUs %#" PRIx64 ": %s", name, sched->cpus,
+         strerror(errno));
+  }
+
+  if (sched->fifo_priority > 0) {
+    const struct sched_param param = {.sched_priority = sched->fifo_priority};
+    if (sched_setscheduler(tid, SCHED_FIFO, &param) < 0) {
+      LOGW("Can't run %s with SCHED_FIFO priority %d: %s", name,
+           sched->fifo_priority, strerror(errno));
+    }
+    return;
+  }
+
+  const struct sched_param param = {.sched_priority = 0};
+  if (sched_getscheduler(tid) != SCHED_OTHER &&
+      sched_setscheduler(tid, SCHED_OTHER, &param) < 0) {
+    LOGW("Can't run %s with SCHED_OTHER: %s", name, strerror(errno));
+  }
+  if (getpriority(PRIO_PROCESS, (id_t)tid) != sched->nice) {
+    if (setpriority(PRIO_PROCESS, (id_t)tid, sched->nice) < 0) {
+      LOGW("Can't run %s with nice %d: %s", name, sched->nice,
+           strerror(errno));
+    }
+  }
+}
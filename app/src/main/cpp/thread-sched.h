@@ -0,0 +1,41 @@
+#ifndef THREAD_SCHED_H
+#define THREAD_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The threads whose scheduling can be configured: the scan, channel hop and
+// report forwarding threads of the scanner, and the receive thread of the
+// plot.
+enum thread_role {
+  THREAD_SCAN,
+  THREAD_HOP,
+  THREAD_FORWARD,
+  THREAD_PLOT,
+  NUM_THREAD_ROLES,
+};
+
+// The CPUs a thread may run on, as a mask of the first 64 or 0 for all, and
+// either a SCHED_FIFO priority or, with fifo_priority 0, a nice value for
+// SCHED_OTHER. The zero value runs a thread like most others, on all CPUs
+// with SCHED_OTHER at nice 0.
+struct thread_sched {
+  uint64_t cpus;
+  int fifo_priority;
+  int nice;
+};
+
+// Parses "[cpus LIST] [fifo PRIORITY | nice VALUE]", where LIST is like
+// "4-7" or "0,2,4-5". An empty string leaves the defaults.
+bool thread_sched_parse(const char *value, struct thread_sched *sched);
+// Parses lines of "ROLE = SETTINGS", with ROLE one of scan, hop, forward and
+// plot, into the settings of each role. Blank lines and lines starting with
+// '#' are skipped.
+bool thread_sched_parse_roles(const char *text,
+                              struct thread_sched scheds[NUM_THREAD_ROLES]);
+// Applies sched to the calling thread, replacing what was applied before.
+// Settings the process is not allowed, such as SCHED_FIFO or a negative nice
+// value without root, are logged and skipped.
+void thread_sched_apply(const struct thread_sched *sched);
+
+#endif
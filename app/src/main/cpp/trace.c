@@ -0,0 +1,289 @@
+#include <android/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define LOG_TAG "trace"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// Records per thread. A ring is drained every flush_interval_us, so a
+// thread can record up to RING_SIZE events in that time without loss.
+enum { RING_SIZE = 8192 };
+static const useconds_t flush_interval_us = 50000;
+
+static const struct trace_name_entry names[NUM_TRACE_NAMES] = {
+    [TRACE_SCAN_START] = {"scan start", "freq"},
+    [TRACE_SCAN_STOP] = {"scan stop", "freq"},
+    [TRACE_CHANNEL_SWITCH] = {"channel switch", "freq"},
+    [TRACE_SWITCH_NOTIFY] = {"switch notify", "epoch"},
+    [TRACE_GET_INTERFACE] = {"get interface", "ifindex"},
+    [TRACE_REPORT_RECV] = {"report recv", "freq"},
+    [TRACE_REPORT_PUBLISH] = {"report publish", "freq"},
+    [TRACE_SQUELCH_FLUSH] = {"squelch flush", "reports"},
+    [TRACE_REPORT_DELIVER] = {"report deliver", "seq"},
+    [TRACE_PLOT_REPORT] = {"plot report", "freq"},
+    [TRACE_PLOT_LOCK] = {"plot lock", ""},
+    [TRACE_STAGE_CAPTURE] = {"capture", ""},
+    [TRACE_STAGE_INDEX] = {"index", ""},
+    [TRACE_STAGE_CHANNELS] = {"channels", ""},
+    [TRACE_STAGE_ALERTS] = {"alerts", ""},
+    [TRACE_STAGE_FLOOR] = {"noise floor", ""},
+    [TRACE_STAGE_AVERAGE] = {"average", "mode"},
+    [TRACE_STAGE_DETECT] = {"detect", "pulses"},
+    [TRACE_STAGE_MATCH] = {"match", "tracks"},
+    [TRACE_STAGE_CLASSIFY] = {"classify", "finished"},
+    [TRACE_STAGE_DRAW] = {"draw row", ""},
+    [TRACE_DETECTOR] = {"detector", "id"},
+    [TRACE_RENDER_LOCK] = {"render lock", ""},
+    [TRACE_RENDER] = {"render", "rows"},
+};
+
+// Written by its thread at head and drained by the writer at tail. A ring
+// outlives its thread until the writer has drained it.
+struct ring {
+  struct ring *next;
+  uint32_t tid;
+  char thread_name[16];
+  bool named;
+  atomic_bool exited;
+  atomic_uint_least64_t head;
+  atomic_uint_least64_t tail;
+  atomic_uint_least64_t dropped;
+  uint64_t dropped_written;
+  struct trace_record records[RING_SIZE];
+};
+
+atomic_bool trace_running;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_once_t once;
+  pthread_key_t key;
+  struct ring *rings;
+  FILE *file;
+  pthread_t writer;
+  atomic_bool stopping;
+  uint64_t num_events;
+  uint64_t num_dropped;
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static __thread struct ring *local_ring;
+
+static void exit_ring(void *arg) {
+  struct ring *ring = arg;
+  atomic_store_explicit(&ring->exited, true, memory_order_release);
+}
+
+static void create_key(void) { pthread_key_create(&trace.key, exit_ring); }
+
+// Rings are only allocated for threads that record while a trace runs.
+static struct ring *get_ring(void) {
+  if (local_ring != NULL) {
+    return local_ring;
+  }
+  struct ring *ring = calloc(1, sizeof(struct ring));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->tid = (uint32_t)gettid();
+  prctl(PR_GET_NAME, ring->thread_name);
+  pthread_once(&trace.once, create_key);
+  pthread_setspecific(trace.key, ring);
+
+  pthread_mutex_lock(&trace.lock);
+  ring->next = trace.rings;
+  trace.rings = ring;
+  pthread_mutex_unlock(&trace.lock);
+  local_ring = ring;
+  return ring;
+}
+
+void trace_record(enum trace_kind kind, enum trace_name name,
+                  int64_t start_ns, int64_t dur_ns, int64_t arg) {
+  struct ring *ring = get_ring();
+  if (ring == NULL) {
+    return;
+  }
+  const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+      RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  ring->records[head % RING_SIZE] = (struct trace_record){
+      .kind = (uint16_t)kind,
+      .name = (uint16_t)name,
+      .tid = ring->tid,
+      .start_ns = start_ns,
+      .dur_ns = dur_ns,
+      .arg = arg,
+  };
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void write_record(const struct trace_record *record) {
+  fwrite(record, sizeof(*record), 1, trace.file);
+}
+
+// Writes out what every ring holds and frees the rings of exited threads.
+// Must be called with lock held.
+static void drain(void) {
+  struct ring **link = &trace.rings;
+  while (*link != NULL) {
+    struct ring *ring = *link;
+    const bool exited =
+        atomic_load_explicit(&ring->exited, memory_order_acquire);
+    if (!ring->named) {
+      struct trace_record record = {.kind = TRACE_THREAD, .tid = ring->tid};
+      memcpy(record.thread_name, ring->thread_name, sizeof(ring->thread_name));
+      write_record(&record);
+      ring->named = true;
+    }
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const uint64_t head =
+        atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (tail < head) {
+      const size_t pos = tail % RING_SIZE;
+      const size_t count = head - tail < RING_SIZE - pos
+                               ? (size_t)(head - tail)
+                               : RING_SIZE - pos;
+      fwrite(&ring->records[pos], sizeof(struct trace_record), count,
+             trace.file);
+      tail += count;
+      trace.num_events += count;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    const uint64_t dropped =
+        atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->dropped_written) {
+      const struct trace_record record = {
+          .kind = TRACE_DROPPED,
+          .tid = ring->tid,
+          .start_ns = trace_now_ns(),
+          .arg = (int64_t)(dropped - ring->dropped_written),
+      };
+      write_record(&record);
+      trace.num_dropped += dropped - ring->dropped_written;
+      ring->dropped_written = dropped;
+    }
+
+    if (exited) {
+      *link = ring->next;
+      free(ring);
+    } else {
+      link = &ring->next;
+    }
+  }
+}
+
+static void *writer_thread(void *arg) {
+  pthread_setname_np(pthread_self(), "trace-writer");
+  while (!atomic_load_explicit(&trace.stopping, memory_order_relaxed)) {
+    usleep(flush_interval_us);
+    pthread_mutex_lock(&trace.lock);
+    drain();
+    pthread_mutex_unlock(&trace.lock);
+  }
+  return NULL;
+}
+
+bool trace_start(const char *path, const char *process) {
+  pthread_mutex_lock(&trace.lock);
+  if (trace.file != NULL) {
+    pthread_mutex_unlock(&trace.lock);
+    return false;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    LOGE("Can't create %s: %s", path, strerror(errno));
+    pthread_mutex_unlock(&trace.lock);
+    return false;
+  }
+  struct trace_header header = {
+      .magic = TRACE_MAGIC,
+      .version = TRACE_VERSION,
+      .pid = (uint32_t)getpid(),
+      .num_names = NUM_TRACE_NAMES,
+      .start_ns = trace_now_ns(),
+  };
+  strlcpy(header.process, process, sizeof(header.process));
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(names, sizeof(names), 1, file) != 1) {
+    LOGE("Can't write %s: %s", path, strerror(errno));
+    fclose(file);
+    pthread_mutex_unlock(&trace.lock);
+    return false;
+  }
+
+  // Records left over from an earlier trace are discarded.
+  struct ring **link = &trace.rings;
+  while (*link != NULL) {
+    struct ring *ring = *link;
+    if (atomic_load_explicit(&ring->exited, memory_order_acquire)) {
+      *link = ring->next;
+      free(ring);
+      continue;
+    }
+    atomic_store_explicit(
+        &ring->tail, atomic_load_explicit(&ring->head, memory_order_acquire),
+        memory_order_release);
+    ring->dropped_written =
+        atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    ring->named = false;
+    link = &ring->next;
+  }
+
+  trace.file = file;
+  trace.num_events = 0;
+  trace.num_dropped = 0;
+  trace.stopping = false;
+  if (pthread_create(&trace.writer, NULL, writer_thread, NULL) != 0) {
+    LOGE("Can't start trace writer");
+    fclose(file);
+    trace.file = NULL;
+    pthread_mutex_unlock(&trace.lock);
+    return false;
+  }
+  atomic_store_explicit(&trace_running, true, memory_order_relaxed);
+  pthread_mutex_unlock(&trace.lock);
+  LOGI("Tracing to %s", path);
+  return true;
+}
+
+void trace_stop(void) {
+  pthread_mutex_lock(&trace.lock);
+  if (trace.file == NULL || trace.stopping) {
+    pthread_mutex_unlock(&trace.lock);
+    return;
+  }
+  atomic_store_explicit(&trace_running, false, memory_order_relaxed);
+  trace.stopping = true;
+  pthread_mutex_unlock(&trace.lock);
+
+  pthread_join(trace.writer, NULL);
+
+  pthread_mutex_lock(&trace.lock);
+  drain();
+  const bool failed = ferror(trace.file) != 0;
+  if (fclose(trace.file) != 0 || failed) {
+    LOGE("Can't write trace: %s", strerror(errno));
+  }
+  trace.file = NULL;
+  LOGI("Traced %" PRIu64 " events, %" PRIu64 " dropped", trace.num_events,
+       trace.num_dropped);
+  pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,128 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Timeline tracing of the capture and plot pipelines. Every thread records
+// into its own ring, which a background thread drains to the trace file.
+// While no trace is running, trace_begin() is a relaxed load and a branch,
+// and trace_end() a branch.
+//
+// File layout, all fields little-endian: one header, then num_names name
+// entries indexed by trace_name, then records in the order they were
+// drained. Records of one thread are in order; the clock is
+// CLOCK_MONOTONIC, shared by all processes of a device, so that traces of
+// the scanner and the plot can be merged. tools/trace-export turns trace
+// files into Chrome trace JSON, which Perfetto opens as well.
+enum { TRACE_MAGIC = 0x65637274 };
+enum { TRACE_VERSION = 1 };
+enum { TRACE_NAME_LEN = 32 };
+enum { TRACE_ARG_LEN = 16 };
+
+struct trace_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t num_names;
+  int64_t start_ns;
+  char process[16];
+};
+
+struct trace_name_entry {
+  char name[TRACE_NAME_LEN];
+  char arg[TRACE_ARG_LEN];
+};
+
+enum trace_kind {
+  TRACE_SPAN,
+  TRACE_INSTANT,
+  TRACE_THREAD,
+  TRACE_DROPPED,
+};
+
+// A span covers start_ns to start_ns + dur_ns, an instant is at start_ns.
+// TRACE_THREAD names the thread tid, TRACE_DROPPED counts in arg the
+// events the ring of tid had no room for.
+struct trace_record {
+  uint16_t kind;
+  uint16_t name;
+  uint32_t tid;
+  union {
+    struct {
+      int64_t start_ns;
+      int64_t dur_ns;
+      int64_t arg;
+    };
+    char thread_name[24];
+  };
+};
+
+enum trace_name {
+  TRACE_SCAN_START,
+  TRACE_SCAN_STOP,
+  TRACE_CHANNEL_SWITCH,
+  TRACE_SWITCH_NOTIFY,
+  TRACE_GET_INTERFACE,
+  TRACE_REPORT_RECV,
+  TRACE_REPORT_PUBLISH,
+  TRACE_SQUELCH_FLUSH,
+  TRACE_REPORT_DELIVER,
+  TRACE_PLOT_REPORT,
+  TRACE_PLOT_LOCK,
+  TRACE_STAGE_CAPTURE,
+  TRACE_STAGE_INDEX,
+  TRACE_STAGE_CHANNELS,
+  TRACE_STAGE_ALERTS,
+  TRACE_STAGE_FLOOR,
+  TRACE_STAGE_AVERAGE,
+  TRACE_STAGE_DETECT,
+  TRACE_STAGE_MATCH,
+  TRACE_STAGE_CLASSIFY,
+  TRACE_STAGE_DRAW,
+  TRACE_DETECTOR,
+  TRACE_RENDER_LOCK,
+  TRACE_RENDER,
+  NUM_TRACE_NAMES,
+};
+
+extern atomic_bool trace_running;
+
+static inline int64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_record(enum trace_kind kind, enum trace_name name,
+                  int64_t start_ns, int64_t dur_ns, int64_t arg);
+
+// Returns the start of a span, or 0 if no trace is running.
+static inline int64_t trace_begin(void) {
+  return atomic_load_explicit(&trace_running, memory_order_relaxed)
+             ? trace_now_ns()
+             : 0;
+}
+
+static inline void trace_end(enum trace_name name, int64_t start_ns,
+                             int64_t arg) {
+  if (start_ns != 0) {
+    trace_record(TRACE_SPAN, name, start_ns, trace_now_ns() - start_ns, arg);
+  }
+}
+
+static inline void trace_instant(enum trace_name name, int64_t arg) {
+  if (atomic_load_explicit(&trace_running, memory_order_relaxed)) {
+    trace_record(TRACE_INSTANT, name, trace_now_ns(), 0, arg);
+  }
+}
+
+// process names the process in the trace. Only one trace runs per process
+// at a time.
+bool trace_start(const char *path, const char *process);
+void trace_stop(void);
+
+#endif
@@ -1,5 +1,6 @@
 package com.example.softsa;
 
+import android.annotation.TargetApi;
 import android.app.Activity;
 import android.app.AlertDialog;
 import android.content.ComponentName;
@@ -11,6 +12,7 @@ import android.graphics.Canvas;
 import android.graphics.Color;
 import android.graphics.Paint;
 import android.graphics.Rect;
+import android.os.Build;
 import android.os.Bundle;
 import android.os.Handler;
 import android.os.IBinder;
@@ -20,14 +22,21 @@ import android.os.Messenger;
 import android.os.RemoteException;
 import android.view.View;
 import android.view.Window;
+import android.widget.EditText;
+import android.widget.Toast;
 
 import java.io.File;
 import java.lang.Double;
 import java.lang.Float;
 import java.lang.Math;
 import java.lang.System;
+import java.lang.invoke.VarHandle;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.Arrays;
+import java.util.HashMap;
 import java.util.List;
+import java.util.Map;
 import java.util.UUID;
 import java.util.function.Supplier;
 import java.util.stream.IntStream;
@@ -40,9 +49,37 @@ public class SoftSA extends Activity {
     5180, 5200, 5220, 5240, 5745, 5765, 5785, 5805, 5825,
   };
   private boolean[] apFreqsSelected = new boolean[apFreqsAll.length];
+  private static final int[] guardTimesAll = {0, 10, 20, 50, 100};
   private int fftSize = 7;
+  private int guardTime = 20;
+  private boolean guardDrop = false;
+  private static final int[] squelchLevelsAll = {0, 3, 6, 10, 20};
+  private int squelch = 0;
+  private boolean squelchDrop = false;
   private boolean showAverage = true;
   private boolean showPulses = false;
+  private boolean showNoiseFloor = false;
+  private boolean showPersistence = false;
+  private File archiveFile = null;
+  private File lastArchiveFile = null;
+  private boolean capturing = false;
+  private boolean[] captureTriggers = {true, false, false, false};
+  private static final int captureBudgetMb = 16;
+  private static final int capturePreMs = 3000;
+  private static final int capturePostMs = 2000;
+  private String alertRules = "detector bluetooth for 5000\n";
+  private String traceName = null;
+  private String schedText = "";
+  private int timeScale = 0;
+  private static final int pyramidLevels = 10;
+  private static final int pyramidRows = 256;
+  private static final int pyramidBudgetMb = 16;
+  private PlotView plotView;
+  private boolean[] detectorsEnabled = {true, true, true, true};
+  private int detectMode = PlotView.DETECT_MODE_CLASSIFY;
+  private int avgMode = PlotView.AVG_MODE_BOXCAR;
+  private int avgTime = 625;
+  private double holdDecay = 0.02;
   private ScanConnection scanConn;
 
   private int[] getApFreqs() {
@@ -61,7 +98,7 @@ public class SoftSA extends Activity {
     });
     builder.setPositiveButton("OK", (dialog, id) -> {
       apFreqsSelected = checkedItems;
-      scanConn.config(getApFreqs(), fftSize);
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
     });
     builder.setNegativeButton("Cancel", null);
     return builder.create();
@@ -70,7 +107,7 @@ public class SoftSA extends Activity {
   private AlertDialog configBinCountDialog() {
     AlertDialog.Builder builder = new AlertDialog.Builder(this);
     builder.setTitle("Bin Count");
-    String[] items = IntStream.rangeClosed(2, 9)
+    String[] items = IntStream.rangeClosed(2, 10)
       .mapToObj(i -> String.format("%d", 1 << i)).toArray(String[]::new);
     int[] checkedItem = {fftSize - 2};
     builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
@@ -78,7 +115,56 @@ public class SoftSA extends Activity {
     });
     builder.setPositiveButton("OK", (dialog, id) -> {
       fftSize = checkedItem[0] + 2;
-      scanConn.config(getApFreqs(), fftSize);
+      plotView.configFftSize(fftSize);
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configGuardTimeDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Channel Guard");
+    String[] items = Arrays.stream(guardTimesAll)
+      .mapToObj(time -> time > 0 ? String.format("%d ms", time) : "Off")
+      .toArray(String[]::new);
+    int[] checkedItem = {Math.max(Arrays.binarySearch(guardTimesAll, guardTime), 0)};
+    builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
+      checkedItem[0] = which;
+    });
+    builder.setPositiveButton("Flag", (dialog, id) -> {
+      guardTime = guardTimesAll[checkedItem[0]];
+      guardDrop = false;
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
+    });
+    builder.setNeutralButton("Drop", (dialog, id) -> {
+      guardTime = guardTimesAll[checkedItem[0]];
+      guardDrop = true;
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configSquelchDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Squelch");
+    String[] items = Arrays.stream(squelchLevelsAll)
+      .mapToObj(level -> level > 0 ? String.format("%d dB above floor", level) : "Off")
+      .toArray(String[]::new);
+    int[] checkedItem = {Math.max(Arrays.binarySearch(squelchLevelsAll, squelch), 0)};
+    builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
+      checkedItem[0] = which;
+    });
+    builder.setPositiveButton("Summarize", (dialog, id) -> {
+      squelch = squelchLevelsAll[checkedItem[0]];
+      squelchDrop = false;
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
+    });
+    builder.setNeutralButton("Drop", (dialog, id) -> {
+      squelch = squelchLevelsAll[checkedItem[0]];
+      squelchDrop = true;
+      scanConn.config(getApFreqs(), fftSize, guardTime, guardDrop, squelch, squelchDrop);
     });
     builder.setNegativeButton("Cancel", null);
     return builder.create();
@@ -87,15 +173,233 @@ public class SoftSA extends Activity {
   private AlertDialog configSpectrogramDialog() {
     AlertDialog.Builder builder = new AlertDialog.Builder(this);
     builder.setTitle("Spectrogram");
-    String[] items = {"Show 0.625 ms Average", "Show Pulses"};
-    boolean[] checkedItems = {showAverage, showPulses};
+    String[] items = {"Show Average", "Show Pulses", "Show Noise Floor", "Show Persistence"};
+    boolean[] checkedItems = {showAverage, showPulses, showNoiseFloor, showPersistence};
     builder.setMultiChoiceItems(items, checkedItems, (dialog, which, isChecked) -> {
       checkedItems[which] = isChecked;
     });
     builder.setPositiveButton("OK", (dialog, id) -> {
       showAverage = checkedItems[0];
       showPulses = checkedItems[1];
-      PlotView.configPlot(showAverage, showPulses);
+      showNoiseFloor = checkedItems[2];
+      showPersistence = checkedItems[3];
+      plotView.configPlot(showAverage, showPulses, showPersistence);
+      plotView.setShowNoiseFloor(showNoiseFloor);
+      plotView.setShowPersistence(showPersistence);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private int getDetectorMask() {
+    return IntStream.range(0, detectorsEnabled.length)
+      .filter(i -> detectorsEnabled[i]).map(i -> 1 << i).sum();
+  }
+
+  private AlertDialog configDetectorsDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Detectors");
+    boolean[] checkedItems = detectorsEnabled.clone();
+    builder.setMultiChoiceItems(PlotView.detectorNames, checkedItems, (dialog, which, isChecked) -> {
+      checkedItems[which] = isChecked;
+    });
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      detectorsEnabled = checkedItems;
+      plotView.configDetectors(getDetectorMask());
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configDetectModeDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Detection Mode");
+    String[] items = {"Classify Signals", "Longest Pulse"};
+    int[] checkedItem = {detectMode};
+    builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
+      checkedItem[0] = which;
+    });
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      detectMode = checkedItem[0];
+      plotView.configDetect(detectMode, null);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configTimeScaleDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Time Scale");
+    String[] items = IntStream.range(0, pyramidLevels)
+      .mapToObj(i -> i == 0 ? "Live" : String.format("%d Reports per Row", 1 << i))
+      .toArray(String[]::new);
+    int[] checkedItem = {timeScale};
+    builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
+      checkedItem[0] = which;
+    });
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      timeScale = checkedItem[0];
+      plotView.configTimeScale(timeScale);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configAverageDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Averaging");
+    String[] items = {"Boxcar", "Exponential", "Peak Hold", "Min Hold"};
+    int[] checkedItem = {avgMode};
+    builder.setSingleChoiceItems(items, checkedItem[0], (dialog, which) -> {
+      checkedItem[0] = which;
+    });
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      avgMode = checkedItem[0];
+      plotView.configAverage(avgMode, avgTime, holdDecay);
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog saveOccupancyDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Occupancy");
+    File file = new File(getExternalFilesDir(null),
+                         String.format("occupancy-%d.bin", System.currentTimeMillis()));
+    builder.setMessage("Save occupancy statistics since start to " + file.getName() + "?");
+    builder.setPositiveButton("Save", (dialog, id) -> {
+      boolean saved = plotView.dumpOccupancy(file.getAbsolutePath());
+      new AlertDialog.Builder(this)
+        .setMessage(saved ? "Saved to " + file.getAbsolutePath() : "Can't save occupancy statistics")
+        .setPositiveButton("OK", null)
+        .show();
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog archiveDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Archive");
+    if (archiveFile != null) {
+      builder.setMessage("Recording to " + archiveFile.getName());
+      builder.setPositiveButton("Stop", (dialog, id) -> {
+        plotView.stopArchive();
+        lastArchiveFile = archiveFile;
+        archiveFile = null;
+      });
+    } else {
+      File file = new File(getExternalFilesDir(null),
+                           String.format("archive-%d.bin", System.currentTimeMillis()));
+      builder.setMessage("Record the spectrogram to " + file.getName() + "?");
+      builder.setPositiveButton("Start", (dialog, id) -> {
+        if (plotView.startArchive(file.getAbsolutePath())) {
+          archiveFile = file;
+        }
+      });
+      if (lastArchiveFile != null) {
+        File benchFile = lastArchiveFile;
+        builder.setNeutralButton("Benchmark", (dialog, id) -> {
+          new Thread(() -> PlotView.benchmarkBandQuery(benchFile.getAbsolutePath(), 1000)).start();
+        });
+      }
+    }
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog captureDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Capture");
+    File dir = getExternalFilesDir("captures");
+    if (capturing) {
+      builder.setMessage("Keeping raw reports, trigger to save them to " + dir.getName());
+      builder.setPositiveButton("Trigger", (dialog, id) -> {
+        plotView.triggerCapture();
+      });
+      builder.setNeutralButton("Stop", (dialog, id) -> {
+        plotView.stopCapture();
+        capturing = false;
+      });
+    } else {
+      boolean[] checkedItems = captureTriggers.clone();
+      builder.setMultiChoiceItems(PlotView.detectorNames, checkedItems, (dialog, which, isChecked) -> {
+        checkedItems[which] = isChecked;
+      });
+      builder.setPositiveButton("Start", (dialog, id) -> {
+        captureTriggers = checkedItems;
+        int mask = IntStream.range(0, captureTriggers.length)
+          .filter(i -> captureTriggers[i]).map(i -> 1 << i).sum();
+        capturing = dir != null && plotView.startCapture(
+          dir.getAbsolutePath(), captureBudgetMb, capturePreMs, capturePostMs, mask);
+      });
+    }
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog traceDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Trace");
+    File dir = getExternalFilesDir("traces");
+    if (traceName != null) {
+      builder.setMessage("Tracing to " + traceName + "-*.trace");
+      builder.setPositiveButton("Stop", (dialog, id) -> {
+        PlotView.stopTrace();
+        scanConn.stopTrace();
+        traceName = null;
+      });
+    } else {
+      String name = String.format("trace-%d", System.currentTimeMillis());
+      builder.setMessage("Record a timeline of the scanner and the plot to "
+          + name + "-*.trace?");
+      builder.setPositiveButton("Start", (dialog, id) -> {
+        if (dir != null && PlotView.startTrace(
+            new File(dir, name + "-plot.trace").getAbsolutePath())) {
+          scanConn.startTrace(
+              new File(dir, name + "-scan.trace").getAbsolutePath());
+          traceName = name;
+        }
+      });
+    }
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configAlertsDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Alerts");
+    EditText editText = new EditText(this);
+    editText.setText(alertRules);
+    editText.setHint("band 2400 2420 above -60 for 200");
+    builder.setView(editText);
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      String rules = editText.getText().toString();
+      if (plotView.configAlerts(rules) < 0) {
+        Toast.makeText(this, "Can't parse alert rules", Toast.LENGTH_SHORT).show();
+      } else {
+        alertRules = rules;
+      }
+    });
+    builder.setNegativeButton("Cancel", null);
+    return builder.create();
+  }
+
+  private AlertDialog configSchedDialog() {
+    AlertDialog.Builder builder = new AlertDialog.Builder(this);
+    builder.setTitle("Scheduling");
+    EditText editText = new EditText(this);
+    editText.setText(schedText);
+    editText.setHint("scan = cpus 4-7 fifo 10");
+    builder.setView(editText);
+    builder.setPositiveButton("OK", (dialog, id) -> {
+      String text = editText.getText().toString();
+      if (!plotView.configSched(text)) {
+        Toast.makeText(this, "Can't parse scheduling", Toast.LENGTH_SHORT).show();
+      } else {
+        schedText = text;
+        scanConn.sched(schedText);
+      }
     });
     builder.setNegativeButton("Cancel", null);
     return builder.create();
@@ -107,12 +411,36 @@ public class SoftSA extends Activity {
     String[] items = {
       "AP Frequencies",
       "Bin Count",
+      "Channel Guard",
+      "Squelch",
       "Spectrogram",
+      "Time Scale",
+      "Averaging",
+      "Detection Mode",
+      "Detectors",
+      "Save Occupancy",
+      "Archive",
+      "Capture",
+      "Alerts",
+      "Scheduling",
+      "Trace",
     };
     List<Supplier<AlertDialog>> dialogBuilders = List.of(
       this::configApFreqsDialog,
       this::configBinCountDialog,
-      this::configSpectrogramDialog);
+      this::configGuardTimeDialog,
+      this::configSquelchDialog,
+      this::configSpectrogramDialog,
+      this::configTimeScaleDialog,
+      this::configAverageDialog,
+      this::configDetectModeDialog,
+      this::configDetectorsDialog,
+      this::saveOccupancyDialog,
+      this::archiveDialog,
+      this::captureDialog,
+      this::configAlertsDialog,
+      this::configSchedDialog,
+      this::traceDialog);
     builder.setItems(items, (dialog, which) -> {
       dialogBuilders.get(which).get().show();
     });
@@ -129,30 +457,55 @@ public class SoftSA extends Activity {
     });
     String uuid = UUID.randomUUID().toString();
     String sockPath = new File(getCacheDir(), uuid + ".sock").getAbsolutePath();
-    PlotView.configPlot(showAverage, showPulses);
-    PlotView.startPlot(sockPath);
+    plotView = new PlotView(this);
+    plotView.configPlot(showAverage, showPulses, showPersistence);
+    plotView.configDetect(detectMode, null);
+    plotView.configAverage(avgMode, avgTime, holdDecay);
+    plotView.configPyramid(pyramidLevels, pyramidRows, pyramidBudgetMb);
+    plotView.configFftSize(fftSize);
+    plotView.configTimeScale(timeScale);
+    plotView.configDetectors(getDetectorMask());
+    plotView.startPlot(sockPath);
+    plotView.setAlertListener((rule, raised, timeUs, power) -> {
+      String[] lines = Arrays.stream(alertRules.split("\n")).map(String::trim)
+        .filter(line -> !line.isEmpty() && !line.startsWith("#")).toArray(String[]::new);
+      String name = rule < lines.length ? lines[rule] : "Rule " + rule;
+      Toast.makeText(this, (raised ? "Alert: " : "Cleared: ") + name, Toast.LENGTH_SHORT).show();
+    });
+    plotView.configAlerts(alertRules);
     scanConn = new ScanConnection();
     Intent scanIntent = new Intent(this, ScanService.class);
     scanIntent.putExtra("com.example.softsa.ap_freqs", getApFreqs());
     scanIntent.putExtra("com.example.softsa.fft_size", fftSize);
     scanIntent.putExtra("com.example.softsa.sock_path", sockPath);
+    scanIntent.putExtra("com.example.softsa.guard_time", guardTime);
+    scanIntent.putExtra("com.example.softsa.guard_drop", guardDrop);
+    scanIntent.putExtra("com.example.softsa.squelch", squelch);
+    scanIntent.putExtra("com.example.softsa.squelch_drop", squelchDrop);
+    scanIntent.putExtra("com.example.softsa.sched", schedText);
     RootService.bind(scanIntent, scanConn);
-    View view = new PlotView(this);
-    view.setOnClickListener(v -> {
+    plotView.setShowNoiseFloor(showNoiseFloor);
+    plotView.setShowPersistence(showPersistence);
+    plotView.setOnClickListener(v -> {
       scanConn.pause();
     });
-    view.setOnLongClickListener(v -> {
+    plotView.setOnLongClickListener(v -> {
       configDialog().show();
       return true;
     });
-    setContentView(view);
+    setContentView(plotView);
   }
 
   @Override
   protected void onDestroy() {
     super.onDestroy();
+    if (traceName != null) {
+      PlotView.stopTrace();
+      scanConn.stopTrace();
+    }
     RootService.unbind(scanConn);
-    PlotView.stopPlot();
+    plotView.stopPlot();
+    plotView.destroy();
   }
 }
 
@@ -161,15 +514,148 @@ class PlotView extends View {
     System.loadLibrary("spectral-plot");
   }
 
-  static native void startPlot(String sockPath);
+  private static native long createEngine();
+
+  private static native void destroyEngine(long engine);
+
+  // The native pipeline of this view, used by all its native methods until
+  // destroy() is called.
+  private long engine = createEngine();
+
+  private native ByteBuffer getSnapshot();
+
+  static native void copySnapshot(ByteBuffer src, ByteBuffer dst);
+
+  // Latest spectrum, tracks and frame state of the engine, valid until
+  // destroy() is called.
+  final PlotSnapshot snapshot = new PlotSnapshot(getSnapshot());
+
+  void destroy() {
+    final long old = engine;
+    engine = 0;
+    destroyEngine(old);
+  }
+
+  native void startPlot(String sockPath);
+
+  native void stopPlot();
+
+  native void configPlot(boolean showAverage, boolean showPulses,
+                         boolean showPersistence);
+
+  native void configDetectors(int mask);
+
+  static final int DETECT_MODE_CLASSIFY = 0;
+  static final int DETECT_MODE_PULSE = 1;
+
+  // thresholds: {thresMin, thresDiff, thresFreq, thresPwr, thresTime,
+  // maxWindowTime, maxWindowSize, floorMargin}, or null for the defaults of
+  // the mode.
+  native void configDetect(int mode, double[] thresholds);
+
+  static final int AVG_MODE_BOXCAR = 0;
+  static final int AVG_MODE_EMA = 1;
+  static final int AVG_MODE_PEAK_HOLD = 2;
+  static final int AVG_MODE_MIN_HOLD = 3;
+
+  // avgTime is the time constant of the exponential average in microseconds,
+  // holdDecay how fast held traces decay in dB per millisecond.
+  native void configAverage(int mode, int avgTime, double holdDecay);
+
+  private native int getNoiseFloor(float[] trace);
+
+  // stats receives {freq, duty, meanPwr, maxPwr} for each 0.5 MHz cell in
+  // [startFreq, endFreq) MHz. hour selects a time-of-day bucket, -1 for all.
+  native int getOccupancy(int startFreq, int endFreq, int hour, float[] stats);
+
+  native boolean dumpOccupancy(String path);
+
+  native boolean startArchive(String path);
+
+  native void stopArchive();
+
+  // Keeps the raw reports of the last budgetMb MiB in memory and saves those
+  // from preMs before to postMs after a trigger to a file in dir. The
+  // detectors in detectorMask trigger when they turn present.
+  native boolean startCapture(String dir, int budgetMb, int preMs, int postMs,
+                              int detectorMask);
 
-  static native void stopPlot();
+  native void stopCapture();
 
-  static native void configPlot(boolean showAverage, boolean showPulses);
+  native boolean triggerCapture();
 
-  private static native void changeHeight(int height);
+  // Rules are given one per line, as described in alerts.h. Returns the
+  // number of rules, or -1 if they can't be parsed.
+  native int configAlerts(String rules);
 
-  private static native long updatePlot(PlotView view);
+  // Settings are given one "ROLE = SETTINGS" line per thread role, as
+  // described in thread-sched.h, and the plot role applies to the receive
+  // thread. Returns false if they can't be parsed.
+  native boolean configSched(String text);
+
+  // Records a timeline of every plot engine to path, as described in
+  // trace.h.
+  static native boolean startTrace(String path);
+
+  static native void stopTrace();
+
+  interface AlertListener {
+    // rule counts the rules from 0, in the order given. power is the band
+    // power in dBm, or NaN for detector rules.
+    void onAlert(int rule, boolean raised, long timeUs, double power);
+  }
+
+  private AlertListener alertListener;
+
+  void setAlertListener(AlertListener listener) {
+    alertListener = listener;
+  }
+
+  // Called on a native thread, in the order of the events.
+  private void onAlert(int rule, boolean raised, long timeUs, double power) {
+    post(() -> {
+      if (alertListener != null) {
+        alertListener.onAlert(rule, raised, timeUs, power);
+      }
+    });
+  }
+
+  // Memory per channel is levels * rowsPerLevel * (3 bytes per bin + 16),
+  // and channels are kept while they fit into budgetMb MiB together.
+  native void configPyramid(int levels, int rowsPerLevel, int budgetMb);
+
+  // Sizes the buffers of the pipeline for reports of up to 2^fftSize bins
+  // per segment. Larger reports are dropped.
+  native void configFftSize(int fftSize);
+
+  // level 0 is the live waterfall, level n draws 2^n reports per row.
+  native void configTimeScale(int level);
+
+  // Mean power in dBm over [startFreq, endFreq] MHz between startAgo and
+  // endAgo ms before the newest indexed data, or NaN.
+  native double getBandPower(int startAgo, int endAgo, double startFreq, double endFreq);
+
+  // Logs the time per band query from an index built over the archive and
+  // from scanning the archive itself.
+  static native void benchmarkBandQuery(String archivePath, int numQueries);
+
+  static final int GRID_WIFI = 0;
+  static final int GRID_BLUETOOTH = 1;
+  static final int GRID_ZIGBEE = 2;
+
+  // Power in dBm of each channel of a grid over the last 100 ms, NaN where
+  // unmeasured. Wi-Fi lists 2.4 GHz channels 1-14, then 5 GHz 36-165.
+  native int getChannelPower(int grid, float[] power);
+
+  // The last 60 s of a channel's power, oldest first, at 100 ms per frame.
+  native int getChannelSeries(int grid, int channel, float[] series);
+
+  private static final float FLOOR_TOP = -20;
+  private static final float FLOOR_RANGE = 100;
+
+  private native void changeHeight(int height);
+
+  private native long updatePlot();
 
   private Bitmap plotBitmap;
   private final Rect r = new Rect();
@@ -178,17 +664,16 @@ class PlotView extends View {
   private final Paint leftLargePaint = new Paint();
   private final Paint leftSmallPaint = new Paint();
   private final Paint centerSmallPaint = new Paint();
+  private final Paint noiseFloorPaint = new Paint();
+  private final float[] noiseFloor = new float[PlotSnapshot.MAX_BINS];
+  private final float[] noiseFloorLines = new float[PlotSnapshot.MAX_BINS * 4];
+  private boolean showNoiseFloor = false;
+  private boolean showPersistence = false;
   private final long[] prevDrawTime = new long[60];
   private final long[] prevNumScans = new long[60];
   private int numDrawsMod60 = 0;
-  private long elapsedQ1 = 0;
-  private long elapsedQ2 = 0;
-  private long elapsedQ3 = 0;
-  private float centerPos = Float.NaN;
-  private int centerFreq = 0;
-  private int spanWidth = 0;
-  private double bluetoothPower = Double.NaN;
-  private double pulseFreq = Double.NaN;
+  static final String[] detectorNames = {"Bluetooth", "ZigBee", "Wi-Fi", "Microwave"};
+  private final PlotSnapshot.Frame frame = new PlotSnapshot.Frame(detectorNames.length);
 
   PlotView(Context context) {
     super(context);
@@ -208,9 +693,36 @@ class PlotView extends View {
     centerSmallPaint.setColor(Color.YELLOW);
     centerSmallPaint.setTextSize(10 * density);
     centerSmallPaint.setTextAlign(Paint.Align.CENTER);
+    noiseFloorPaint.setColor(Color.CYAN);
+    noiseFloorPaint.setStrokeWidth(1 * density);
     Arrays.fill(prevDrawTime, System.nanoTime());
   }
 
+  void setShowNoiseFloor(boolean show) {
+    showNoiseFloor = show;
+  }
+
+  void setShowPersistence(boolean show) {
+    showPersistence = show;
+  }
+
+  private void drawNoiseFloor(Canvas canvas, int width, int height) {
+    int numBins = getNoiseFloor(noiseFloor);
+    if (numBins < 2) {
+      return;
+    }
+    float binWidth = (float) width / numBins;
+    int numLines = 0;
+    for (int i = 0; i + 1 < numBins; i++) {
+      noiseFloorLines[numLines * 4] = (i + 0.5f) * binWidth;
+      noiseFloorLines[numLines * 4 + 1] = (FLOOR_TOP - noiseFloor[i]) / FLOOR_RANGE * height;
+      noiseFloorLines[numLines * 4 + 2] = (i + 1.5f) * binWidth;
+      noiseFloorLines[numLines * 4 + 3] = (FLOOR_TOP - noiseFloor[i + 1]) / FLOOR_RANGE * height;
+      numLines++;
+    }
+    canvas.drawLines(noiseFloorLines, 0, numLines * 4, noiseFloorPaint);
+  }
+
   @Override
   protected void onSizeChanged(int w, int h, int oldw, int oldh) {
     plotBitmap = Bitmap.createBitmap(w, h, Bitmap.Config.RGB_565);
@@ -220,7 +732,16 @@ class PlotView extends View {
   @Override
   protected void onDraw(Canvas canvas) {
     long drawTime = System.nanoTime();
-    long numScans = updatePlot(this);
+    long numScans = updatePlot();
+    snapshot.readFrame(frame);
+    long elapsedQ1 = frame.elapsed[0];
+    long elapsedQ2 = frame.elapsed[1];
+    long elapsedQ3 = frame.elapsed[2];
+    float centerPos = frame.centerPos;
+    int centerFreq = frame.centerFreq;
+    int spanWidth = frame.spanWidth;
+    double[] detectorPower = frame.detectorPower;
+    double pulseFreq = frame.pulseFreq;
     long elapsedNano60 = Math.max(drawTime - prevDrawTime[numDrawsMod60], 1);
     prevDrawTime[numDrawsMod60] = drawTime;
     prevNumScans[numDrawsMod60] = numScans;
@@ -230,16 +751,25 @@ class PlotView extends View {
     canvas.drawBitmap(plotBitmap, 0, 0, null);
     int width = getWidth();
     int height = getHeight();
+    if (showNoiseFloor) {
+      drawNoiseFloor(canvas, width, height);
+    }
     canvas.drawText(scanRateText, width, height, rightLargePaint);
-    if (elapsedQ1 > 0) {
+    if (showPersistence) {
+      for (int i = 1; i < 4; i++) {
+        String levelText = String.format("%.0f dBm", FLOOR_TOP - FLOOR_RANGE * i / 4);
+        canvas.drawText(levelText, width, height / 4.0f * i, rightSmallPaint);
+      }
+    }
+    if (!showPersistence && elapsedQ1 > 0) {
       String elapsedQ1Text = String.format("%d ms ago", elapsedQ1 / 1000);
       canvas.drawText(elapsedQ1Text, width, height / 4.0f * 1, rightSmallPaint);
     }
-    if (elapsedQ2 > 0) {
+    if (!showPersistence && elapsedQ2 > 0) {
       String elapsedQ1Text = String.format("%d ms ago", elapsedQ2 / 1000);
       canvas.drawText(elapsedQ1Text, width, height / 4.0f * 2, rightSmallPaint);
     }
-    if (elapsedQ3 > 0) {
+    if (!showPersistence && elapsedQ3 > 0) {
       String elapsedQ1Text = String.format("%d ms ago", elapsedQ3 / 1000);
       canvas.drawText(elapsedQ1Text, width, height / 4.0f * 3, rightSmallPaint);
     }
@@ -254,10 +784,16 @@ class PlotView extends View {
       rightSmallPaint.getTextBounds(endFreqText, 0, endFreqText.length(), r);
       canvas.drawText(endFreqText, width, r.height(), rightSmallPaint);
     }
-    if (!Double.isNaN(bluetoothPower)) {
-      String bluetoothText = String.format("Bluetooth: %3.0f dBm", bluetoothPower);
-      canvas.drawText(bluetoothText, 0, height, leftLargePaint);
-    } else if (!Double.isNaN(pulseFreq)) {
+    float detectorY = height;
+    for (int i = 0; i < detectorPower.length; i++) {
+      if (Double.isNaN(detectorPower[i])) {
+        continue;
+      }
+      String detectorText = String.format("%s: %3.0f dBm", detectorNames[i], detectorPower[i]);
+      canvas.drawText(detectorText, 0, detectorY, leftLargePaint);
+      detectorY -= leftLargePaint.getTextSize();
+    }
+    if (detectorY == height && !Double.isNaN(pulseFreq)) {
       String pulseText = String.format("Pulse: %.8f MHz", pulseFreq);
       canvas.drawText(pulseText, 0, height, leftLargePaint);
     }
@@ -267,29 +803,254 @@ class PlotView extends View {
   }
 }
 
+// Reads the snapshot an engine shares with Java. The engine writes it while
+// seq is odd, so every read copies what it needs between two loads of seq
+// and retries until both are the same even value. The layout must match
+// struct plot_snapshot in spectral-plot.c. Reads are meant for one thread,
+// as they may share a copy.
+class PlotSnapshot {
+  static final int MAX_BINS = 2048;
+  static final int MAX_TRACKS = 64;
+  static final int TRACK_FIELDS = 6;
+
+  private static final int SEQ = 0;
+  private static final int VERSION = 4;
+  private static final int ELAPSED = 8;
+  private static final int CENTER_POS = 32;
+  private static final int CENTER_FREQ = 36;
+  private static final int SPAN_WIDTH = 40;
+  private static final int NUM_BINS = 44;
+  private static final int PULSE_FREQ = 48;
+  private static final int DETECTOR_PWR = 56;
+  private static final int TSTAMP = 88;
+  private static final int NUM_TRACKS = 92;
+  private static final int NUM_SCANS = 96;
+  private static final int SPECTRUM = 104;
+  private static final int TRACKS = SPECTRUM + MAX_BINS * 4;
+  private static final int TRACK_SIZE = 40;
+
+  // Before API 33 there is no fence to keep the loads of a copy between the
+  // loads of seq around it, so reads go through a copy that native code
+  // takes under the seqlock instead.
+  private static final boolean IN_PLACE = Build.VERSION.SDK_INT >= 33;
+
+  private final ByteBuffer buf;
+  private final ByteBuffer copy;
+
+  PlotSnapshot(ByteBuffer buf) {
+    this.buf = buf.order(ByteOrder.nativeOrder());
+    copy = IN_PLACE ? null
+        : ByteBuffer.allocateDirect(buf.capacity()).order(ByteOrder.nativeOrder());
+  }
+
+  static class Frame {
+    final long[] elapsed = new long[3];
+    float centerPos = Float.NaN;
+    int centerFreq;
+    int spanWidth;
+    final double[] detectorPower;
+    double pulseFreq = Double.NaN;
+    long numScans;
+
+    Frame(int numDetectors) {
+      detectorPower = new double[numDetectors];
+      Arrays.fill(detectorPower, Double.NaN);
+    }
+  }
+
+  @TargetApi(33)
+  private int beginRead() {
+    int seq;
+    while (((seq = buf.getInt(SEQ)) & 1) != 0) {
+      Thread.yield();
+    }
+    VarHandle.acquireFence();
+    return seq;
+  }
+
+  @TargetApi(33)
+  private boolean endRead(int seq) {
+    VarHandle.acquireFence();
+    return buf.getInt(SEQ) == seq;
+  }
+
+  private ByteBuffer readCopy() {
+    PlotView.copySnapshot(buf, copy);
+    return copy;
+  }
+
+  int version() {
+    return buf.getInt(VERSION);
+  }
+
+  void readFrame(Frame frame) {
+    if (!IN_PLACE) {
+      readFrame(readCopy(), frame);
+      return;
+    }
+    int seq;
+    do {
+      seq = beginRead();
+      readFrame(buf, frame);
+    } while (!endRead(seq));
+  }
+
+  private static void readFrame(ByteBuffer src, Frame frame) {
+    for (int i = 0; i < frame.elapsed.length; i++) {
+      frame.elapsed[i] = src.getLong(ELAPSED + i * 8);
+    }
+    frame.centerPos = src.getFloat(CENTER_POS);
+    frame.centerFreq = src.getInt(CENTER_FREQ);
+    frame.spanWidth = src.getInt(SPAN_WIDTH);
+    for (int i = 0; i < frame.detectorPower.length; i++) {
+      frame.detectorPower[i] = src.getDouble(DETECTOR_PWR + i * 8);
+    }
+    frame.pulseFreq = src.getDouble(PULSE_FREQ);
+    frame.numScans = src.getLong(NUM_SCANS);
+  }
+
+  // Copies the averaged spectrum of the latest report into spectrum, which
+  // needs room for MAX_BINS bins, and returns its bin count. The first bin
+  // is centerFreq - spanWidth / 2 MHz.
+  int readSpectrum(float[] spectrum) {
+    if (!IN_PLACE) {
+      return readSpectrum(readCopy(), spectrum);
+    }
+    int seq;
+    int numBins;
+    do {
+      seq = beginRead();
+      numBins = readSpectrum(buf, spectrum);
+    } while (!endRead(seq));
+    return numBins;
+  }
+
+  private static int readSpectrum(ByteBuffer src, float[] spectrum) {
+    int numBins = Math.min(src.getInt(NUM_BINS), spectrum.length);
+    for (int i = 0; i < numBins; i++) {
+      spectrum[i] = src.getFloat(SPECTRUM + i * 4);
+    }
+    return numBins;
+  }
+
+  // Copies the tracks active at the latest report into tracks, TRACK_FIELDS
+  // values each: {center, bw, pwr, tstampFirst, tstampLast, count}, with
+  // frequencies in MHz and power in dBm. Returns the number of tracks.
+  int readTracks(double[] tracks) {
+    if (!IN_PLACE) {
+      return readTracks(readCopy(), tracks);
+    }
+    int seq;
+    int numTracks;
+    do {
+      seq = beginRead();
+      numTracks = readTracks(buf, tracks);
+    } while (!endRead(seq));
+    return numTracks;
+  }
+
+  private static int readTracks(ByteBuffer src, double[] tracks) {
+    int numTracks = Math.min(src.getInt(NUM_TRACKS), tracks.length / TRACK_FIELDS);
+    for (int i = 0; i < numTracks; i++) {
+      int pos = TRACKS + i * TRACK_SIZE;
+      tracks[i * TRACK_FIELDS] = src.getDouble(pos);
+      tracks[i * TRACK_FIELDS + 1] = src.getDouble(pos + 8);
+      tracks[i * TRACK_FIELDS + 2] = src.getDouble(pos + 16);
+      tracks[i * TRACK_FIELDS + 3] = src.getInt(pos + 24);
+      tracks[i * TRACK_FIELDS + 4] = src.getInt(pos + 28);
+      tracks[i * TRACK_FIELDS + 5] = src.getInt(pos + 32);
+    }
+    return numTracks;
+  }
+
+  // Timestamp of the report the spectrum and tracks are from.
+  int tstamp() {
+    if (!IN_PLACE) {
+      return readCopy().getInt(TSTAMP);
+    }
+    int seq;
+    int tstamp;
+    do {
+      seq = beginRead();
+      tstamp = buf.getInt(TSTAMP);
+    } while (!endRead(seq));
+    return tstamp;
+  }
+}
+
 class ScanService extends RootService implements Handler.Callback {
   static {
     System.loadLibrary("spectral-scan");
   }
 
-  private static native void startScan(int[] apFreqs, int fftSize, String sockPath);
+  // Quiet reports, with no bin squelch dB above its noise floor, are sent as
+  // summaries of several reports each or dropped. 0 sends every report.
+  // sched schedules the scanner threads, as described in thread-sched.h.
+  private static native void startScan(int[] apFreqs, int fftSize, String sockPath,
+                                       int guardTime, boolean guardDrop, int squelch,
+                                       boolean squelchDrop, String sched);
 
   private static native void stopScan();
 
+  // Each subscriber gets every report on its own datagram socket through its
+  // own queue, so a slow one only loses its own reports.
+  private static native int addSubscriber(String sockPath, int queueSize, boolean dropOldest);
+
+  private static native void removeSubscriber(int id);
+
+  // Records a timeline of the scanner to path, as described in trace.h.
+  private static native boolean startTrace(String path);
+
+  private static native void stopTrace();
+
   static final int MSG_PAUSE = 0;
   static final int MSG_CONFIG = 1;
+  static final int MSG_SUBSCRIBE = 2;
+  static final int MSG_UNSUBSCRIBE = 3;
+  static final int MSG_TRACE = 4;
+  static final int MSG_SCHED = 5;
+
+  private static class Subscriber {
+    final int queueSize;
+    final boolean dropOldest;
+    int id = -1;
+
+    Subscriber(int queueSize, boolean dropOldest) {
+      this.queueSize = queueSize;
+      this.dropOldest = dropOldest;
+    }
+  }
 
   private int[] apFreqs;
   private int fftSize;
   private String sockPath;
+  private int guardTime;
+  private boolean guardDrop;
+  private int squelch;
+  private boolean squelchDrop;
+  private String sched;
   private boolean paused = false;
+  private final HashMap<String, Subscriber> subscribers = new HashMap<>();
+
+  private void start() {
+    startScan(apFreqs, fftSize, sockPath, guardTime, guardDrop, squelch, squelchDrop, sched);
+    for (Map.Entry<String, Subscriber> e : subscribers.entrySet()) {
+      Subscriber s = e.getValue();
+      s.id = addSubscriber(e.getKey(), s.queueSize, s.dropOldest);
+    }
+  }
 
   @Override
   public IBinder onBind(Intent intent) {
     apFreqs = intent.getIntArrayExtra("com.example.softsa.ap_freqs");
     fftSize = intent.getIntExtra("com.example.softsa.fft_size", 0);
     sockPath = intent.getStringExtra("com.example.softsa.sock_path");
-    startScan(apFreqs, fftSize, sockPath);
+    guardTime = intent.getIntExtra("com.example.softsa.guard_time", 0);
+    guardDrop = intent.getBooleanExtra("com.example.softsa.guard_drop", false);
+    squelch = intent.getIntExtra("com.example.softsa.squelch", 0);
+    squelchDrop = intent.getBooleanExtra("com.example.softsa.squelch_drop", false);
+    sched = intent.getStringExtra("com.example.softsa.sched");
+    start();
     Handler h = new Handler(Looper.getMainLooper(), this);
     Messenger m = new Messenger(h);
     return m.getBinder();
@@ -309,7 +1070,7 @@ class ScanService extends RootService implements Handler.Callback {
     if (msg.what == MSG_PAUSE) {
       if (paused) {
         paused = false;
-        startScan(apFreqs, fftSize, sockPath);
+        start();
       } else {
         paused = true;
         stopScan();
@@ -318,9 +1079,42 @@ class ScanService extends RootService implements Handler.Callback {
       Bundle data = msg.getData();
       apFreqs = data.getIntArray("ap_freqs");
       fftSize = data.getInt("fft_size");
+      guardTime = data.getInt("guard_time");
+      guardDrop = data.getBoolean("guard_drop");
+      squelch = data.getInt("squelch");
+      squelchDrop = data.getBoolean("squelch_drop");
       if (!paused) {
         stopScan();
-        startScan(apFreqs, fftSize, sockPath);
+        start();
+      }
+    } else if (msg.what == MSG_SUBSCRIBE) {
+      Bundle data = msg.getData();
+      String path = data.getString("sock_path");
+      Subscriber s = new Subscriber(data.getInt("queue_size"), data.getBoolean("drop_oldest"));
+      Subscriber old = subscribers.put(path, s);
+      if (!paused) {
+        if (old != null && old.id >= 0) {
+          removeSubscriber(old.id);
+        }
+        s.id = addSubscriber(path, s.queueSize, s.dropOldest);
+      }
+    } else if (msg.what == MSG_UNSUBSCRIBE) {
+      Subscriber s = subscribers.remove(msg.getData().getString("sock_path"));
+      if (!paused && s != null && s.id >= 0) {
+        removeSubscriber(s.id);
+      }
+    } else if (msg.what == MSG_SCHED) {
+      sched = msg.getData().getString("sched");
+      if (!paused) {
+        stopScan();
+        start();
+      }
+    } else if (msg.what == MSG_TRACE) {
+      String path = msg.getData().getString("path");
+      if (path != null) {
+        startTrace(path);
+      } else {
+        stopTrace();
       }
     }
     return false;
@@ -354,7 +1148,53 @@ class ScanConnection implements ServiceConnection {
     }
   }
 
-  void config(int[] apFreqs, int fftSize) {
+  void subscribe(String sockPath, int queueSize, boolean dropOldest) {
+    Bundle data = new Bundle();
+    data.putString("sock_path", sockPath);
+    data.putInt("queue_size", queueSize);
+    data.putBoolean("drop_oldest", dropOldest);
+    send(ScanService.MSG_SUBSCRIBE, data);
+  }
+
+  void unsubscribe(String sockPath) {
+    Bundle data = new Bundle();
+    data.putString("sock_path", sockPath);
+    send(ScanService.MSG_UNSUBSCRIBE, data);
+  }
+
+  void sched(String sched) {
+    Bundle data = new Bundle();
+    data.putString("sched", sched);
+    send(ScanService.MSG_SCHED, data);
+  }
+
+  void startTrace(String path) {
+    Bundle data = new Bundle();
+    data.putString("path", path);
+    send(ScanService.MSG_TRACE, data);
+  }
+
+  void stopTrace() {
+    send(ScanService.MSG_TRACE, new Bundle());
+  }
+
+  private void send(int what, Bundle data) {
+    if (m == null) {
+      return;
+    }
+    Message msg = Message.obtain(null, what);
+    msg.setData(data);
+    try {
+      m.send(msg);
+    } catch (RemoteException e) {
+      e.printStackTrace();
+    } finally {
+      msg.recycle();
+    }
+  }
+
+  void config(int[] apFreqs, int fftSize, int guardTime, boolean guardDrop, int squelch,
+              boolean squelchDrop) {
     if (m == null) {
       return;
     }
@@ -362,6 +1202,10 @@ class ScanConnection implements ServiceConnection {
     Bundle data = new Bundle();
     data.putIntArray("ap_freqs", apFreqs);
     data.putInt("fft_size", fftSize);
+    data.putInt("guard_time", guardTime);
+    data.putBoolean("guard_drop", guardDrop);
+    data.putInt("squelch", squelch);
+    data.putBoolean("squelch_drop", squelchDrop);
     msg.setData(data);
     try {
       m.send(msg);
@@ -0,0 +1,807 @@
+// Offline analysis of the files written by a capture (see capture.h). Each
+// file is split into segments at hop boundaries, and every segment runs
+// through the pulse chain of the receive thread, the detectors and the
+// occupancy statistics. Segments are spread over a pool of threads that
+// steal from each other once their own are done. Results are merged in
+// segment order, so they do not depend on the number of threads.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "classifier.h"
+#include "noise-floor.h"
+#include "occupancy.h"
+#include "pulse-chain.h"
+#include "spectral-report.h"
+
+enum { MAX_THREADS = 256 };
+// As the classifier batches tracks for its detectors.
+enum { MAX_BATCH_TRACKS = 512 };
+static const int32_t tick_time = 20000;
+
+static const struct detector *const detectors[NUM_DETECTORS] = {
+    [DETECTOR_BLUETOOTH] = &bluetooth_detector,
+    [DETECTOR_ZIGBEE] = &zigbee_detector,
+    [DETECTOR_WIFI] = &wifi_detector,
+    [DETECTOR_MICROWAVE] = &microwave_detector,
+};
+
+struct capture_file {
+  const char *path;
+  uint8_t *map;
+  size_t size;
+  struct capture_header header;
+  size_t *offsets;
+  size_t num_records;
+};
+
+// Records from warm_start on are processed, but only those from start on
+// are counted. The warm-up stands in for the noise floor and detector state
+// that the app carries over from the records before.
+struct segment {
+  size_t file;
+  size_t warm_start;
+  size_t start;
+  size_t end;
+};
+
+struct detector_stats {
+  uint64_t present_reports;
+  int64_t present_us;
+  double pwr_sum;
+  double max_pwr;
+};
+
+struct segment_result {
+  uint64_t num_reports;
+  struct detector_stats detectors[NUM_DETECTORS];
+  struct track *tracks;
+  size_t num_tracks;
+  size_t tracks_capacity;
+};
+
+// The owner takes segments from the tail, thieves from the head.
+struct deque {
+  pthread_mutex_t lock;
+  size_t *items;
+  size_t head;
+  size_t tail;
+};
+
+struct pool;
+
+struct worker {
+  struct pool *pool;
+  unsigned id;
+  pthread_t thread;
+  struct deque deque;
+  struct occupancy *occupancy;
+  void *states[NUM_DETECTORS];
+  struct averager avg;
+  int window_sum[MAX_NUM_BINS];
+  double avg_pwr[MAX_NUM_BINS];
+  double thres[MAX_NUM_BINS];
+  struct pulse_single new_pulses[MAX_NUM_BINS];
+  struct pulse old_pulses[MAX_NUM_BINS];
+  struct pulse pulses[MAX_NUM_BINS];
+  struct track finished[MAX_NUM_BINS];
+  uint64_t num_segments;
+  uint64_t num_steals;
+};
+
+struct pool {
+  struct capture_file *files;
+  size_t num_files;
+  struct segment *segments;
+  size_t num_segments;
+  struct segment_result *results;
+  struct worker *workers[MAX_THREADS];
+  unsigned num_workers;
+};
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct capture_record get_record(const struct capture_file *f,
+                                        size_t idx) {
+  struct capture_record rec;
+  memcpy(&rec, f->map + f->offsets[idx], sizeof(rec));
+  return rec;
+}
+
+static bool open_file(struct capture_file *f, const char *path) {
+  f->path = path;
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(f->header)) {
+    fprintf(stderr, "Can't read %s\n", path);
+    close(fd);
+    return false;
+  }
+  f->size = (size_t)st.st_size;
+  f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (f->map == MAP_FAILED) {
+    fprintf(stderr, "Can't map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  madvise(f->map, f->size, MADV_SEQUENTIAL);
+
+  memcpy(&f->header, f->map, sizeof(f->header));
+  if (f->header.magic != CAPTURE_MAGIC ||
+      f->header.version != CAPTURE_VERSION) {
+    fprintf(stderr, "%s is not a capture file\n", path);
+    return false;
+  }
+
+  // num_records is 0 in a file whose dump did not finish, so the records
+  // are counted rather than trusted.
+  size_t capacity = 1024;
+  f->offsets = malloc(capacity * sizeof(size_t));
+  if (f->offsets == NULL) {
+    return false;
+  }
+  size_t pos = sizeof(f->header);
+  while (f->size - pos >= sizeof(struct capture_record)) {
+    struct capture_record rec;
+    memcpy(&rec, f->map + pos, sizeof(rec));
+    if (rec.len > f->size - pos - sizeof(rec)) {
+      fprintf(stderr, "%s is truncated after %zu records\n", path,
+              f->num_records);
+      break;
+    }
+    if (f->num_records == capacity) {
+      capacity *= 2;
+      size_t *offsets = realloc(f->offsets, capacity * sizeof(size_t));
+      if (offsets == NULL) {
+        return false;
+      }
+      f->offsets = offsets;
+    }
+    f->offsets[f->num_records++] = pos;
+    pos += sizeof(rec) + rec.len;
+  }
+  return true;
+}
+
+static void close_file(struct capture_file *f) {
+  if (f->map != NULL && f->map != MAP_FAILED) {
+    munmap(f->map, f->size);
+  }
+  free(f->offsets);
+}
+
+static uint16_t record_freq(const struct capture_file *f, size_t idx) {
+  const struct capture_record rec = get_record(f, idx);
+  if (rec.len < REPORT_FREQ_OFFSET + sizeof(uint16_t)) {
+    return 0;
+  }
+  return report_get_u16(f->map + f->offsets[idx] + sizeof(rec),
+                        REPORT_FREQ_OFFSET);
+}
+
+static bool add_segment(struct pool *pool, size_t *capacity, size_t file,
+                        size_t start, size_t end, int64_t warmup_us) {
+  if (pool->num_segments == *capacity) {
+    *capacity = *capacity > 0 ? 2 * *capacity : 256;
+    struct segment *segments =
+        realloc(pool->segments, *capacity * sizeof(struct segment));
+    if (segments == NULL) {
+      return false;
+    }
+    pool->segments = segments;
+  }
+
+  const struct capture_file *f = &pool->files[file];
+  const int64_t start_us = get_record(f, start).time_us;
+  size_t warm_start = start;
+  while (warm_start > 0 &&
+         start_us - get_record(f, warm_start - 1).time_us <= warmup_us) {
+    warm_start--;
+  }
+  pool->segments[pool->num_segments++] = (struct segment){
+      .file = file, .warm_start = warm_start, .start = start, .end = end};
+  return true;
+}
+
+// Segments end at the first hop boundary after segment_us, where the boxcar
+// of the app starts over anyway.
+static bool split_files(struct pool *pool, int64_t segment_us,
+                        int64_t warmup_us) {
+  size_t capacity = 0;
+  for (size_t file = 0; file < pool->num_files; file++) {
+    const struct capture_file *f = &pool->files[file];
+    if (f->num_records == 0) {
+      continue;
+    }
+    size_t start = 0;
+    int64_t start_us = get_record(f, 0).time_us;
+    uint16_t last_freq = record_freq(f, 0);
+    uint32_t last_epoch = get_record(f, 0).tag.epoch;
+    for (size_t idx = 1; idx < f->num_records; idx++) {
+      const struct capture_record rec = get_record(f, idx);
+      const uint16_t freq = record_freq(f, idx);
+      const bool hop = freq != last_freq || rec.tag.epoch != last_epoch;
+      last_freq = freq;
+      last_epoch = rec.tag.epoch;
+      if (hop && rec.time_us - start_us >= segment_us) {
+        if (!add_segment(pool, &capacity, file, start, idx, warmup_us)) {
+          return false;
+        }
+        start = idx;
+        start_us = rec.time_us;
+      }
+    }
+    if (!add_segment(pool, &capacity, file, start, f->num_records,
+                     warmup_us)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool add_tracks(struct segment_result *res, const struct track tracks[],
+                       uint16_t num_tracks) {
+  if (res->num_tracks + num_tracks > res->tracks_capacity) {
+    size_t capacity = res->tracks_capacity > 0 ? res->tracks_capacity : 256;
+    while (capacity < res->num_tracks + num_tracks) {
+      capacity *= 2;
+    }
+    struct track *grown = realloc(res->tracks, capacity * sizeof(*grown));
+    if (grown == NULL) {
+      return false;
+    }
+    res->tracks = grown;
+    res->tracks_capacity = capacity;
+  }
+  memcpy(res->tracks + res->num_tracks, tracks,
+         num_tracks * sizeof(struct track));
+  res->num_tracks += num_tracks;
+  return true;
+}
+
+// The same steps as the receive thread of a plot engine in classify mode,
+// with the detectors run in line on the batches the classifier would get.
+static void run_segment(struct worker *w, size_t seg_idx) {
+  const struct segment *seg = &w->pool->segments[seg_idx];
+  const struct capture_file *f = &w->pool->files[seg->file];
+  struct segment_result *res = &w->pool->results[seg_idx];
+  const struct detect_params *params =
+      &default_detect_params[DETECT_MODE_CLASSIFY];
+  const struct avg_params avg_params = {.mode = AVG_MODE_BOXCAR};
+
+  struct noise_floor *nf = noise_floor_create();
+  if (nf == NULL) {
+    fprintf(stderr, "Can't allocate noise floor\n");
+    return;
+  }
+  averager_set_mode(&w->avg, AVG_MODE_BOXCAR);
+  struct detection results[NUM_DETECTORS] = {0};
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    detectors[id]->reset(w->states[id]);
+  }
+  const struct bin_kernels *kernels = get_bin_kernels(0);
+  uint16_t kernels_bin_count = 0;
+  uint16_t num_pulses = 0;
+  int32_t last_tstamp = 0;
+  int64_t last_time_us = INT64_MIN;
+
+  for (size_t idx = seg->warm_start; idx < seg->end; idx++) {
+    const struct capture_record rec = get_record(f, idx);
+    const uint8_t *data = f->map + f->offsets[idx] + sizeof(rec);
+    struct report_view report;
+    if (!report_view_parse(&report, data, rec.len)) {
+      continue;
+    }
+    const bool counted = idx >= seg->start;
+    const uint16_t bin_pwr_count = report.segments[0].bin_pwr_count;
+    const int8_t *mean_pwr = report.segments[0].bin_pwr;
+    uint32_t weight = 1;
+    if (rec.tag.flags & HOP_TAG_SUMMARY) {
+      mean_pwr = report_summary_mean(&report, rec.len);
+      if (mean_pwr == NULL) {
+        continue;
+      }
+      weight = rec.tag.num_squelched > 0 ? rec.tag.num_squelched : 1;
+    }
+    if (rec.tag.flags & HOP_TAG_GUARD) {
+      continue;
+    }
+
+    const uint16_t center_freq = report.segments[0].center_freq;
+    const int16_t *floor =
+        noise_floor_update(nf, center_freq, bin_pwr_count, mean_pwr, weight);
+    noise_floor_thresholds(floor, bin_pwr_count, params->floor_margin,
+                           w->thres);
+    if (counted) {
+      const int64_t wall_us = f->header.trigger_wall_us +
+                              (rec.time_us - f->header.trigger_time_us);
+      occupancy_set_time(w->occupancy, (time_t)(wall_us / 1000000));
+      occupancy_update(w->occupancy, center_freq, SPAN_WIDTH, bin_pwr_count,
+                       mean_pwr, w->thres, weight);
+    }
+
+    if (bin_pwr_count != kernels_bin_count) {
+      kernels = get_bin_kernels(bin_pwr_count);
+      kernels_bin_count = bin_pwr_count;
+    }
+    const struct window_avg_data *avg_data =
+        averager_update(&w->avg, kernels, mean_pwr, bin_pwr_count, weight,
+                        center_freq, rec.tag.epoch, report.tstamp, params,
+                        &avg_params);
+    const uint16_t new_num_pulses = kernels->detect_pulses[DETECT_MODE_CLASSIFY](
+        avg_data, w->thres, w->new_pulses, bin_pwr_count, params);
+    const uint16_t old_num_pulses = num_pulses;
+    memcpy(w->old_pulses, w->pulses, old_num_pulses * sizeof(struct pulse));
+    num_pulses = match_pulses(w->new_pulses, new_num_pulses, bin_pwr_count,
+                              w->old_pulses, old_num_pulses, w->pulses,
+                              params);
+
+    uint16_t num_finished = 0;
+    for (uint16_t pulse_idx = 0; pulse_idx < old_num_pulses; pulse_idx++) {
+      const struct pulse *p = &w->old_pulses[pulse_idx];
+      if (p->matched) {
+        continue;
+      }
+      w->finished[num_finished++] = (struct track){
+          .center = p->center,
+          .bw = p->bw,
+          .pwr = p->pwr,
+          .tstamp_first = p->tstamp_first,
+          .tstamp_last = p->tstamp_last,
+          .cnt = p->cnt,
+      };
+    }
+    if (counted && !add_tracks(res, w->finished, num_finished)) {
+      fprintf(stderr, "Can't allocate tracks\n");
+    }
+
+    if (num_finished > 0 || report.tstamp < last_tstamp ||
+        (int64_t)report.tstamp - last_tstamp >= tick_time) {
+      last_tstamp = report.tstamp;
+      const struct track_batch batch = {
+          .tstamp = report.tstamp,
+          .center_freq = center_freq,
+          .num_tracks =
+              num_finished < MAX_BATCH_TRACKS ? num_finished : MAX_BATCH_TRACKS,
+          .tracks = w->finished,
+      };
+      for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+        detectors[id]->process(w->states[id], &batch, &results[id]);
+      }
+    }
+
+    if (counted) {
+      const int64_t elapsed =
+          last_time_us != INT64_MIN ? rec.time_us - last_time_us : 0;
+      res->num_reports += weight;
+      for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+        struct detector_stats *stats = &res->detectors[id];
+        if (!results[id].present) {
+          continue;
+        }
+        stats->max_pwr = stats->present_reports > 0
+                             ? fmax(stats->max_pwr, results[id].pwr)
+                             : results[id].pwr;
+        stats->present_reports += weight;
+        stats->present_us += elapsed;
+        stats->pwr_sum += results[id].pwr * (double)elapsed;
+      }
+    }
+    last_time_us = rec.time_us;
+  }
+  noise_floor_destroy(nf);
+}
+
+static bool deque_pop(struct deque *d, size_t *item) {
+  pthread_mutex_lock(&d->lock);
+  const bool found = d->tail > d->head;
+  if (found) {
+    *item = d->items[--d->tail];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+static bool deque_steal(struct deque *d, size_t *item) {
+  pthread_mutex_lock(&d->lock);
+  const bool found = d->tail > d->head;
+  if (found) {
+    *item = d->items[d->head++];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// No segments are added once the workers run, so a worker whose own deque
+// is empty and that finds nothing to steal is done.
+static void *worker_thread(void *arg) {
+  struct worker *w = arg;
+  struct pool *pool = w->pool;
+  for (;;) {
+    size_t seg_idx;
+    if (!deque_pop(&w->deque, &seg_idx)) {
+      bool found = false;
+      for (unsigned i = 1; i < pool->num_workers && !found; i++) {
+        struct worker *victim = pool->workers[(w->id + i) % pool->num_workers];
+        found = deque_steal(&victim->deque, &seg_idx);
+      }
+      if (!found) {
+        break;
+      }
+      w->num_steals++;
+    }
+    run_segment(w, seg_idx);
+    w->num_segments++;
+  }
+  return NULL;
+}
+
+static void destroy_worker(struct worker *w) {
+  if (w == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&w->deque.lock);
+  free(w->deque.items);
+  occupancy_destroy(w->occupancy);
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    free(w->states[id]);
+  }
+  free(w->avg.scans);
+  free(w);
+}
+
+static struct worker *create_worker(struct pool *pool, unsigned id) {
+  struct worker *w = calloc(1, sizeof(*w));
+  if (w == NULL) {
+    return NULL;
+  }
+  w->pool = pool;
+  w->id = id;
+  pthread_mutex_init(&w->deque.lock, NULL);
+  w->deque.items = malloc((pool->num_segments + 1) * sizeof(size_t));
+  w->occupancy = occupancy_create();
+  bool ok = w->deque.items != NULL && w->occupancy != NULL;
+  for (unsigned det = 0; det < NUM_DETECTORS && ok; det++) {
+    w->states[det] = calloc(1, detectors[det]->state_size);
+    ok = w->states[det] != NULL;
+  }
+  w->avg = (struct averager){
+      .mode = AVG_MODE_EMA,
+      .max_bins = MAX_NUM_BINS,
+      .window_sum = w->window_sum,
+      .data.bin_pwr = w->avg_pwr,
+  };
+  if (!ok || !averager_set_mode(&w->avg, AVG_MODE_BOXCAR)) {
+    destroy_worker(w);
+    return NULL;
+  }
+  return w;
+}
+
+static void reset_results(struct pool *pool) {
+  for (size_t idx = 0; idx < pool->num_segments; idx++) {
+    struct segment_result *res = &pool->results[idx];
+    struct track *tracks = res->tracks;
+    const size_t capacity = res->tracks_capacity;
+    *res = (struct segment_result){.tracks = tracks,
+                                   .tracks_capacity = capacity};
+  }
+}
+
+// Every worker starts with a contiguous run of segments, so that neighbours
+// in a file stay on one thread until the load becomes uneven.
+static bool run_pool(struct pool *pool, unsigned num_workers,
+                     struct occupancy *occupancy, uint64_t *num_steals) {
+  reset_results(pool);
+  pool->num_workers = num_workers;
+  for (unsigned id = 0; id < num_workers; id++) {
+    pool->workers[id] = create_worker(pool, id);
+    if (pool->workers[id] == NULL) {
+      fprintf(stderr, "Can't allocate worker\n");
+      for (unsigned prev = 0; prev < id; prev++) {
+        destroy_worker(pool->workers[prev]);
+      }
+      return false;
+    }
+    struct deque *d = &pool->workers[id]->deque;
+    const size_t first = pool->num_segments * id / num_workers;
+    const size_t last = pool->num_segments * (id + 1) / num_workers;
+    for (size_t seg_idx = first; seg_idx < last; seg_idx++) {
+      d->items[d->tail++] = seg_idx;
+    }
+  }
+
+  unsigned started = 1;
+  for (; started < num_workers; started++) {
+    struct worker *w = pool->workers[started];
+    if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+      fprintf(stderr, "Can't start worker thread\n");
+      break;
+    }
+  }
+  worker_thread(pool->workers[0]);
+  *num_steals = pool->workers[0]->num_steals;
+  occupancy_merge(occupancy, pool->workers[0]->occupancy);
+  for (unsigned id = 1; id < num_workers; id++) {
+    struct worker *w = pool->workers[id];
+    if (id < started) {
+      pthread_join(w->thread, NULL);
+    }
+    *num_steals += w->num_steals;
+    occupancy_merge(occupancy, w->occupancy);
+  }
+  for (unsigned id = 0; id < num_workers; id++) {
+    destroy_worker(pool->workers[id]);
+    pool->workers[id] = NULL;
+  }
+  return true;
+}
+
+static uint64_t fnv_add(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  for (size_t idx = 0; idx < len; idx++) {
+    hash = (hash ^ bytes[idx]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// A digest of everything the analysis produces, to check that runs with
+// different numbers of threads agree.
+static uint64_t digest(const struct pool *pool,
+                       const struct occupancy *occupancy) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t idx = 0; idx < pool->num_segments; idx++) {
+    const struct segment_result *res = &pool->results[idx];
+    hash = fnv_add(hash, &res->num_reports, sizeof(res->num_reports));
+    hash = fnv_add(hash, res->detectors, sizeof(res->detectors));
+    hash = fnv_add(hash, res->tracks, res->num_tracks * sizeof(struct track));
+  }
+  static struct occupancy_stats stats[MAX_NUM_BINS];
+  for (int hour = -1; hour < OCCUPANCY_HOURS; hour++) {
+    const uint16_t num_cells =
+        occupancy_query(occupancy, 2400, 6000, hour, stats, MAX_NUM_BINS);
+    hash = fnv_add(hash, stats, num_cells * sizeof(struct occupancy_stats));
+  }
+  return hash;
+}
+
+static bool write_tracks(const struct pool *pool, const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Can't create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "file,center_mhz,bw_mhz,pwr_dbm,tstamp_first,tstamp_last,cnt\n");
+  for (size_t idx = 0; idx < pool->num_segments; idx++) {
+    const struct segment_result *res = &pool->results[idx];
+    const char *file = pool->files[pool->segments[idx].file].path;
+    for (size_t track_idx = 0; track_idx < res->num_tracks; track_idx++) {
+      const struct track *t = &res->tracks[track_idx];
+      fprintf(fp, "%s,%.3f,%.3f,%.1f,%" PRId32 ",%" PRId32 ",%" PRId32 "\n",
+              file, t->center, t->bw, t->pwr, t->tstamp_first,
+              t->tstamp_last, t->cnt);
+    }
+  }
+  const bool ok = !ferror(fp);
+  if (fclose(fp) != 0 || !ok) {
+    fprintf(stderr, "Can't write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+static void print_summary(const struct pool *pool) {
+  uint64_t num_reports = 0;
+  size_t num_tracks = 0;
+  struct detector_stats totals[NUM_DETECTORS] = {0};
+  int64_t span_us = 0;
+  for (size_t idx = 0; idx < pool->num_segments; idx++) {
+    const struct segment *seg = &pool->segments[idx];
+    const struct capture_file *f = &pool->files[seg->file];
+    const struct segment_result *res = &pool->results[idx];
+    num_reports += res->num_reports;
+    num_tracks += res->num_tracks;
+    span_us += get_record(f, seg->end - 1).time_us -
+               get_record(f, seg->start).time_us;
+    for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+      const struct detector_stats *stats = &res->detectors[id];
+      if (stats->present_reports == 0) {
+        continue;
+      }
+      totals[id].max_pwr = totals[id].present_reports > 0
+                               ? fmax(totals[id].max_pwr, stats->max_pwr)
+                               : stats->max_pwr;
+      totals[id].present_reports += stats->present_reports;
+      totals[id].present_us += stats->present_us;
+      totals[id].pwr_sum += stats->pwr_sum;
+    }
+  }
+
+  printf("%zu files, %zu segments, %" PRIu64 " reports over %.1f s, %zu "
+         "tracks\n",
+         pool->num_files, pool->num_segments, num_reports,
+         (double)span_us / 1e6, num_tracks);
+  for (unsigned id = 0; id < NUM_DETECTORS; id++) {
+    const struct detector_stats *stats = &totals[id];
+    if (stats->present_reports == 0) {
+      printf("%-10s not present\n", detectors[id]->name);
+      continue;
+    }
+    printf("%-10s present %.1f s (%.1f%%), mean %.1f dBm, max %.1f dBm\n",
+           detectors[id]->name, (double)stats->present_us / 1e6,
+           span_us > 0 ? 100.0 * (double)stats->present_us / (double)span_us
+                       : 0.0,
+           stats->present_us > 0 ? stats->pwr_sum / (double)stats->present_us
+                                 : stats->max_pwr,
+           stats->max_pwr);
+  }
+}
+
+static int usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-j THREADS] [-s SEGMENT_S] [-w WARMUP_S] [-o PREFIX] "
+          "[-S] FILE...\n",
+          prog);
+  return 2;
+}
+
+// Scaling runs go 1, 2, 4... threads up to num_threads, and must all come
+// to the same digest.
+static int analyze(struct pool *pool, unsigned num_threads, bool scaling,
+                   const char *prefix) {
+  uint64_t num_reports = 0;
+  for (size_t seg_idx = 0; seg_idx < pool->num_segments; seg_idx++) {
+    const struct segment *seg = &pool->segments[seg_idx];
+    num_reports += seg->end - seg->warm_start;
+  }
+
+  unsigned threads = scaling ? 1 : num_threads;
+  double base_time = 0;
+  uint64_t first_digest = 0;
+  struct occupancy *occupancy = NULL;
+  for (;;) {
+    occupancy_destroy(occupancy);
+    occupancy = occupancy_create();
+    if (occupancy == NULL) {
+      fprintf(stderr, "Can't allocate occupancy\n");
+      return 1;
+    }
+    uint64_t num_steals;
+    const int64_t start = now_us();
+    if (!run_pool(pool, threads, occupancy, &num_steals)) {
+      occupancy_destroy(occupancy);
+      return 1;
+    }
+    const double elapsed = (double)(now_us() - start) / 1e6;
+    const uint64_t hash = digest(pool, occupancy);
+    if (threads == 1 || !scaling) {
+      base_time = elapsed;
+      first_digest = hash;
+    }
+    if (scaling) {
+      printf("%3u threads: %7.3f s, %9.0f reports/s, speedup %5.2f, "
+             "efficiency %3.0f%%, %6" PRIu64 " steals, digest %016" PRIx64
+             "\n",
+             threads, elapsed, (double)num_reports / elapsed,
+             base_time / elapsed, 100.0 * base_time / elapsed / threads,
+             num_steals, hash);
+      if (hash != first_digest) {
+        fprintf(stderr, "Results with %u threads differ from 1 thread\n",
+                threads);
+        occupancy_destroy(occupancy);
+        return 1;
+      }
+    }
+    if (threads == num_threads) {
+      break;
+    }
+    threads = threads * 2 < num_threads ? threads * 2 : num_threads;
+  }
+
+  print_summary(pool);
+  if (!scaling) {
+    printf("digest %016" PRIx64 "\n", first_digest);
+  }
+  int ret = 0;
+  if (prefix != NULL) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s-tracks.csv", prefix);
+    if (!write_tracks(pool, path)) {
+      ret = 1;
+    }
+    snprintf(path, sizeof(path), "%s-occupancy.bin", prefix);
+    const int err = occupancy_dump(occupancy, path);
+    if (err < 0) {
+      fprintf(stderr, "Can't write %s: %s\n", path, strerror(-err));
+      ret = 1;
+    }
+  }
+  occupancy_destroy(occupancy);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  double segment_s = 10;
+  double warmup_s = 2;
+  const char *prefix = NULL;
+  bool scaling = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:s:w:o:S")) != -1) {
+    if (opt == 'j') {
+      num_threads = atol(optarg);
+    } else if (opt == 's') {
+      segment_s = atof(optarg);
+    } else if (opt == 'w') {
+      warmup_s = atof(optarg);
+    } else if (opt == 'o') {
+      prefix = optarg;
+    } else if (opt == 'S') {
+      scaling = true;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (optind == argc || num_threads < 1 || segment_s < 0 || warmup_s < 0) {
+    return usage(argv[0]);
+  }
+  if (num_threads > MAX_THREADS) {
+    num_threads = MAX_THREADS;
+  }
+
+  struct pool pool = {.num_files = (size_t)(argc - optind)};
+  pool.files = calloc(pool.num_files, sizeof(struct capture_file));
+  if (pool.files == NULL) {
+    return 1;
+  }
+  bool ok = true;
+  for (size_t file = 0; file < pool.num_files && ok; file++) {
+    ok = open_file(&pool.files[file], argv[optind + (int)file]);
+  }
+  if (ok && !split_files(&pool, (int64_t)(segment_s * 1e6),
+                         (int64_t)(warmup_s * 1e6))) {
+    fprintf(stderr, "Can't allocate segments\n");
+    ok = false;
+  }
+  if (ok) {
+    pool.results =
+        calloc(pool.num_segments + 1, sizeof(struct segment_result));
+    ok = pool.results != NULL;
+  }
+  const int ret =
+      ok ? analyze(&pool, (unsigned)num_threads, scaling, prefix) : 1;
+
+  if (pool.results != NULL) {
+    for (size_t idx = 0; idx < pool.num_segments; idx++) {
+      free(pool.results[idx].tracks);
+    }
+  }
+  free(pool.results);
+  free(pool.segments);
+  for (size_t file = 0; file < pool.num_files; file++) {
+    close_file(&pool.files[file]);
+  }
+  free(pool.files);
+  return ret;
+}
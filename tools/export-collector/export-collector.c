@@ -0,0 +1,376 @@
+// Reference collector for batches sent by the spectral-scand exporter. It
+// decodes every batch, checks sequence numbers and prints throughput once
+// per second per device.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "export-protocol.h"
+#include "row-codec.h"
+#include "spectral-report.h"
+
+enum { MAX_CLIENTS = 32 };
+enum { MAX_DEVICES = 64 };
+
+struct channel {
+  bool used;
+  uint16_t center_freq;
+  uint16_t bin_pwr_count;
+  uint64_t last_used;
+  int8_t prev[MAX_NUM_BINS];
+};
+
+struct device {
+  uint32_t device_id;
+  bool seen;
+  uint32_t next_seq;
+  uint32_t next_report;
+  int64_t num_batches;
+  int64_t num_reports;
+  int64_t num_summaries;
+  int64_t num_squelched;
+  int64_t num_bytes;
+  int64_t raw_bytes;
+  int64_t lost_batches;
+  int64_t missed_reports;
+  int64_t last_reports;
+  int64_t last_bytes;
+};
+
+struct client {
+  int fd;
+  size_t len;
+  uint8_t buf[sizeof(struct export_batch) + EXPORT_MAX_PACKET];
+};
+
+static struct device devices[MAX_DEVICES];
+static size_t num_devices;
+static bool verbose;
+static volatile sig_atomic_t quit;
+
+static void handle_signal(int sig) { quit = 1; }
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct device *find_device(uint32_t device_id) {
+  for (size_t idx = 0; idx < num_devices; idx++) {
+    if (devices[idx].device_id == device_id) {
+      return &devices[idx];
+    }
+  }
+  if (num_devices == MAX_DEVICES) {
+    return NULL;
+  }
+  devices[num_devices].device_id = device_id;
+  return &devices[num_devices++];
+}
+
+// Must pick the same channel as the exporter does.
+static struct channel *find_channel(struct channel channels[],
+                                    uint16_t center_freq,
+                                    uint16_t bin_pwr_count, bool *first) {
+  struct channel *victim = &channels[0];
+  for (size_t idx = 0; idx < EXPORT_MAX_CHANNELS; idx++) {
+    struct channel *ch = &channels[idx];
+    if (ch->used && ch->center_freq == center_freq &&
+        ch->bin_pwr_count == bin_pwr_count) {
+      *first = false;
+      return ch;
+    }
+    if (!ch->used || (victim->used && ch->last_used < victim->last_used)) {
+      victim = ch;
+    }
+  }
+
+  victim->used = true;
+  victim->center_freq = center_freq;
+  victim->bin_pwr_count = bin_pwr_count;
+  *first = true;
+  return victim;
+}
+
+static bool decode_batch(const struct export_batch *header,
+                         const uint8_t payload[], struct device *dev,
+                         int64_t *raw_bytes) {
+  struct channel channels[EXPORT_MAX_CHANNELS] = {0};
+  uint64_t clock = 0;
+  struct bit_reader br = {.buf = payload, .len = header->payload_len};
+  uint32_t tstamp = (uint32_t)header->base_tstamp;
+  int64_t num_summaries = 0;
+  int64_t num_squelched = 0;
+
+  for (uint16_t row = 0; row < header->num_rows; row++) {
+    const uint16_t center_freq = (uint16_t)get_bits(&br, 16);
+    const uint16_t bin_pwr_count = (uint16_t)get_bits(&br, 12);
+    const uint32_t flags = get_bits(&br, EXPORT_FLAG_BITS);
+    const bool summary = (flags & HOP_TAG_SUMMARY) != 0;
+    const uint32_t row_squelched = summary ? get_bits(&br, 16) : 0;
+    if (bin_pwr_count > MAX_NUM_BINS) {
+      return false;
+    }
+
+    bool first;
+    struct channel *ch =
+        find_channel(channels, center_freq, bin_pwr_count, &first);
+    ch->last_used = ++clock;
+    tstamp += row_codec_decode(&br, ch->prev, bin_pwr_count, first);
+    // The means of a summary are coded against its maxima.
+    int8_t mean_pwr[MAX_NUM_BINS];
+    if (summary) {
+      memcpy(mean_pwr, ch->prev, bin_pwr_count);
+      row_codec_decode(&br, mean_pwr, bin_pwr_count, false);
+      num_summaries++;
+      num_squelched += row_squelched;
+    }
+    if (br.pos > br.len) {
+      return false;
+    }
+    *raw_bytes +=
+        REPORT_BINS_OFFSET + (summary ? 2 : 1) * (int64_t)bin_pwr_count;
+
+    if (verbose) {
+      int max_pwr = INT8_MIN;
+      int sum_pwr = 0;
+      for (uint16_t bin = 0; bin < bin_pwr_count; bin++) {
+        if (ch->prev[bin] > max_pwr) {
+          max_pwr = ch->prev[bin];
+        }
+        sum_pwr += summary ? mean_pwr[bin] : ch->prev[bin];
+      }
+      printf("%" PRIu32 " %" PRIu32 " %u MHz %u bins max %d dBm mean %.1f "
+             "dBm%s%s",
+             header->device_id, tstamp, center_freq, bin_pwr_count, max_pwr,
+             bin_pwr_count > 0 ? (double)sum_pwr / bin_pwr_count : 0.0,
+             flags & HOP_TAG_GUARD ? " guard" : "",
+             flags & HOP_TAG_PENDING ? " pending" : "");
+      if (summary) {
+        printf(" summary of %" PRIu32, row_squelched);
+      }
+      printf("\n");
+    }
+  }
+  dev->num_summaries += num_summaries;
+  dev->num_squelched += num_squelched;
+  return true;
+}
+
+static void handle_batch(const struct export_batch *header,
+                         const uint8_t payload[]) {
+  struct device *dev = find_device(header->device_id);
+  if (dev == NULL) {
+    return;
+  }
+
+  int64_t raw_bytes = 0;
+  if (!decode_batch(header, payload, dev, &raw_bytes)) {
+    fprintf(stderr, "Corrupt batch %" PRIu32 " from device %" PRIu32 "\n",
+            header->seq, header->device_id);
+    return;
+  }
+
+  if (dev->seen) {
+    dev->lost_batches += (int32_t)(header->seq - dev->next_seq);
+    dev->missed_reports += (int32_t)(header->first_report - dev->next_report);
+  }
+  dev->seen = true;
+  dev->next_seq = header->seq + 1;
+  dev->next_report = header->first_report + header->num_rows;
+  dev->num_batches++;
+  dev->num_reports += header->num_rows;
+  dev->num_bytes += (int64_t)(sizeof(*header) + header->payload_len);
+  dev->raw_bytes += raw_bytes;
+}
+
+// Returns false if the header is not one of ours.
+static bool check_header(const struct export_batch *header) {
+  return header->magic == EXPORT_MAGIC && header->version == EXPORT_VERSION &&
+         header->payload_len <= EXPORT_MAX_PACKET;
+}
+
+static void print_stats(double elapsed) {
+  for (size_t idx = 0; idx < num_devices; idx++) {
+    struct device *dev = &devices[idx];
+    const int64_t reports = dev->num_reports - dev->last_reports;
+    const int64_t bytes = dev->num_bytes - dev->last_bytes;
+    printf("device %" PRIu32 ": %.0f reports/s, %.0f kB/s, %.1f bytes/report "
+           "(%.1fx), %" PRId64 " batches lost, %" PRId64 " reports missed\n",
+           dev->device_id, (double)reports / elapsed,
+           (double)bytes / elapsed / 1000,
+           reports > 0 ? (double)bytes / (double)reports : 0.0,
+           dev->num_bytes > 0 ? (double)dev->raw_bytes / (double)dev->num_bytes
+                              : 0.0,
+           dev->lost_batches, dev->missed_reports);
+    dev->last_reports = dev->num_reports;
+    dev->last_bytes = dev->num_bytes;
+  }
+  fflush(stdout);
+}
+
+// Consumes whole batches from the stream buffer of a TCP client.
+static bool read_client(struct client *c) {
+  const ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+  if (n <= 0) {
+    return false;
+  }
+  c->len += (size_t)n;
+
+  size_t pos = 0;
+  while (c->len - pos >= sizeof(struct export_batch)) {
+    struct export_batch header;
+    memcpy(&header, c->buf + pos, sizeof(header));
+    if (!check_header(&header)) {
+      fprintf(stderr, "Stream out of frame, dropping client\n");
+      return false;
+    }
+    const size_t len = sizeof(header) + header.payload_len;
+    if (c->len - pos < len) {
+      break;
+    }
+    handle_batch(&header, c->buf + pos + sizeof(header));
+    pos += len;
+  }
+  memmove(c->buf, c->buf + pos, c->len - pos);
+  c->len -= pos;
+  return true;
+}
+
+static int open_socket(bool udp, int port) {
+  const int fd = socket(AF_INET6, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  const int off = 0;
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  if (udp) {
+    const int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  }
+
+  struct sockaddr_in6 addr = {
+      .sin6_family = AF_INET6,
+      .sin6_port = htons((uint16_t)port),
+      .sin6_addr = IN6ADDR_ANY_INIT,
+  };
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  if (!udp && listen(fd, MAX_CLIENTS) < 0) {
+    perror("listen");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  bool udp = false;
+  int port = 7878;
+  int opt;
+  while ((opt = getopt(argc, argv, "up:v")) != -1) {
+    if (opt == 'u') {
+      udp = true;
+    } else if (opt == 'p') {
+      port = atoi(optarg);
+    } else if (opt == 'v') {
+      verbose = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-u] [-p PORT] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  const int sock = open_socket(udp, port);
+  if (sock < 0) {
+    return 1;
+  }
+
+  struct sigaction sa = {.sa_handler = handle_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  static struct client clients[MAX_CLIENTS];
+  size_t num_clients = 0;
+  static uint8_t datagram[sizeof(struct export_batch) + EXPORT_MAX_PACKET];
+  int64_t last_print = now_us();
+
+  while (!quit) {
+    struct pollfd pfds[1 + MAX_CLIENTS] = {{.fd = sock, .events = POLLIN}};
+    for (size_t idx = 0; idx < num_clients; idx++) {
+      pfds[1 + idx] = (struct pollfd){.fd = clients[idx].fd, .events = POLLIN};
+    }
+    const int n = poll(pfds, 1 + num_clients, 200);
+
+    if (n > 0 && (pfds[0].revents & POLLIN)) {
+      if (udp) {
+        const ssize_t len = recv(sock, datagram, sizeof(datagram), 0);
+        struct export_batch header;
+        memcpy(&header, datagram, sizeof(header));
+        if (len >= (ssize_t)sizeof(header) && check_header(&header) &&
+            (size_t)len == sizeof(header) + header.payload_len) {
+          handle_batch(&header, datagram + sizeof(header));
+        }
+      } else {
+        const int fd = accept(sock, NULL, NULL);
+        if (fd >= 0 && num_clients < MAX_CLIENTS) {
+          clients[num_clients].fd = fd;
+          clients[num_clients++].len = 0;
+        } else if (fd >= 0) {
+          close(fd);
+        }
+      }
+    }
+
+    for (size_t idx = num_clients; n > 0 && idx-- > 0;) {
+      if ((pfds[1 + idx].revents & (POLLIN | POLLHUP | POLLERR)) &&
+          !read_client(&clients[idx])) {
+        close(clients[idx].fd);
+        clients[idx] = clients[--num_clients];
+      }
+    }
+
+    const int64_t now = now_us();
+    if (now - last_print >= 1000000) {
+      print_stats((double)(now - last_print) / 1e6);
+      last_print = now;
+    }
+  }
+
+  for (size_t idx = 0; idx < num_devices; idx++) {
+    const struct device *dev = &devices[idx];
+    printf("device %" PRIu32 " total: %" PRId64 " reports in %" PRId64
+           " batches, %.1f bytes/report, %" PRId64 " batches lost, %" PRId64
+           " reports missed, %" PRId64 " summaries of %" PRId64 " reports\n",
+           dev->device_id, dev->num_reports, dev->num_batches,
+           dev->num_reports > 0
+               ? (double)dev->num_bytes / (double)dev->num_reports
+               : 0.0,
+           dev->lost_batches, dev->missed_reports, dev->num_summaries,
+           dev->num_squelched);
+  }
+  for (size_t idx = 0; idx < num_clients; idx++) {
+    close(clients[idx].fd);
+  }
+  close(sock);
+  return 0;
+}
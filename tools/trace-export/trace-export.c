@@ -0,0 +1,172 @@
+// Converts trace files written by the scanner and the plot (see trace.h)
+// into one Chrome trace JSON file, which chrome://tracing and Perfetto both
+// open. All processes of a device trace on CLOCK_MONOTONIC, so the files of
+// the scanner and the plot line up on one timeline.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static void write_string(FILE *out, const char *s, size_t max_len) {
+  putc('"', out);
+  for (size_t idx = 0; idx < max_len && s[idx] != '\0'; idx++) {
+    const unsigned char c = (unsigned char)s[idx];
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      putc(c, out);
+    }
+  }
+  putc('"', out);
+}
+
+// Chrome traces count in microseconds.
+static void write_us(FILE *out, int64_t ns) {
+  fprintf(out, "%" PRId64 ".%03d", ns / 1000, (int)(ns % 1000));
+}
+
+static void begin_event(FILE *out, bool *first) {
+  fputs(*first ? "\n" : ",\n", out);
+  *first = false;
+}
+
+static bool export_file(FILE *out, const char *path, bool *first) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct trace_header header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+    fprintf(stderr, "%s is not a trace file\n", path);
+    fclose(in);
+    return false;
+  }
+  struct trace_name_entry *names =
+      calloc(header.num_names, sizeof(struct trace_name_entry));
+  if (names == NULL ||
+      fread(names, sizeof(struct trace_name_entry), header.num_names, in) !=
+          header.num_names) {
+    fprintf(stderr, "Can't read names of %s\n", path);
+    free(names);
+    fclose(in);
+    return false;
+  }
+
+  begin_event(out, first);
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%" PRIu32
+               ",\"args\":{\"name\":",
+          header.pid);
+  write_string(out, header.process, sizeof(header.process));
+  fputs("}}", out);
+
+  int64_t num_events = 0;
+  int64_t num_dropped = 0;
+  struct trace_record record;
+  while (fread(&record, sizeof(record), 1, in) == 1) {
+    if (record.kind == TRACE_THREAD) {
+      begin_event(out, first);
+      fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%" PRIu32
+                   ",\"tid\":%" PRIu32 ",\"args\":{\"name\":",
+              header.pid, record.tid);
+      write_string(out, record.thread_name, sizeof(record.thread_name));
+      fputs("}}", out);
+      continue;
+    }
+    if (record.kind == TRACE_DROPPED) {
+      begin_event(out, first);
+      fputs("{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"ts\":", out);
+      write_us(out, record.start_ns);
+      fprintf(out, ",\"pid\":%" PRIu32 ",\"tid\":%" PRIu32
+                   ",\"args\":{\"events\":%" PRId64 "}}",
+              header.pid, record.tid, record.arg);
+      num_dropped += record.arg;
+      continue;
+    }
+    if ((record.kind != TRACE_SPAN && record.kind != TRACE_INSTANT) ||
+        record.name >= header.num_names) {
+      continue;
+    }
+
+    const struct trace_name_entry *name = &names[record.name];
+    begin_event(out, first);
+    fputs("{\"name\":", out);
+    write_string(out, name->name, sizeof(name->name));
+    fputs(",\"cat\":", out);
+    write_string(out, header.process, sizeof(header.process));
+    if (record.kind == TRACE_SPAN) {
+      fputs(",\"ph\":\"X\",\"ts\":", out);
+      write_us(out, record.start_ns);
+      fputs(",\"dur\":", out);
+      write_us(out, record.dur_ns);
+    } else {
+      fputs(",\"ph\":\"i\",\"s\":\"t\",\"ts\":", out);
+      write_us(out, record.start_ns);
+    }
+    fprintf(out, ",\"pid\":%" PRIu32 ",\"tid\":%" PRIu32, header.pid,
+            record.tid);
+    if (name->arg[0] != '\0') {
+      fputs(",\"args\":{", out);
+      write_string(out, name->arg, sizeof(name->arg));
+      fprintf(out, ":%" PRId64 "}", record.arg);
+    }
+    putc('}', out);
+    num_events++;
+  }
+
+  fprintf(stderr, "%s: %" PRId64 " events, %" PRId64 " dropped\n", path,
+          num_events, num_dropped);
+  free(names);
+  fclose(in);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const char *out_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:")) != -1) {
+    if (opt == 'o') {
+      out_path = optarg;
+    } else {
+      fprintf(stderr, "Usage: %s [-o OUTPUT] TRACE...\n", argv[0]);
+      return 2;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "Usage: %s [-o OUTPUT] TRACE...\n", argv[0]);
+    return 2;
+  }
+
+  FILE *out = stdout;
+  if (out_path != NULL) {
+    out = fopen(out_path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "Can't create %s: %s\n", out_path, strerror(errno));
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  bool first = true;
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+  for (int idx = optind; idx < argc; idx++) {
+    ok = export_file(out, argv[idx], &first) && ok;
+  }
+  fputs("\n]}\n", out);
+
+  if (ferror(out) || (out != stdout && fclose(out) != 0)) {
+    fprintf(stderr, "Can't write %s\n", out_path != NULL ? out_path : "output");
+    return 1;
+  }
+  return ok ? 0 : 1;
+}